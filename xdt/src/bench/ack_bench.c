@@ -0,0 +1,319 @@
+/* ack_bench.c
+ *
+ * ACK handling cost of the sender protocol machine versus window size.
+ *
+ * The sender instance is driven directly through sender_handle(), the
+ * runtime environment (sending SDUs/PDUs, timers) is replaced by stubs.
+ * Every round the producer fills the whole window with XDATrequs, then all
+ * DTs are acknowledged in order. Only the ACK handling is measured. For
+ * comparison the same is done with the former fixed array buffer, which
+ * shifted all entries left on every ACK.
+ *
+ * usage: ./ack_bench [-a <ACKs per window size>] [<window size> ...]
+ *        (default: 1 5 16 64 256 1024 4096 window sizes)
+ */
+
+#include <service/service.h>
+#include <service/sender.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+
+static long acks = 2000000;
+
+static unsigned long sdus, pdus;
+
+
+/* runtime environment stubs */
+
+void
+send_pdu(XDT_pdu * pdu)
+{
+  (void)pdu;
+  ++pdus;
+}
+
+void
+hold_pdus(void)
+{
+}
+
+void
+flush_pdus(void)
+{
+}
+
+void
+send_sdu(XDT_sdu * sdu)
+{
+  (void)sdu;
+  ++sdus;
+}
+
+void
+get_message(XDT_message * msg)
+{
+  (void)msg;
+  abort();
+}
+
+int
+keep_payload(unsigned *offset)
+{
+  (void)offset;
+  return 0;
+}
+
+void
+free_payload(unsigned offset, unsigned length)
+{
+  (void)offset;
+  (void)length;
+}
+
+void
+create_timer(XDT_timer * timer, int type)
+{
+  timer->type = type;
+}
+
+void
+set_timer(XDT_timer * timer, double timeout)
+{
+  (void)timer;
+  (void)timeout;
+}
+
+void
+reset_timer(XDT_timer * timer)
+{
+  (void)timer;
+}
+
+void
+delete_timer(XDT_timer * timer)
+{
+  (void)timer;
+}
+
+void
+get_peer_rtt(double *srtt, double *rttvar)
+{
+  (void)srtt;
+  (void)rttvar;
+}
+
+void
+set_peer_rtt(double srtt, double rttvar)
+{
+  (void)srtt;
+  (void)rttvar;
+}
+
+void
+count_stat(unsigned counter, unsigned long amount)
+{
+  (void)counter;
+  (void)amount;
+}
+
+void
+record_rtt(double rtt)
+{
+  (void)rtt;
+}
+
+
+static void
+requ(XDT_message * msg, unsigned sequ)
+{
+  static char data[XDT_DATA_DEFAULT];
+
+  memset(msg, 0, sizeof *msg);
+  msg->sdu.type = XDATrequ;
+  msg->sdu.x.dat_requ.conn = 1;
+  msg->sdu.x.dat_requ.sequ = sequ;
+  msg->sdu.x.dat_requ.length = XDT_DATA_DEFAULT;
+  msg->sdu.x.dat_requ.data = data;
+}
+
+static void
+ack(XDT_message * msg, unsigned sequ)
+{
+  msg->pdu.type = ACK;
+  msg->pdu.x.ack.conn = 1;
+  msg->pdu.x.ack.sequ = sequ;
+  msg->pdu.x.ack.sack = 0;
+  msg->pdu.x.ack.max_length = XDT_DATA_DEFAULT;
+}
+
+/* ACK handling of the sender */
+static double
+run_sender(unsigned window)
+{
+  XDT_sender s;
+  XDT_config config;
+  XDT_message msg;
+  unsigned sequ = 1, i;
+  long done = 0;
+  double elapsed = 0, start;
+
+  memset(&config, 0, sizeof config);
+  config.window = window;
+  config.rto_min = SENDER_RTO_MIN;
+  config.rto_max = SENDER_RTO_MAX;
+  config.max_length = XDT_DATA_DEFAULT;
+  sender_init(&s, &config);
+
+  requ(&msg, sequ);
+  sender_handle(&s, &msg);
+  ack(&msg, sequ);
+  sender_handle(&s, &msg);
+
+  while (done < acks) {
+    unsigned first = sequ + 1;
+
+    for (i = 0; i < window; ++i) {
+      requ(&msg, ++sequ);
+      sender_handle(&s, &msg);
+    }
+
+    start = now_ns();
+    for (i = 0; i < window; ++i) {
+      ack(&msg, first + i);
+      sender_handle(&s, &msg);
+    }
+    elapsed += now_ns() - start;
+    done += window;
+  }
+
+  sender_cleanup(&s);
+
+  return elapsed / done;
+}
+
+/* ACK handling of the former fixed array buffer (shifted on every ACK), entries sized for XDT_DATA_DEFAULT payload */
+static double
+run_array(unsigned window)
+{
+  size_t const size = PDU_DT_SIZE(XDT_DATA_DEFAULT);
+  char *buffer;
+  XDT_message msg;
+  unsigned sequ = 1, i, k;
+  int buffer_index = -1;
+  long done = 0;
+  double elapsed = 0, start;
+
+  if (!(buffer = calloc(window, size))) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+#define ENTRY(k) ((XDT_pdu *)(buffer + (k) * size))
+
+  while (done < acks) {
+    unsigned first = sequ + 1;
+
+    for (i = 0; i < window; ++i) {
+      requ(&msg, ++sequ);
+      ENTRY(++buffer_index)->x.dt.sequ = sequ;
+    }
+
+    start = now_ns();
+    for (i = 0; i < window; ++i) {
+      ack(&msg, first + i);
+      for (k = 0; k < window; k++) {
+        if (ENTRY(k)->x.dt.sequ == msg.pdu.x.ack.sequ) {
+          memset(ENTRY(k), 0, size);
+          for (k = 0; k < window; k++) {
+            if (ENTRY(k)->x.dt.sequ == 0) {
+              if (k == window - 1) {
+                break;
+              }
+              memcpy(ENTRY(k), ENTRY(k + 1), size);
+              memset(ENTRY(k + 1), 0, size);
+            }
+          }
+          buffer_index--;
+          break;
+        }
+      }
+    }
+    elapsed += now_ns() - start;
+    done += window;
+  }
+
+#undef ENTRY
+
+  free(buffer);
+
+  return elapsed / done;
+}
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-a <ACKs per window size>] [<window size> ...]");
+}
+
+int
+main(int argc, char *argv[])
+{
+  static unsigned const default_windows[] = { 1, 5, 16, 64, 256, 1024, 4096 };
+  unsigned windows[64];
+  int count = 0, opt, i;
+
+  while ((opt = getopt(argc, argv, "a:")) != -1) {
+    switch (opt) {
+    case 'a':
+      acks = atol(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind > argc || acks < 1 || argc - optind > (int)(sizeof windows / sizeof *windows)) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (optind == argc) {
+    for (i = 0; i < (int)(sizeof default_windows / sizeof *default_windows); ++i) {
+      windows[count++] = default_windows[i];
+    }
+  } else {
+    for (i = optind; i < argc; ++i) {
+      if (atoi(argv[i]) < 1 || atoi(argv[i]) > SENDER_WINDOW_MAX) {
+        fprintf(stderr, "window size must be within 1 and %u\n", SENDER_WINDOW_MAX);
+        return EXIT_FAILURE;
+      }
+      windows[count++] = atoi(argv[i]);
+    }
+  }
+
+  printf("%8s %16s %16s\n", "window", "ring[ns/ACK]", "array[ns/ACK]");
+  for (i = 0; i < count; ++i) {
+    double ring = run_sender(windows[i]);
+    /* the shifting array is quadratic, keep its runtime bounded */
+    long saved = acks;
+    double array;
+
+    if (windows[i] > 256) {
+      acks = acks / (windows[i] / 256) + 1;
+    }
+    array = run_array(windows[i]);
+    acks = saved;
+
+    printf("%8u %16.1f %16.1f\n", windows[i], ring, array);
+  }
+
+  return EXIT_SUCCESS;
+}
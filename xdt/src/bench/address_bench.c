@@ -0,0 +1,110 @@
+/* address_bench.c
+ *
+ * Cost of the XDT address functions a service calls per new connection.
+ *
+ * The benchmark parses the given address <iterations> times, formats its
+ * user access point name and looks up its socket addresses by
+ * xdt_address_endpoint(), each with <slots> different slots so the
+ * endpoint cache holds more than one entry. With a hostname instead of
+ * an IPv4 address, parsing runs through the resolver cache.
+ *
+ * usage: ./address_bench [-n <iterations>] [-s <slots>] <address>
+ */
+
+#include <xdt/address.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/un.h>
+
+
+static int iterations = 1000000;
+static unsigned slots = 16;
+
+
+static void
+report(char const *name, double elapsed)
+{
+  printf("%-16s %10.1f %12.0f\n", name, elapsed / iterations, iterations / (elapsed / 1e9));
+}
+
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-n <iterations>] [-s <slots>] <address>");
+}
+
+int
+main(int argc, char *argv[])
+{
+  char text[128], path[sizeof ((struct sockaddr_un *)0)->sun_path];
+  XDT_address addr, parsed;
+  XDT_endpoint ep;
+  unsigned long sum = 0;
+  double start;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+    case 'n':
+      iterations = atoi(optarg);
+      break;
+    case 's':
+      slots = atoi(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 1 != argc || iterations < 1 || !slots) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (xdt_address_parse(argv[optind], &addr) < 0) {
+    fputs("error in <address>\n", stderr);
+    return EXIT_FAILURE;
+  }
+  snprintf(text, sizeof text, "%s", argv[optind]);
+
+  printf("%d iterations, %u slots, address %s\n\n", iterations, slots, text);
+  printf("%-16s %10s %12s\n", "function", "ns/call", "calls/s");
+
+  start = now_ns();
+  for (i = 0; i < iterations; ++i) {
+    if (xdt_address_parse(text, &parsed) < 0) {
+      fputs("xdt_address_parse() failed\n", stderr);
+      return EXIT_FAILURE;
+    }
+    sum += parsed.port;
+  }
+  report("parse", now_ns() - start);
+
+  start = now_ns();
+  for (i = 0; i < iterations; ++i) {
+    addr.slot = XDT_SLOT_MIN + i % slots;
+    xdt_address_to_uap_name(&addr, path, sizeof path);
+    sum += path[0];
+  }
+  report("to_uap_name", now_ns() - start);
+
+  start = now_ns();
+  for (i = 0; i < iterations; ++i) {
+    addr.slot = XDT_SLOT_MIN + i % slots;
+    if (xdt_address_endpoint(&addr, &ep) < 0) {
+      fputs("xdt_address_endpoint() failed\n", stderr);
+      return EXIT_FAILURE;
+    }
+    sum += ep.uap_len;
+  }
+  report("endpoint", now_ns() - start);
+
+  return sum ? EXIT_SUCCESS : EXIT_FAILURE;
+}
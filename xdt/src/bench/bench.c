@@ -0,0 +1,48 @@
+/* bench.c
+ *
+ * Helpers shared by the benchmarks, see bench.h.
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+
+/* monotonic clock reading in nanoseconds */
+double
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* monotonic clock reading in microseconds */
+double
+now_us(void)
+{
+  return now_ns() / 1e3;
+}
+
+/* monotonic clock reading in seconds */
+double
+now_s(void)
+{
+  return now_ns() / 1e9;
+}
+
+/* print "usage: <cmd> <options>" to stderr, options is a printf() format of the further arguments */
+void
+bench_usage(char const *cmd, char const *options, ...)
+{
+  va_list ap;
+
+  fprintf(stderr, "usage: %s ", cmd);
+  va_start(ap, options);
+  vfprintf(stderr, options, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+}
@@ -0,0 +1,18 @@
+/* bench.h
+ *
+ * Helpers shared by the benchmarks: monotonic clock readings in the unit a
+ * benchmark reports, and the usage message.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+
+double now_s(void);
+double now_us(void);
+double now_ns(void);
+
+void bench_usage(char const *cmd, char const *options, ...);
+
+
+#endif /* BENCH_H */
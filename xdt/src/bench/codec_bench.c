@@ -0,0 +1,192 @@
+/* codec_bench.c
+ *
+ * Encoding and decoding cost of the PDU wire codecs.
+ *
+ * Every PDU kind is encoded and decoded repeatedly by the XDR codec and the
+ * raw codec. Both decode DTs into a view of the payload in the stream (no
+ * copy into the PDU). Each round trip is checked to reproduce the PDU. Which codec the service uses is chosen at configure time
+ * (--enable-raw-codec).
+ *
+ * usage: ./codec_bench [-n <rounds>]
+ */
+
+#include <service/pdu.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+
+static long rounds = 1000000;
+
+/* keeps the compiler from optimizing decoding away */
+static unsigned long volatile sink;
+
+static char stream[PDU_STREAM_MAX];
+
+
+static void
+address(XDT_address * addr, int port, unsigned slot)
+{
+  memset(addr, 0, sizeof *addr);
+  strcpy(addr->host, "127.0.0.1");
+  addr->port = port;
+  addr->slot = slot;
+}
+
+static int
+same(XDT_pdu const *a, XDT_pdu const *b)
+{
+  if (a->type != b->type) {
+    return 0;
+  }
+  switch ((int)a->type) {
+  case DT:
+    return a->x.dt.sequ == b->x.dt.sequ && a->x.dt.eom == b->x.dt.eom && a->x.dt.length == b->x.dt.length
+      && (a->x.dt.sequ == 1 ? XDT_ADDRESS_EQUAL(a->x.dt.source_addr, b->x.dt.source_addr)
+          && XDT_ADDRESS_EQUAL(a->x.dt.dest_addr, b->x.dt.dest_addr) && a->x.dt.max_length == b->x.dt.max_length
+          && a->x.dt.window == b->x.dt.window
+          : a->x.dt.conn == b->x.dt.conn)
+      && !memcmp(a->x.dt.data, b->x.dt.data, a->x.dt.length);
+  case ACK:
+    return a->x.ack.sequ == b->x.ack.sequ && a->x.ack.conn == b->x.ack.conn && a->x.ack.sack == b->x.ack.sack;
+  case ABO:
+    return a->x.abo.conn == b->x.abo.conn;
+  }
+  return 0;
+}
+
+/* measures one codec on one PDU */
+static int
+run(char const *kind, char const *codec, XDT_pdu * pdu,
+    int (*encode) (XDT_pdu *, char *, size_t), int (*decode) (char *, size_t, XDT_pdu *))
+{
+  static XDT_pdu out;
+  double start, enc, dec;
+  int len = 0, n;
+  long i;
+
+  start = now_ns();
+  for (i = 0; i < rounds; ++i) {
+    len = encode(pdu, stream, sizeof stream);
+  }
+  enc = (now_ns() - start) / rounds;
+  if (len < 0) {
+    fprintf(stderr, "%s: encoding %s failed\n", codec, kind);
+    return -1;
+  }
+
+  start = now_ns();
+  for (i = 0; i < rounds; ++i) {
+    sink += decode(stream, len, &out);
+  }
+  dec = (now_ns() - start) / rounds;
+
+  /* check the round trip */
+  memset(&out, 0, sizeof out);
+  n = decode(stream, len, &out);
+  if (n != len || !same(pdu, &out)) {
+    fprintf(stderr, "%s: round trip of %s failed\n", codec, kind);
+    return -2;
+  }
+
+  printf("%-14s %-9s %6d bytes %10.1f %10.1f\n", kind, codec, len, enc, dec);
+
+  return 0;
+}
+
+static int
+run_all(char const *kind, XDT_pdu * pdu)
+{
+  return run(kind, "XDR", pdu, serialize_pdu_xdr, deserialize_pdu_xdr) < 0
+    || run(kind, "raw", pdu, serialize_pdu_raw, deserialize_pdu_raw) < 0 ? -1 : 0;
+}
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-n <rounds>]");
+}
+
+int
+main(int argc, char *argv[])
+{
+  static unsigned const lengths[] = { XDT_DATA_DEFAULT, 4096, XDT_DATA_MAX };
+  static char data[XDT_DATA_MAX];
+  static XDT_pdu pdu;
+  char kind[32];
+  int opt;
+  unsigned i;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      rounds = atol(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc || rounds < 1) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("service codec (configure time): %s\n\n", XDT_PDU_CODEC);
+  printf("%-14s %-9s %12s %10s %10s\n", "PDU", "codec", "encoded", "enc[ns]", "dec[ns]");
+
+  /* first DT carries the addresses */
+  pdu.type = DT;
+  pdu.x.dt.code = DT;
+  address(&pdu.x.dt.source_addr, 50000, 1);
+  address(&pdu.x.dt.dest_addr, 50001, 1);
+  pdu.x.dt.sequ = 1;
+  pdu.x.dt.max_length = XDT_DATA_MAX;
+  pdu.x.dt.window = 64;
+  pdu.x.dt.length = XDT_DATA_DEFAULT;
+  for (i = 0; i < XDT_DATA_MAX; ++i) {
+    data[i] = (char)i;
+  }
+  pdu.x.dt.data = data;
+  if (run_all("DT 1", &pdu) < 0) {
+    return EXIT_FAILURE;
+  }
+
+  pdu.x.dt.sequ = 2;
+  pdu.x.dt.conn = 4711;
+  for (i = 0; i < sizeof lengths / sizeof *lengths; ++i) {
+    pdu.x.dt.length = lengths[i];
+    snprintf(kind, sizeof kind, "DT %u", lengths[i]);
+    if (run_all(kind, &pdu) < 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  memset(&pdu.x, 0, sizeof pdu.x.ack);
+  pdu.type = ACK;
+  pdu.x.ack.code = ACK;
+  pdu.x.ack.sequ = 2;
+  pdu.x.ack.conn = 4711;
+  if (run_all("ACK", &pdu) < 0) {
+    return EXIT_FAILURE;
+  }
+  pdu.x.ack.sack = 0x5;
+  if (run_all("ACK SACK", &pdu) < 0) {
+    return EXIT_FAILURE;
+  }
+
+  pdu.type = ABO;
+  pdu.x.abo.code = ABO;
+  pdu.x.abo.conn = 4711;
+  if (run_all("ABO", &pdu) < 0) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
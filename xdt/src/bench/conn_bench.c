@@ -0,0 +1,341 @@
+/* conn_bench.c
+ *
+ * Connection setup and per-PDU latency benchmark of the XDT service.
+ *
+ * The benchmark starts the given service program twice, once in the default
+ * mode (one forked process per connection) and once in single-process mode (-s).
+ * It acts as sending peer and as consumer: for every connection an initial DT
+ * is sent to the service, followed by stop-and-wait DTs up to the one carrying 
+ * the end of message. Measured are the time from sending the initial DT until 
+ * its ACK arrives (connection setup) and the round trip time of every other DT.
+ *
+ * usage: ./conn_bench [-n <connections>] [-p <PDUs per connection>] [-l <payload length>] <service program> <listen address>
+ */
+
+#include <service/pdu.h>
+
+#include <xdt/address.h>
+#include <xdt/sdu.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+
+/** @brief Time to wait for an ACK before the DT is repeated (microseconds) */
+#define RETRY_TIMEOUT_US 200000
+
+/** @brief Number of unanswered repetitions until a connection is given up */
+#define RETRY_MAX 25
+
+
+static int connections = 200;
+static int pdus = 10;
+static unsigned length = XDT_DATA_DEFAULT;
+
+static XDT_address service_addr, peer_addr, consumer_addr;
+static struct sockaddr_in service_sin;
+static int peer_sock = -1, consumer_sock = -1;
+static char consumer_path[sizeof ((struct sockaddr_un *)0)->sun_path];
+
+
+static int
+compare_double(void const *a, void const *b)
+{
+  double l = *(double const *)a, r = *(double const *)b;
+
+  return (l > r) - (l < r);
+}
+
+
+/* start the service program, wait until its service access point exists */
+static pid_t
+start_service(char const *program, int single_process)
+{
+  char sap_path[sizeof consumer_path];
+  char address[64];
+  struct stat st;
+  pid_t pid;
+  int i;
+
+  xdt_address_to_sap_name(&service_addr, sap_path, sizeof sap_path);
+  remove(sap_path);
+  snprintf(address, sizeof address, "%s:%d", service_addr.host, service_addr.port);
+
+  switch (pid = fork()) {
+  case -1:
+    perror("fork");
+    exit(EXIT_FAILURE);
+
+  case 0:
+    /* the service prints every message, keep this out of the measurement */
+    if ((i = open("/dev/null", O_WRONLY)) != -1) {
+      dup2(i, STDOUT_FILENO);
+      dup2(i, STDERR_FILENO);
+    }
+    if (single_process) {
+      execl(program, program, "-s", address, (char *)0);
+    } else {
+      execl(program, program, address, (char *)0);
+    }
+    _exit(127);
+  }
+
+  for (i = 0; i < 200 && stat(sap_path, &st) == -1; ++i) {
+    usleep(10000);
+  }
+  if (i == 200) {
+    fprintf(stderr, "service '%s' did not come up\n", program);
+    kill(pid, SIGTERM);
+    exit(EXIT_FAILURE);
+  }
+
+  return pid;
+}
+
+static void
+stop_service(pid_t pid)
+{
+  kill(pid, SIGTERM);
+  waitpid(pid, 0, 0);
+}
+
+
+/* throw away everything the receiver instances delivered to the consumer */
+static void
+drain_consumer(void)
+{
+  static char packed[XDT_SDU_SIZE(XDT_DATA_MAX)];
+
+  while (recv(consumer_sock, packed, sizeof packed, MSG_DONTWAIT) > 0);
+}
+
+/* send a DT and wait for its ACK, repeating the DT on timeout */
+static int
+transmit(XDT_pdu * dt, unsigned *conn, int *retries)
+{
+  char stream[PDU_STREAM_MAX];
+  XDT_pdu ack;
+  int len, tries;
+
+  if ((len = serialize_pdu(dt, stream, sizeof stream)) < 0) {
+    fputs("serializing PDU failed\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+
+  for (tries = 0; tries < RETRY_MAX; ++tries) {
+    if (tries) {
+      ++*retries;
+    }
+    if (sendto(peer_sock, stream, len, 0, (struct sockaddr *)&service_sin, sizeof service_sin) == -1) {
+      perror("sendto");
+      exit(EXIT_FAILURE);
+    }
+
+    for (;;) {
+      char in[PDU_STREAM_MAX];
+      ssize_t n;
+
+      if ((n = recv(peer_sock, in, sizeof in, 0)) == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;                /* timeout, repeat */
+        }
+        if (errno == EINTR) {
+          continue;
+        }
+        perror("recv");
+        exit(EXIT_FAILURE);
+      }
+      if (deserialize_pdu(in, n, &ack) >= 0 && ack.type == ACK && ack.x.ack.sequ == dt->x.dt.sequ) {
+        *conn = ack.x.ack.conn;
+        drain_consumer();
+        return 0;
+      }
+    }
+  }
+
+  return -1;
+}
+
+/* run all connections against a started service */
+static void
+run(char const *name, char const *program, int single_process)
+{
+  int samples = connections * (pdus - 1), count = 0, retries = 0, failed = 0;
+  double *rtt = malloc((samples ? samples : 1) * sizeof *rtt);
+  double setup = 0, sum = 0, start, elapsed;
+  pid_t pid = start_service(program, single_process);
+  static char data[XDT_DATA_MAX];
+  XDT_pdu dt;
+  int c, p;
+
+  if (!rtt) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&dt, 0, sizeof dt);
+  dt.type = DT;
+  dt.x.dt.code = DT;
+  dt.x.dt.source_addr = peer_addr;
+  dt.x.dt.dest_addr = consumer_addr;
+  dt.x.dt.max_length = length < XDT_DATA_DEFAULT ? XDT_DATA_DEFAULT : length;
+  dt.x.dt.length = length;
+  dt.x.dt.data = memset(data, 'x', length);
+
+  start = now_us();
+
+  for (c = 0; c < connections; ++c) {
+    unsigned conn = 0;
+    double t;
+
+    dt.x.dt.sequ = 1;
+    dt.x.dt.eom = 0;
+    t = now_us();
+    if (transmit(&dt, &conn, &retries) < 0) {
+      ++failed;
+      continue;
+    }
+    setup += now_us() - t;
+
+    dt.x.dt.conn = conn;
+    for (p = 2; p <= pdus; ++p) {
+      dt.x.dt.sequ = p;
+      dt.x.dt.eom = p == pdus;
+      t = now_us();
+      if (transmit(&dt, &conn, &retries) < 0) {
+        ++failed;
+        break;
+      }
+      rtt[count] = now_us() - t;
+      sum += rtt[count++];
+    }
+  }
+
+  elapsed = now_us() - start;
+
+  stop_service(pid);
+
+  qsort(rtt, count, sizeof *rtt, compare_double);
+  printf("%-16s %10.1f %12.1f %12.1f %10.1f %10.1f %8d %7d\n", name,
+         connections / (elapsed / 1e6),
+         setup / (connections - failed ? connections - failed : 1),
+         count ? sum / count : 0.0, count ? rtt[count / 2] : 0.0, count ? rtt[count * 99 / 100] : 0.0, retries, failed);
+
+  free(rtt);
+}
+
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-n <connections>] [-p <PDUs per connection, at least 2>] [-l <payload length>] <service program> <listen address>");
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct sockaddr_in sin;
+  struct sockaddr_un sun;
+  struct timeval tv;
+  char const *program;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "n:p:l:")) != -1) {
+    switch (opt) {
+    case 'n':
+      connections = atoi(optarg);
+      break;
+    case 'p':
+      pdus = atoi(optarg);
+      break;
+    case 'l':
+      length = atoi(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 2 != argc || connections < 1 || pdus < 2 || length > XDT_DATA_MAX) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  program = argv[optind];
+
+  if (xdt_address_parse(argv[optind + 1], &service_addr) < 0 || service_addr.port >= XDT_PORT_MAX) {
+    fputs("error in <listen address>\n", stderr);
+    return EXIT_FAILURE;
+  }
+
+  /* the benchmark acts as sending peer on the next port ... */
+  peer_addr = service_addr;
+  peer_addr.port = service_addr.port + 1;
+  peer_addr.slot = 1;
+
+  /* ... and as consumer served by the measured service */
+  consumer_addr = service_addr;
+  consumer_addr.slot = 1;
+
+  memset(&service_sin, 0, sizeof service_sin);
+  service_sin.sin_family = AF_INET;
+  service_sin.sin_port = htons(service_addr.port);
+  inet_pton(AF_INET, service_addr.host, &service_sin.sin_addr);
+
+  if ((peer_sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
+    perror("socket");
+    return EXIT_FAILURE;
+  }
+  sin = service_sin;
+  sin.sin_port = htons(peer_addr.port);
+  if (bind(peer_sock, (struct sockaddr *)&sin, sizeof sin) == -1) {
+    perror("bind");
+    return EXIT_FAILURE;
+  }
+  tv.tv_sec = 0;
+  tv.tv_usec = RETRY_TIMEOUT_US;
+  if (setsockopt(peer_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv) == -1) {
+    perror("setsockopt");
+    return EXIT_FAILURE;
+  }
+
+  if ((consumer_sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1) {
+    perror("socket");
+    return EXIT_FAILURE;
+  }
+  memset(&sun, 0, sizeof sun);
+  sun.sun_family = AF_LOCAL;
+  xdt_address_to_uap_name(&consumer_addr, consumer_path, sizeof consumer_path);
+  strcpy(sun.sun_path, consumer_path);
+  remove(consumer_path);
+  if (bind(consumer_sock, (struct sockaddr *)&sun, sizeof sun) == -1) {
+    perror("bind");
+    return EXIT_FAILURE;
+  }
+
+  printf("%d connections, %d DTs each, %u bytes payload\n\n", connections, pdus, length);
+  printf("%-16s %10s %12s %12s %10s %10s %8s %7s\n", "mode", "conn/s", "setup[us]", "rtt[us]", "p50[us]", "p99[us]", "retries", "failed");
+
+  for (i = 0; i < 2; ++i) {
+    run(i ? "single-process" : "fork", program, i);
+  }
+
+  remove(consumer_path);
+
+  return EXIT_SUCCESS;
+}
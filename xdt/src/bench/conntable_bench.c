@@ -0,0 +1,260 @@
+/* conntable_bench.c
+ *
+ * Lookup cost benchmark of the dispatcher's connection table.
+ *
+ * For every table size the table is filled with the given number of
+ * connections (half of them sender, half receiver instances) and every index
+ * is queried with randomly chosen existing keys. For comparison the same
+ * lookups are done by a linear scan over all instances, as the dispatcher
+ * did before the table was hashed. Finally connections are released and set
+ * up again to measure the cost of slot recycling.
+ *
+ * usage: ./conntable_bench [-l <lookups per index>] [<connections> ...]
+ *        (default: 10 1000 100000 connections)
+ */
+
+#include <service/conntable.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <arpa/inet.h>
+
+
+static unsigned lookups = 1000000;
+
+/* keeps the compiler from optimizing lookups away */
+static unsigned long volatile sink;
+
+
+static void
+setup_connection(XDT_instance * inst, unsigned i)
+{
+  inst->role = (i & 1) ? XDT_SERVICE_RECEIVER : XDT_SERVICE_SENDER;
+  inst->pid = 1000 + i;
+  inst->real_conn = i + 1;
+  inst->mapped_conn = i + 1;
+
+  snprintf(inst->producer.host, sizeof inst->producer.host, "10.0.%u.%u", (i >> 8) & 0xff, i & 0xff);
+  inst->producer.port = XDT_PORT_MIN + i % 1000;
+  inst->producer.slot = i;
+  strcpy(inst->consumer.host, "10.1.0.1");
+  inst->consumer.port = XDT_PORT_MIN;
+  inst->consumer.slot = i / 7;
+
+  inst->receiver.sin_family = AF_INET;
+  inst->receiver.sin_addr.s_addr = htonl(0x0a020000 + i);
+  inst->receiver.sin_port = htons(XDT_PORT_MIN + i % 1000);
+  inst->receiver_len = sizeof inst->receiver;
+}
+
+/* linear lookup by real connection number (as before hashing) */
+static XDT_instance *
+scan_by_real_conn(XDT_instance ** all, unsigned count, unsigned conn)
+{
+  unsigned i;
+
+  for (i = 0; i < count; ++i) {
+    if (all[i]->role == XDT_SERVICE_RECEIVER && all[i]->real_conn == conn) {
+      return all[i];
+    }
+  }
+  return 0;
+}
+
+/* linear lookup by address pair (as before hashing) */
+static XDT_instance *
+scan_by_xdt_addresses(XDT_instance ** all, unsigned count, XDT_address const *src, XDT_address const *dst)
+{
+  unsigned i;
+
+  for (i = 0; i < count; ++i) {
+    if (all[i]->role == XDT_SERVICE_SENDER && XDT_ADDRESS_EQUAL(all[i]->producer, *src)
+        && XDT_ADDRESS_EQUAL(all[i]->consumer, *dst)) {
+      return all[i];
+    }
+  }
+  return 0;
+}
+
+static void
+report(unsigned count, char const *index, unsigned n, double start, unsigned misses)
+{
+  printf("%9u  %-16s %10.1f ns/lookup%s\n", count, index, (now_ns() - start) / n,
+         misses ? "  (LOOKUP ERRORS)" : "");
+}
+
+static int
+run(unsigned count)
+{
+  XDT_conntable table;
+  XDT_instance **all, *inst;
+  unsigned *keys, i, n, misses;
+  double start;
+
+  if (!(all = malloc(count * sizeof *all)) || !(keys = malloc(lookups * sizeof *keys))) {
+    perror("malloc");
+    return -1;
+  }
+  if (xdt_conntable_create(&table) < 0) {
+    return -2;
+  }
+
+  for (i = 0; i < count; ++i) {
+    if (!(all[i] = xdt_conntable_alloc(&table))) {
+      fputs("xdt_conntable_alloc() failed\n", stderr);
+      return -3;
+    }
+    setup_connection(all[i], i);
+    xdt_conntable_link(&table, all[i]);
+  }
+
+  /* random keys, separately for senders (even) and receivers (odd) */
+  for (i = 0; i < lookups; ++i) {
+    keys[i] = count > 1 ? (unsigned)(rand() % (count & ~1u)) & ~1u : 0;
+  }
+
+  misses = 0;
+  start = now_ns();
+  for (i = 0; i < lookups; ++i) {
+    inst = xdt_conntable_by_mapped_conn(&table, keys[i] + 1);
+    misses += !inst;
+    sink += (unsigned long)inst;
+  }
+  report(count, "mapped conn", lookups, start, misses);
+
+  misses = 0;
+  start = now_ns();
+  for (i = 0; i < lookups; ++i) {
+    inst = all[keys[i]];
+    inst = xdt_conntable_by_xdt_addresses(&table, &inst->producer, &inst->consumer);
+    misses += !inst;
+    sink += (unsigned long)inst;
+  }
+  report(count, "address pair", lookups, start, misses);
+
+  misses = 0;
+  start = now_ns();
+  for (i = 0; i < lookups; ++i) {
+    inst = all[keys[i]];
+    inst = xdt_conntable_by_socket_address(&table, inst->real_conn, &inst->receiver, inst->receiver_len);
+    misses += !inst;
+    sink += (unsigned long)inst;
+  }
+  report(count, "peer sockaddr", lookups, start, misses);
+
+  if (count > 1) {
+    misses = 0;
+    start = now_ns();
+    for (i = 0; i < lookups; ++i) {
+      inst = xdt_conntable_by_real_conn(&table, keys[i] + 2);
+      misses += !inst;
+      sink += (unsigned long)inst;
+    }
+    report(count, "real conn", lookups, start, misses);
+  }
+
+  misses = 0;
+  start = now_ns();
+  for (i = 0; i < lookups; ++i) {
+    inst = xdt_conntable_by_pid(&table, 1000 + keys[i]);
+    misses += !inst;
+    sink += (unsigned long)inst;
+  }
+  report(count, "pid", lookups, start, misses);
+
+  /* the old linear scan, fewer rounds for big tables */
+  n = count > 1000 ? lookups / 1000 : lookups;
+  misses = 0;
+  start = now_ns();
+  for (i = 0; i < n; ++i) {
+    inst = all[keys[i]];
+    inst = scan_by_xdt_addresses(all, count, &inst->producer, &inst->consumer);
+    misses += !inst;
+    sink += (unsigned long)inst;
+  }
+  report(count, "scan addr pair", n, start, misses);
+
+  if (count > 1) {
+    misses = 0;
+    start = now_ns();
+    for (i = 0; i < n; ++i) {
+      inst = scan_by_real_conn(all, count, keys[i] + 2);
+      misses += !inst;
+      sink += (unsigned long)inst;
+    }
+    report(count, "scan real conn", n, start, misses);
+  }
+
+  /* release and set up connections again (slot recycling) */
+  n = lookups / 10;
+  start = now_ns();
+  for (i = 0; i < n; ++i) {
+    unsigned k = keys[i];
+
+    xdt_conntable_free(&table, all[k]);
+    all[k] = xdt_conntable_alloc(&table);
+    setup_connection(all[k], k);
+    xdt_conntable_link(&table, all[k]);
+  }
+  printf("%9u  %-16s %10.1f ns/connection (table size %u slots)\n", count, "free+setup", (now_ns() - start) / n,
+         table.size);
+
+  xdt_conntable_delete(&table);
+  free(keys);
+  free(all);
+
+  return 0;
+}
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-l <lookups per index, at least 1000>] [<connections> ...]");
+}
+
+int
+main(int argc, char *argv[])
+{
+  static unsigned const default_counts[] = { 10, 1000, 100000 };
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "l:")) != -1) {
+    switch (opt) {
+    case 'l':
+      lookups = atoi(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind > argc || lookups < 1000) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  srand(1);
+  printf("%9s  %-16s %10s\n", "conns", "index", "cost");
+
+  if (optind == argc) {
+    for (i = 0; i < (int)(sizeof default_counts / sizeof *default_counts); ++i) {
+      if (run(default_counts[i]) < 0) {
+        return EXIT_FAILURE;
+      }
+    }
+  } else {
+    for (i = optind; i < argc; ++i) {
+      if (atoi(argv[i]) < 1 || run(atoi(argv[i])) < 0) {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
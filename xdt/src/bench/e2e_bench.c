@@ -0,0 +1,688 @@
+/* e2e_bench.c
+ *
+ * End-to-end loopback benchmark: producer -> service -> service -> consumer.
+ *
+ * The benchmark starts the given service program twice, as sending service
+ * on the listen address and as receiving service on the next port, each with
+ * the <service options>. It acts as <streams> producers and consumers, every
+ * producer transfers <bytes> of payload in XDATrequs of <payload length>
+ * bytes to its consumer, keeping within the window the XDATconfs grant. The
+ * payload is derived from <seed>, so runs are reproducible, and checked by
+ * the consumer. Both services are started afresh for each of the <runs>.
+ *
+ * Measured per run are the goodput (payload bytes the consumers got per
+ * second), the latency of every SDU from its XDATrequ to its XDATind, the
+ * CPU time of both services and their instance processes and of the
+ * benchmark itself per MB of payload, and the retransmissions, T2
+ * expirations, go-back-N rounds and dropped queue messages taken from the
+ * services' statistics segments (see service/stats.h). The results are
+ * printed as a table, or as CSV or JSON for comparing runs by scripts.
+ * Payload rings (service option -u) are not supported.
+ *
+ * usage: ./e2e_bench [-n <bytes>] [-c <streams>] [-l <payload length>] [-r <runs>] [-S <seed>] [-o table|csv|json] [-a <service options>] <service program> <listen address>
+ */
+
+#include <service/stats.h>
+
+#include <xdt/address.h>
+#include <xdt/sdu.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+
+
+/** @brief Time without any SDU until the run is given up (milliseconds) */
+#define IDLE_TIMEOUT_MS 10000
+
+/** @brief Biggest number of streams */
+#define STREAMS_MAX 256
+
+/** @brief Most service options */
+#define OPTIONS_MAX 32
+
+/** @brief Number of different payload offsets into the pattern */
+#define PATTERN_SHIFTS 256
+
+
+typedef struct
+{
+  int producer; /* socket of the producer's user access point */
+  int consumer; /* socket of the consumer's user access point */
+  XDT_address source, dest;
+  unsigned conn; /* connection number, known after the first XDATconf */
+  unsigned sequ; /* sequence number of the last XDATrequ sent */
+  unsigned limit; /* sequence number up to which XDATrequs may be sent */
+  unsigned chunk; /* payload size agreed for the connection */
+  unsigned long long sent; /* payload bytes sent */
+  unsigned expected; /* sequence number of the next XDATind */
+  unsigned long long received; /* payload bytes received in order */
+  double *sent_at; /* time each XDATrequ was sent, by sequence number */
+  unsigned sent_max; /* number of entries of sent_at */
+  int connected, paused, eom, produced, consumed, failed;
+} stream;
+
+typedef struct
+{
+  double seconds; /* time until all streams have finished */
+  double goodput; /* MB of payload the consumers got per second */
+  unsigned long sdus; /* XDATinds received in order */
+  double p50, p90, p99, max; /* SDU latency in microseconds */
+  double service_cpu; /* CPU seconds of both services per MB */
+  double bench_cpu; /* CPU seconds of the benchmark per MB */
+  unsigned long long retransmitted, t2, go_back_n, dropped;
+  int failed, corrupt;
+} result;
+
+
+static unsigned long long bytes = 2000000;
+static int concurrent = 1;
+static unsigned length = 1000;
+static int runs = 3;
+static unsigned long seed = 1;
+static char const *format = "table";
+static char const *options = "";
+
+static char *service_argv[OPTIONS_MAX + 3];
+static XDT_address sender_addr, receiver_addr;
+static int sap_sock = -1;
+static stream streams[STREAMS_MAX];
+static char pattern[XDT_DATA_MAX + PATTERN_SHIFTS];
+static double *latency;
+static unsigned long latencies;
+
+
+static double
+cpu_seconds(int who)
+{
+  struct rusage ru;
+
+  getrusage(who, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static int
+compare_double(void const *a, void const *b)
+{
+  double l = *(double const *)a, r = *(double const *)b;
+
+  return (l > r) - (l < r);
+}
+
+/* the payload pattern of the seed, by xorshift64 */
+static void
+fill_pattern(void)
+{
+  unsigned long long x = seed * 0x9e3779b97f4a7c15ull + 1;
+  size_t i;
+
+  for (i = 0; i < sizeof pattern; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    pattern[i] = (char)x;
+  }
+}
+
+/* payload of XDATrequ sequ of stream i */
+static char *
+payload(int i, unsigned sequ)
+{
+  return pattern + (i * 31u + sequ) % PATTERN_SHIFTS;
+}
+
+
+/* split the service options at blanks */
+static void
+split_options(char *text)
+{
+  char *arg;
+  int n = 1;
+
+  for (arg = strtok(text, " "); arg; arg = strtok(0, " ")) {
+    if (n > OPTIONS_MAX) {
+      fprintf(stderr, "more than %d service options\n", OPTIONS_MAX);
+      exit(EXIT_FAILURE);
+    }
+    service_argv[n++] = arg;
+  }
+  service_argv[n + 1] = 0;
+}
+
+/* start the service program, wait until its service access point exists */
+static pid_t
+start_service(char *program, XDT_address const *addr)
+{
+  char sap_path[sizeof ((struct sockaddr_un *)0)->sun_path];
+  char address[64];
+  struct stat st;
+  pid_t pid;
+  int i;
+
+  xdt_address_to_sap_name(addr, sap_path, sizeof sap_path);
+  remove(sap_path);
+  snprintf(address, sizeof address, "%s:%d", addr->host, addr->port);
+  for (i = 1; service_argv[i]; ++i);
+  service_argv[0] = program;
+  service_argv[i] = address;
+
+  switch (pid = fork()) {
+  case -1:
+    perror("fork");
+    exit(EXIT_FAILURE);
+
+  case 0:
+    if ((i = open("/dev/null", O_WRONLY)) != -1) {
+      dup2(i, STDOUT_FILENO);
+      dup2(i, STDERR_FILENO);
+    }
+    execv(program, service_argv);
+    _exit(127);
+  }
+  service_argv[i] = 0;
+
+  for (i = 0; i < 200 && stat(sap_path, &st) == -1; ++i) {
+    usleep(10000);
+  }
+  if (i == 200) {
+    fprintf(stderr, "service '%s' did not come up\n", program);
+    kill(pid, SIGTERM);
+    exit(EXIT_FAILURE);
+  }
+
+  return pid;
+}
+
+static void
+stop_service(pid_t pid)
+{
+  kill(pid, SIGTERM);
+  waitpid(pid, 0, 0);
+}
+
+/* sum up the statistics segment of a running service, 0 if it has none */
+static int
+read_stats(XDT_address const *addr, XDT_stat_block * sum)
+{
+  XDT_stats const *stats;
+  char name[64];
+  void *mem;
+  int fd;
+
+  memset(sum, 0, sizeof *sum);
+  if (xdt_stats_name(addr, name, sizeof name) < 0 || (fd = shm_open(name, O_RDONLY, 0)) == -1) {
+    return 0;
+  }
+  mem = mmap(0, sizeof (XDT_stats), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    return 0;
+  }
+  stats = mem;
+  if (stats->magic == XDT_STAT_MAGIC && stats->conns == XDT_STAT_CONNS) {
+    xdt_stats_sum(stats, sum);
+  }
+  munmap(mem, sizeof (XDT_stats));
+
+  return 1;
+}
+
+
+/* socket bound to the user access point of addr */
+static int
+bind_uap(XDT_address const *addr)
+{
+  struct sockaddr_un sun;
+  int sock, size = 4 << 20;
+
+  memset(&sun, 0, sizeof sun);
+  sun.sun_family = AF_LOCAL;
+  xdt_address_to_uap_name(addr, sun.sun_path, sizeof sun.sun_path);
+  remove(sun.sun_path);
+  if ((sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1 || bind(sock, (struct sockaddr *)&sun, sizeof sun) == -1) {
+    perror("binding user access point failed");
+    exit(EXIT_FAILURE);
+  }
+  setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+
+  return sock;
+}
+
+static void
+unbind_uap(XDT_address const *addr, int sock)
+{
+  char path[sizeof ((struct sockaddr_un *)0)->sun_path];
+
+  close(sock);
+  xdt_address_to_uap_name(addr, path, sizeof path);
+  remove(path);
+}
+
+/* connect to the service access point of the sending service */
+static void
+connect_sap(void)
+{
+  struct sockaddr_un sun;
+
+  memset(&sun, 0, sizeof sun);
+  sun.sun_family = AF_LOCAL;
+  xdt_address_to_sap_name(&sender_addr, sun.sun_path, sizeof sun.sun_path);
+  if ((sap_sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1
+      || connect(sap_sock, (struct sockaddr *)&sun, sizeof sun) == -1) {
+    perror("connecting service access point failed");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+/* send the next XDATrequ of stream i, the first one carries at most the default payload size */
+static void
+send_next(int i)
+{
+  static XDT_sdu sdu;
+  struct iovec iov[2];
+  stream *s = &streams[i];
+  unsigned long long left = bytes - s->sent;
+  unsigned len = s->sequ ? s->chunk : XDT_DATA_DEFAULT;
+
+  if (len > length) {
+    len = length;
+  }
+  if (len > left) {
+    len = (unsigned)left;
+  }
+
+  memset(&sdu, 0, sizeof sdu);
+  sdu.type = XDATrequ;
+  sdu.x.dat_requ.sequ = ++s->sequ;
+  sdu.x.dat_requ.conn = s->conn;
+  sdu.x.dat_requ.source_addr = s->source;
+  sdu.x.dat_requ.dest_addr = s->dest;
+  sdu.x.dat_requ.max_length = length < XDT_DATA_DEFAULT ? XDT_DATA_DEFAULT : length;
+  sdu.x.dat_requ.length = len;
+  sdu.x.dat_requ.eom = s->eom = len == left;
+  sdu.x.dat_requ.data = payload(i, s->sequ);
+
+  s->sent += len;
+  s->sent_at[s->sequ] = now_us();
+  while (writev(sap_sock, iov, xdt_sdu_iov(&sdu, iov)) == -1) {
+    if (errno != EINTR) {
+      perror("writev");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* receive an SDU without waiting, its payload stays in a static buffer until the next call */
+static int
+receive(int sock, XDT_sdu * sdu)
+{
+  static char packed[XDT_SDU_SIZE(XDT_DATA_MAX)];
+  ssize_t n;
+
+  if ((n = recv(sock, packed, sizeof packed, MSG_DONTWAIT)) <= 0) {
+    return 0;
+  }
+  if (xdt_sdu_unpack(sdu, packed, n) < 0) {
+    sdu->type = 0;
+  }
+
+  return 1;
+}
+
+/* send XDATrequs as far as the window allows */
+static void
+fill_window(int i)
+{
+  stream *s = &streams[i];
+
+  while (s->connected && !s->paused && !s->eom && s->sequ < s->limit) {
+    send_next(i);
+  }
+}
+
+/* the producer's part: XDATconf opens the window, XBREAKind closes it, done on XDISind */
+static void
+serve_producer(int i)
+{
+  stream *s = &streams[i];
+  XDT_sdu sdu;
+
+  while (receive(s->producer, &sdu)) {
+    switch ((int)sdu.type) {
+    case XDATconf:
+      if (!s->connected) {
+        s->conn = sdu.x.dat_conf.conn;
+        s->connected = 1;
+      }
+      if (sdu.x.dat_conf.max_length >= XDT_DATA_DEFAULT && sdu.x.dat_conf.max_length < s->chunk) {
+        s->chunk = sdu.x.dat_conf.max_length;
+      }
+      if (sdu.x.dat_conf.sequ + (sdu.x.dat_conf.window ? sdu.x.dat_conf.window : 1) > s->limit) {
+        s->limit = sdu.x.dat_conf.sequ + (sdu.x.dat_conf.window ? sdu.x.dat_conf.window : 1);
+      }
+      s->paused = 0;
+      break;
+
+    case XBREAKind:
+      s->paused = 1;
+      break;
+
+    case XABORTind:
+      s->failed = 1;
+      s->consumed = 1;
+      /* fall through */
+    case XDISind:
+      s->produced = 1;
+      break;
+    }
+  }
+  fill_window(i);
+}
+
+/* the consumer's part: checks the payload and takes the latency of every XDATind in order */
+static void
+serve_consumer(int i, int *corrupt)
+{
+  stream *s = &streams[i];
+  XDT_sdu sdu;
+  double now;
+
+  while (receive(s->consumer, &sdu)) {
+    if (sdu.type == XABORTind) {
+      s->failed = 1;
+      s->consumed = 1;
+      continue;
+    }
+    if (sdu.type != XDATind || sdu.x.dat_ind.sequ != s->expected) {
+      continue;
+    }
+
+    now = now_us();
+    if (sdu.x.dat_ind.sequ < s->sent_max && s->sent_at[sdu.x.dat_ind.sequ] > 0) {
+      latency[latencies++] = now - s->sent_at[sdu.x.dat_ind.sequ];
+    }
+    if (sdu.x.dat_ind.shared || memcmp(sdu.x.dat_ind.data, payload(i, sdu.x.dat_ind.sequ), sdu.x.dat_ind.length)) {
+      ++*corrupt;
+    }
+    s->received += sdu.x.dat_ind.length;
+    s->expected++;
+    if (sdu.x.dat_ind.eom) {
+      s->consumed = 1;
+    }
+  }
+}
+
+/* run all streams against two started services */
+static void
+run(char *program, result * r)
+{
+  struct pollfd fds[2 * STREAMS_MAX];
+  double start, elapsed, children, self;
+  unsigned long long total = 0;
+  unsigned sdus_max = (unsigned)(bytes / (length < XDT_DATA_DEFAULT ? length : XDT_DATA_DEFAULT)) + 2;
+  XDT_stat_block sending, receiving;
+  pid_t sender, receiver;
+  int done = 0, i, n;
+
+  memset(r, 0, sizeof *r);
+  children = cpu_seconds(RUSAGE_CHILDREN);
+  self = cpu_seconds(RUSAGE_SELF);
+  sender = start_service(program, &sender_addr);
+  receiver = start_service(program, &receiver_addr);
+
+  latencies = 0;
+  if (!(latency = malloc((size_t)concurrent * sdus_max * sizeof *latency))) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < concurrent; ++i) {
+    stream *s = &streams[i];
+
+    memset(s, 0, sizeof *s);
+    s->source = sender_addr;
+    s->source.slot = i + 1;
+    s->dest = receiver_addr;
+    s->dest.slot = i + 1;
+    s->producer = bind_uap(&s->source);
+    s->consumer = bind_uap(&s->dest);
+    s->chunk = length < XDT_DATA_DEFAULT ? XDT_DATA_DEFAULT : length;
+    s->expected = 1;
+    s->sent_max = sdus_max;
+    if (!(s->sent_at = calloc(sdus_max, sizeof *s->sent_at))) {
+      perror("calloc");
+      exit(EXIT_FAILURE);
+    }
+    fds[2 * i].fd = s->producer;
+    fds[2 * i + 1].fd = s->consumer;
+    fds[2 * i].events = fds[2 * i + 1].events = POLLIN;
+  }
+  connect_sap();
+
+  /* the first XDATrequ of every stream, the XDATconf tells the window */
+  start = now_us();
+  for (i = 0; i < concurrent; ++i) {
+    send_next(i);
+  }
+
+  while (done < concurrent) {
+    if ((n = poll(fds, 2 * concurrent, IDLE_TIMEOUT_MS)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      exit(EXIT_FAILURE);
+    }
+    if (!n) {
+      fprintf(stderr, "no SDU within %d ms, %d of %d streams done\n", IDLE_TIMEOUT_MS, done, concurrent);
+      break;
+    }
+
+    for (i = 0; i < concurrent; ++i) {
+      stream *s = &streams[i];
+
+      if (s->produced && s->consumed) {
+        continue;
+      }
+      if (fds[2 * i].revents & POLLIN) {
+        serve_producer(i);
+      }
+      if (fds[2 * i + 1].revents & POLLIN) {
+        serve_consumer(i, &r->corrupt);
+      }
+      if (s->produced && s->consumed) {
+        done++;
+      }
+    }
+  }
+
+  elapsed = now_us() - start;
+
+  /* the statistics segments are removed when the services exit */
+  read_stats(&sender_addr, &sending);
+  read_stats(&receiver_addr, &receiving);
+
+  close(sap_sock);
+  for (i = 0; i < concurrent; ++i) {
+    stream *s = &streams[i];
+
+    if (!s->produced || !s->consumed || s->failed) {
+      r->failed++;
+    }
+    total += s->received;
+    unbind_uap(&s->source, s->producer);
+    unbind_uap(&s->dest, s->consumer);
+    free(s->sent_at);
+  }
+  self = cpu_seconds(RUSAGE_SELF) - self;
+  stop_service(sender);
+  stop_service(receiver);
+  children = cpu_seconds(RUSAGE_CHILDREN) - children;
+
+  qsort(latency, latencies, sizeof *latency, compare_double);
+  r->seconds = elapsed / 1e6;
+  r->goodput = total / elapsed;
+  r->sdus = latencies;
+  if (latencies) {
+    r->p50 = latency[latencies / 2];
+    r->p90 = latency[latencies * 9 / 10];
+    r->p99 = latency[latencies * 99 / 100];
+    r->max = latency[latencies - 1];
+  }
+  r->service_cpu = total ? children / (total / 1e6) : 0;
+  r->bench_cpu = total ? self / (total / 1e6) : 0;
+  r->retransmitted = sending.counter[XDT_STAT_RETRANSMITTED];
+  r->t2 = sending.counter[XDT_STAT_T2_EXPIRED];
+  r->go_back_n = sending.counter[XDT_STAT_GO_BACK_N];
+  r->dropped = sending.counter[XDT_STAT_DROPPED] + receiving.counter[XDT_STAT_DROPPED];
+
+  free(latency);
+}
+
+
+static void
+print_result(char const *name, result const *r, int last)
+{
+  if (!strcmp(format, "csv")) {
+    printf("%s,%d,%llu,%u,%lu,\"%s\",%.6f,%.3f,%lu,%.1f,%.1f,%.1f,%.1f,%.4f,%.4f,%llu,%llu,%llu,%llu,%d,%d\n", name,
+           concurrent, bytes, length, seed, options, r->seconds, r->goodput, r->sdus, r->p50, r->p90, r->p99, r->max,
+           r->service_cpu, r->bench_cpu, r->retransmitted, r->t2, r->go_back_n, r->dropped, r->failed, r->corrupt);
+  } else if (!strcmp(format, "json")) {
+    printf("    {\"run\": \"%s\", \"seconds\": %.6f, \"goodput_mb_s\": %.3f, \"sdus\": %lu, "
+           "\"latency_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+           "\"service_cpu_s_per_mb\": %.4f, \"bench_cpu_s_per_mb\": %.4f, \"retransmitted\": %llu, "
+           "\"t2_expired\": %llu, \"go_back_n\": %llu, \"dropped\": %llu, \"failed\": %d, \"corrupt\": %d}%s\n",
+           name, r->seconds, r->goodput, r->sdus, r->p50, r->p90, r->p99, r->max, r->service_cpu, r->bench_cpu,
+           r->retransmitted, r->t2, r->go_back_n, r->dropped, r->failed, r->corrupt, last ? "" : ",");
+  } else {
+    printf("%-6s %8.3f %9.2f %9lu %9.1f %9.1f %9.1f %10.1f %8.4f %8.4f %8llu %6llu %6llu %7llu %6d %7d\n", name,
+           r->seconds, r->goodput, r->sdus, r->p50, r->p90, r->p99, r->max, r->service_cpu, r->bench_cpu,
+           r->retransmitted, r->t2, r->go_back_n, r->dropped, r->failed, r->corrupt);
+  }
+}
+
+static void
+print_header(void)
+{
+  if (!strcmp(format, "csv")) {
+    puts("run,streams,bytes,length,seed,service_options,seconds,goodput_mb_s,sdus,latency_p50_us,latency_p90_us,"
+         "latency_p99_us,latency_max_us,service_cpu_s_per_mb,bench_cpu_s_per_mb,retransmitted,t2_expired,go_back_n,"
+         "dropped,failed,corrupt");
+  } else if (!strcmp(format, "json")) {
+    printf("{\n  \"benchmark\": \"e2e_bench\", \"streams\": %d, \"bytes\": %llu, \"length\": %u, \"seed\": %lu, "
+           "\"service_options\": \"%s\", \"cpus\": %ld,\n  \"runs\": [\n", concurrent, bytes, length, seed, options,
+           sysconf(_SC_NPROCESSORS_ONLN));
+  } else {
+    printf("%d streams of %llu bytes, %u bytes payload, seed %lu, service options '%s', %ld CPUs\n\n", concurrent,
+           bytes, length, seed, options, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-6s %8s %9s %9s %9s %9s %9s %10s %8s %8s %8s %6s %6s %7s %6s %7s\n", "run", "time/s", "MB/s", "SDUs",
+           "p50[us]", "p90[us]", "p99[us]", "max[us]", "svc s/MB", "bch s/MB", "retrans", "T2", "gbn", "dropped",
+           "failed", "corrupt");
+  }
+}
+
+static void
+print_footer(void)
+{
+  if (!strcmp(format, "json")) {
+    puts("  ]\n}");
+  }
+}
+
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-n <bytes>] [-c <streams, at most %d>] [-l <payload length, at most %d>] [-r <runs>] "
+              "[-S <seed>] [-o table|csv|json] [-a <service options>] <service program> <listen address>",
+              STREAMS_MAX, XDT_DATA_MAX);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static char options_copy[1024];
+  char *program;
+  result r;
+  char name[16];
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "n:c:l:r:S:o:a:")) != -1) {
+    switch (opt) {
+    case 'n':
+      bytes = strtoull(optarg, 0, 10);
+      break;
+    case 'c':
+      concurrent = atoi(optarg);
+      break;
+    case 'l':
+      length = atoi(optarg);
+      break;
+    case 'r':
+      runs = atoi(optarg);
+      break;
+    case 'S':
+      seed = strtoul(optarg, 0, 10);
+      break;
+    case 'o':
+      format = optarg;
+      break;
+    case 'a':
+      options = optarg;
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 2 != argc || !bytes || concurrent < 1 || concurrent > STREAMS_MAX || !length || length > XDT_DATA_MAX
+      || runs < 1 || (strcmp(format, "table") && strcmp(format, "csv") && strcmp(format, "json"))
+      || strlen(options) >= sizeof options_copy || strchr(options, '"')) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  program = argv[optind];
+
+  if (xdt_address_parse(argv[optind + 1], &sender_addr) < 0 || sender_addr.port >= XDT_PORT_MAX) {
+    fputs("error in <listen address>\n", stderr);
+    return EXIT_FAILURE;
+  }
+  receiver_addr = sender_addr;
+  receiver_addr.port = sender_addr.port + 1;
+
+  strcpy(options_copy, options);
+  split_options(options_copy);
+  fill_pattern();
+
+  /* a consumer may be gone when its service still writes */
+  signal(SIGPIPE, SIG_IGN);
+
+  print_header();
+  for (i = 0; i < runs; ++i) {
+    snprintf(name, sizeof name, "%d", i + 1);
+    run(program, &r);
+    print_result(name, &r, i == runs - 1);
+    fflush(stdout);
+  }
+  print_footer();
+
+  return EXIT_SUCCESS;
+}
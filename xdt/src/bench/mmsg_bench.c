@@ -0,0 +1,187 @@
+/* mmsg_bench.c
+ *
+ * System calls per megabyte of batched versus single datagram I/O.
+ *
+ * Encoded DTs are sent over a loopback UDP socket pair, in rounds of
+ * <batch> datagrams: either by one sendmmsg(2) and one recvmmsg(2) per
+ * round, or by one send(2) and one recvfrom(2) per datagram, as the
+ * dispatcher did before. The number of system calls is counted by the
+ * benchmark itself. The service chooses its batch size by -b <batch>.
+ *
+ * usage: ./mmsg_bench [-m <megabytes>] [-p <payload>]
+ */
+
+#include <service/pdu.h>
+#include <service/service.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+
+static long megabytes = 64;
+
+static unsigned payload = 1024;
+
+static int tx, rx;
+
+static char streams[XDT_BATCH_MAX][PDU_STREAM_MAX];
+
+static struct iovec iov[XDT_BATCH_MAX];
+
+static struct mmsghdr msgs[XDT_BATCH_MAX];
+
+
+/* connected loopback socket pair, tx sends to rx */
+static void
+open_sockets(void)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof addr;
+  int size = 4 << 20;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if ((rx = socket(AF_INET, SOCK_DGRAM, 0)) == -1 || (tx = socket(AF_INET, SOCK_DGRAM, 0)) == -1
+      || setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &size, sizeof size) == -1
+      || bind(rx, (struct sockaddr *)&addr, sizeof addr) == -1
+      || getsockname(rx, (struct sockaddr *)&addr, &len) == -1
+      || connect(tx, (struct sockaddr *)&addr, sizeof addr) == -1) {
+    perror("opening sockets failed");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* sends and receives count datagrams of len bytes in rounds of batch, returns the number of system calls */
+static long
+run(long count, unsigned batch, int len, int batched)
+{
+  long calls = 0, done;
+  unsigned i;
+  int n;
+
+  for (done = 0; done < count; done += batch) {
+    if (batched) {
+      for (i = 0; i < batch; ++i) {
+        iov[i].iov_len = len;
+      }
+      if ((n = sendmmsg(tx, msgs, batch, 0)) != (int)batch) {
+        perror("sendmmsg");
+        exit(EXIT_FAILURE);
+      }
+      calls++;
+      for (i = 0; i < batch; ++i) {
+        iov[i].iov_len = PDU_STREAM_MAX;
+      }
+      for (i = 0; i < batch; i += n) {
+        if ((n = recvmmsg(rx, msgs + i, batch - i, 0, 0)) <= 0) {
+          perror("recvmmsg");
+          exit(EXIT_FAILURE);
+        }
+        calls++;
+      }
+    } else {
+      for (i = 0; i < batch; ++i) {
+        if (send(tx, streams[i], len, 0) != len) {
+          perror("send");
+          exit(EXIT_FAILURE);
+        }
+        calls++;
+      }
+      for (i = 0; i < batch; ++i) {
+        if (recvfrom(rx, streams[i], PDU_STREAM_MAX, 0, 0, 0) != len) {
+          perror("recvfrom");
+          exit(EXIT_FAILURE);
+        }
+        calls++;
+      }
+    }
+  }
+
+  return calls;
+}
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-m <megabytes>] [-p <payload>]");
+}
+
+int
+main(int argc, char *argv[])
+{
+  static unsigned const batches[] = { 1, 4, XDT_BATCH, XDT_BATCH_MAX };
+  static char data[XDT_DATA_MAX];
+  static XDT_pdu pdu;
+  long count, calls;
+  double start, ns, mb;
+  unsigned i, b;
+  int opt, len, batched;
+
+  while ((opt = getopt(argc, argv, "m:p:")) != -1) {
+    switch (opt) {
+    case 'm':
+      megabytes = atol(optarg);
+      break;
+    case 'p':
+      payload = (unsigned)atol(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc || megabytes < 1 || payload < 1 || payload > XDT_DATA_MAX) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  pdu.type = DT;
+  pdu.x.dt.code = DT;
+  pdu.x.dt.sequ = 2;
+  pdu.x.dt.conn = 4711;
+  pdu.x.dt.length = payload;
+  pdu.x.dt.data = data;
+  if ((len = serialize_pdu(&pdu, streams[0], PDU_STREAM_MAX)) < 0) {
+    fputs("serializing DT failed\n", stderr);
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < XDT_BATCH_MAX; ++i) {
+    memcpy(streams[i], streams[0], len);
+    iov[i].iov_base = streams[i];
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  open_sockets();
+
+  /* whole rounds for every batch size */
+  count = (megabytes * 1000000L / payload + XDT_BATCH_MAX - 1) / XDT_BATCH_MAX * XDT_BATCH_MAX;
+  mb = (double)count * payload / 1e6;
+  printf("%ld DTs with %u payload bytes (%d bytes encoded by %s)\n\n", count, payload, len, XDT_PDU_CODEC);
+  printf("%-6s %-9s %14s %10s\n", "batch", "I/O", "syscalls/MB", "MB/s");
+
+  for (b = 0; b < sizeof batches / sizeof *batches; ++b) {
+    for (batched = 0; batched <= 1; ++batched) {
+      start = now_ns();
+      calls = run(count, batches[b], len, batched);
+      ns = now_ns() - start;
+      printf("%-6u %-9s %14.1f %10.1f\n", batches[b], batched ? "mmsg" : "single", calls / mb, mb / ns * 1e9);
+    }
+  }
+
+  close(tx);
+  close(rx);
+
+  return EXIT_SUCCESS;
+}
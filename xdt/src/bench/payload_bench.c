@@ -0,0 +1,192 @@
+/* payload_bench.c
+ *
+ * Throughput of payload passed through a unix domain socket versus a shared
+ * memory payload ring.
+ *
+ * XDATrequ SDUs are sent over a unix datagram socket pair and received in
+ * the same process, one at a time. Every payload is read from an input
+ * buffer first, as the producer reads stdin, and is passed
+ *   socket: inside the SDU, as deliver_sdu_data() does; the receiver copies
+ *           it into its DT buffer, as the sender instance does,
+ *   copy:   through a payload ring, read into a buffer and copied into the
+ *           ring, copied out of the ring by the receiver (the former -m path),
+ *   ring:   through a payload ring, read right into the ring and used there
+ *           by the receiver, as the producer and sender instance do with -m.
+ *
+ * usage: ./payload_bench [-m <megabytes>]
+ */
+
+#include <xdt/sdu.h>
+#include <xdt/payload.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+static long megabytes = 256;
+
+static unsigned const payloads[] = { XDT_DATA_DEFAULT, 1024, 8000, XDT_DATA_MAX };
+
+static int tx, rx;
+
+static XDT_payload_ring writer, reader;
+
+static char input[XDT_DATA_MAX], buffer[XDT_DATA_MAX], sink[XDT_DATA_MAX];
+
+static char const *const paths[] = { "socket", "copy", "ring" };
+
+static XDT_sdu out, in;
+
+static char packed[XDT_SDU_SIZE(XDT_DATA_MAX)];
+
+
+/* receive the SDU sent, its payload stays in packed */
+static void
+receive(void)
+{
+  ssize_t n;
+
+  if ((n = read(rx, packed, sizeof packed)) == -1 || xdt_sdu_unpack(&in, packed, n) < 0) {
+    perror("passing SDU failed");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* one SDU with the payload inside */
+static void
+pass_inline(unsigned length)
+{
+  struct iovec iov[2];
+
+  memcpy(buffer, input, length);
+  out.x.dat_requ.shared = 0;
+  out.x.dat_requ.data = buffer;
+  out.x.dat_requ.length = length;
+  if (writev(tx, iov, xdt_sdu_iov(&out, iov)) == -1) {
+    perror("passing SDU failed");
+    exit(EXIT_FAILURE);
+  }
+  receive();
+  memcpy(sink, in.x.dat_requ.data, in.x.dat_requ.length);
+}
+
+/* one SDU with the payload in the ring, copy != 0 copies it on both sides */
+static void
+pass_shared(unsigned length, int copy)
+{
+  char const *data;
+  char *slot;
+
+  if (!(slot = xdt_payload_reserve(&writer, length, &out.x.dat_requ.offset))) {
+    fputs("payload ring full\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  if (copy) {
+    memcpy(buffer, input, length);
+    memcpy(slot, buffer, length);
+  } else {
+    memcpy(slot, input, length);
+  }
+  out.x.dat_requ.shared = 1;
+  out.x.dat_requ.length = length;
+  if (write(tx, &out, xdt_sdu_size(&out)) == -1) {
+    perror("passing SDU failed");
+    exit(EXIT_FAILURE);
+  }
+  receive();
+  if (!(data = xdt_payload_data(&reader, in.x.dat_requ.offset, in.x.dat_requ.length))) {
+    fputs("invalid payload range\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  if (copy) {
+    memcpy(sink, data, in.x.dat_requ.length);
+  }
+  xdt_payload_release(&reader, in.x.dat_requ.offset, in.x.dat_requ.length);
+}
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-m <megabytes>]");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int socks[2], fd, opt, path;
+  double start, ns, mb;
+  long count, n;
+  unsigned p;
+
+  while ((opt = getopt(argc, argv, "m:")) != -1) {
+    switch (opt) {
+    case 'm':
+      megabytes = atol(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc || megabytes < 1) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (socketpair(AF_UNIX, SOCK_DGRAM, 0, socks) == -1) {
+    perror("socketpair");
+    return EXIT_FAILURE;
+  }
+  tx = socks[0];
+  rx = socks[1];
+
+  /* the reader maps the ring by a descriptor of its own, as after SCM_RIGHTS */
+  xdt_payload_init(&writer);
+  xdt_payload_init(&reader);
+  if (xdt_payload_create(&writer) < 0 || (fd = dup(writer.fd)) == -1 || xdt_payload_attach(&reader, fd) < 0) {
+    perror("creating payload ring failed");
+    return EXIT_FAILURE;
+  }
+
+  memset(input, 0x5a, sizeof input);
+  memset(&out, 0, sizeof out);
+  out.type = XDATrequ;
+  out.x.dat_requ.conn = 4711;
+
+  printf("%ld MB per run, %u byte payload ring\n\n", megabytes, XDT_PAYLOAD_RING_SIZE);
+  printf("%-8s %-7s %10s %12s\n", "payload", "path", "MB/s", "ns/SDU");
+
+  for (p = 0; p < sizeof payloads / sizeof *payloads; ++p) {
+    count = megabytes * 1000000L / payloads[p];
+    mb = (double)count * payloads[p] / 1e6;
+    out.x.dat_requ.length = payloads[p];
+    for (path = 0; path < (int)(sizeof paths / sizeof *paths); ++path) {
+      start = now_ns();
+      for (n = 0; n < count; ++n) {
+        if (path) {
+          pass_shared(payloads[p], path == 1);
+        } else {
+          pass_inline(payloads[p]);
+        }
+      }
+      ns = now_ns() - start;
+      printf("%-8u %-7s %10.1f %12.1f\n", payloads[p], paths[path], mb / ns * 1e9, ns / count);
+    }
+  }
+
+  xdt_payload_detach(&reader);
+  xdt_payload_detach(&writer);
+  close(tx);
+  close(rx);
+
+  return EXIT_SUCCESS;
+}
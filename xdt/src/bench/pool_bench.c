@@ -0,0 +1,425 @@
+/* pool_bench.c
+ *
+ * Connection setup rate of two XDT services forking an instance process per
+ * connection versus pre-forked instance processes.
+ *
+ * The benchmark starts the given service program twice, as sending service
+ * on the listen address and as receiving service on the next port, once
+ * forking per connection and once with <workers> pre-forked instance processes
+ * (-P). It acts as producers and consumers of <concurrent> streams: every
+ * transfer is one XDATrequ with the payload and one carrying the end of
+ * message, a stream starts its next transfer when the producer got XDISind
+ * and the consumer the end of message. Measured are the connections per
+ * second, the setup latency from the first XDATrequ until its XDATconf
+ * (both services have set up their instance by then) and the time until
+ * both sides are done.
+ *
+ * usage: ./pool_bench [-n <transfers>] [-c <concurrent>] [-l <payload length>] [-P <workers>] <service program> <listen address>
+ */
+
+#include <xdt/address.h>
+#include <xdt/sdu.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+
+
+/** @brief Time without any SDU until the run is given up (milliseconds) */
+#define IDLE_TIMEOUT_MS 10000
+
+/** @brief Biggest number of concurrent streams */
+#define STREAMS_MAX 256
+
+
+typedef struct
+{
+  int producer; /* socket of the producer's user access point */
+  int consumer; /* socket of the consumer's user access point */
+  XDT_address source, dest;
+  double started; /* time the running transfer was started */
+  double confirmed; /* time the first XDATrequ was confirmed, 0 if not yet */
+  int produced, consumed; /* producer got XDISind, consumer the end of message */
+} stream;
+
+
+static int transfers = 2000;
+static int concurrent = 1;
+static unsigned length = 100;
+static unsigned workers = 16;
+
+static XDT_address sender_addr, receiver_addr;
+static int sap_sock = -1;
+static stream streams[STREAMS_MAX];
+
+
+static int
+compare_double(void const *a, void const *b)
+{
+  double l = *(double const *)a, r = *(double const *)b;
+
+  return (l > r) - (l < r);
+}
+
+
+/* start the service program, wait until its service access point exists */
+static pid_t
+start_service(char const *program, XDT_address const *addr, unsigned pool)
+{
+  char sap_path[sizeof ((struct sockaddr_un *)0)->sun_path];
+  char address[64], count[16];
+  struct stat st;
+  pid_t pid;
+  int i;
+
+  xdt_address_to_sap_name(addr, sap_path, sizeof sap_path);
+  remove(sap_path);
+  snprintf(address, sizeof address, "%s:%d", addr->host, addr->port);
+  snprintf(count, sizeof count, "%u", pool);
+
+  switch (pid = fork()) {
+  case -1:
+    perror("fork");
+    exit(EXIT_FAILURE);
+
+  case 0:
+    if ((i = open("/dev/null", O_WRONLY)) != -1) {
+      dup2(i, STDOUT_FILENO);
+      dup2(i, STDERR_FILENO);
+    }
+    if (pool) {
+      execl(program, program, "-P", count, address, (char *)0);
+    } else {
+      execl(program, program, address, (char *)0);
+    }
+    _exit(127);
+  }
+
+  for (i = 0; i < 200 && stat(sap_path, &st) == -1; ++i) {
+    usleep(10000);
+  }
+  if (i == 200) {
+    fprintf(stderr, "service '%s' did not come up\n", program);
+    kill(pid, SIGTERM);
+    exit(EXIT_FAILURE);
+  }
+
+  return pid;
+}
+
+static void
+stop_service(pid_t pid)
+{
+  kill(pid, SIGTERM);
+  waitpid(pid, 0, 0);
+}
+
+
+/* socket bound to the user access point of addr */
+static int
+bind_uap(XDT_address const *addr)
+{
+  struct sockaddr_un sun;
+  int sock;
+
+  memset(&sun, 0, sizeof sun);
+  sun.sun_family = AF_LOCAL;
+  xdt_address_to_uap_name(addr, sun.sun_path, sizeof sun.sun_path);
+  remove(sun.sun_path);
+  if ((sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1 || bind(sock, (struct sockaddr *)&sun, sizeof sun) == -1) {
+    perror("binding user access point failed");
+    exit(EXIT_FAILURE);
+  }
+
+  return sock;
+}
+
+static void
+unbind_uap(XDT_address const *addr, int sock)
+{
+  char path[sizeof ((struct sockaddr_un *)0)->sun_path];
+
+  close(sock);
+  xdt_address_to_uap_name(addr, path, sizeof path);
+  remove(path);
+}
+
+/* connect to the service access point of the sending service */
+static void
+connect_sap(void)
+{
+  struct sockaddr_un sun;
+
+  memset(&sun, 0, sizeof sun);
+  sun.sun_family = AF_LOCAL;
+  xdt_address_to_sap_name(&sender_addr, sun.sun_path, sizeof sun.sun_path);
+  if ((sap_sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1
+      || connect(sap_sock, (struct sockaddr *)&sun, sizeof sun) == -1) {
+    perror("connecting service access point failed");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void
+deliver(XDT_sdu * sdu)
+{
+  struct iovec iov[2];
+
+  if (writev(sap_sock, iov, xdt_sdu_iov(sdu, iov)) == -1) {
+    perror("writev");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* the payload stays in a static buffer until the next call */
+static void
+receive(int sock, XDT_sdu * sdu)
+{
+  static char packed[XDT_SDU_SIZE(XDT_DATA_MAX)];
+  ssize_t n;
+
+  if ((n = recv(sock, packed, sizeof packed, 0)) == -1) {
+    perror("recv");
+    exit(EXIT_FAILURE);
+  }
+  if (xdt_sdu_unpack(sdu, packed, n) < 0) {
+    sdu->type = 0;
+  }
+}
+
+/* first XDATrequ of a transfer, carrying the payload */
+static void
+start_transfer(stream * s)
+{
+  static char data[XDT_DATA_MAX];
+  XDT_sdu sdu;
+
+  memset(&sdu, 0, sizeof sdu);
+  sdu.type = XDATrequ;
+  sdu.x.dat_requ.sequ = 1;
+  sdu.x.dat_requ.source_addr = s->source;
+  sdu.x.dat_requ.dest_addr = s->dest;
+  sdu.x.dat_requ.max_length = XDT_DATA_DEFAULT;
+  sdu.x.dat_requ.length = length;
+  sdu.x.dat_requ.data = memset(data, 'x', length);
+
+  s->produced = s->consumed = 0;
+  s->confirmed = 0;
+  s->started = now_us();
+  deliver(&sdu);
+}
+
+/* the producer's part: end the transfer on its first XDATconf, done on XDISind */
+static void
+serve_producer(stream * s, int *failed)
+{
+  XDT_sdu sdu;
+
+  receive(s->producer, &sdu);
+
+  switch ((int)sdu.type) {
+  case XDATconf:
+    if (sdu.x.dat_conf.sequ == 1) {
+      unsigned conn = sdu.x.dat_conf.conn;
+
+      s->confirmed = now_us();
+      memset(&sdu, 0, sizeof sdu);
+      sdu.type = XDATrequ;
+      sdu.x.dat_requ.sequ = 2;
+      sdu.x.dat_requ.conn = conn;
+      sdu.x.dat_requ.eom = 1;
+      deliver(&sdu);
+    }
+    break;
+
+  case XABORTind:
+    ++*failed;
+    s->consumed = 1;
+    /* fall through */
+  case XDISind:
+    s->produced = 1;
+    break;
+  }
+}
+
+/* the consumer's part: done on the end of message */
+static void
+serve_consumer(stream * s)
+{
+  XDT_sdu sdu;
+
+  receive(s->consumer, &sdu);
+  if (sdu.type == XDATind && sdu.x.dat_ind.eom) {
+    s->consumed = 1;
+  }
+}
+
+/* run all transfers against two started services */
+static void
+run(char const *name, char const *program, unsigned pool)
+{
+  pid_t sender = start_service(program, &sender_addr, pool);
+  pid_t receiver = start_service(program, &receiver_addr, pool);
+  double *latency = malloc(transfers * sizeof *latency);
+  double *setup = malloc(transfers * sizeof *setup);
+  struct pollfd fds[2 * STREAMS_MAX];
+  int started = 0, done = 0, failed = 0, i, n;
+  double start, elapsed, sum = 0;
+
+  if (!latency || !setup) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < concurrent; ++i) {
+    stream *s = &streams[i];
+
+    s->source = sender_addr;
+    s->source.slot = i + 1;
+    s->dest = receiver_addr;
+    s->dest.slot = i + 1;
+    s->producer = bind_uap(&s->source);
+    s->consumer = bind_uap(&s->dest);
+    fds[2 * i].fd = s->producer;
+    fds[2 * i + 1].fd = s->consumer;
+    fds[2 * i].events = fds[2 * i + 1].events = POLLIN;
+  }
+  connect_sap();
+
+  start = now_us();
+  for (i = 0; i < concurrent && started < transfers; ++i, ++started) {
+    start_transfer(&streams[i]);
+  }
+
+  while (done < transfers) {
+    if ((n = poll(fds, 2 * concurrent, IDLE_TIMEOUT_MS)) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      exit(EXIT_FAILURE);
+    }
+    if (!n) {
+      fprintf(stderr, "%s: no SDU within %d ms, %d transfers done\n", name, IDLE_TIMEOUT_MS, done);
+      failed += transfers - done;
+      break;
+    }
+
+    for (i = 0; i < concurrent; ++i) {
+      stream *s = &streams[i];
+
+      if (fds[2 * i].revents & POLLIN) {
+        serve_producer(s, &failed);
+      }
+      if (fds[2 * i + 1].revents & POLLIN) {
+        serve_consumer(s);
+      }
+      if (s->produced && s->consumed && s->started > 0) {
+        setup[done] = s->confirmed > 0 ? s->confirmed - s->started : 0;
+        sum += setup[done];
+        latency[done++] = now_us() - s->started;
+        s->started = 0;
+        if (started < transfers) {
+          start_transfer(s);
+          started++;
+        }
+      }
+    }
+  }
+
+  elapsed = now_us() - start;
+
+  close(sap_sock);
+  for (i = 0; i < concurrent; ++i) {
+    unbind_uap(&streams[i].source, streams[i].producer);
+    unbind_uap(&streams[i].dest, streams[i].consumer);
+  }
+  stop_service(sender);
+  stop_service(receiver);
+
+  qsort(latency, done, sizeof *latency, compare_double);
+  qsort(setup, done, sizeof *setup, compare_double);
+  printf("%-8s %10.1f %10.1f %10.1f %10.1f %10.1f %7d\n", name, done / (elapsed / 1e6),
+         done ? sum / done : 0.0, done ? setup[done / 2] : 0.0, done ? setup[done * 99 / 100] : 0.0,
+         done ? latency[done * 99 / 100] : 0.0, failed);
+
+  free(latency);
+  free(setup);
+}
+
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-n <transfers>] [-c <concurrent, at most %d>] [-l <payload length, at most %d>] "
+              "[-P <workers>] <service program> <listen address>", STREAMS_MAX, XDT_DATA_DEFAULT);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char const *program;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c:l:P:")) != -1) {
+    switch (opt) {
+    case 'n':
+      transfers = atoi(optarg);
+      break;
+    case 'c':
+      concurrent = atoi(optarg);
+      break;
+    case 'l':
+      length = atoi(optarg);
+      break;
+    case 'P':
+      workers = atoi(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 2 != argc || transfers < 1 || concurrent < 1 || concurrent > STREAMS_MAX || length > XDT_DATA_DEFAULT
+      || !workers) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  program = argv[optind];
+
+  if (xdt_address_parse(argv[optind + 1], &sender_addr) < 0 || sender_addr.port >= XDT_PORT_MAX) {
+    fputs("error in <listen address>\n", stderr);
+    return EXIT_FAILURE;
+  }
+  receiver_addr = sender_addr;
+  receiver_addr.port = sender_addr.port + 1;
+
+  /* a consumer may be gone when its service still writes */
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("%d transfers, %d concurrent, %u bytes payload, %u pre-forked instance processes\n\n", transfers, concurrent,
+         length, workers);
+  printf("%-8s %10s %10s %10s %10s %10s %7s\n", "mode", "conns/s", "setup[us]", "p50[us]", "p99[us]", "total p99",
+         "failed");
+
+  run("fork", program, 0);
+  run("pool", program, workers);
+
+  return EXIT_SUCCESS;
+}
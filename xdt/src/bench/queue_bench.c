@@ -0,0 +1,149 @@
+/* queue_bench.c
+ *
+ * Throughput benchmark of the dispatcher-to-instance message queue.
+ *
+ * Like the dispatcher, the benchmark creates a queue, forks a consumer process
+ * and writes messages into the queue, which the consumer reads one by one.
+ * Measured is the time until the consumer got all messages, for small
+ * (ABO PDU) and full size (DT PDU with XDT_DATA_DEFAULT payload bytes) messages. The queue implementation is
+ * chosen at configure time (--enable-shm-queue), so build the package both
+ * ways to compare them.
+ *
+ * usage: ./queue_bench [-n <messages>]
+ */
+
+#include <service/queue.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+
+static long messages = 1000000;
+
+/* a packed message: a PDU with up to the default payload size behind its header */
+typedef union
+{
+  XDT_pdu pdu;
+  char buf[PDU_SIZE(XDT_DATA_DEFAULT)];
+} packed_pdu;
+
+
+/* reads all messages, checks their order */
+static int
+consume(XDT_queue * queue, size_t size)
+{
+  packed_pdu msg;
+  long i;
+  int bytes;
+
+  for (i = 0; i < messages; ++i) {
+    while ((bytes = xdt_queue_read(queue, &msg, sizeof msg, 0)) < 0 && errno == EINTR);
+    if (bytes != (int)size) {
+      perror("xdt_queue_read");
+      return EXIT_FAILURE;
+    }
+    if (msg.pdu.x.abo.conn != (unsigned)i) {
+      fprintf(stderr, "message %ld out of order\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int
+run(char const *name, size_t size)
+{
+  XDT_queue queue;
+  packed_pdu msg;
+  double start, elapsed;
+  pid_t pid;
+  long i;
+  int status;
+
+  if (xdt_queue_create(&queue) < 0) {
+    perror("xdt_queue_create");
+    return -1;
+  }
+
+  fflush(stdout);
+  switch (pid = fork()) {
+  case -1:
+    perror("fork");
+    xdt_queue_delete(&queue);
+    return -2;
+
+  case 0:
+    exit(consume(&queue, size));
+  }
+
+  memset(&msg, 0, sizeof msg);
+  msg.pdu.type = size > sizeof (long) + sizeof (XDT_abo) ? DT : ABO;
+
+  start = now_s();
+  for (i = 0; i < messages; ++i) {
+    msg.pdu.x.abo.conn = i;
+    if (xdt_queue_write(&queue, &msg, size) < 0) {
+      perror("xdt_queue_write");
+      kill(pid, SIGKILL);
+      break;
+    }
+  }
+  if (waitpid(pid, &status, 0) == -1) {
+    perror("waitpid");
+  }
+  elapsed = now_s() - start;
+  xdt_queue_delete(&queue);
+
+  if (i < messages || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+    return -3;
+  }
+
+  printf("%-24s %-6s %4u bytes %10.0f msgs/s %8.1f ns/msg\n", XDT_QUEUE_BACKEND, name, (unsigned)size,
+         messages / elapsed, elapsed * 1e9 / messages);
+
+  return 0;
+}
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-n <messages>]");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+    case 'n':
+      messages = atol(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc || messages < 1) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (run("small", sizeof (long) + sizeof (XDT_abo)) < 0 || run("full", PDU_SIZE(XDT_DATA_DEFAULT)) < 0) {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,403 @@
+/* shard_bench.c
+ *
+ * PDU throughput of the XDT service versus its number of dispatcher shards.
+ *
+ * The benchmark starts the given service program in single-process mode with
+ * 1, 2, 4, ... up to <max shards> shards (-s -n). It acts as <streams> sending
+ * peers, each with a UDP socket of its own on the ports following the listen
+ * address, and as their consumers: every stream transfers <DTs> DTs over one
+ * connection, keeping up to <window> DTs unacknowledged and repeating them
+ * from the oldest on timeout. Measured are the acknowledged DTs per second.
+ * The shards only help with at least as many cores as shards plus the load
+ * the benchmark itself needs.
+ *
+ * usage: ./shard_bench [-n <DTs>] [-c <streams>] [-w <window>] [-l <payload length>] [-S <max shards>] <service program> <listen address>
+ */
+
+#include <service/pdu.h>
+#include <service/shard.h>
+
+#include <xdt/address.h>
+#include <xdt/sdu.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+
+/** @brief Time without acknowledgement progress until the window is repeated (microseconds) */
+#define RETRY_TIMEOUT_US 100000
+
+/** @brief Number of repetitions without progress until a stream is given up */
+#define RETRY_MAX 50
+
+/** @brief Biggest number of streams */
+#define STREAMS_MAX 256
+
+
+typedef struct
+{
+  int peer; /* UDP socket of the sending peer */
+  int consumer; /* socket of the consumer's user access point */
+  XDT_address source, dest;
+  unsigned conn; /* connection number assigned by the service */
+  unsigned base; /* oldest unacknowledged DT */
+  unsigned next; /* next DT to send */
+  double progress; /* time of the last acknowledgement progress */
+  int tries; /* repetitions without progress */
+  int done;
+} stream;
+
+
+static int dts = 2000;
+static int concurrent = 16;
+static unsigned window = 8;
+static unsigned length = XDT_DATA_DEFAULT;
+static unsigned max_shards = 4;
+
+static XDT_address service_addr;
+static struct sockaddr_in service_sin;
+static stream streams[STREAMS_MAX];
+
+
+
+/* start the service program, wait until its service access point exists */
+static pid_t
+start_service(char const *program, unsigned shards)
+{
+  char sap_path[sizeof ((struct sockaddr_un *)0)->sun_path];
+  char address[64], count[16];
+  struct stat st;
+  pid_t pid;
+  int i;
+
+  xdt_address_to_sap_name(&service_addr, sap_path, sizeof sap_path);
+  remove(sap_path);
+  snprintf(address, sizeof address, "%s:%d", service_addr.host, service_addr.port);
+  snprintf(count, sizeof count, "%u", shards);
+
+  switch (pid = fork()) {
+  case -1:
+    perror("fork");
+    exit(EXIT_FAILURE);
+
+  case 0:
+    if ((i = open("/dev/null", O_WRONLY)) != -1) {
+      dup2(i, STDOUT_FILENO);
+      dup2(i, STDERR_FILENO);
+    }
+    execl(program, program, "-s", "-n", count, address, (char *)0);
+    _exit(127);
+  }
+
+  for (i = 0; i < 200 && stat(sap_path, &st) == -1; ++i) {
+    usleep(10000);
+  }
+  if (i == 200) {
+    fprintf(stderr, "service '%s' did not come up\n", program);
+    kill(pid, SIGTERM);
+    exit(EXIT_FAILURE);
+  }
+
+  return pid;
+}
+
+static void
+stop_service(pid_t pid)
+{
+  kill(pid, SIGTERM);
+  waitpid(pid, 0, 0);
+}
+
+
+/* the sending peer's socket on the port of its XDT address */
+static int
+bind_peer(XDT_address const *addr)
+{
+  struct sockaddr_in sin = service_sin;
+  int sock;
+
+  sin.sin_port = htons(addr->port);
+  if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1 || bind(sock, (struct sockaddr *)&sin, sizeof sin) == -1) {
+    perror("binding peer socket failed");
+    exit(EXIT_FAILURE);
+  }
+
+  return sock;
+}
+
+/* socket bound to the user access point of addr */
+static int
+bind_uap(XDT_address const *addr)
+{
+  struct sockaddr_un sun;
+  int sock;
+
+  memset(&sun, 0, sizeof sun);
+  sun.sun_family = AF_LOCAL;
+  xdt_address_to_uap_name(addr, sun.sun_path, sizeof sun.sun_path);
+  remove(sun.sun_path);
+  if ((sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1 || bind(sock, (struct sockaddr *)&sun, sizeof sun) == -1) {
+    perror("binding user access point failed");
+    exit(EXIT_FAILURE);
+  }
+
+  return sock;
+}
+
+static void
+unbind_uap(XDT_address const *addr, int sock)
+{
+  char path[sizeof ((struct sockaddr_un *)0)->sun_path];
+
+  close(sock);
+  xdt_address_to_uap_name(addr, path, sizeof path);
+  remove(path);
+}
+
+
+/* send DT sequ of a stream */
+static void
+send_dt(stream * s, unsigned sequ)
+{
+  static char data[XDT_DATA_MAX];
+  static XDT_pdu dt;
+  char out[PDU_STREAM_MAX];
+  int len;
+
+  if (!dt.type) {
+    dt.type = DT;
+    dt.x.dt.code = DT;
+    dt.x.dt.max_length = length < XDT_DATA_DEFAULT ? XDT_DATA_DEFAULT : length;
+    dt.x.dt.length = length;
+    dt.x.dt.data = memset(data, 'x', length);
+  }
+  dt.x.dt.source_addr = s->source;
+  dt.x.dt.dest_addr = s->dest;
+  dt.x.dt.conn = s->conn;
+  dt.x.dt.sequ = sequ;
+  dt.x.dt.eom = sequ == (unsigned)dts;
+
+  if ((len = serialize_pdu(&dt, out, sizeof out)) < 0) {
+    fputs("serializing PDU failed\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  if (sendto(s->peer, out, len, 0, (struct sockaddr *)&service_sin, sizeof service_sin) == -1 && errno != EAGAIN) {
+    perror("sendto");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* send DTs up to the window, the first DT alone until its ACK tells the connection number */
+static void
+fill_window(stream * s)
+{
+  unsigned limit = s->base == 1 ? 1 : s->base + window - 1;
+
+  while (s->next <= limit && s->next <= (unsigned)dts) {
+    send_dt(s, s->next++);
+  }
+}
+
+/* take the ACKs of a stream, returns the number of newly acknowledged DTs */
+static unsigned
+serve_peer(stream * s)
+{
+  char in[PDU_STREAM_MAX];
+  unsigned acked = 0;
+  XDT_pdu ack;
+  ssize_t n;
+
+  while ((n = recv(s->peer, in, sizeof in, MSG_DONTWAIT)) > 0) {
+    if (deserialize_pdu(in, n, &ack) <= 0 || ack.type != ACK || ack.x.ack.sequ < s->base) {
+      continue;
+    }
+    if (s->base == 1) {
+      s->conn = ack.x.ack.conn;
+    }
+    acked += ack.x.ack.sequ + 1 - s->base;
+    s->base = ack.x.ack.sequ + 1;
+    s->progress = now_us();
+    s->tries = 0;
+  }
+
+  if (s->base > (unsigned)dts) {
+    s->done = 1;
+  } else {
+    fill_window(s);
+  }
+
+  return acked;
+}
+
+/* throw away everything the receiver instances delivered to the consumer */
+static void
+drain_consumer(stream * s)
+{
+  static char packed[XDT_SDU_SIZE(XDT_DATA_MAX)];
+
+  while (recv(s->consumer, packed, sizeof packed, MSG_DONTWAIT) > 0);
+}
+
+/* run all streams against a service with the given number of shards */
+static void
+run(char const *program, unsigned shards)
+{
+  pid_t pid = start_service(program, shards);
+  struct pollfd fds[2 * STREAMS_MAX];
+  unsigned long acked = 0;
+  int done = 0, failed = 0, retries = 0, i;
+  double start, elapsed, now;
+
+  for (i = 0; i < concurrent; ++i) {
+    stream *s = &streams[i];
+
+    memset(s, 0, sizeof *s);
+    s->source = service_addr;
+    s->source.port = service_addr.port + 1 + i;
+    s->source.slot = 1;
+    s->dest = service_addr;
+    s->dest.slot = i + 1;
+    s->peer = bind_peer(&s->source);
+    s->consumer = bind_uap(&s->dest);
+    s->base = s->next = 1;
+    fds[2 * i].fd = s->peer;
+    fds[2 * i + 1].fd = s->consumer;
+    fds[2 * i].events = fds[2 * i + 1].events = POLLIN;
+  }
+
+  start = now_us();
+  for (i = 0; i < concurrent; ++i) {
+    streams[i].progress = start;
+    fill_window(&streams[i]);
+  }
+
+  while (done < concurrent) {
+    if (poll(fds, 2 * concurrent, RETRY_TIMEOUT_US / 1000) == -1 && errno != EINTR) {
+      perror("poll");
+      exit(EXIT_FAILURE);
+    }
+
+    now = now_us();
+    for (i = 0; i < concurrent; ++i) {
+      stream *s = &streams[i];
+
+      if (fds[2 * i + 1].revents & POLLIN) {
+        drain_consumer(s);
+      }
+      if (s->done) {
+        continue;
+      }
+      if (fds[2 * i].revents & POLLIN) {
+        acked += serve_peer(s);
+        if (s->done) {
+          ++done;
+          continue;
+        }
+      }
+      if (now - s->progress > RETRY_TIMEOUT_US) {
+        /* repeat the window from the oldest unacknowledged DT */
+        if (++s->tries > RETRY_MAX) {
+          s->done = 1;
+          ++failed;
+          ++done;
+          continue;
+        }
+        ++retries;
+        s->progress = now;
+        s->next = s->base;
+        fill_window(s);
+      }
+    }
+  }
+
+  elapsed = now_us() - start;
+
+  for (i = 0; i < concurrent; ++i) {
+    close(streams[i].peer);
+    unbind_uap(&streams[i].dest, streams[i].consumer);
+  }
+  stop_service(pid);
+
+  printf("%-8u %12.1f %10.2f %8d %7d\n", shards, acked / (elapsed / 1e6),
+         acked * (double)length / elapsed, retries, failed);
+}
+
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-n <DTs, at least 2>] [-c <streams, at most %d>] [-w <window>] [-l <payload length>] "
+              "[-S <max shards, at most %u>] <service program> <listen address>", STREAMS_MAX, XDT_SHARDS_MAX);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char const *program;
+  unsigned shards;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c:w:l:S:")) != -1) {
+    switch (opt) {
+    case 'n':
+      dts = atoi(optarg);
+      break;
+    case 'c':
+      concurrent = atoi(optarg);
+      break;
+    case 'w':
+      window = atoi(optarg);
+      break;
+    case 'l':
+      length = atoi(optarg);
+      break;
+    case 'S':
+      max_shards = atoi(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 2 != argc || dts < 2 || concurrent < 1 || concurrent > STREAMS_MAX || !window
+      || length > XDT_DATA_MAX || !max_shards || max_shards > XDT_SHARDS_MAX) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  program = argv[optind];
+
+  if (xdt_address_parse(argv[optind + 1], &service_addr) < 0 || service_addr.port + concurrent > XDT_PORT_MAX) {
+    fputs("error in <listen address>, the streams need the following ports\n", stderr);
+    return EXIT_FAILURE;
+  }
+  memset(&service_sin, 0, sizeof service_sin);
+  service_sin.sin_family = AF_INET;
+  service_sin.sin_port = htons(service_addr.port);
+  inet_pton(AF_INET, service_addr.host, &service_sin.sin_addr);
+
+  printf("%d streams of %d DTs, window %u, %u bytes payload, %ld CPUs\n\n", concurrent, dts, window, length,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-8s %12s %10s %8s %7s\n", "shards", "DTs/s", "MB/s", "retries", "failed");
+
+  for (shards = 1; shards <= max_shards; shards *= 2) {
+    run(program, shards);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+/* wheel_bench.c
+ *
+ * Cost of arming and disarming protocol timers.
+ *
+ * <timers> timers are armed with random timeouts in the timer wheel of the
+ * service, then each one is re-armed and disarmed repeatedly, as the sender
+ * does on every ACK. For comparison, a POSIX timer (timer_create(2)) is
+ * re-armed and disarmed by timer_settime(2), as the service did before.
+ * Finally the time to find the next expiration and to expire all timers
+ * is measured.
+ *
+ * usage: ./wheel_bench [-t <timers>] [-n <rounds>]
+ */
+
+#include <service/wheel.h>
+
+#include "bench.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include <unistd.h>
+
+
+static long timers = 10000;
+
+static long rounds = 1000000;
+
+
+static void
+wheel(void)
+{
+  static XDT_wheel w;
+  XDT_wheel_timer *t;
+  double start, base, next;
+  long i, expired = 0;
+
+  if (!(t = calloc(timers, sizeof *t))) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+
+  base = now_s();
+  xdt_wheel_init(&w, base);
+  for (i = 0; i < timers; ++i) {
+    xdt_wheel_add(&w, &t[i], base + 0.01 + (rand() % 10000) / 1000.0);
+  }
+
+  start = now_s();
+  for (i = 0; i < rounds; ++i) {
+    XDT_wheel_timer *e = &t[i % timers];
+
+    xdt_wheel_remove(&w, e);
+    xdt_wheel_add(&w, e, base + 0.2 + (i & 1023) / 1000.0);
+  }
+  printf("%-34s %10.1f ns\n", "wheel reset + set", (now_s() - start) / rounds * 1e9);
+
+  start = now_s();
+  for (i = 0; i < 1000; ++i) {
+    next = xdt_wheel_next(&w);
+  }
+  printf("%-34s %10.1f ns (in %.3f s)\n", "wheel next expiration", (now_s() - start) / 1000 * 1e9, next - base);
+
+  start = now_s();
+  while (xdt_wheel_expire(&w, base + 20)) {
+    expired++;
+  }
+  printf("%-34s %10.1f ns per timer (%ld)\n", "wheel expire all", (now_s() - start) / expired * 1e9, expired);
+
+  free(t);
+}
+
+static void
+posix_timer(void)
+{
+  struct sigevent sev;
+  struct itimerspec on, off;
+  timer_t id;
+  double start;
+  long i;
+
+  memset(&sev, 0, sizeof sev);
+  sev.sigev_notify = SIGEV_NONE;
+  if (timer_create(CLOCK_MONOTONIC, &sev, &id) == -1) {
+    perror("timer_create");
+    exit(EXIT_FAILURE);
+  }
+  memset(&on, 0, sizeof on);
+  memset(&off, 0, sizeof off);
+  on.it_value.tv_sec = 10;
+
+  start = now_s();
+  for (i = 0; i < rounds; ++i) {
+    timer_settime(id, 0, &off, 0);
+    timer_settime(id, 0, &on, 0);
+  }
+  printf("%-34s %10.1f ns\n", "timer_settime reset + set", (now_s() - start) / rounds * 1e9);
+
+  timer_delete(id);
+}
+
+/* print the usage to stderr */
+static void
+print_usage(char const *cmd)
+{
+  bench_usage(cmd, "[-t <timers>] [-n <rounds>]");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+    switch (opt) {
+    case 't':
+      timers = atol(optarg);
+      break;
+    case 'n':
+      rounds = atol(optarg);
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc || timers < 1 || rounds < 1) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  printf("%ld armed timers, %ld rounds\n\n", timers, rounds);
+  wheel();
+  posix_timer();
+
+  return EXIT_SUCCESS;
+}
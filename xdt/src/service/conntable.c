@@ -0,0 +1,497 @@
+/**
+ * @file conntable.c
+ * @ingroup service
+ * @brief Connection table of the dispatcher
+ *
+ * The dispatcher has to find the instance of a connection for every
+ * message received, by different keys depending on the message type.
+ * All keys are indexed by chained hash tables sharing one bucket count,
+ * which is doubled whenever there are more instances than buckets.
+ */
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+#include "conntable.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+
+/** @brief Number of instances allocated at once */
+#define CHUNK_SIZE 256
+
+/** @brief Initial number of buckets per index (power of two) */
+#define INITIAL_BUCKETS 64
+
+
+/**
+ * @brief Returns the instance stored in a slot
+ *
+ * @param table points to the connection table
+ * @param slot slot number
+ */
+#define SLOT(table, slot) (&(table)->chunks[(slot) / CHUNK_SIZE][(slot) % CHUNK_SIZE])
+
+
+/**
+ * @brief Scrambles an integer key
+ *
+ * @param v key
+ * @param h hash value to combine the key with
+ *
+ * @return hash value
+ */
+static unsigned
+hash_uint(unsigned v, unsigned h)
+{
+  h = (h ^ v) * 2654435761u;
+  return h ^ (h >> 16);
+}
+
+/**
+ * @brief FNV-1a hash of a byte sequence
+ *
+ * @param p points to the bytes
+ * @param len number of bytes
+ * @param h hash value to combine the bytes with
+ *
+ * @return hash value
+ */
+static unsigned
+hash_bytes(void const *p, size_t len, unsigned h)
+{
+  unsigned char const *b = p;
+
+  while (len--) {
+    h = (h ^ *b++) * 16777619u;
+  }
+  return h;
+}
+
+/** @brief Hash value of a producer and consumer address pair */
+static unsigned
+hash_addresses(XDT_address const *src, XDT_address const *dst)
+{
+  return hash_bytes(dst, sizeof *dst, hash_bytes(src, sizeof *src, 2166136261u));
+}
+
+/** @brief Hash value of a connection number and peer socket address */
+static unsigned
+hash_socket(unsigned conn, struct sockaddr_in const *addr)
+{
+  return hash_uint(addr->sin_addr.s_addr, hash_uint(addr->sin_port, hash_uint(conn, 0)));
+}
+
+
+/**
+ * @brief Inserts an instance into an index
+ *
+ * @param table points to the connection table
+ * @param inst points to the instance
+ * @param index one of the index identifiers, e.g. ::CONN_BY_REAL
+ * @param hash hash value of the instance's key
+ */
+static void
+link_index(XDT_conntable * table, XDT_instance * inst, int index, unsigned hash)
+{
+  unsigned *head = &table->buckets[index][hash & table->mask];
+
+  inst->hash[index] = hash;
+  inst->next[index] = *head;
+  *head = inst->slot + 1;
+  inst->linked |= 1u << index;
+}
+
+/**
+ * @brief Removes an instance from all indexes
+ *
+ * @param table points to the connection table
+ * @param inst points to the instance
+ */
+static void
+unlink_all(XDT_conntable * table, XDT_instance * inst)
+{
+  int index;
+
+  for (index = 0; index < CONN_INDEXES; ++index) {
+    unsigned *link;
+
+    if (!(inst->linked & (1u << index))) {
+      continue;
+    }
+    link = &table->buckets[index][inst->hash[index] & table->mask];
+    while (*link && *link != inst->slot + 1) {
+      link = &SLOT(table, *link - 1)->next[index];
+    }
+    if (*link) {
+      *link = inst->next[index];
+    }
+  }
+  inst->linked = 0;
+}
+
+/**
+ * @brief Doubles the number of buckets of all indexes
+ *
+ * @param table points to the connection table
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+static int
+grow_buckets(XDT_conntable * table)
+{
+  unsigned count = 2 * (table->mask + 1);
+  unsigned *buckets[CONN_INDEXES];
+  unsigned slot;
+  int index;
+
+  for (index = 0; index < CONN_INDEXES; ++index) {
+    if (!(buckets[index] = calloc(count, sizeof *buckets[index]))) {
+      while (index--) {
+        free(buckets[index]);
+      }
+      return -1;
+    }
+  }
+  for (index = 0; index < CONN_INDEXES; ++index) {
+    free(table->buckets[index]);
+    table->buckets[index] = buckets[index];
+  }
+  table->mask = count - 1;
+
+  /* relink all instances with their stored hash values */
+  for (slot = 0; slot < table->fresh; ++slot) {
+    XDT_instance *inst = SLOT(table, slot);
+    unsigned linked = inst->linked;
+
+    for (index = 0; index < CONN_INDEXES; ++index) {
+      if (linked & (1u << index)) {
+        link_index(table, inst, index, inst->hash[index]);
+      }
+    }
+  }
+
+  return 0;
+}
+
+
+/*** PUBLIC *************************************************************/
+
+
+/**
+ * @brief Creates an empty connection table
+ *
+ * @param table points to a connection table object
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+int
+xdt_conntable_create(XDT_conntable * table)
+{
+  int index;
+
+  if (!table) {
+    errno = EINVAL;
+    return -2;
+  }
+
+  memset(table, 0, sizeof *table);
+  table->mask = INITIAL_BUCKETS - 1;
+  for (index = 0; index < CONN_INDEXES; ++index) {
+    if (!(table->buckets[index] = calloc(INITIAL_BUCKETS, sizeof *table->buckets[index]))) {
+      xdt_conntable_delete(table);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Releases all memory of a connection table
+ *
+ * @param table points to the connection table
+ */
+void
+xdt_conntable_delete(XDT_conntable * table)
+{
+  unsigned i;
+  int index;
+
+  for (i = 0; i < table->chunk_count; ++i) {
+    free(table->chunks[i]);
+  }
+  free(table->chunks);
+  for (index = 0; index < CONN_INDEXES; ++index) {
+    free(table->buckets[index]);
+  }
+  memset(table, 0, sizeof *table);
+}
+
+/**
+ * @brief Allocates an instance in the connection table
+ *
+ * The instance is not linked into any index and its role is set to
+ * ::XDT_SERVICE_NA.
+ *
+ * @param table points to the connection table
+ *
+ * @return pointer to the new instance, @e null if out of memory
+ */
+XDT_instance *
+xdt_conntable_alloc(XDT_conntable * table)
+{
+  XDT_instance *inst;
+  unsigned slot;
+
+  if (table->used >= table->mask + 1 && grow_buckets(table) < 0) {
+    return 0;
+  }
+
+  if (table->free_slots) {
+    /* reuse released slot */
+    slot = table->free_slots - 1;
+    table->free_slots = SLOT(table, slot)->next[0];
+
+  } else {
+    if (table->fresh == table->size) {
+      /* all chunks are used up */
+      XDT_instance **chunks = realloc(table->chunks, (table->chunk_count + 1) * sizeof *chunks);
+
+      if (!chunks) {
+        return 0;
+      }
+      table->chunks = chunks;
+      if (!(chunks[table->chunk_count] = calloc(CHUNK_SIZE, sizeof **chunks))) {
+        return 0;
+      }
+      ++table->chunk_count;
+      table->size += CHUNK_SIZE;
+    }
+    slot = table->fresh++;
+  }
+
+  inst = SLOT(table, slot);
+  memset(inst, 0, sizeof *inst);
+  inst->role = XDT_SERVICE_NA;
+  inst->slot = slot;
+  ++table->used;
+
+  return inst;
+}
+
+/**
+ * @brief Releases an instance
+ *
+ * The instance is removed from all indexes and its slot is reused 
+ * by the next xdt_conntable_alloc() call.
+ *
+ * @param table points to the connection table
+ * @param inst points to the instance allocated by xdt_conntable_alloc()
+ */
+void
+xdt_conntable_free(XDT_conntable * table, XDT_instance * inst)
+{
+  unlink_all(table, inst);
+  inst->role = XDT_SERVICE_NA;
+  inst->next[0] = table->free_slots;
+  table->free_slots = inst->slot + 1;
+  --table->used;
+}
+
+/**
+ * @brief (Re-)indexes an instance
+ *
+ * Has to be called whenever a key member of the instance has changed.
+ * Receivers are indexed by their connection number, senders by their 
+ * mapped connection number, their producer and consumer addresses and, 
+ * as soon as the socket address of the receiving peer is known, by this 
+ * address and the connection number. Instances with a process id are
+ * indexed by it.
+ *
+ * @param table points to the connection table
+ * @param inst points to the instance
+ *
+ * @return 0 on success
+ */
+int
+xdt_conntable_link(XDT_conntable * table, XDT_instance * inst)
+{
+  unlink_all(table, inst);
+
+  if (inst->role == XDT_SERVICE_RECEIVER) {
+    link_index(table, inst, CONN_BY_REAL, hash_uint(inst->real_conn, 0));
+
+  } else if (inst->role == XDT_SERVICE_SENDER) {
+    link_index(table, inst, CONN_BY_MAPPED, hash_uint(inst->mapped_conn, 0));
+    link_index(table, inst, CONN_BY_ADDRESSES, hash_addresses(&inst->producer, &inst->consumer));
+    if (inst->receiver_len) {
+      link_index(table, inst, CONN_BY_SOCKET, hash_socket(inst->real_conn, &inst->receiver));
+    }
+  }
+
+  if (inst->pid > 0) {
+    link_index(table, inst, CONN_BY_PID, hash_uint(inst->pid, 0));
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Iterates over all instances in use
+ *
+ * Releasing the instance @a inst during the iteration is allowed.
+ *
+ * @param table points to the connection table
+ * @param inst the instance returned by the last call, @e null to start the iteration
+ *
+ * @return pointer to the next instance with a role other than ::XDT_SERVICE_NA, 
+ *         @e null if there are no more instances
+ */
+XDT_instance *
+xdt_conntable_next(XDT_conntable * table, XDT_instance * inst)
+{
+  unsigned slot;
+
+  for (slot = inst ? inst->slot + 1 : 0; slot < table->fresh; ++slot) {
+    if (SLOT(table, slot)->role != XDT_SERVICE_NA) {
+      return SLOT(table, slot);
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief Searches for a receiver instance by it's connection number
+ *
+ * @param table points to the connection table
+ * @param conn connection number
+ *
+ * @return pointer to the receiver instance with connection number @a conn, else @e null
+ */
+XDT_instance *
+xdt_conntable_by_real_conn(XDT_conntable * table, unsigned conn)
+{
+  unsigned s;
+
+  for (s = table->buckets[CONN_BY_REAL][hash_uint(conn, 0) & table->mask]; s; s = SLOT(table, s - 1)->next[CONN_BY_REAL]) {
+    XDT_instance *inst = SLOT(table, s - 1);
+
+    if (inst->role == XDT_SERVICE_RECEIVER && inst->real_conn == conn) {
+      return inst;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Searches for a sender instance by it's mapped connection number
+ *
+ * @param table points to the connection table
+ * @param conn mapped connection number
+ *
+ * @return pointer to the sender instance with mapped connection number @a conn, else @e null
+ */
+XDT_instance *
+xdt_conntable_by_mapped_conn(XDT_conntable * table, unsigned conn)
+{
+  unsigned s;
+
+  for (s = table->buckets[CONN_BY_MAPPED][hash_uint(conn, 0) & table->mask]; s; s = SLOT(table, s - 1)->next[CONN_BY_MAPPED]) {
+    XDT_instance *inst = SLOT(table, s - 1);
+
+    if (inst->role == XDT_SERVICE_SENDER && inst->mapped_conn == conn) {
+      return inst;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Searches for a sender instance by it's endpoint addresses
+ *
+ * @param table points to the connection table
+ * @param src source address
+ * @param dst destination address
+ *
+ * @return pointer to the sender instance with matching addresses, else @e null
+ */
+XDT_instance *
+xdt_conntable_by_xdt_addresses(XDT_conntable * table, XDT_address const *src, XDT_address const *dst)
+{
+  unsigned s;
+
+  for (s = table->buckets[CONN_BY_ADDRESSES][hash_addresses(src, dst) & table->mask]; s; s = SLOT(table, s - 1)->next[CONN_BY_ADDRESSES]) {
+    XDT_instance *inst = SLOT(table, s - 1);
+
+    if (inst->role == XDT_SERVICE_SENDER && XDT_ADDRESS_EQUAL(*src, inst->producer) && XDT_ADDRESS_EQUAL(*dst, inst->consumer)) {
+      return inst;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Searches for a sender instance by it's connection number 
+ *        and send address of it's receiving peer
+ *
+ * @param table points to the connection table
+ * @param conn connection number
+ * @param addr socket address of the sending peer
+ * @param addr_len size of the address @a addr
+ *
+ * @return pointer to the sender instance, else @e null
+ */
+XDT_instance *
+xdt_conntable_by_socket_address(XDT_conntable * table, unsigned conn, struct sockaddr_in const *addr, socklen_t addr_len)
+{
+  unsigned s;
+
+  for (s = table->buckets[CONN_BY_SOCKET][hash_socket(conn, addr) & table->mask]; s; s = SLOT(table, s - 1)->next[CONN_BY_SOCKET]) {
+    XDT_instance *inst = SLOT(table, s - 1);
+
+    if (inst->role == XDT_SERVICE_SENDER && inst->real_conn == conn && inst->receiver_len == addr_len && !memcmp(&inst->receiver, addr, addr_len)) {
+      return inst;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Searches for an instance by it's process id
+ *
+ * @param table points to the connection table
+ * @param pid process id
+ *
+ * @return pointer to the instance, else @e null
+ */
+XDT_instance *
+xdt_conntable_by_pid(XDT_conntable * table, pid_t pid)
+{
+  unsigned s;
+
+  for (s = table->buckets[CONN_BY_PID][hash_uint(pid, 0) & table->mask]; s; s = SLOT(table, s - 1)->next[CONN_BY_PID]) {
+    XDT_instance *inst = SLOT(table, s - 1);
+
+    if (inst->role != XDT_SERVICE_NA && inst->pid == pid) {
+      return inst;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @}
+ */
@@ -0,0 +1,163 @@
+/**
+ * @file conntable.h
+ * @ingroup service
+ * @brief Instance context data and the dispatcher's connection table
+ */
+
+#ifndef CONNTABLE_H
+#define CONNTABLE_H
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+
+#include "service.h"
+#include "queue.h"
+#include "sender.h"
+#include "receiver.h"
+#include "wheel.h"
+#include "tunnel.h"
+
+#include <xdt/payload.h>
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+
+/** @brief Number of maximum timers per instance */
+#define MAX_INSTANCE_TIMERS 3
+
+struct xdt_instance;
+
+/**
+ * @brief Timer of an instance, armed in the timer wheel of the serving process
+ *
+ * Setting and resetting only changes @a expires. The wheel entry is moved when
+ * the timer has to expire earlier than it is armed, else it is checked against
+ * @a expires when it fires and armed again for a postponed deadline.
+ */
+typedef struct
+{
+  XDT_wheel_timer entry; /**< wheel entry, must be the first member */
+  XDT_timer *timer; /**< timer object owned by the protocol instance, @e null if slot is unused */
+  struct xdt_instance *inst; /**< instance owning the timer */
+  double expires; /**< absolute expiration time (see monotonic_time()), 0 if disarmed */
+  double armed; /**< absolute expiration time the wheel entry is armed with */
+} XDT_soft_timer;
+
+/**
+ * @brief Indexes of the connection table
+ *
+ * Which indexes an instance is linked into depends on its role and the
+ * state of the connection, see xdt_conntable_link().
+ */
+enum
+{
+  CONN_BY_REAL, /**< receiver instances by connection number */
+  CONN_BY_MAPPED, /**< sender instances by mapped connection number */
+  CONN_BY_ADDRESSES, /**< sender instances by producer and consumer address */
+  CONN_BY_SOCKET, /**< sender instances by connection number and socket address of the receiving peer */
+  CONN_BY_PID, /**< instances by process id (not in single-process mode) */
+  CONN_INDEXES /**< number of indexes */
+};
+
+/** @brief Instance context data */
+typedef struct xdt_instance
+{
+  int role; /**< type of instance (sender, receiver or none) */
+  pid_t pid; /**< process id of this instance */
+
+  unsigned real_conn; /**< data transfer connection number assigned by the receiver */
+  unsigned mapped_conn; /**< mapped local connection number (maybe different from @a real_conn in sender instance) */
+
+  XDT_address producer; /**< source address (only needed for sender instance) */
+  XDT_address consumer; /**< destination address (only needed for sender instance) */
+
+  int user_sock; /**< unix domain socket for communication with associated user */
+  int peer_sock; /**< UDP socket for communication with associated peer, the tunnel's socket if @a tunnel is set */
+  XDT_tunnel *tunnel; /**< tunnel to the peer service, @e null if the instance has a socket of its own */
+  struct sockaddr_in receiver;  /**< sending socket address of receiving peer (only needed for sender instance) */
+  socklen_t receiver_len; /**< size of the @a receiver address */
+
+  XDT_queue queue; /**< message queue beween dispatcher and the service instance */
+  XDT_queue_stats queue_stats; /**< statistics of @a queue */
+  struct xdt_backlog *backlog; /**< messages held back while @a queue was full, oldest first (dispatcher only) */
+  struct xdt_backlog *backlog_last; /**< newest message in @a backlog */
+  unsigned backlog_len; /**< number of messages in @a backlog */
+  struct xdt_instance *backlogged_next; /**< next instance with a backlog */
+  int timer_fd; /**< timerfd armed by the instance process and watched by the dispatcher, -1 in single-process mode or if pooled */
+  int event_fd; /**< eventfd counting the messages written to @a queue (see XDT_config.direct), else -1 */
+  unsigned pending; /**< messages counted by @a event_fd and not read yet (instance process only) */
+  struct sockaddr_in peer_to; /**< where PDUs go while @a peer_sock is not connected (see XDT_config.direct) */
+  socklen_t peer_to_len; /**< size of @a peer_to, 0 if @a peer_sock is connected */
+  struct sockaddr_in probe; /**< socket address the initial DT came from, gets the initial ACK too (receiver instance, see XDT_config.direct) */
+  socklen_t probe_len; /**< size of @a probe, 0 if none */
+  XDT_stat_conn *stats; /**< statistics of the connection (see stats.h), @e null if it has no slot */
+  unsigned worker; /**< pre-forked process serving the instance (index + 1, see XDT_config.pool), 0 if none */
+  XDT_payload_ring ring; /**< payload ring shared with the user: read from the producer's, written to the consumer's */
+  unsigned taken_offset; /**< ring offset of the payload served by take_payload(), released with the next message */
+  unsigned taken_length; /**< length of the payload at @a taken_offset, 0 if none */
+  unsigned kept_end; /**< ring offset behind the payload kept last by keep_payload() */
+  int kept; /**< if not 0, payloads up to @a kept_end are kept until free_payload() */
+  char *landing; /**< ring space reserved to receive the next message into (see get_message()), @e null if none */
+  unsigned landing_offset; /**< ring offset of @a landing */
+  unsigned landing_size; /**< number of bytes at @a landing */
+
+  union
+  {
+    XDT_sender sender; /**< sender protocol state (only used in single-process mode) */
+    XDT_receiver receiver; /**< receiver protocol state (only used in single-process mode) */
+  } proto;
+  XDT_soft_timer timers[MAX_INSTANCE_TIMERS]; /**< timers of the instance */
+
+  unsigned slot; /**< slot number of the instance in the connection table */
+  unsigned linked; /**< bit mask of the indexes the instance is linked into */
+  unsigned hash[CONN_INDEXES]; /**< hash values the instance is linked with */
+  unsigned next[CONN_INDEXES]; /**< successor in the index bucket chains (slot number + 1, 0 terminates) */
+} XDT_instance;
+
+
+/**
+ * @brief Connection table
+ *
+ * Holds the context data of all running instances (use as an opaque type).
+ * Instances are stored in chunks which never move, so pointers to an instance
+ * stay valid until it is released. Released slots are reused first.
+ * Every index is a hash table with chained buckets, so all lookups take
+ * constant time on average.
+ */
+typedef struct
+{
+  XDT_instance **chunks; /**< instance storage */
+  unsigned chunk_count; /**< number of allocated chunks */
+  unsigned size; /**< number of slots in all chunks */
+  unsigned used; /**< number of instances in use */
+  unsigned free_slots; /**< head of the list of released slots (slot number + 1, chained by next[0]) */
+  unsigned fresh; /**< number of slots used at least once, all further slots are unused so far */
+  unsigned *buckets[CONN_INDEXES]; /**< bucket heads of the indexes (slot number + 1) */
+  unsigned mask; /**< number of buckets per index minus one */
+} XDT_conntable;
+
+
+int xdt_conntable_create(XDT_conntable * table);
+void xdt_conntable_delete(XDT_conntable * table);
+
+XDT_instance *xdt_conntable_alloc(XDT_conntable * table);
+void xdt_conntable_free(XDT_conntable * table, XDT_instance * inst);
+int xdt_conntable_link(XDT_conntable * table, XDT_instance * inst);
+XDT_instance *xdt_conntable_next(XDT_conntable * table, XDT_instance * inst);
+
+XDT_instance *xdt_conntable_by_real_conn(XDT_conntable * table, unsigned conn);
+XDT_instance *xdt_conntable_by_mapped_conn(XDT_conntable * table, unsigned conn);
+XDT_instance *xdt_conntable_by_xdt_addresses(XDT_conntable * table, XDT_address const *src, XDT_address const *dst);
+XDT_instance *xdt_conntable_by_socket_address(XDT_conntable * table, unsigned conn, struct sockaddr_in const *addr, socklen_t addr_len);
+XDT_instance *xdt_conntable_by_pid(XDT_conntable * table, pid_t pid);
+
+
+/**
+ * @}
+ */
+
+#endif /* CONNTABLE_H */
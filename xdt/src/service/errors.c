@@ -1,7 +1,7 @@
 /**
  * @file errors.c
  * @ingroup service
- * @brief send(2) and sendto(2) replacements which simulate error cases
+ * @brief send(2), sendto(2) and sendmmsg(2) replacements which simulate error cases
  */
 
 /**
@@ -9,6 +9,10 @@
  * @{
  */
 
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
 #include "errors.h"
 #include "pdu.h"
 
@@ -18,35 +22,24 @@
 
 
 /**
- * @brief @e sendto(2) replacement with built-in error case simulation
- *
- * The interface is like the original @e sendto(2) function, but with the @e flags
- * parameter replaced by the @e error @e case to simulate. The behaviour differs in 
- * some ways:
- * - actual transmission depends on the error case specified
- * - if the socket is in a connected state, no ICMP errors are reported
+ * @brief Decides if the simulated error case drops an encoded PDU
  *
- * For further description you should have a look at the @e sendto(2) manual.
+ * Only type and sequence number decide, the PDU is not decoded completely.
+ * Called for every PDU of a datagram aggregating several PDUs before it is sent.
  *
- * @param s socket to use for transmission
- * @param msg message to send
- * @param len length of the message
+ * @param msg encoded PDU
+ * @param len length of the encoded PDU
  * @param error_case error case to simulate
- * @param to address of the target
- * @param tolen size of the address @a to
- * 
- * @return number of characters sent, or -1 if an error occurred
+ *
+ * @return 1 if the PDU is dropped, 0 if it is sent, -1 on invalid PDU or error case
  */
-ssize_t
-sendto_err(int s, void *msg, size_t len, XDT_error error_case, const struct sockaddr *to, socklen_t tolen)
+int
+dropped_err(void *msg, size_t len, XDT_error error_case)
 {
-  XDT_pdu pdu;
-  ssize_t bytes_sent;
+  long type = 0;
+  unsigned sequ = 0;
 
-  errno = 0;
-
-  if (deserialize_pdu(msg, len, &pdu) < 0) {
-    errno = EINVAL;
+  if (error_case != ERR_NO && peek_pdu(msg, len, &type, &sequ) < 0) {
     return -1;
   }
 
@@ -56,14 +49,14 @@ sendto_err(int s, void *msg, size_t len, XDT_error error_case, const struct sock
     break;
 
   case ERR_DAT1:
-    if (pdu.type == DT && pdu.x.dt.sequ == 1) {
-      return len;
+    if (type == DT && sequ == 1) {
+      return 1;
     }
     break;
 
   case ERR_DAT2:
-    if (pdu.type == DT && pdu.x.dt.sequ == 2) {
-      return len;
+    if (type == DT && sequ == 2) {
+      return 1;
     }
     break;
 
@@ -71,29 +64,29 @@ sendto_err(int s, void *msg, size_t len, XDT_error error_case, const struct sock
     {
       static int first = 1;
 
-      if (first && pdu.type == DT && pdu.x.dt.sequ == 4) {
+      if (first && type == DT && sequ == 4) {
         first = 0;
-        return len;
+        return 1;
       }
     }
     break;
 
   case ERR_DAT3UP:
-    if (pdu.type == DT && pdu.x.dt.sequ > 2) {
-      return len;
+    if (type == DT && sequ > 2) {
+      return 1;
     }
     break;
 
   case ERR_ACK1:
-    if (pdu.type == ACK && pdu.x.ack.sequ == 1) {
-      return len;
+    if (type == ACK && sequ == 1) {
+      return 1;
     }
     break;
 
   /*
   case ERR_ACK3:
-    if (pdu.type == ACK && pdu.x.ack.sequ == 3) {
-      return len;
+    if (type == ACK && sequ == 3) {
+      return 1;
     }
     break;
   */
@@ -102,27 +95,64 @@ sendto_err(int s, void *msg, size_t len, XDT_error error_case, const struct sock
 	{
 	  static int first = 1;
 	
-      if (first && pdu.type == ACK && pdu.x.ack.sequ == 3) {
+      if (first && type == ACK && sequ == 3) {
 	    first = 0;
-        return len;
+        return 1;
       }
 	}
     break;
 
   case ERR_ACK4UP:
-    if (pdu.type == ACK && pdu.x.ack.sequ > 3) {
-      return len;
+    if (type == ACK && sequ > 3) {
+      return 1;
     }
     break;
 
   case ERR_ABO:
-    if ((pdu.type == ACK && pdu.x.ack.sequ > 3) || pdu.type == ABO) {
-      return len;
+    if ((type == ACK && sequ > 3) || type == ABO) {
+      return 1;
     }
     break;
 
   default:
     /* invalid error case */
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief @e sendto(2) replacement with built-in error case simulation
+ *
+ * The interface is like the original @e sendto(2) function, but with the @e flags
+ * parameter replaced by the @e error @e case to simulate. The behaviour differs in 
+ * some ways:
+ * - actual transmission depends on the error case specified
+ * - if the socket is in a connected state, no ICMP errors are reported
+ *
+ * For further description you should have a look at the @e sendto(2) manual.
+ *
+ * @param s socket to use for transmission
+ * @param msg message to send
+ * @param len length of the message
+ * @param error_case error case to simulate
+ * @param to address of the target
+ * @param tolen size of the address @a to
+ * 
+ * @return number of characters sent, or -1 if an error occurred
+ */
+ssize_t
+sendto_err(int s, void *msg, size_t len, XDT_error error_case, const struct sockaddr *to, socklen_t tolen)
+{
+  ssize_t bytes_sent;
+
+  errno = 0;
+
+  switch (dropped_err(msg, len, error_case)) {
+  case 1:
+    return len;
+  case -1:
     errno = EINVAL;
     return -1;
   }
@@ -170,6 +200,56 @@ send_err(int s, void *msg, size_t len, XDT_error error_case)
 }
 
 
+/**
+ * @brief @e sendmmsg(2) replacement with built-in error case simulation
+ *
+ * Like send_err(), but sends several messages on a connected socket by as few
+ * system calls as possible. The error case is simulated for every message,
+ * dropped ones are removed from @a msgs.
+ *
+ * @param s connected socket to use for transmission
+ * @param msgs messages to send, each with one encoded PDU in @e msg_iov
+ * @param vlen number of messages in @a msgs
+ * @param error_case error case to simulate
+ *
+ * @return number of messages sent (including dropped ones), or -1 if an error occurred
+ */
+int
+sendmmsg_err(int s, struct mmsghdr *msgs, unsigned vlen, XDT_error error_case)
+{
+  unsigned i, count = 0;
+  int sent;
+
+  errno = 0;
+
+  for (i = 0; i < vlen; ++i) {
+    switch (dropped_err(msgs[i].msg_hdr.msg_iov->iov_base, msgs[i].msg_hdr.msg_iov->iov_len, error_case)) {
+    case 0:
+      msgs[count++] = msgs[i];
+      break;
+    case -1:
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  for (i = 0; i < count; i += sent) {
+    if ((sent = sendmmsg(s, msgs + i, count - i, 0)) == -1) {
+      if (errno == EINTR) {
+        sent = 0;
+        continue;
+      }
+      if (errno == ECONNREFUSED) {
+        /* most systems return ICMP errors, but we ignore this */
+        return vlen;
+      }
+      return -1;
+    }
+  }
+
+  return vlen;
+}
+
 /**
  * @}
  */
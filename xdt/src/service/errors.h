@@ -104,8 +104,12 @@ typedef enum
 } XDT_error;
 
 
+struct mmsghdr;
+
+int dropped_err(void *msg, size_t len, XDT_error error_case);
 ssize_t send_err(int s, void *msg, size_t len, XDT_error error_case);
 ssize_t sendto_err(int s, void *msg, size_t len, XDT_error error_case, const struct sockaddr *to, socklen_t tolen);
+int sendmmsg_err(int s, struct mmsghdr *msgs, unsigned vlen, XDT_error error_case);
 
 /**
  * @}
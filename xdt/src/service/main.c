@@ -36,6 +36,49 @@
  * When a timer expires, a timer message is put into the queue, 
  * with the type member set to this message type and no additional data.
  *
+ * When started with @e -s, the service runs in single-process mode: no instance 
+ * is spawned, instead the dispatcher keeps the sender and receiver state of every
+ * connection in a context object (XDT_sender, XDT_receiver) and passes each message 
+ * directly to sender_handle() or receiver_handle(). Timers expire within the 
+ * dispatcher's @e epoll(7) loop. The wire behaviour is the same in both modes.
+ *
+ * With @e -T (which implies @e -s) all connections with the same peer service
+ * share a tunnel (see tunnel.h): one UDP socket opened on first use, the round
+ * trip time estimate and the datagrams carrying ACKs. Services without @e -T
+ * still talk to it. Tunnels are not supported with instance processes: the
+ * state they share lives in the dispatcher, so @e -T always serves all
+ * connections there, as @e -s does.
+ *
+ * With @e -n, that many dispatcher processes (shards) share the listen address
+ * (see shard.c). The kernel steers every PDU to the shard serving its connection.
+ * The initial XDATrequ from a producer is received by the first shard and passed
+ * on, further SDUs go to the access point of the serving shard. Every shard
+ * serves its connections in its own way (@e -s or not) and limits their number
+ * by @e -c on its own.
+ *
+ * The dispatcher never waits for the queue of a slow instance: while it is
+ * full, DTs and ACKs are dropped (the peers repeat them) and other messages
+ * are held back until the instance caught up, see queue_message(). With
+ * @e -q, each queue holds at most that many bytes.
+ *
+ * With @e -P, the dispatcher forks that many instance processes in advance,
+ * which serve one connection after another, so setting up a connection
+ * costs no fork(2). Only while all of them are busy, an instance process
+ * is forked per connection.
+ *
+ * With @e -d, instances take the PDUs of established connections from their
+ * own UDP socket. The receiving instance sends a copy of its initial ACK to
+ * the sending instance's socket. Once that copy arrives, the sending instance
+ * addresses its DTs to the receiving instance's socket, and once such a DT
+ * arrives, the receiving instance addresses its ACKs to the sender's socket,
+ * so the dispatchers are left out of the data transfer. With a peer service
+ * without @e -d, the copy is dropped and the PDUs pass the dispatchers as before.
+ *
+ * Counters and histograms of every connection and of the whole service
+ * (PDUs, retransmissions, timer expirations, round trip times, queue depths)
+ * are kept in a shared memory segment named after the listen address, see
+ * stats.h. The @e xdtstat tool shows them while the service runs.
+ *
  *
  * @bug For the message delivery to the user layer @e connected unix domain sockets
  *      are used. Connecting to the user socket may require read/write
@@ -49,16 +92,21 @@
 
 #include "errors.h"
 #include "service.h"
+#include "shard.h"
 #include "sender.h"
 #include "receiver.h"
 
 #include <xdt/address.h>
+#include <xdt/log.h>
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
 #include <signal.h>
+#include <limits.h>
+
+#include <unistd.h>
 
 
 /**
@@ -102,6 +150,32 @@ init_signal_handler(void)
   }
 }
 
+/**
+ * @brief Converts a command line option argument into an unsigned number
+ *
+ * @param arg option argument
+ * @param value where to store the number
+ *
+ * @return 0 on success, value < 0 if @a arg is not a decimal number
+ */
+static int
+parse_unsigned(char const *arg, unsigned *value)
+{
+  char *end;
+  unsigned long ul;
+
+  if (!isdigit((int)arg[0])) {
+    return -1;
+  }
+  ul = strtoul(arg, &end, 10);
+  if (*end || ul > UINT_MAX) {
+    return -2;
+  }
+  *value = ul;
+
+  return 0;
+}
+
 /**
  * @brief Prints program usage information
  *
@@ -111,12 +185,35 @@ init_signal_handler(void)
 static void
 print_usage(FILE * f, char const *cmd)
 {
-  fprintf(f, "usage: %s [-e <error case>] <listen address>\n\n"
+  fprintf(f, "usage: %s [-e <error case>] [-s] [-c <connections>] [-w <window>] [-m <min RTO>] [-M <max RTO>]\n"
+             "       [-a <ACK count>] [-r] [-p <payload>] [-b <batch>] [-u] [-T] [-n <shards>] [-q <queue size>]\n"
+             "       [-P <workers>] [-d] [-l <log level>] [-t <trace file>] <listen address>\n\n"
              "<error case> = number within %u (no error) and %u\n"
+             "-s = serve all connections in the dispatcher process (no process per connection)\n"
+             "<connections> = number of maximum simultaneous connections, 0 for no limit (default is %u)\n"
+             "<window> = number of DTs to send without acknowledgement, within 1 and %u (default is %u)\n"
+             "<min RTO>, <max RTO> = bounds of the retransmission timeout in ms, within 1 and %u (default is %u and %u)\n"
+             "<ACK count> = number of DTs to acknowledge by one ACK, within 1 and %u (default is %u)\n"
+             "-r = receive by selective repeat (buffer out-of-order DTs) instead of go-back-N\n"
+             "<payload> = biggest payload size of a DT in bytes agreed to, within %u and %u (default is %u)\n"
+             "<batch> = number of datagrams to receive or send by one system call, within 1 and %u (default is %u)\n"
+             "-u = pass the payload to consumers by a shared memory ring instead of the socket\n"
+             "-T = multiplex all connections with a peer service over one tunnel, only in the dispatcher process (implies -s)\n"
+             "<shards> = number of dispatcher processes sharing the listen address, a power of two up to %u (default is 1)\n"
+             "<queue size> = bytes an instance's message queue holds, at least %lu, 0 for the system's limit (default is 0)\n"
+             "<workers> = number of instance processes to fork in advance, not with -s or -T (default is 0)\n"
+             "-d = peers send the PDUs of established connections to the instance's socket directly, not with -s or -T\n"
+             "<log level> = %d (quiet), %d (dump messages and per-connection statistics) or %d (dump messages and payload), at most %d compiled in (default is %d)\n"
+             "<trace file> = record binary message trace events to <trace file>.<pid>, decode them by xdttrace\n"
              "<listen address> = host:port\n\n"
              "  host = hostname or IPv4 address in standard dot notation\n"
              "  port = IP port number in range [%d, %d]\n",
-          cmd, ERR_NO, ERR_MAX_SUCC - 1, XDT_PORT_MIN, XDT_PORT_MAX);
+          cmd, ERR_NO, ERR_MAX_SUCC - 1, XDT_MAX_CONNECTIONS, SENDER_WINDOW_MAX, SENDER_WINDOW,
+          SENDER_RTO_MAX, SENDER_RTO_MIN, SENDER_RTO_MAX,
+          RECEIVER_ACK_EVERY_MAX, RECEIVER_ACK_EVERY, XDT_DATA_DEFAULT, XDT_DATA_MAX, XDT_DATA_MAX,
+          XDT_BATCH_MAX, XDT_BATCH, XDT_SHARDS_MAX, (unsigned long)xdt_queue_msg_max(),
+          XDT_LOG_QUIET, XDT_LOG_MESSAGES, XDT_LOG_PAYLOAD, XDT_LOG_MAX, XDT_LOG_QUIET,
+          XDT_PORT_MIN, XDT_PORT_MAX);
 }
 
 /** 
@@ -124,7 +221,7 @@ print_usage(FILE * f, char const *cmd)
  *
  * The main function translates the given XDT address string
  * into it's binary representation and evaluates 
- * the error case to simulate.
+ * the error case to simulate and the serving mode.
  *
  *
  * Then it calls the message dispatcher.
@@ -140,47 +237,198 @@ int
 main(int argc, char *argv[])
 {
   XDT_address sap;
-  XDT_error error_case = 0;
-  int addr_index = 1;
+  XDT_config config;
+  int opt;
 
-  if (argc < 2) {
-    print_usage(stderr, argv[0]);
-    return EXIT_FAILURE;
-  } else {
-    /* check for '-e' */
-    if (argv[1][0] == '-' && argv[1][1] == 'e') {
-      if (argv[1][2]) {
-        /* e.g '-e5' */
-        if (!isdigit((int)argv[1][2]) || argv[1][3]) {
-          /* e.g. '-ex' or '-e55' */
-          error_case = ERR_MAX_SUCC;
+  config.error_case = ERR_NO;
+  config.single_process = 0;
+  config.max_connections = XDT_MAX_CONNECTIONS;
+  config.window = SENDER_WINDOW;
+  config.rto_min = SENDER_RTO_MIN;
+  config.rto_max = SENDER_RTO_MAX;
+  config.ack_every = RECEIVER_ACK_EVERY;
+  config.selective = 0;
+  config.max_length = XDT_DATA_MAX;
+  config.batch = XDT_BATCH;
+  config.shared_payload = 0;
+  config.tunnel = 0;
+  config.shards = 1;
+  config.queue_size = 0;
+  config.pool = 0;
+  config.direct = 0;
+
+  while ((opt = getopt(argc, argv, "e:sc:w:m:M:a:rp:b:uTn:q:P:dl:t:")) != -1) {
+    switch (opt) {
+    case 'e':
+      /* e.g. '-e5' or '-e 5', but not '-ex' or '-e55' */
+      if (!isdigit((int)optarg[0]) || optarg[1]) {
+        config.error_case = ERR_MAX_SUCC;
+      } else {
+        config.error_case = optarg[0] - '0';
+      }
+      break;
+
+    case 's':
+      config.single_process = 1;
+      break;
+
+    case 'c':
+      if (parse_unsigned(optarg, &config.max_connections) < 0) {
+        fputs("error in <connections>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'w':
+      if (parse_unsigned(optarg, &config.window) < 0 || !config.window || config.window > SENDER_WINDOW_MAX) {
+        fputs("error in <window>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'm':
+      if (parse_unsigned(optarg, &config.rto_min) < 0 || !config.rto_min || config.rto_min > SENDER_RTO_MAX) {
+        fputs("error in <min RTO>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'M':
+      if (parse_unsigned(optarg, &config.rto_max) < 0 || !config.rto_max || config.rto_max > SENDER_RTO_MAX) {
+        fputs("error in <max RTO>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'a':
+      if (parse_unsigned(optarg, &config.ack_every) < 0 || !config.ack_every
+          || config.ack_every > RECEIVER_ACK_EVERY_MAX) {
+        fputs("error in <ACK count>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'r':
+      config.selective = 1;
+      break;
+
+    case 'p':
+      if (parse_unsigned(optarg, &config.max_length) < 0 || config.max_length < XDT_DATA_DEFAULT
+          || config.max_length > XDT_DATA_MAX) {
+        fputs("error in <payload>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'b':
+      if (parse_unsigned(optarg, &config.batch) < 0 || !config.batch || config.batch > XDT_BATCH_MAX) {
+        fputs("error in <batch>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'u':
+      config.shared_payload = 1;
+      break;
+
+    case 'T':
+      /* the connections share the tunnel's state in the dispatcher process */
+      config.tunnel = 1;
+      config.single_process = 1;
+      break;
+
+    case 'n':
+      /* the shard is the connection number modulo the number of shards */
+      if (parse_unsigned(optarg, &config.shards) < 0 || !config.shards || config.shards > XDT_SHARDS_MAX
+          || (config.shards & (config.shards - 1))) {
+        fputs("error in <shards>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'q':
+      /* the biggest message must fit */
+      if (parse_unsigned(optarg, &config.queue_size) < 0
+          || (config.queue_size && config.queue_size < xdt_queue_msg_max())) {
+        fputs("error in <queue size>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'P':
+      if (parse_unsigned(optarg, &config.pool) < 0) {
+        fputs("error in <workers>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'd':
+      config.direct = 1;
+      break;
+
+    case 'l':
+      if (!isdigit((int)optarg[0]) || optarg[1] || optarg[0] - '0' > XDT_LOG_MAX) {
+        fputs("error in <log level>\n", stderr);
+        print_usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+      }
+      xdt_log_level = optarg[0] - '0';
+      break;
+
+    case 't':
+      if (xdt_trace_open(optarg) < 0) {
+        if (!xdt_tracing()) {
+          fputs("error in <trace file>: tracing not compiled in (configure --enable-trace)\n", stderr);
         } else {
-          error_case = argv[1][2] - '0';
-          addr_index = 2;
+          perror("error in <trace file>");
         }
-      } else if (argc > 2 && isdigit((int)argv[2][0])) {
-        /* e.g. '-e 5' */
-        error_case = argv[2][0] - '0';
-        addr_index = 3;
-      } else {
-        /* e.g. '-e' or '-e x' or '-e 55' */
-        error_case = ERR_MAX_SUCC;
+        return EXIT_FAILURE;
       }
+      break;
+
+    default:
+      print_usage(stderr, argv[0]);
+      return EXIT_FAILURE;
     }
   }
 
-  if (error_case >= ERR_MAX_SUCC) {
+  if (config.rto_min > config.rto_max) {
+    fputs("error in <min RTO>: greater than <max RTO>\n", stderr);
+    print_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (config.pool && config.single_process) {
+    fputs("error in <workers>: no instance processes with -s or -T\n", stderr);
+    print_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (config.direct && config.single_process) {
+    fputs("error in -d: no instance sockets with -s or -T\n", stderr);
+    print_usage(stderr, argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (config.error_case >= ERR_MAX_SUCC) {
     fputs("error in <error case>\n", stderr);
     print_usage(stderr, argv[0]);
     return EXIT_FAILURE;
   }
-  if (addr_index + 1 != argc) {
+  if (optind + 1 != argc) {
     fputs("error in parameter count\n", stderr);
     print_usage(stderr, argv[0]);
     return EXIT_FAILURE;
   }
 
-  if (xdt_address_parse(argv[addr_index], &sap) < 0) {
+  if (xdt_address_parse(argv[optind], &sap) < 0) {
     fputs("error in <listen address>\n", stderr);
     print_usage(stderr, argv[0]);
     return EXIT_FAILURE;
@@ -189,24 +437,36 @@ main(int argc, char *argv[])
     
   /* now:
    *
-   * sap        - identifies the service instance
-   * error_case - contains the error case to simulate
+   * sap    - identifies the service instance
+   * config - contains the error case to simulate and the serving mode
    */
 
   {
     unsigned conn = 0;
-    int role = dispatch(&sap, &conn, error_case);
+    int role = dispatch(&sap, &conn, &config);
 
     init_signal_handler();
   
     switch (role) {
 
     case XDT_SERVICE_SENDER:
-      start_sender();
+      start_sender(&config);
       break;
 
     case XDT_SERVICE_RECEIVER:
-      start_receiver(conn);
+      start_receiver(conn, &config);
+      break;
+
+    case XDT_SERVICE_WORKER:
+      /* pre-forked, serve one connection after another */
+      while ((role = await_connection(&conn)) != XDT_SERVICE_NA) {
+        if (role == XDT_SERVICE_SENDER) {
+          start_sender(&config);
+        } else {
+          start_receiver(conn, &config);
+        }
+        finish_connection();
+      }
       break;
 
     default:
@@ -9,8 +9,14 @@
  * @{
  */
 
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
 #include "pdu.h"
 
+#include <xdt/log.h>
+
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
@@ -64,11 +70,41 @@ static int
 marshal_ack(XDR * xdrs, XDT_ack * ack)
 {
   /* sequ
-   * [source_addr dest_addr] (if sequ==1)
+   * [source_addr dest_addr max_length] (if sequ==1)
    * conn
+   * has_sack [sack] (if has_sack)
    */
 
-  return xdr_u_int(xdrs, &ack->sequ) && ((ack->sequ == 1) ? (marshal_address(xdrs, &ack->source_addr) && marshal_address(xdrs, &ack->dest_addr)) : 1) && xdr_u_int(xdrs, &ack->conn);
+  bool_t has_sack = xdrs->x_op == XDR_ENCODE && ack->sack != 0;
+
+  if (!(xdr_u_int(xdrs, &ack->sequ) && ((ack->sequ == 1) ? (marshal_address(xdrs, &ack->source_addr) && marshal_address(xdrs, &ack->dest_addr) && xdr_u_int(xdrs, &ack->max_length)) : 1) && xdr_u_int(xdrs, &ack->conn) && xdr_bool(xdrs, &has_sack))) {
+    return 0;
+  }
+  if (!has_sack) {
+    ack->sack = 0;
+    return 1;
+  }
+  return xdr_u_int(xdrs, &ack->sack);
+}
+
+/**
+ * @brief Marshalls the payload of a DT PDU into/from an XDR encoded byte stream
+ *
+ * Decoding does not copy the payload, XDT_dt.data points into the stream instead.
+ *
+ * @param xdrs the byte stream associated XDR stream object
+ * @param dt points to the DT PDU, its length already marshalled
+ * 
+ * return 1 on success, 0 on failure
+ */
+static int
+marshal_data(XDR * xdrs, XDT_dt * dt)
+{
+  if (xdrs->x_op == XDR_DECODE) {
+    dt->data = (char *)xdr_inline(xdrs, (dt->length + BYTES_PER_XDR_UNIT - 1) / BYTES_PER_XDR_UNIT * BYTES_PER_XDR_UNIT);
+    return dt->data != 0;
+  }
+  return xdr_opaque(xdrs, dt->data, dt->length);
 }
 
 /**
@@ -83,13 +119,132 @@ static int
 marshal_dt(XDR * xdrs, XDT_dt * dt)
 {
   /* sequ
-   * source_addr dest_addr (if sequ==1) | conn (if sequ!=1)
+   * source_addr dest_addr max_length window (if sequ==1) | conn (if sequ!=1)
    * eom
    * length
    * data
    */
 
-  return xdr_u_int(xdrs, &dt->sequ) && ((dt->sequ == 1) ? (marshal_address(xdrs, &dt->source_addr) && marshal_address(xdrs, &dt->dest_addr)) : xdr_u_int(xdrs, &dt->conn)) && xdr_u_int(xdrs, &dt->eom) && xdr_u_int(xdrs, &dt->length) && xdr_opaque(xdrs, dt->data, dt->length);
+  return xdr_u_int(xdrs, &dt->sequ) && ((dt->sequ == 1) ? (marshal_address(xdrs, &dt->source_addr) && marshal_address(xdrs, &dt->dest_addr) && xdr_u_int(xdrs, &dt->max_length) && xdr_u_int(xdrs, &dt->window)) : xdr_u_int(xdrs, &dt->conn)) && xdr_u_int(xdrs, &dt->eom) && xdr_u_int(xdrs, &dt->length) && dt->length <= XDT_DATA_MAX && marshal_data(xdrs, dt);
+}
+
+
+/**
+ * @brief Returns the size of a PDU message
+ *
+ * DTs end with the last used payload byte,
+ * so only this number of bytes has to be stored or transferred.
+ *
+ * @param pdu points to the PDU message
+ *
+ * @return size in bytes (type and specific PDU)
+ */
+size_t
+pdu_size(XDT_pdu const *pdu)
+{
+  switch ((int)pdu->type) {
+  case DT:
+    return offsetof(XDT_pdu, x.dt.data) + pdu->x.dt.length;
+  case ACK:
+    return offsetof(XDT_pdu, x) + sizeof (XDT_ack);
+  case ABO:
+    return offsetof(XDT_pdu, x) + sizeof (XDT_abo);
+  default:
+    return sizeof (long);
+  }
+}
+
+
+/**
+ * @brief Packs a PDU message into a buffer
+ *
+ * The used payload bytes of a DT take the place of the @e data pointer.
+ *
+ * @param pdu points to the PDU message
+ * @param buffer where to pack the PDU into, at least pdu_size() bytes
+ *
+ * @return size in bytes of the packed PDU
+ */
+size_t
+pack_pdu(XDT_pdu const *pdu, void *buffer)
+{
+  if (pdu->type != DT) {
+    memcpy(buffer, pdu, pdu_size(pdu));
+    return pdu_size(pdu);
+  }
+  memcpy(buffer, pdu, offsetof(XDT_pdu, x.dt.data));
+  memcpy((char *)buffer + offsetof(XDT_pdu, x.dt.data), pdu->x.dt.data, pdu->x.dt.length);
+
+  return pdu_size(pdu);
+}
+
+/**
+ * @brief Unpacks a queued PDU message
+ *
+ * The payload of a DT is not copied, XDT_dt.data points into @a buffer instead,
+ * so @a buffer has to be kept as long as the PDU is used.
+ *
+ * @param pdu where to unpack the PDU into, must not overlap @a buffer
+ * @param buffer the packed PDU message
+ * @param size number of bytes in @a buffer
+ *
+ * @return 0 on success, -1 if @a size does not match the PDU
+ */
+int
+unpack_pdu(XDT_pdu * pdu, void *buffer, size_t size)
+{
+  size_t header;
+
+  if (size < sizeof (long)) {
+    return -1;
+  }
+  memcpy(&pdu->type, buffer, sizeof (long));
+  header = pdu->type == DT ? offsetof(XDT_pdu, x.dt.data) : pdu_size(pdu);
+  if (size < header) {
+    return -1;
+  }
+  memcpy(pdu, buffer, header);
+  if (pdu->type != DT) {
+    return 0;
+  }
+  pdu->x.dt.data = (char *)buffer + header;
+
+  return pdu->x.dt.length <= XDT_DATA_MAX && size == header + pdu->x.dt.length ? 0 : -1;
+}
+
+/**
+ * @brief Prepares an entry of a DT buffer
+ *
+ * The payload of the entry is kept right behind it (see #PDU_DT_SIZE).
+ *
+ * @param slot the entry, aligned and at least #PDU_DT_SIZE bytes
+ *
+ * @return the entry as PDU message
+ */
+XDT_pdu *
+pdu_slot_init(void *slot)
+{
+  XDT_pdu *pdu = slot;
+
+  pdu->x.dt.data = (char *)(pdu + 1);
+
+  return pdu;
+}
+
+/**
+ * @brief Copies a DT into an entry of a DT buffer
+ *
+ * @param slot the entry prepared by pdu_slot_init(), big enough for the payload of @a pdu
+ * @param pdu the DT to be copied
+ */
+void
+pdu_slot_copy(XDT_pdu * slot, XDT_pdu const *pdu)
+{
+  char *data = (char *)(slot + 1);
+
+  *slot = *pdu;
+  slot->x.dt.data = data;
+  memcpy(data, pdu->x.dt.data, pdu->x.dt.length);
 }
 
 
@@ -103,7 +258,7 @@ marshal_dt(XDR * xdrs, XDT_dt * dt)
  * @return number of written bytes in stream on success, value < 0 on failure
  */
 int
-serialize_pdu(XDT_pdu * pdu, char *stream, size_t stream_len)
+serialize_pdu_xdr(XDT_pdu * pdu, char *stream, size_t stream_len)
 {
   XDR xdrs;
   unsigned pos = 0;
@@ -154,6 +309,8 @@ serialize_pdu(XDT_pdu * pdu, char *stream, size_t stream_len)
 
 /**
  * @brief Deserializes a PDU message from an XDR encoded byte stream
+ *
+ * The payload of a DT is not copied, XDT_dt.data points into @a stream instead.
  * 
  * @param stream buffer containing the encoded PDU
  * @param stream_len number of bytes in the @a stream
@@ -162,7 +319,7 @@ serialize_pdu(XDT_pdu * pdu, char *stream, size_t stream_len)
  * @return number of read bytes from stream on success, value < 0 on failure
  */
 int
-deserialize_pdu(char *stream, size_t stream_len, XDT_pdu * pdu)
+deserialize_pdu_xdr(char *stream, size_t stream_len, XDT_pdu * pdu)
 {
   XDR xdrs;
   int code;
@@ -221,30 +378,139 @@ deserialize_pdu(char *stream, size_t stream_len, XDT_pdu * pdu)
 }
 
 
-/*** DEBUG PRINTING ***************************************************/
+/**
+ * @brief Decodes the type and sequence number of an XDR encoded PDU only
+ *
+ * Both are the first items of every DT and ACK, so the rest of the
+ * stream (addresses, payload) is not touched.
+ *
+ * @param stream buffer containing the encoded PDU
+ * @param stream_len number of bytes in the @a stream
+ * @param type where to store the PDU type
+ * @param sequ where to store the sequence number (0 for ABOs)
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+int
+peek_pdu_xdr(char *stream, size_t stream_len, long *type, unsigned *sequ)
+{
+  XDR xdrs;
+  int code;
+  int ok;
+
+  if (!stream || !stream_len || !type || !sequ) {
+    return -2;
+  }
+
+  xdrmem_create(&xdrs, stream, stream_len, XDR_DECODE);
+
+  ok = xdr_int(&xdrs, &code);
+  if (ok) {
+    *type = code;
+    *sequ = 0;
+    if (code == DT || code == ACK) {
+      ok = xdr_u_int(&xdrs, sequ);
+    } else if (code != ABO) {
+      ok = 0;
+    }
+  }
+
+  xdr_destroy(&xdrs);
+
+  return ok ? 0 : -1;
+}
 
 
-/** @brief Wether to print the PDU payload or not */
-#define PRINT_PDU_PAYLOAD 0
+/*** CODEC CHOSEN AT CONFIGURE TIME ***********************************/
+
+
+/**
+ * @brief Serializes a PDU message for the wire
+ *
+ * Uses the codec chosen at configure time (see #XDT_PDU_CODEC).
+ *
+ * @param pdu points to the PDU message to be serialized
+ * @param stream buffer to encode the PDU into
+ * @param stream_len number of avaiable bytes in @a stream
+ *
+ * @return number of written bytes in stream on success, value < 0 on failure
+ */
+int
+serialize_pdu(XDT_pdu * pdu, char *stream, size_t stream_len)
+{
+#ifdef XDT_RAW_CODEC
+  return serialize_pdu_raw(pdu, stream, stream_len);
+#else
+  return serialize_pdu_xdr(pdu, stream, stream_len);
+#endif
+}
+
+/**
+ * @brief Deserializes a PDU message received from the wire
+ *
+ * Uses the codec chosen at configure time (see #XDT_PDU_CODEC).
+ * The payload of a DT is not copied, XDT_dt.data points into @a stream instead.
+ *
+ * @param stream buffer containing the encoded PDU
+ * @param stream_len number of bytes in the @a stream
+ * @param pdu points to the PDU message to be deserialized
+ *
+ * @return number of read bytes from stream on success, value < 0 on failure
+ */
+int
+deserialize_pdu(char *stream, size_t stream_len, XDT_pdu * pdu)
+{
+#ifdef XDT_RAW_CODEC
+  return deserialize_pdu_raw(stream, stream_len, pdu);
+#else
+  return deserialize_pdu_xdr(stream, stream_len, pdu);
+#endif
+}
+
+/**
+ * @brief Decodes the type and sequence number of an encoded PDU only
+ *
+ * Uses the codec chosen at configure time (see #XDT_PDU_CODEC).
+ *
+ * @param stream buffer containing the encoded PDU
+ * @param stream_len number of bytes in the @a stream
+ * @param type where to store the PDU type
+ * @param sequ where to store the sequence number (0 for ABOs)
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+int
+peek_pdu(char *stream, size_t stream_len, long *type, unsigned *sequ)
+{
+#ifdef XDT_RAW_CODEC
+  return peek_pdu_raw(stream, stream_len, type, sequ);
+#else
+  return peek_pdu_xdr(stream, stream_len, type, sequ);
+#endif
+}
+
+/*** DEBUG PRINTING ***************************************************/
 
 
 /**
  * @brief Prints (or not) the PDU payload
  * 
  * When detecting any non-printable characters, the rest of the output
- * is leaved out (indicated by a special tag). Output in general depends 
- * if #PRINT_PDU_PAYLOAD is set.
+ * is leaved out (indicated by a special tag). The payload is printed
+ * only at log level #XDT_LOG_PAYLOAD.
  *
- * @param data PDU data array
+ * @param data PDU payload
  * @param length used bytes in @a data
  * @param stream output stream, @e stderr is used if @e null
  */
 static void
-print_pdu_data(char data[XDT_DATA_MAX], unsigned length, FILE * stream)
+print_pdu_data(char const *data, unsigned length, FILE * stream)
 {
   unsigned i;
 
-  return;
+  if (!xdt_logging(XDT_LOG_PAYLOAD)) {
+    return;
+  }
 
   fputs("data = '", stderr);
   for (i = 0; i < length && i < XDT_DATA_MAX; ++i) {
@@ -287,6 +553,10 @@ print_pdu(XDT_pdu * pdu, char *info, FILE * stream)
     }
     fprintf(stream, "sequ = %u\n", pdu->x.dt.sequ);
     fprintf(stream, "eom = %u\n", pdu->x.dt.eom);
+    if (pdu->x.dt.sequ == 1) {
+      fprintf(stream, "max_length = %u\n", pdu->x.dt.max_length);
+      fprintf(stream, "window = %u\n", pdu->x.dt.window);
+    }
     print_pdu_data(pdu->x.dt.data, pdu->x.dt.length, stream);
     fprintf(stream, "length = %u\n", pdu->x.dt.length);
     break;
@@ -298,6 +568,12 @@ print_pdu(XDT_pdu * pdu, char *info, FILE * stream)
     }
     fprintf(stream, "conn = %u\n", pdu->x.ack.conn);
     fprintf(stream, "sequ = %u\n", pdu->x.ack.sequ);
+    if (pdu->x.ack.sequ == 1) {
+      fprintf(stream, "max_length = %u\n", pdu->x.ack.max_length);
+    }
+    if (pdu->x.ack.sack) {
+      fprintf(stream, "sack = %#x\n", pdu->x.ack.sack);
+    }
     break;
   case ABO:
     fprintf(stream, "type = ABO\n");
@@ -12,9 +12,22 @@
  * @{
  */
 
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
 #include <xdt/sdu.h>
 #include <xdt/address.h>
 
+
+#ifdef XDT_RAW_CODEC
+/** @brief Name of the PDU wire codec chosen at configure time */
+# define XDT_PDU_CODEC "raw"
+#else
+/** @brief Name of the PDU wire codec chosen at configure time */
+# define XDT_PDU_CODEC "XDR"
+#endif
+
 /**
  * @brief PDU message types
  *
@@ -38,18 +51,31 @@ typedef struct
   unsigned conn;  /**< connection number, ignored if first message (sequence number is 1), else mandatory */
   unsigned sequ; /**< sequence number */
   unsigned eom; /**< end of message indicator */
-  char data[XDT_DATA_MAX]; /**< payload (uninterpreted byte sequence) */
+  unsigned max_length; /**< biggest payload size the sender offers, only transferred if first message */
+  unsigned window; /**< number of DTs the sender sends without acknowledgement, 0 if not told, only transferred if first message */
   unsigned length; /**< number of used bytes in payload XDT_dt.data */
+  char *data; /**< payload (uninterpreted byte sequence), only the used bytes are stored and transferred (see pack_pdu()) */
 } XDT_dt;
 
-/** @brief ACK PDU */
+/** @brief Number of DTs a selective acknowledgement covers */
+#define XDT_SACK_BITS 32
+
+/**
+ * @brief ACK PDU
+ *
+ * Acknowledges all DTs up to sequence number @a sequ (cumulative acknowledgement).
+ * Bit i of @a sack acknowledges the DT with sequence number @a sequ + 2 + i,
+ * which the receiver holds although DT @a sequ + 1 is missing.
+ */
 typedef struct
 {
   int code; /**< PDU type, must be ::ACK */
   XDT_address source_addr; /**< source address, mandatory if first message, else ignored */
   XDT_address dest_addr; /**< destination address, mandatory if first message, else ignored */
   unsigned conn; /**< connection number, to be set to the given conn value by the receiver instance if first message!!! */
-  unsigned sequ; /**< sequence number */
+  unsigned sequ; /**< sequence number of the newest DT received in sequence */
+  unsigned sack; /**< selective acknowledgement bitmap of DTs beyond @a sequ + 1, 0 if none */
+  unsigned max_length; /**< biggest payload size the receiver agrees to (at most the offered one), only transferred if first message */
 } XDT_ack;
 
 
@@ -68,7 +94,12 @@ typedef union
   XDT_abo abo; /**< ABO PDU */
 } XDT_pdu_x;
 
-/** @brief Compound PDU message */
+/**
+ * @brief Compound PDU message
+ *
+ * DT messages are variable in length: they are queued packed, the used payload
+ * bytes take the place of the @e data pointer (see pdu_size(), pack_pdu() and unpack_pdu()).
+ */
 typedef struct
 {
   long type; /**< message type, e.g. ::DT */
@@ -76,16 +107,49 @@ typedef struct
 } XDT_pdu;
 
 
+/** @brief Biggest size of a packed PDU message with up to @a max_length payload bytes */
+#define PDU_SIZE(max_length) (offsetof(XDT_pdu, x.dt.data) + (max_length))
+
+/**
+ * @brief Size of a DT message keeping up to @a max_length payload bytes right behind it
+ *
+ * For buffers of DTs, XDT_dt.data points behind the message (see pdu_slot_init()).
+ * Rounded up, so consecutive DTs in a buffer are properly aligned.
+ */
+#define PDU_DT_SIZE(max_length) \
+  ((sizeof (XDT_pdu) + (max_length) + sizeof (long) - 1) / sizeof (long) * sizeof (long))
+
 /**
- * @brief Maximal size of an XDR encoded PDU
+ * @brief Maximal size of an encoded PDU header
  *
- * XDR encodes each item in max 4 bytes, so we take an approximation on the biggest message.
+ * The biggest header is the one of the first DT: 8 items and two addresses
+ * encoded in 4 byte units by XDR (the raw codec needs less).
  */
-#define PDU_STREAM_MAX (4 * sizeof(XDT_pdu_x))
+#define PDU_HEADER_STREAM_MAX (4 * (8 + 2 * (2 + (sizeof (XDT_address) + 3) / 4)))
+
+/** @brief Maximal size of an encoded PDU with up to @a max_length payload bytes (header and payload padded to 4 bytes) */
+#define PDU_STREAM_SIZE(max_length) (PDU_HEADER_STREAM_MAX + ((max_length) + 3) / 4 * 4)
+
+/** @brief Maximal size of an encoded PDU */
+#define PDU_STREAM_MAX PDU_STREAM_SIZE(XDT_DATA_MAX)
 
 
+size_t pdu_size(XDT_pdu const *pdu);
+size_t pack_pdu(XDT_pdu const *pdu, void *buffer);
+int unpack_pdu(XDT_pdu * pdu, void *buffer, size_t size);
+XDT_pdu *pdu_slot_init(void *slot);
+void pdu_slot_copy(XDT_pdu * slot, XDT_pdu const *pdu);
 int serialize_pdu(XDT_pdu * pdu, char *stream, size_t stream_len);
 int deserialize_pdu(char *stream, size_t stream_len, XDT_pdu * pdu);
+int peek_pdu(char *stream, size_t stream_len, long *type, unsigned *sequ);
+
+int serialize_pdu_xdr(XDT_pdu * pdu, char *stream, size_t stream_len);
+int deserialize_pdu_xdr(char *stream, size_t stream_len, XDT_pdu * pdu);
+int peek_pdu_xdr(char *stream, size_t stream_len, long *type, unsigned *sequ);
+
+int serialize_pdu_raw(XDT_pdu * pdu, char *stream, size_t stream_len);
+int deserialize_pdu_raw(char *stream, size_t stream_len, XDT_pdu * pdu);
+int peek_pdu_raw(char *stream, size_t stream_len, long *type, unsigned *sequ);
 void print_pdu(XDT_pdu * pdu, char *info, FILE * stream);
 
 
@@ -0,0 +1,353 @@
+/**
+ * @file pdu_raw.c
+ * @ingroup service
+ * @brief Compact PDU wire codec (big-endian, no XDR)
+ *
+ * All items are encoded in network byte order (big-endian) with the smallest
+ * sufficient width, without padding:
+ *
+ * @verbatim
+ * item          | width | present
+ * --------------+-------+--------------------------------------------
+ * code          | 1     | always
+ * flags         | 1     | always (bit 0: eom, bit 1: sack follows)
+ * sequ          | 4     | DT, ACK
+ * source_addr   | addr  | DT, ACK with sequ 1
+ * dest_addr     | addr  | DT, ACK with sequ 1
+ * max_length    | 4     | DT, ACK with sequ 1
+ * window        | 4     | DT with sequ 1
+ * conn          | 4     | DT with sequ != 1, ACK, ABO
+ * sack          | 4     | ACK with flag bit 1
+ * length        | 2     | DT
+ * data          | length| DT
+ *
+ * addr = host length (1), host (host length), port (2), slot (4)
+ * @endverbatim
+ *
+ * Decoding reads directly from the receive buffer and checks every item
+ * against the end of the stream.
+ */
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+#include "pdu.h"
+
+#include <string.h>
+
+
+/** @brief DT flag: end of message */
+#define RAW_EOM 0x01
+
+/** @brief ACK flag: selective acknowledgement bitmap follows */
+#define RAW_SACK 0x02
+
+
+/** @brief Encoding or decoding position in a byte stream */
+typedef struct
+{
+  unsigned char *pos; /**< next byte */
+  unsigned char *end; /**< first byte behind the stream */
+} RAW_stream;
+
+
+/** @brief Appends the lowest byte of @a v, returns 0 if the stream is full */
+static int
+put8(RAW_stream * s, unsigned v)
+{
+  if (s->end - s->pos < 1) {
+    return 0;
+  }
+  *s->pos++ = (unsigned char)v;
+  return 1;
+}
+
+/** @brief Appends the lowest 16 bits of @a v big-endian, returns 0 if the stream is full */
+static int
+put16(RAW_stream * s, unsigned v)
+{
+  if (s->end - s->pos < 2) {
+    return 0;
+  }
+  s->pos[0] = (unsigned char)(v >> 8);
+  s->pos[1] = (unsigned char)v;
+  s->pos += 2;
+  return 1;
+}
+
+/** @brief Appends @a v as 32 bits big-endian, returns 0 if the stream is full */
+static int
+put32(RAW_stream * s, unsigned v)
+{
+  if (s->end - s->pos < 4) {
+    return 0;
+  }
+  s->pos[0] = (unsigned char)(v >> 24);
+  s->pos[1] = (unsigned char)(v >> 16);
+  s->pos[2] = (unsigned char)(v >> 8);
+  s->pos[3] = (unsigned char)v;
+  s->pos += 4;
+  return 1;
+}
+
+/** @brief Reads one byte into @a v, returns 0 at the end of the stream */
+static int
+get8(RAW_stream * s, unsigned *v)
+{
+  if (s->end - s->pos < 1) {
+    return 0;
+  }
+  *v = *s->pos++;
+  return 1;
+}
+
+/** @brief Reads 16 bits big-endian into @a v, returns 0 at the end of the stream */
+static int
+get16(RAW_stream * s, unsigned *v)
+{
+  if (s->end - s->pos < 2) {
+    return 0;
+  }
+  *v = (unsigned)s->pos[0] << 8 | s->pos[1];
+  s->pos += 2;
+  return 1;
+}
+
+/** @brief Reads 32 bits big-endian into @a v, returns 0 at the end of the stream */
+static int
+get32(RAW_stream * s, unsigned *v)
+{
+  if (s->end - s->pos < 4) {
+    return 0;
+  }
+  *v = (unsigned)s->pos[0] << 24 | (unsigned)s->pos[1] << 16 | (unsigned)s->pos[2] << 8 | s->pos[3];
+  s->pos += 4;
+  return 1;
+}
+
+/**
+ * @brief Encodes an XDT address
+ *
+ * return 1 on success, 0 on failure
+ */
+static int
+put_address(RAW_stream * s, XDT_address const *addr)
+{
+  size_t len = strnlen(addr->host, sizeof addr->host);
+
+  if (!put8(s, len) || s->end - s->pos < (long)len) {
+    return 0;
+  }
+  memcpy(s->pos, addr->host, len);
+  s->pos += len;
+
+  return put16(s, addr->port) && put32(s, addr->slot);
+}
+
+/**
+ * @brief Decodes an XDT address
+ *
+ * The host string is padded with zero bytes, so addresses may be
+ * compared by #XDT_ADDRESS_EQUAL.
+ *
+ * return 1 on success, 0 on failure
+ */
+static int
+get_address(RAW_stream * s, XDT_address * addr)
+{
+  unsigned len, port;
+
+  if (!get8(s, &len) || len >= sizeof addr->host || s->end - s->pos < (long)len) {
+    return 0;
+  }
+  memset(addr->host, 0, sizeof addr->host);
+  memcpy(addr->host, s->pos, len);
+  s->pos += len;
+
+  if (!get16(s, &port) || !get32(s, &addr->slot)) {
+    return 0;
+  }
+  addr->port = port;
+
+  return 1;
+}
+
+
+/**
+ * @brief Serializes a PDU message into the compact byte stream
+ *
+ * @param pdu points to the PDU message to be serialized
+ * @param stream buffer to encode the PDU into
+ * @param stream_len number of avaiable bytes in @a stream
+ *
+ * @return number of written bytes in stream on success, value < 0 on failure
+ */
+int
+serialize_pdu_raw(XDT_pdu * pdu, char *stream, size_t stream_len)
+{
+  RAW_stream s;
+
+  if (!stream || !stream_len || !pdu) {
+    return -2;
+  }
+  s.pos = (unsigned char *)stream;
+  s.end = s.pos + stream_len;
+
+  switch ((int)pdu->type) {
+  case DT:
+    {
+      XDT_dt *dt = &pdu->x.dt;
+
+      if (dt->length > XDT_DATA_MAX
+          || !put8(&s, DT) || !put8(&s, dt->eom ? RAW_EOM : 0) || !put32(&s, dt->sequ)
+          || !(dt->sequ == 1 ? put_address(&s, &dt->source_addr) && put_address(&s, &dt->dest_addr)
+               && put32(&s, dt->max_length) && put32(&s, dt->window) : put32(&s, dt->conn))
+          || !put16(&s, dt->length) || s.end - s.pos < (long)dt->length) {
+        return -10;
+      }
+      memcpy(s.pos, dt->data, dt->length);
+      s.pos += dt->length;
+    }
+    break;
+
+  case ACK:
+    {
+      XDT_ack *ack = &pdu->x.ack;
+
+      if (!put8(&s, ACK) || !put8(&s, ack->sack ? RAW_SACK : 0) || !put32(&s, ack->sequ)
+          || !(ack->sequ == 1 ? put_address(&s, &ack->source_addr) && put_address(&s, &ack->dest_addr)
+               && put32(&s, ack->max_length) : 1)
+          || !put32(&s, ack->conn) || !(ack->sack ? put32(&s, ack->sack) : 1)) {
+        return -20;
+      }
+    }
+    break;
+
+  case ABO:
+    if (!put8(&s, ABO) || !put8(&s, 0) || !put32(&s, pdu->x.abo.conn)) {
+      return -30;
+    }
+    break;
+
+  default:
+    return -40;
+  }
+
+  return (char *)s.pos - stream;
+}
+
+/**
+ * @brief Deserializes a PDU message from the compact byte stream
+ *
+ * The payload of a DT is not copied, XDT_dt.data points into @a stream instead.
+ *
+ * @param stream buffer containing the encoded PDU
+ * @param stream_len number of bytes in the @a stream
+ * @param pdu points to the PDU message to be deserialized
+ *
+ * @return number of read bytes from stream on success, value < 0 on failure
+ */
+int
+deserialize_pdu_raw(char *stream, size_t stream_len, XDT_pdu * pdu)
+{
+  RAW_stream s;
+  unsigned code, flags;
+
+  if (!stream || !stream_len || !pdu) {
+    return -2;
+  }
+  s.pos = (unsigned char *)stream;
+  s.end = s.pos + stream_len;
+
+  if (!get8(&s, &code) || !get8(&s, &flags)) {
+    return -1;
+  }
+  pdu->type = code;
+
+  switch (code) {
+  case DT:
+    {
+      XDT_dt *dt = &pdu->x.dt;
+
+      dt->code = code;
+      dt->eom = (flags & RAW_EOM) != 0;
+      if (!get32(&s, &dt->sequ)
+          || !(dt->sequ == 1 ? get_address(&s, &dt->source_addr) && get_address(&s, &dt->dest_addr)
+               && get32(&s, &dt->max_length) && get32(&s, &dt->window) : get32(&s, &dt->conn))
+          || !get16(&s, &dt->length) || dt->length > XDT_DATA_MAX || s.end - s.pos < (long)dt->length) {
+        return -10;
+      }
+      dt->data = (char *)s.pos;
+      s.pos += dt->length;
+    }
+    break;
+
+  case ACK:
+    {
+      XDT_ack *ack = &pdu->x.ack;
+
+      ack->code = code;
+      ack->sack = 0;
+      if (!get32(&s, &ack->sequ)
+          || !(ack->sequ == 1 ? get_address(&s, &ack->source_addr) && get_address(&s, &ack->dest_addr)
+               && get32(&s, &ack->max_length) : 1)
+          || !get32(&s, &ack->conn) || !((flags & RAW_SACK) ? get32(&s, &ack->sack) : 1)) {
+        return -20;
+      }
+    }
+    break;
+
+  case ABO:
+    pdu->x.abo.code = code;
+    if (!get32(&s, &pdu->x.abo.conn)) {
+      return -30;
+    }
+    break;
+
+  default:
+    return -40;
+  }
+
+  return (char *)s.pos - stream;
+}
+
+/**
+ * @brief Decodes the type and sequence number of a PDU in the compact byte stream only
+ *
+ * @param stream buffer containing the encoded PDU
+ * @param stream_len number of bytes in the @a stream
+ * @param type where to store the PDU type
+ * @param sequ where to store the sequence number (0 for ABOs)
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+int
+peek_pdu_raw(char *stream, size_t stream_len, long *type, unsigned *sequ)
+{
+  RAW_stream s;
+  unsigned code, flags;
+
+  if (!stream || !type || !sequ) {
+    return -2;
+  }
+  s.pos = (unsigned char *)stream;
+  s.end = s.pos + stream_len;
+
+  if (!get8(&s, &code) || !get8(&s, &flags)) {
+    return -1;
+  }
+  *type = code;
+  *sequ = 0;
+  if (code == DT || code == ACK) {
+    return get32(&s, sequ) ? 0 : -1;
+  }
+
+  return code == ABO ? 0 : -1;
+}
+
+
+/**
+ * @}
+ */
@@ -26,6 +26,7 @@
 
 #include "queue.h"
 
+#include <stdio.h>
 #include <errno.h>
 
 #include <sys/types.h>
@@ -33,6 +34,35 @@
 #include <sys/msg.h>
 
 
+/** @brief Size limit of System V messages assumed, if the actual one is unknown (Linux default) */
+#define QUEUE_MSGMAX 8192
+
+
+/**
+ * @brief Returns the size of the biggest message an XDT queue can hold
+ *
+ * The data size of System V messages is limited by the kernel parameter
+ * @e msgmax (see @e msgop(2)), on Linux read from @e /proc.
+ *
+ * @return size of message (type and data)
+ */
+size_t
+xdt_queue_msg_max(void)
+{
+  unsigned long max = QUEUE_MSGMAX;
+  FILE *f;
+
+  if ((f = fopen("/proc/sys/kernel/msgmax", "r"))) {
+    if (fscanf(f, "%lu", &max) != 1) {
+      max = QUEUE_MSGMAX;
+    }
+    fclose(f);
+  }
+
+  return max + sizeof (long);
+}
+
+
 /**
  * @brief Creates an XDT queue
  *
@@ -54,6 +84,60 @@ xdt_queue_create(XDT_queue * queue)
 }
 
 
+/**
+ * @brief Limits the size of an XDT queue
+ *
+ * Sets the number of data bytes the queue holds (@e msg_qbytes, see @e msgctl(2)).
+ * Only lowering the system's default @e msgmnb needs no privileges.
+ *
+ * @param queue points to an XDT queue
+ * @param bytes size limit of all messages (type and data) in the queue
+ *
+ * @return 0 on success, value < 0 on error (-1 if @e msgctl(2) failed)
+ */
+int
+xdt_queue_limit(XDT_queue * queue, size_t bytes)
+{
+  struct msqid_ds ds;
+
+  errno = 0;
+
+  if (!queue || bytes < sizeof (long)) {
+    errno = EINVAL;
+    return -2;
+  }
+
+  if (msgctl(queue->id, IPC_STAT, &ds) == -1) {
+    return -1;
+  }
+  ds.msg_qbytes = bytes - sizeof (long);
+  return msgctl(queue->id, IPC_SET, &ds);
+}
+
+
+/**
+ * @brief Returns the number of messages in an XDT queue
+ *
+ * @param queue points to an XDT queue
+ *
+ * @return number of messages, value < 0 on error (-1 if @e msgctl(2) failed)
+ */
+int
+xdt_queue_depth(XDT_queue * queue)
+{
+  struct msqid_ds ds;
+
+  errno = 0;
+
+  if (!queue) {
+    errno = EINVAL;
+    return -2;
+  }
+
+  return msgctl(queue->id, IPC_STAT, &ds) == -1 ? -1 : (int)ds.msg_qnum;
+}
+
+
 /**
  * @brief Reads a message from an XDT queue
  * 
@@ -116,6 +200,28 @@ xdt_queue_write(XDT_queue * queue, void *msg, size_t msg_size)
   return msgsnd(queue->id, msg, msg_size - sizeof (long), 0);
 }
 
+/**
+ * @brief Writes a message to an XDT queue without blocking
+ *
+ * @param queue points to an XDT queue
+ * @param msg points to the message
+ * @param msg_size size of the message (type and data) @a msg,
+ *        so the value must be at least the size of a @e long
+ *
+ * @return 0 on success, value < 0 on error (-1 if @e msgsnd(2) failed,
+ *         with @e errno set to @c EAGAIN if the queue is full)
+ */
+int
+xdt_queue_try_write(XDT_queue * queue, void *msg, size_t msg_size)
+{
+  errno = 0;
+
+  if (!queue || !msg || msg_size < sizeof (long)) {
+    return -2;
+  }
+  return msgsnd(queue->id, msg, msg_size - sizeof (long), IPC_NOWAIT);
+}
+
 /**
  * @brief Deletes the XDT queue
  *
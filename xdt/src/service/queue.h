@@ -13,11 +13,23 @@
  */
 
 
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
 #include "pdu.h"
 
 #include <xdt/sdu.h>
 
 
+#ifdef XDT_SHM_QUEUE
+
+/** @brief Name of the queue implementation chosen at configure time */
+# define XDT_QUEUE_BACKEND "shared memory ring"
+
+/** @brief Shared memory part of an XDT message queue (see queue_shm.c) */
+struct xdt_queue_ring;
+
 /**
  * @brief XDT message queue context
  *
@@ -25,13 +37,49 @@
  */
 typedef struct
 {
-  int id;
+  int id; /**< 0 if the queue exists, -1 if not */
+  struct xdt_queue_ring *ring; /**< ring mapped into dispatcher and instance process */
 } XDT_queue;
 
+#else
+
+/** @brief Name of the queue implementation chosen at configure time */
+# define XDT_QUEUE_BACKEND "System V message queue"
+
+/**
+ * @brief XDT message queue context
+ *
+ * Holds message queue information (use as an opaque type).
+ */
+typedef struct
+{
+  int id; /**< System V message queue identifier, -1 if the queue does not exist */
+} XDT_queue;
+
+#endif /* XDT_SHM_QUEUE */
+
+
+/**
+ * @brief Queue statistics of an instance
+ *
+ * Kept by the dispatcher, which writes to the queue without blocking.
+ */
+typedef struct
+{
+  unsigned long queued; /**< messages written to the queue */
+  unsigned long deferred; /**< messages held back while the queue was full */
+  unsigned long dropped; /**< PDUs dropped while the queue was full */
+  unsigned depth_max; /**< biggest number of messages seen in the queue */
+} XDT_queue_stats;
+
 
+size_t xdt_queue_msg_max(void);
 int xdt_queue_create(XDT_queue * queue);
+int xdt_queue_limit(XDT_queue * queue, size_t bytes);
+int xdt_queue_depth(XDT_queue * queue);
 int xdt_queue_read(XDT_queue * queue, void *msg, size_t msg_size, int type);
 int xdt_queue_write(XDT_queue * queue, void *msg, size_t msg_size);
+int xdt_queue_try_write(XDT_queue * queue, void *msg, size_t msg_size);
 int xdt_queue_delete(XDT_queue * queue);
 
 
@@ -0,0 +1,490 @@
+/**
+ * @file queue_shm.c
+ * @ingroup service
+ * @brief XDT message queue implementation (shared memory ring)
+ *
+ * This file implements the XDT queue by a lock-free single-producer/single-consumer
+ * ring buffer in a shared anonymous memory mapping. It is used instead of queue.c
+ * if the package is configured with @c --enable-shm-queue.
+ *
+ * The queue has to be created before @e fork(2), so the dispatcher (producer) and
+ * the instance process (consumer) share the ring. Messages are copied into the
+ * ring as variable length records (only the used bytes of a message) without any
+ * system call. Only if the consumer waits for an empty or the producer for a full
+ * ring, they are woken up by @e futex(2) calls on sequence counters in the ring.
+ *
+ * Messages consisting only of the @e long type value (i.e. timer wake-ups)
+ * are treated as signals: writing them only takes atomic operations and never
+ * blocks, so pending wake-ups of one type are coalesced.
+ * They are stored apart from the ring, at most once per type and delivered after
+ * all messages already in the ring. Reading with a type greater than 0 only
+ * regards these messages.
+ *
+ * As the mapping is inherited by every instance process forked later, the
+ * number of simultaneous queues is limited by the number of memory mappings
+ * per process (see @e vm.max_map_count), not by @e msgmni.
+ */
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+
+#include "queue.h"
+
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+/** @brief Number of bytes in the ring for message records (power of two) */
+#define QUEUE_CAPACITY (256 * 1024)
+
+/** @brief Number of different pending timer messages (signals) */
+#define QUEUE_SIGNALS 8
+
+/** @brief Size of the biggest packed message (type and data) a record holds */
+#define QUEUE_MSG_MAX (XDT_SDU_SIZE(XDT_DATA_MAX) > PDU_SIZE(XDT_DATA_MAX) ? XDT_SDU_SIZE(XDT_DATA_MAX) : PDU_SIZE(XDT_DATA_MAX))
+
+/** @brief Record size marking the rest of the ring as unused (the next record starts at the beginning) */
+#define QUEUE_WRAP ((size_t)-1)
+
+/** @brief Assumed cache line size, the counters of both sides are kept apart */
+#define CACHE_LINE 64
+
+
+/** @brief Message record in the ring, followed by the message */
+typedef struct
+{
+  size_t size; /**< size of the message (type and data) or #QUEUE_WRAP */
+} XDT_queue_record;
+
+/** @brief Shared memory part of an XDT message queue */
+struct xdt_queue_ring
+{
+  unsigned head; /**< number of bytes read (written by the consumer only) */
+  int consumer_waiting; /**< consumer waits on @a data_seq */
+  unsigned data_seq; /**< incremented on every message or signal written */
+  unsigned taken; /**< number of messages read */
+  char pad1[CACHE_LINE - 4 * sizeof (unsigned)];
+
+  unsigned tail; /**< number of bytes written (written by the producer only) */
+  int producer_waiting; /**< producer waits on @a space_seq */
+  unsigned space_seq; /**< incremented on every message read */
+  unsigned put; /**< number of messages written */
+  unsigned limit; /**< number of bytes the records may take, at most #QUEUE_CAPACITY */
+  char pad2[CACHE_LINE - 5 * sizeof (unsigned)];
+
+  long signals[QUEUE_SIGNALS]; /**< types of pending signal messages, 0 for free entries */
+
+  union
+  {
+    XDT_queue_record align; /**< aligns the records */
+    char bytes[QUEUE_CAPACITY]; /**< message records */
+  } data;
+};
+
+
+/** @brief Number of ring bytes a record of a message with @a size bytes takes */
+static unsigned
+record_size(size_t size)
+{
+  return (sizeof (XDT_queue_record) + size + sizeof (XDT_queue_record) - 1) / sizeof (XDT_queue_record) * sizeof (XDT_queue_record);
+}
+
+/** @brief Record at position @a pos of the ring */
+static XDT_queue_record *
+record_at(struct xdt_queue_ring *ring, unsigned pos)
+{
+  return (XDT_queue_record *) &ring->data.bytes[pos % QUEUE_CAPACITY];
+}
+
+
+/**
+ * @brief Waits until the counter @a seq differs from @a value
+ *
+ * @return 0 if woken up or the counter already changed, -1 on error (e.g. interrupted)
+ */
+static int
+futex_wait(unsigned *seq, unsigned value)
+{
+  if (syscall(SYS_futex, seq, FUTEX_WAIT, value, 0, 0, 0) == -1 && errno != EAGAIN) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief Increments the counter @a seq and wakes up the other side if it waits on it
+ */
+static void
+futex_post(unsigned *seq, int *waiting)
+{
+  __atomic_add_fetch(seq, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+    syscall(SYS_futex, seq, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+  }
+}
+
+/**
+ * @brief Takes the first pending signal message of type @a type
+ *
+ * @return the type of the signal message, 0 if there is none
+ */
+static long
+take_signal(struct xdt_queue_ring *ring, long type)
+{
+  int i;
+
+  for (i = 0; i < QUEUE_SIGNALS; ++i) {
+    long t = __atomic_load_n(&ring->signals[i], __ATOMIC_ACQUIRE);
+
+    if (t && (!type || t == type) && __atomic_compare_exchange_n(&ring->signals[i], &t, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return t;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Checks for pending signal messages
+ *
+ * @return 1 if there is at least one, 0 if not
+ */
+static int
+signal_pending(struct xdt_queue_ring *ring)
+{
+  int i;
+
+  for (i = 0; i < QUEUE_SIGNALS; ++i) {
+    if (__atomic_load_n(&ring->signals[i], __ATOMIC_SEQ_CST)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief Returns the size of the biggest message an XDT queue can hold
+ *
+ * @return size of message (type and data)
+ */
+size_t
+xdt_queue_msg_max(void)
+{
+  return QUEUE_MSG_MAX;
+}
+
+
+/**
+ * @brief Creates an XDT queue
+ *
+ * @param queue points to an XDT queue object
+ *
+ * @return 0 on success, value < 0 on error (-1 if @e mmap(2) failed)
+ */
+int
+xdt_queue_create(XDT_queue * queue)
+{
+  errno = 0;
+
+  if (!queue) {
+    errno = EINVAL;
+    return -2;
+  }
+
+  queue->id = -1;
+  queue->ring = mmap(0, sizeof *queue->ring, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (queue->ring == MAP_FAILED) {
+    queue->ring = 0;
+    return -1;
+  }
+  /* anonymous mappings are zero-filled, so the ring is empty */
+  queue->ring->limit = QUEUE_CAPACITY;
+  queue->id = 0;
+
+  return 0;
+}
+
+
+/**
+ * @brief Limits the size of an XDT queue
+ *
+ * @param queue points to an XDT queue
+ * @param bytes number of ring bytes the message records may take,
+ *        at most the ring's capacity is used
+ *
+ * @return 0 on success, value < 0 on error
+ */
+int
+xdt_queue_limit(XDT_queue * queue, size_t bytes)
+{
+  errno = 0;
+
+  if (!queue || !queue->ring || bytes < record_size(sizeof (long))) {
+    errno = EINVAL;
+    return -2;
+  }
+
+  queue->ring->limit = bytes < QUEUE_CAPACITY ? bytes : QUEUE_CAPACITY;
+  return 0;
+}
+
+
+/**
+ * @brief Returns the number of messages in an XDT queue
+ *
+ * Pending signal messages are not counted.
+ *
+ * @param queue points to an XDT queue
+ *
+ * @return number of messages, value < 0 on error
+ */
+int
+xdt_queue_depth(XDT_queue * queue)
+{
+  errno = 0;
+
+  if (!queue || !queue->ring) {
+    errno = EINVAL;
+    return -2;
+  }
+
+  return (int)(__atomic_load_n(&queue->ring->put, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->ring->taken, __ATOMIC_ACQUIRE));
+}
+
+
+/**
+ * @brief Reads a message from an XDT queue
+ *
+ * @param queue points to an XDT queue
+ * @param msg points to the buffer where to store the message
+ * @param msg_size size of the buffer @a msg points to
+ * @param type message type you are interested in (0 if no special interests)
+ *
+ * If type is 0, the function blocks until the next message is available.
+ * If type is greater than 0, the function immediatly returns, regardless of if such a message is available.
+ * In this case only signal messages are regarded.
+ *
+ * @return
+ * - on success size of message (type and data), so the value is at least the size of a @e long
+ * - 0 if type was set and no such message is available
+ * - value < 0 on error (-1 with @e errno set to @c EINTR if interrupted by a signal,
+ *   -3 with @e errno set to @c E2BIG if the message does not fit into @a msg)
+ */
+int
+xdt_queue_read(XDT_queue * queue, void *msg, size_t msg_size, int type)
+{
+  struct xdt_queue_ring *ring = queue->ring;
+
+  errno = 0;
+
+  if (msg_size < sizeof (long)) {
+    errno = EINVAL;
+    return -2;
+  }
+
+  if (type) {
+    return (*(long *)msg = take_signal(ring, type)) ? (int)sizeof (long) : 0;
+  }
+
+  for (;;) {
+    unsigned seq;
+    long t;
+    int empty;
+
+    if (ring->head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+      XDT_queue_record *record = record_at(ring, ring->head);
+      size_t size = record->size;
+
+      if (size == QUEUE_WRAP) {
+        /* skip the unused rest of the ring */
+        __atomic_store_n(&ring->head, ring->head + QUEUE_CAPACITY - ring->head % QUEUE_CAPACITY, __ATOMIC_RELEASE);
+        continue;
+      }
+      if (size > msg_size) {
+        errno = E2BIG;
+        return -3;
+      }
+      memcpy(msg, record + 1, size);
+      __atomic_store_n(&ring->head, ring->head + record_size(size), __ATOMIC_RELEASE);
+      __atomic_store_n(&ring->taken, ring->taken + 1, __ATOMIC_RELEASE);
+      futex_post(&ring->space_seq, &ring->producer_waiting);
+
+      return size;
+    }
+
+    if ((t = take_signal(ring, 0))) {
+      *(long *)msg = t;
+      return sizeof (long);
+    }
+
+    /* ring is empty: announce waiting, then check again before sleeping */
+    __atomic_store_n(&ring->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    seq = __atomic_load_n(&ring->data_seq, __ATOMIC_SEQ_CST);
+    empty = ring->head == __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) && !signal_pending(ring);
+    if (empty && futex_wait(&ring->data_seq, seq) < 0) {
+      __atomic_store_n(&ring->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+      return -1;
+    }
+    __atomic_store_n(&ring->consumer_waiting, 0, __ATOMIC_SEQ_CST);
+  }
+}
+
+
+/**
+ * @brief Writes a message record, optionally waiting for space in the ring
+ *
+ * @param queue points to an XDT queue
+ * @param msg points to the message
+ * @param msg_size size of the message (type and data)
+ * @param wait not 0 to block while the ring is full
+ *
+ * @return 0 on success, value < 0 on error (see xdt_queue_write() and xdt_queue_try_write())
+ */
+static int
+write_record(XDT_queue * queue, void *msg, size_t msg_size, int wait)
+{
+  struct xdt_queue_ring *ring;
+  XDT_queue_record *record;
+  unsigned pad;
+
+  errno = 0;
+
+  if (!queue || !msg || msg_size < sizeof (long) || msg_size > QUEUE_MSG_MAX) {
+    return -2;
+  }
+  ring = queue->ring;
+
+  if (msg_size == sizeof (long)) {
+    long type = *(long *)msg;
+    int i;
+
+    for (i = 0; i < QUEUE_SIGNALS; ++i) {
+      long t = 0;
+
+      if (__atomic_compare_exchange_n(&ring->signals[i], &t, type, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) || t == type) {
+        futex_post(&ring->data_seq, &ring->consumer_waiting);
+        return 0;
+      }
+    }
+    errno = EAGAIN;
+    return -1;
+  }
+
+  /* a record must not wrap around, then the rest of the ring is skipped */
+  pad = QUEUE_CAPACITY - ring->tail % QUEUE_CAPACITY;
+  if (pad >= record_size(msg_size)) {
+    pad = 0;
+  }
+
+  while (ring->limit - (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) < pad + record_size(msg_size)) {
+    unsigned seq;
+    int full;
+
+    if (!wait || ring->tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+      /* the limit is too small for the record and the wrap around */
+      errno = EAGAIN;
+      return -1;
+    }
+
+    /* ring is full: announce waiting, then check again before sleeping */
+    __atomic_store_n(&ring->producer_waiting, 1, __ATOMIC_SEQ_CST);
+    seq = __atomic_load_n(&ring->space_seq, __ATOMIC_SEQ_CST);
+    full = ring->limit - (ring->tail - __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST)) < pad + record_size(msg_size);
+    if (full && futex_wait(&ring->space_seq, seq) < 0) {
+      __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST);
+      return -1;
+    }
+    __atomic_store_n(&ring->producer_waiting, 0, __ATOMIC_SEQ_CST);
+  }
+
+  if (pad) {
+    record_at(ring, ring->tail)->size = QUEUE_WRAP;
+    __atomic_store_n(&ring->tail, ring->tail + pad, __ATOMIC_RELEASE);
+  }
+  record = record_at(ring, ring->tail);
+  record->size = msg_size;
+  memcpy(record + 1, msg, msg_size);
+  __atomic_store_n(&ring->put, ring->put + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&ring->tail, ring->tail + record_size(msg_size), __ATOMIC_RELEASE);
+  futex_post(&ring->data_seq, &ring->consumer_waiting);
+
+  return 0;
+}
+
+/**
+ * @brief Writes a message to an XDT queue
+ *
+ * Blocks while the ring has not enough space, signal messages never block.
+ *
+ * @param queue points to an XDT queue
+ * @param msg points to the message
+ * @param msg_size size of the message (type and data) @a msg,
+ *        so the value must be at least the size of a @e long
+ *
+ * @return 0 on success, value < 0 on error (-1 with @e errno set to @c EINTR if interrupted
+ *         by a signal or to @c EAGAIN if too many different signal messages are pending)
+ */
+int
+xdt_queue_write(XDT_queue * queue, void *msg, size_t msg_size)
+{
+  return write_record(queue, msg, msg_size, 1);
+}
+
+/**
+ * @brief Writes a message to an XDT queue without blocking
+ *
+ * @param queue points to an XDT queue
+ * @param msg points to the message
+ * @param msg_size size of the message (type and data) @a msg,
+ *        so the value must be at least the size of a @e long
+ *
+ * @return 0 on success, value < 0 on error (-1 with @e errno set to @c EAGAIN
+ *         if the ring is full or too many different signal messages are pending)
+ */
+int
+xdt_queue_try_write(XDT_queue * queue, void *msg, size_t msg_size)
+{
+  return write_record(queue, msg, msg_size, 0);
+}
+
+/**
+ * @brief Deletes the XDT queue
+ *
+ * Only the mapping of the calling process is removed,
+ * the ring persists until the other side unmapped it or exited too.
+ *
+ * @return 0 on success, value < 0 on error (-1 if @e munmap(2) failed)
+ */
+int
+xdt_queue_delete(XDT_queue * queue)
+{
+  struct xdt_queue_ring *ring;
+
+  errno = 0;
+
+  if (!queue || !queue->ring) {
+    return -2;
+  }
+
+  ring = queue->ring;
+  queue->id = -1;
+  queue->ring = 0;
+  return munmap(ring, sizeof *ring);
+}
+
+
+/**
+ * @}
+ */
@@ -15,6 +15,7 @@
 #include "service.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 /** @brief states of automata */
 enum {
@@ -23,56 +24,62 @@ enum {
     AWAIT_CORRECT_DT
 };
 
-/** @brief connection number of data transfer */
-static unsigned conn = 0;
-
-/** @brief sequ number of data transfer */
-static unsigned sequ = 0;
-
-/** @brief connection timer */
-static XDT_timer timer;
-
 /** @brief Timeout constant */
 static double TIMEOUT = 10.;
 
-/** @brief sender running flag */
-static int running = 1;
-
-/** @brief current state */
-static int state = IDLE;
+/** @brief Maximum delay of an ACK */
+static double ACK_DELAY = .02;
 
-/** @brief timer message type */
+/** @brief timer message types */
 enum {
     timer_msg_min_pred = pdu_msg_max_succ,
     TI,
+    TA,
     timer_msg_max_succ
 };
 
-static void receiver_idle(void) 
+static void receiver_idle(XDT_receiver *r, XDT_message *msg)
 {
-  XDT_message msg;
   XDT_pdu* pdu_dt;
   XDT_pdu pdu_ack;
   XDT_sdu sdu;
 
-  get_message(&msg);
-
-  if (msg.type == DT) {
-    pdu_dt = &msg.pdu;
+  if (msg->type == DT) {
+    pdu_dt = &msg->pdu;
 
     // if first DT received
     if (pdu_dt->x.dt.sequ == 1) {
       
       // update sequ
-      sequ = pdu_dt->x.dt.sequ;
+      r->sequ = pdu_dt->x.dt.sequ;
+
+      // agree to the offered payload size, as far as we accept it
+      if (pdu_dt->x.dt.max_length < r->max_length) {
+        r->max_length = pdu_dt->x.dt.max_length < XDT_DATA_DEFAULT ? XDT_DATA_DEFAULT : pdu_dt->x.dt.max_length;
+      }
+      // acknowledge a full window at once, else every window waits for the ACK delay
+      if (pdu_dt->x.dt.window && r->ack_every >= pdu_dt->x.dt.window) {
+        r->ack_every = pdu_dt->x.dt.window > 1 ? pdu_dt->x.dt.window - 1 : 1;
+      }
+      if (r->held) {
+        r->entry_size = PDU_DT_SIZE(r->max_length);
+        if (!(r->reorder = calloc(RECEIVER_REORDER, r->entry_size))) {
+          perror("allocating reorder buffer failed");
+          exit(EXIT_FAILURE);
+        }
+        for (unsigned i = 0; i < RECEIVER_REORDER; i++) {
+          pdu_slot_init(r->reorder + i * r->entry_size);
+        }
+      }
 
       // create and send XDATind
       sdu.type = XDATind;
-      sdu.x.dat_ind.conn = conn;
+      sdu.x.dat_ind.conn = r->conn;
       sdu.x.dat_ind.sequ = pdu_dt->x.dt.sequ;
       sdu.x.dat_ind.eom = pdu_dt->x.dt.eom;
       sdu.x.dat_ind.length = pdu_dt->x.dt.length;
-      XDT_COPY_DATA(&pdu_dt->x.dt.data, &sdu.x.dat_ind.data, pdu_dt->x.dt.length);
+      sdu.x.dat_ind.shared = 0;
+      sdu.x.dat_ind.data = pdu_dt->x.dt.data;
 
       send_sdu(&sdu);
 
@@ -81,252 +88,279 @@ static void receiver_idle(void)
       pdu_ack.x.ack.code = ACK;
       pdu_ack.x.ack.source_addr = pdu_dt->x.dt.dest_addr;
       pdu_ack.x.ack.dest_addr = pdu_dt->x.dt.source_addr;
-      pdu_ack.x.ack.conn = conn;
+      pdu_ack.x.ack.conn = r->conn;
       pdu_ack.x.ack.sequ = pdu_dt->x.dt.sequ;
+      pdu_ack.x.ack.sack = 0;
+      pdu_ack.x.ack.max_length = r->max_length;
 
       send_pdu(&pdu_ack);
 
       // start timer
-      set_timer(&timer, TIMEOUT);
+      set_timer(&r->timer, TIMEOUT);
 
-      state = CONNECTED;
+      r->state = CONNECTED;
     }
   }
 }
 
-static void receiver_connect(void) {
-  XDT_message msg;
-  XDT_pdu* pdu;
+/**
+ * @brief deliver DT in sequence to the consumer
+ *
+ * @return not 0 if the DT carries the end of message
+ */
+static int deliver(XDT_receiver *r, XDT_pdu *pdu) {
   XDT_sdu sdu;
-  XDT_pdu pdu_send;
-
-  get_message(&msg);
-
-  if (msg.type == DT)
-  {
-    pdu = &msg.pdu;
 
-    // reset timer
-    reset_timer(&timer);
-    set_timer(&timer,TIMEOUT);
-
-    conn = pdu->x.dt.conn;
+  // create and send XDATind
+  sdu.type = XDATind;
+  sdu.x.dat_ind.conn = r->conn;
+  sdu.x.dat_ind.sequ = pdu->x.dt.sequ;
+  sdu.x.dat_ind.eom = pdu->x.dt.eom;
+  sdu.x.dat_ind.length = pdu->x.dt.length;
+  sdu.x.dat_ind.shared = 0;
+  sdu.x.dat_ind.data = pdu->x.dt.data;
 
-    // if last package arrived
-    if (pdu->x.dt.eom == 1) {
-
-      // create and send ACK
-      pdu_send.type = ACK;
-      pdu_send.x.ack.code = ACK;
-      pdu_send.x.ack.conn = conn;
-      pdu_send.x.ack.dest_addr = pdu->x.dt.source_addr;
-      pdu_send.x.ack.source_addr = pdu->x.dt.dest_addr;
-      pdu_send.x.ack.sequ = pdu->x.dt.sequ;
+  send_sdu(&sdu);
 
-      send_pdu(&pdu_send);
+  r->sequ = pdu->x.dt.sequ;
 
-      // create and send XDATind
-      sdu.type = XDATind;
-      sdu.x.dat_ind.conn = conn;
-      sdu.x.dat_ind.sequ = pdu->x.dt.sequ;
-      sdu.x.dat_ind.eom = pdu->x.dt.eom;
-      sdu.x.dat_ind.length = pdu->x.dt.length;
-      XDT_COPY_DATA(&pdu->x.dt.data, &sdu.x.dat_ind.data, pdu->x.dt.length);
-
-      send_sdu(&sdu);
-
-      // create and send XDIsind
-      sdu.type = XDISind;
-      sdu.x.dis_ind.conn = pdu->x.dt.conn;
-
-      send_sdu(&sdu);
-
-      running = 0;
-      state = IDLE;
-
-    } else {
-
-      // if wrong sequ
-      if (pdu->x.dt.sequ != (sequ + 1)) {
-        state = AWAIT_CORRECT_DT;
-      } else {
+  return pdu->x.dt.eom;
+}
 
-        // valid sequ received
-        sequ = pdu->x.dt.sequ;
+/** @brief reorder buffer entry with index slot */
+static XDT_pdu *reorder_slot(XDT_receiver *r, unsigned slot) {
+  return (XDT_pdu *)(r->reorder + slot * r->entry_size);
+}
 
-        // create and send XDATind
-        sdu.type = XDATind;
-        sdu.x.dat_ind.conn = conn;
-        sdu.x.dat_ind.sequ = pdu->x.dt.sequ;
-        sdu.x.dat_ind.eom = pdu->x.dt.eom;
-        sdu.x.dat_ind.length = pdu->x.dt.length;
-        XDT_COPY_DATA(&pdu->x.dt.data, &sdu.x.dat_ind.data, pdu->x.dt.length);
+/**
+ * @brief keep out-of-order DT in the reorder buffer (selective repeat only)
+ *
+ * Only DTs acknowledgeable by the SACK bitmap are kept, others are dropped.
+ */
+static void hold(XDT_receiver *r, XDT_pdu *pdu) {
+  unsigned slot = pdu->x.dt.sequ % RECEIVER_REORDER;
 
-        send_sdu(&sdu);
+  if (pdu->x.dt.sequ - (r->sequ + 2) < RECEIVER_REORDER && !r->held[slot]
+      && pdu->x.dt.length <= r->max_length) {
+    pdu_slot_copy(reorder_slot(r, slot), pdu);
+    r->held[slot] = 1;
+  }
+}
 
-        // create and send ACK
-        pdu_send.type = ACK;
-        pdu_send.x.ack.code = ACK;
-        pdu_send.x.ack.source_addr = pdu->x.dt.dest_addr;
-        pdu_send.x.ack.dest_addr = pdu->x.dt.source_addr;
-        pdu_send.x.ack.conn = conn;
-        pdu_send.x.ack.sequ = pdu->x.dt.sequ;
+/** @brief SACK bitmap of the DTs in the reorder buffer */
+static unsigned sack_bits(XDT_receiver *r) {
+  unsigned bits = 0;
 
-        send_pdu(&pdu_send);
+  if (r->reorder) {
+    for (unsigned i = 0; i < XDT_SACK_BITS; i++) {
+      if (r->held[(r->sequ + 2 + i) % RECEIVER_REORDER]) {
+        bits |= 1u << i;
       }
     }
+  }
 
-  // if timer expired
-  } else if (msg.type == TI) {
-    // create and send ABO
-    pdu_send.type = ABO;
-    pdu_send.x.abo.code = ABO;
-    pdu_send.x.abo.conn = conn;
-    send_pdu(&pdu_send);
+  return bits;
+}
 
-    // create and send ABORTInd
-    sdu.type = XABORTind;
-    send_sdu(&sdu);
+/** @brief send cumulative ACK for all delivered DTs, selective for buffered ones */
+static void send_ack(XDT_receiver *r) {
+  XDT_pdu pdu_send;
 
-    running = 0;
-    state = IDLE;
+  pdu_send.type = ACK;
+  pdu_send.x.ack.code = ACK;
+  pdu_send.x.ack.conn = r->conn;
+  pdu_send.x.ack.sequ = r->sequ;
+  pdu_send.x.ack.sack = sack_bits(r);
+
+  send_pdu(&pdu_send);
+
+  // nothing left to acknowledge
+  if (r->unacked) {
+    r->unacked = 0;
+    reset_timer(&r->delay);
   }
 }
 
-static void
-receiver_await_correct_dt(void)
-{
+/**
+ * @brief acknowledge delivered DT, coalesced with following ones
+ *
+ * The ACK is sent after ack_every DTs or when the delay timer expires.
+ */
+static void ack_later(XDT_receiver *r) {
+  if (++r->unacked >= r->ack_every) {
+    send_ack(r);
+  } else if (r->unacked == 1) {
+    set_timer(&r->delay, ACK_DELAY);
+  }
+}
 
-  XDT_message msg;
-  XDT_pdu *pdu;
-  XDT_pdu pdu_send;
+/** @brief implement receiver's CONNECTED and AWAIT_CORRECT_DT states */
+static void receiver_connect(XDT_receiver *r, XDT_message *msg) {
+  XDT_pdu* pdu;
   XDT_sdu sdu;
+  XDT_pdu pdu_send;
 
-  get_message(&msg);
-
-    // if timer expired
-    if(msg.type == TI) {
-      
-      // create and send ABO
-      pdu_send.type = ABO;
-      pdu_send.x.abo.code = ABO;
-      pdu_send.x.abo.conn = conn;
-      send_pdu(&pdu_send);
-
-      // create and send XABORTind
-      sdu.type = XABORTind;
-      sdu.x.abort_ind.conn = conn;
-      send_sdu(&sdu);
-
-      state = IDLE;
-      running = 0;
+  if (msg->type == DT) {
+    pdu = &msg->pdu;
 
-    } else if (msg.type == DT) {
+    // reset timer
+    reset_timer(&r->timer);
+    set_timer(&r->timer,TIMEOUT);
+
+    r->conn = pdu->x.dt.conn;
+
+    // if wrong sequ
+    if (pdu->x.dt.sequ != (r->sequ + 1)) {
+      if (r->reorder) {
+        // selective repeat: buffer DT, tell the sender what is missing
+        hold(r, pdu);
+        send_ack(r);
+        r->state = CONNECTED;
+      } else {
+        // flush delayed ACK, so the sender knows where to go back to
+        if (r->unacked) {
+          send_ack(r);
+        }
+        r->state = AWAIT_CORRECT_DT;
+      }
 
-      pdu = &msg.pdu;
+    } else {
+      // valid sequ received, buffered DTs following it are in sequence now
+      int eom = deliver(r, pdu), drained = 0;
 
-      conn = pdu->x.dt.conn;
+      while (!eom && r->reorder && r->held[(r->sequ + 1) % RECEIVER_REORDER]) {
+        unsigned slot = (r->sequ + 1) % RECEIVER_REORDER;
 
-      // reset timer
-      reset_timer(&timer);
-      set_timer(&timer,TIMEOUT);
+        r->held[slot] = 0;
+        eom = deliver(r, reorder_slot(r, slot));
+        drained = 1;
+      }
 
       // if last package arrived
-      if (pdu->x.dt.eom == 1) {
-
-        // create and send ACK
-        pdu_send.type = ACK;
-        pdu_send.x.ack.code = pdu->x.dt.code;
-        pdu_send.x.ack.conn = pdu->x.dt.conn;
-        pdu_send.x.ack.dest_addr = pdu->x.dt.source_addr;
-        pdu_send.x.ack.source_addr = pdu->x.dt.dest_addr;
-        pdu_send.x.ack.sequ = pdu->x.dt.sequ;
-
-        send_pdu(&pdu_send);
-
-        // create and send XDATind
-        sdu.type = XDATind;
-        sdu.x.dat_ind.conn = conn;
-        sdu.x.dat_ind.sequ = pdu->x.dt.sequ;
-        sdu.x.dat_ind.eom = pdu->x.dt.eom;
-        sdu.x.dat_ind.length = pdu->x.dt.length;
-        XDT_COPY_DATA(&pdu->x.dt.data, &sdu.x.dat_ind.data, pdu->x.dt.length);
+      if (eom) {
+        send_ack(r);
 
-        send_sdu(&sdu);
-
-        // create XDIsind
+        // create and send XDISind
         sdu.type = XDISind;
-        sdu.x.dis_ind.conn = pdu->x.dt.conn;
+        sdu.x.dis_ind.conn = r->conn;
 
         send_sdu(&sdu);
 
-        running = 0;
-        state = IDLE;
+        r->running = 0;
+        r->state = IDLE;
 
       } else {
-
-        // if wrong sequ
-        if (pdu->x.dt.sequ != (sequ + 1)) {
-          state = AWAIT_CORRECT_DT;
+        // a closed gap is acknowledged at once
+        if (drained) {
+          send_ack(r);
         } else {
-          // valid sequ received
+          ack_later(r);
+        }
 
-          // create and send XDATind
-          sdu.type = XDATind;
-          sdu.x.dat_ind.conn = conn;
-          sdu.x.dat_ind.sequ = pdu->x.dt.sequ;
-          sdu.x.dat_ind.eom = pdu->x.dt.eom;
-          sdu.x.dat_ind.length = pdu->x.dt.length;
-          XDT_COPY_DATA(&pdu->x.dt.data, &sdu.x.dat_ind.data, pdu->x.dt.length);
+        r->state = CONNECTED;
+      }
+    }
 
-          send_sdu(&sdu);
+  // if delayed ACK is due
+  } else if (msg->type == TA) {
+    if (r->unacked) {
+      send_ack(r);
+    }
 
-          // create and send ACK
-          pdu_send.type = ACK;
-          pdu_send.x.ack.code = ACK;
-          pdu_send.x.ack.source_addr = pdu->x.dt.dest_addr;
-          pdu_send.x.ack.dest_addr = pdu->x.dt.source_addr;
-          pdu_send.x.ack.conn = conn;
-          pdu_send.x.ack.sequ = pdu->x.dt.sequ;
+  // if timer expired
+  } else if (msg->type == TI) {
+    count_stat(XDT_STAT_TI_EXPIRED, 1);
 
-          send_pdu(&pdu_send);
+    // create and send ABO
+    pdu_send.type = ABO;
+    pdu_send.x.abo.code = ABO;
+    pdu_send.x.abo.conn = r->conn;
+    send_pdu(&pdu_send);
 
-          //update sequ
-          sequ = pdu->x.dt.sequ;
+    // create and send XABORTind
+    sdu.type = XABORTind;
+    sdu.x.abort_ind.conn = r->conn;
+    send_sdu(&sdu);
 
-          // reset and set timer
-          reset_timer(&timer);
-          set_timer(&timer,TIMEOUT);
+    r->running = 0;
+    r->state = IDLE;
+  }
+}
 
-          state = CONNECTED;
-        }
-      }
+/**
+ * @brief Initializes a receiver instance context
+ *
+ * The timer is created for the instance currently served by the runtime environment.
+ *
+ * @param r points to the receiver context
+ * @param connection the connection number assigned to the data transfer
+ * @param config protocol parameters: number of DTs to acknowledge by one ACK (at most),
+ *        selective repeat (out-of-order DTs are buffered instead of dropped) and biggest payload size
+ */
+void
+receiver_init(XDT_receiver *r, unsigned connection, XDT_config const *config)
+{
+  r->state = IDLE;
+  r->running = 1;
+  r->conn = connection;
+  r->sequ = 0;
+  r->ack_every = config->ack_every;
+  r->max_length = config->max_length;
+  r->unacked = 0;
+  create_timer(&r->timer, TI);
+  create_timer(&r->delay, TA);
+
+  r->entry_size = 0;
+  r->reorder = 0;
+  r->held = 0;
+  if (config->selective && !(r->held = calloc(RECEIVER_REORDER, sizeof *r->held))) {
+    perror("allocating reorder buffer failed");
+    exit(EXIT_FAILURE);
   }
 }
 
 /** 
  * @brief State scheduler
  *
- * Calls the appropriate function associated with the current protocol state.
+ * Calls the appropriate function associated with the current protocol state
+ * to process the message @a msg.
+ *
+ * @param r points to the receiver context
+ * @param msg message read by get_message() or delivered by the dispatcher
+ *
+ * @return not 0 while the receiver is running, 0 when the data transfer has finished
  */
-static void
-run_receiver(void)
+int
+receiver_handle(XDT_receiver *r, XDT_message *msg)
 {
-  while(running != 0) {
+  //printf("\nZustand Receiver: %d\n",r->state);
 
-    //printf("\nZustand Receiver: %d\n",state);
-
-    if(state == IDLE) {
-      receiver_idle();
-    }
-    else if(state == AWAIT_CORRECT_DT) {
-      receiver_await_correct_dt();
-    }
-    else if(state == CONNECTED) {
-      receiver_connect();
-    }
+  if(r->state == IDLE) {
+    receiver_idle(r, msg);
+  }
+  else if(r->state == AWAIT_CORRECT_DT || r->state == CONNECTED) {
+    receiver_connect(r, msg);
   }
-} /* run_receiver */
+
+  return r->running;
+} /* receiver_handle */
+
+/**
+ * @brief Releases the resources of a receiver instance context
+ *
+ * @param r points to the receiver context
+ */
+void
+receiver_cleanup(XDT_receiver *r)
+{
+  delete_timer(&r->timer);
+  delete_timer(&r->delay);
+
+  free(r->reorder);
+  free(r->held);
+  r->reorder = 0;
+  r->held = 0;
+}
 
 /** 
  * @brief Receiver instance entry function
@@ -339,24 +373,31 @@ run_receiver(void)
  * - get_message() to read SDU, PDU and timer messages from the queue
  * - send_sdu() to send an SDU message to the consumer,     
  * - send_pdu() to send a PDU message to the sending peer,
- * - #XDT_COPY_DATA to copy the message payload,        
+ * - pdu_slot_copy() to keep a DT along with its payload,
  * - create_timer() to create a timer associated with a message type,
- * - set_timer() to arm a timer (on expiration a timer associated message is  
- *   put into the queue)                    
- * - reset_timer() to disarm a timer (all timer associated messages are removed  
- *   from the queue)
+ * - set_timer() to arm a timer (on expiration a timer associated message is
+ *   delivered by get_message()), re-arming only stores the new deadline
+ * - reset_timer() to disarm a timer (no timer message is delivered afterwards)
  * - delete_timer() to delete a timer.
+ * - count_stat() to update the connection's statistics.
  *
  * @param connection the connection number assigned to the data transfer
  *        handled by this instance
+ * @param config protocol parameters (see receiver_init())
  */
 void
-start_receiver(unsigned connection)
+start_receiver(unsigned connection, XDT_config const *config)
 {
-  conn = connection;
-  create_timer(&timer, TI);
-  run_receiver();
-  delete_timer(&timer);
+  XDT_receiver r;
+  XDT_message msg;
+
+  receiver_init(&r, connection, config);
+
+  do {
+    get_message(&msg);
+  } while (receiver_handle(&r, &msg));
+
+  receiver_cleanup(&r);
 
 } /* start_receiver */
 
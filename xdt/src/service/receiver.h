@@ -7,7 +7,51 @@
 #ifndef RECEIVER_H
 #define RECEIVER_H
 
-void start_receiver(unsigned connection);
+/**
+ * @addtogroup service
+ * @{
+ */
+
+#include "service.h"
+
+
+/** @brief Default number of DTs acknowledged by one ACK */
+#define RECEIVER_ACK_EVERY 1
+
+/** @brief Maximum number of DTs acknowledged by one ACK */
+#define RECEIVER_ACK_EVERY_MAX 64
+
+/** @brief Number of out-of-order DTs a selective repeat receiver buffers (one per SACK bit) */
+#define RECEIVER_REORDER XDT_SACK_BITS
+
+/**
+ * @brief Receiver instance context
+ *
+ * Holds the complete protocol state of one receiving data transfer, so several
+ * receivers may be served by the same process (see XDT_config.single_process).
+ */
+typedef struct
+{
+  int state; /**< current state */
+  int running; /**< receiver running flag */
+  unsigned conn; /**< connection number of data transfer */
+  unsigned sequ; /**< sequence number of the last DT delivered to the consumer */
+  unsigned ack_every; /**< number of DTs to acknowledge by one ACK (at most) */
+  unsigned unacked; /**< number of delivered DTs not yet acknowledged */
+  XDT_timer timer; /**< connection timer */
+  XDT_timer delay; /**< delayed ACK timer */
+  unsigned max_length; /**< biggest payload size accepted, after connection establishment agreed with the sending peer */
+  size_t entry_size; /**< size of an entry in @a reorder: a DT with up to @a max_length payload bytes */
+  char *reorder; /**< out-of-order DTs indexed by the sequence number modulo #RECEIVER_REORDER, allocated on connection establishment, 0 for go-back-N */
+  unsigned char *held; /**< flags of the valid entries in @a reorder, 0 for go-back-N */
+} XDT_receiver;
+
+
+void receiver_init(XDT_receiver * receiver, unsigned connection, XDT_config const *config);
+int receiver_handle(XDT_receiver * receiver, XDT_message * msg);
+void receiver_cleanup(XDT_receiver * receiver);
+
+void start_receiver(unsigned connection, XDT_config const *config);
 
 
 /**
@@ -13,8 +13,10 @@
 
 #include "sender.h"
 #include "service.h"
+#include <xdt/log.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 /** @brief states of automata */
 enum {
@@ -34,69 +36,237 @@ enum {
   timer_msg_max_succ
 };
 
-/** @brief connection timer t1 t2 t3 */
-static XDT_timer t1,t2,t3;
-
-/** @brief Timeout constants t1 t2 t3*/
+/** @brief Timeout constants t1 t3, t2 is adapted to the round trip time (see sample_rtt()) */
 static double TIMEOUT1 = 5.;
-static double TIMEOUT2 = 5.;
 static double TIMEOUT3 = 10.;
 
-/** @brief connection number of data transfer */
-static unsigned conn = 0;
+/** @brief Initial timeout t2 before the first round trip time sample */
+static double TIMEOUT2 = 1.;
+
+/** @brief current time in seconds */
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** @brief limit timeout to the bounds given by the command line */
+static double bound_rto(XDT_sender *s, double rto) {
+  return rto < s->rto_min ? s->rto_min : rto > s->rto_max ? s->rto_max : rto;
+}
+
+/** @brief measure the round trip time of DT sequ, unless another DT is measured */
+static void start_timing(XDT_sender *s, unsigned sequ) {
+  if (!s->timing) {
+    s->timing = 1;
+    s->timed = sequ;
+    s->timed_at = now();
+  }
+}
+
+/**
+ * @brief update the smoothed round trip time and t2 by a new sample (RFC 6298)
+ *
+ * A new sample also ends the exponential backoff.
+ */
+static void sample_rtt(XDT_sender *s) {
+  double rtt = now() - s->timed_at;
+
+  record_rtt(rtt);
+
+  if (s->srtt < 0) {
+    s->srtt = rtt;
+    s->rttvar = rtt / 2;
+  } else {
+    double delta = s->srtt > rtt ? s->srtt - rtt : rtt - s->srtt;
+
+    s->rttvar = .75 * s->rttvar + .25 * delta;
+    s->srtt = .875 * s->srtt + .125 * rtt;
+  }
+  s->rto = bound_rto(s, s->srtt + 4 * s->rttvar);
+  s->timing = 0;
+
+  set_peer_rtt(s->srtt, s->rttvar);
+}
+
+/** @brief double t2 after it expired (exponential backoff) */
+static void back_off(XDT_sender *s) {
+  s->rto = bound_rto(s, 2 * s->rto);
+}
+
+/** @brief number of buffered (sent but not yet acknowledged) DTs */
+static unsigned used_slots(XDT_sender *s) {
+  return s->next - s->base;
+}
+
+/** @brief number of free buffer entries */
+static unsigned free_slots(XDT_sender *s) {
+  return s->window - used_slots(s);
+}
+
+/**
+ * @brief allocate the buffer for the window
+ *
+ * Each entry holds a DT with the negotiated payload size, so the buffer is
+ * allocated on connection establishment.
+ */
+static void init_buffer(XDT_sender *s) {
+  s->entry_size = PDU_DT_SIZE(s->max_length);
+  if (!(s->buffer = calloc(s->mask + 1, s->entry_size))) {
+    perror("allocating sender buffer failed");
+    exit(EXIT_FAILURE);
+  }
+  for (unsigned i = 0; i <= s->mask; i++) {
+    pdu_slot_init(s->buffer + i * s->entry_size);
+  }
+}
+
+/** @brief buffer entry of the DT with sequence number sequ */
+static XDT_pdu *buffer_slot(XDT_sender *s, unsigned sequ) {
+  return (XDT_pdu *)(s->buffer + (sequ & s->mask) * s->entry_size);
+}
+
+/**
+ * @brief send cumulative XDATconf for all accepted XDATrequs
+ *
+ * The producer may send as many XDATrequs beyond as there are free buffer entries.
+ */
+static void confirm(XDT_sender *s) {
+  XDT_sdu sdu;
+
+  sdu.type = XDATconf;
+  sdu.x.dat_conf.conn = s->conn;
+  sdu.x.dat_conf.sequ = s->requ_sequ;
+  sdu.x.dat_conf.window = free_slots(s);
+  sdu.x.dat_conf.max_length = s->max_length;
+  send_sdu(&sdu);
 
-/** @brief current state */
-static int state = IDLE;
+  s->granted = s->requ_sequ + sdu.x.dat_conf.window;
+}
 
-/** @brief last visited state */
-static int last_state = -1;
+/** @brief retransmit buffered DT with sequence number sequ */
+static void retransmit(XDT_sender *s, unsigned sequ) {
+  XDT_pdu *pdu = buffer_slot(s, sequ);
 
-/** @brief last sequ */
-static unsigned int last_sequ = 0;
+  send_pdu(pdu);
 
-/** @brief null pdu for buffer */
-static XDT_pdu null;
+  // Karn's rule: the ACK of a retransmitted DT is no round trip time sample
+  if (s->timing && s->timed == sequ) {
+    s->timing = 0;
+  }
 
-/** @brief index for buffer */ 
-static int buffer_index = -1;
+  s->retransmissions++;
+  s->retransmitted += pdu->x.dt.length;
+  count_stat(XDT_STAT_RETRANSMITTED, 1);
+}
 
-/** @brief temporary index for buffer */
-static int temp_index = -1;
+/**
+ * @brief check if a cumulative XDATconf is due
+ *
+ * The producer is confirmed when it used up all of it's grant or when at least
+ * half of it's window is used up and the grant is extended by half a window.
+ * So it is not flooded with XDATconfs while the buffer is more than half full.
+ */
+static int worth_confirming(XDT_sender *s) {
+  unsigned left = s->granted - s->requ_sequ;
+  unsigned extension = s->requ_sequ + free_slots(s) - s->granted;
 
-/** @brief n from go_back_n */
-#define n 5
+  return !left || (left <= s->window / 2 && extension >= s->window / 2 && extension <= s->window);
+}
 
-/** @brief buffer, that saves n pdu DT */
-static XDT_pdu buffer [n];
+/**
+ * @brief free the producer's payload ring space of the DTs from base up to sequ
+ *
+ * The ring space is freed cumulatively, so the newest payload kept is freed only.
+ */
+static void free_kept(XDT_sender *s, unsigned sequ) {
+  for (unsigned n = sequ + 1 - s->base; n--; ) {
+    XDT_sender_kept *kept = &s->kept[(s->base + n) & s->mask];
 
-/** @brief sender running flag */
-static int running = 1;
+    if (kept->length) {
+      free_payload(kept->offset, kept->length);
+      break;
+    }
+  }
+}
 
-/** @brief shift not null elements left */
-static void shift_buffer(void) {
+/**
+ * @brief delete acknowledged DTs from buffer
+ *
+ * The ACK covers all DTs up to it's sequence number, so they are released
+ * at once, along with their payloads in the producer's payload ring.
+ * DTs acknowledged selectively are marked to be skipped by GO_BACK_N,
+ * the missing DTs before them are retransmitted (selective repeat).
+ *
+ * @return number of released DTs
+ */
+static unsigned acknowledge(XDT_sender *s, XDT_pdu *ack) {
+  unsigned sequ = ack->x.ack.sequ, released = 0, highest;
 
-  for (int i = 0; i < n; i++) {
-    if (buffer[i].x.dt.sequ == 0) {
-      if (i == (n-1)) break;
-      buffer[i] = buffer[i+1];
-      buffer[i+1] = null;
+  if (sequ - s->base < used_slots(s)) {
+    released = sequ + 1 - s->base;
+    if (s->timing && s->timed - s->base < released) {
+      sample_rtt(s);
     }
+    free_kept(s, sequ);
+    s->base = sequ + 1;
   }
+  highest = s->base;
+
+  for (unsigned i = 0, bits = ack->x.ack.sack; bits; i++, bits >>= 1) {
+    unsigned sacked = sequ + 2 + i;
+
+    if ((bits & 1) && sacked - s->base < used_slots(s)) {
+      s->sacked[sacked & s->mask] = 1;
+      highest = sacked;
+    }
+  }
+
+  // selective repeat: retransmit the gaps below the highest selectively
+  // acknowledged DT at once, each only once until T2 expires
+  if (highest != s->base) {
+    if (s->recovered - s->base > used_slots(s)) {
+      s->recovered = s->base;
+    }
+    for (; s->recovered - s->base < highest - s->base; s->recovered++) {
+      if (!s->sacked[s->recovered & s->mask]) {
+        retransmit(s, s->recovered);
+      }
+    }
+  }
+
+  return released;
 }
 
-/** @brief implement sender's IDLE state */
-static void sender_idle(void) {
-  XDT_message msg;
+/** @brief finish data transfer, if the DT carrying the end of message is acknowledged */
+static void finish(XDT_sender *s, XDT_pdu *ack) {
+  XDT_sdu sdu;
 
-  get_message(&msg);
+  if (s->last_sequ && ack->x.ack.sequ == s->last_sequ) {
+    sdu.type = XDISind;
+    sdu.x.dis_ind.conn = ack->x.ack.conn;
+    send_sdu(&sdu);
+
+    if (xdt_logging(XDT_LOG_MESSAGES)) {
+      printf("connection %u: %lu DTs (%lu bytes) retransmitted, srtt %.3f ms, rto %.3f ms\n", s->conn,
+             s->retransmissions, s->retransmitted, s->srtt * 1e3, s->rto * 1e3);
+    }
 
-  last_state = state;
+    s->running = 0;
+    s->state = IDLE;
+  }
+}
+
+/** @brief implement sender's IDLE state */
+static void sender_idle(XDT_sender *s, XDT_message *msg) {
+  s->last_state = s->state;
 
   XDT_sdu* sdu;
   XDT_pdu pdu;
 
-  if (msg.type == XDATrequ) {
-      sdu = &msg.sdu;
+  if (msg->type == XDATrequ) {
+      sdu = &msg->sdu;
 
       // create and send DT
       pdu.type = DT;
@@ -105,327 +275,411 @@ static void sender_idle(void) {
       pdu.x.dt.source_addr = sdu->x.dat_requ.source_addr;
       pdu.x.dt.sequ = sdu->x.dat_requ.sequ;
       pdu.x.dt.eom = sdu->x.dat_requ.eom;
-      XDT_COPY_DATA(&sdu->x.dat_requ.data,&pdu.x.dt.data,sdu->x.dat_requ.length);
+
+      // offer the payload size wanted by the producer, as far as we agree to it
+      if (sdu->x.dat_requ.max_length < s->max_length) {
+        s->max_length = sdu->x.dat_requ.max_length < XDT_DATA_DEFAULT ? XDT_DATA_DEFAULT : sdu->x.dat_requ.max_length;
+      }
+      pdu.x.dt.max_length = s->max_length;
+      pdu.x.dt.window = s->window;
+      // the first DT is not retransmitted, so the payload is not copied
+      pdu.x.dt.data = sdu->x.dat_requ.data;
       pdu.x.dt.length = sdu->x.dat_requ.length;
 
       send_pdu(&pdu);
+      start_timing(s, pdu.x.dt.sequ);
 
       // start timer t1
-      set_timer(&t1,TIMEOUT1);
+      set_timer(&s->t1,TIMEOUT1);
 
       // change state
-      state = AWAIT_ACK;
+      s->state = AWAIT_ACK;
     }
 }
 
 /** @brief implement sender AWAIT_ACK state */
-static void sender_await_ack(void) {
-  XDT_message msg;
-
-  get_message(&msg);
-
-  last_state = state;
+static void sender_await_ack(XDT_sender *s, XDT_message *msg) {
+  s->last_state = s->state;
 
   XDT_sdu sdu;
   XDT_pdu* pdu;
 
-  if (msg.type == ACK) {
+  if (msg->type == ACK) {
     // reset timer t1
-    reset_timer(&t1);
+    reset_timer(&s->t1);
     
-    pdu = &msg.pdu;
+    pdu = &msg->pdu;
 
-    conn = pdu->x.ack.conn;
+    s->conn = pdu->x.ack.conn;
 
     // if first ack received
     if (pdu->x.ack.sequ == 1) {
-      // create and send XDATconf
-      sdu.type = XDATconf;
-      sdu.x.dat_conf.conn = conn;
-      sdu.x.dat_conf.sequ = pdu->x.ack.sequ;
-      send_sdu(&sdu);
+      if (s->timing) {
+        sample_rtt(s);
+      }
+
+      // the receiver may agree to a smaller payload size only
+      if (pdu->x.ack.max_length < s->max_length) {
+        s->max_length = pdu->x.ack.max_length < XDT_DATA_DEFAULT ? XDT_DATA_DEFAULT : pdu->x.ack.max_length;
+      }
+      init_buffer(s);
+
+      // send XDATconf, the producer may fill the whole buffer
+      s->requ_sequ = 1;
+      confirm(s);
 
       // start timers t2, t3
-      set_timer(&t2,TIMEOUT2);
-      set_timer(&t3,TIMEOUT3);
+      set_timer(&s->t2, s->rto);
+      set_timer(&s->t3,TIMEOUT3);
 
-      state = CONNECTED;
+      s->state = CONNECTED;
     }
 
   // if timer t1 expired
-  } else if (msg.type == T1) {
+  } else if (msg->type == T1) {
     // create and send XABORTind
     sdu.type = XABORTind;
     send_sdu(&sdu);
 
     // end program
-    running = 0;
-    state = IDLE;
+    s->running = 0;
+    s->state = IDLE;
   }
 }
 
 /** @brief implement sender CONNECTED state */
-static void sender_connected(void) {
-  XDT_message msg;
-
-  get_message(&msg);
-
+static void sender_connected(XDT_sender *s, XDT_message *msg) {
   XDT_sdu* sdu_recv;
   XDT_pdu* pdu_recv;
 
-  XDT_sdu sdu_conf, sdu_abort_ind, sdu_break_ind, sdu_xdisind;
-  XDT_pdu pdu;
-
-  last_state = state;
+  XDT_sdu sdu_abort_ind, sdu_break_ind;
+  XDT_sender_kept *kept;
+  XDT_pdu *pdu;
 
-  if (msg.type == ACK) {
-      // reset and set timer t2
-      reset_timer(&t2);
-      set_timer(&t2, TIMEOUT2);
+  s->last_state = s->state;
 
-      pdu_recv = &msg.pdu;
+  if (msg->type == ACK) {
+      pdu_recv = &msg->pdu;
 
-      // check buffer
-      for (int i = 0; i < n; i++) {
-        // if received Ack belongs to DT in buffer delete DT
-        if (buffer[i].x.dt.sequ == pdu_recv->x.ack.sequ) {
-          //printf("                                       DT wurde bestaetigt, Index vorher: %d\n\n", buffer_index);
-          buffer[i] = null;
-          shift_buffer();
-          buffer_index--;
-          break;
-        }
+      // if received Ack belongs to DTs in buffer delete DTs,
+      // reset and set timer t2 on progress only
+      if (acknowledge(s, pdu_recv)) {
+        reset_timer(&s->t2);
+        set_timer(&s->t2, s->rto);
       }
 
       // if last ACK then state = IDLE and send_sdu(XDISind)
-      if (pdu_recv->x.ack.sequ == last_sequ) {
-        sdu_xdisind.type = XDISind;
-        sdu_xdisind.x.dis_ind.conn = pdu_recv->x.ack.conn;
-
-        send_sdu(&sdu_xdisind);
+      finish(s, pdu_recv);
 
-        running = 0;
-        state = IDLE;
-      }
-      
 
-    } else if (msg.type == ABO) {
-      pdu_recv = &msg.pdu;
+    } else if (msg->type == ABO) {
+      pdu_recv = &msg->pdu;
 
       // create and send XABORTind
       sdu_abort_ind.type = XABORTind;
       sdu_abort_ind.x.abort_ind.conn = pdu_recv->x.abo.conn;
       send_sdu(&sdu_abort_ind);
-      running = 0;
-      state = IDLE;
+      s->running = 0;
+      s->state = IDLE;
+
+    } else if (msg->type == XDATrequ) {
+      sdu_recv = &msg->sdu;
+
+      // payload does not fit into the buffer entry -> abort
+      if (sdu_recv->x.dat_requ.length > s->max_length) {
+        sdu_abort_ind.type = XABORTind;
+        sdu_abort_ind.x.abort_ind.conn = s->conn;
+        send_sdu(&sdu_abort_ind);
+        s->running = 0;
+        s->state = IDLE;
+        return;
+      }
 
-    } else if (msg.type == XDATrequ) {
-      sdu_recv = &msg.sdu;
-      
-      conn = sdu_recv->x.dat_requ.conn;
+      // sequence numbers are consecutive, so the DT is created in its buffer entry
+      if (!used_slots(s)) {
+        s->base = s->next = sdu_recv->x.dat_requ.sequ;
+      }
+      s->sacked[s->next & s->mask] = 0;
+      kept = &s->kept[s->next & s->mask];
+      pdu = pdu_slot_init(buffer_slot(s, s->next++));
 
       // create and send DT
-      pdu.type = DT;
-      pdu.x.dt.code = DT;
-      pdu.x.dt.dest_addr = sdu_recv->x.dat_requ.dest_addr;
-      pdu.x.dt.source_addr = sdu_recv->x.dat_requ.source_addr;
-      pdu.x.dt.conn = conn;
-      pdu.x.dt.sequ = sdu_recv->x.dat_requ.sequ;
-      pdu.x.dt.eom = sdu_recv->x.dat_requ.eom;
-      XDT_COPY_DATA(&sdu_recv->x.dat_requ.data,&pdu.x.dt.data,sdu_recv->x.dat_requ.length);
-      pdu.x.dt.length = sdu_recv->x.dat_requ.length;
-
-      send_pdu(&pdu);
+      pdu->type = DT;
+      pdu->x.dt.code = DT;
+      pdu->x.dt.dest_addr = sdu_recv->x.dat_requ.dest_addr;
+      pdu->x.dt.source_addr = sdu_recv->x.dat_requ.source_addr;
+      pdu->x.dt.conn = s->conn;
+      pdu->x.dt.sequ = sdu_recv->x.dat_requ.sequ;
+      pdu->x.dt.eom = sdu_recv->x.dat_requ.eom;
+      // a payload in the producer's payload ring stays there until acknowledged
+      if (keep_payload(&kept->offset)) {
+        kept->length = sdu_recv->x.dat_requ.length;
+        pdu->x.dt.data = sdu_recv->x.dat_requ.data;
+      } else {
+        kept->length = 0;
+        XDT_COPY_DATA(sdu_recv->x.dat_requ.data,pdu->x.dt.data,sdu_recv->x.dat_requ.length);
+      }
+      pdu->x.dt.length = sdu_recv->x.dat_requ.length;
 
-      // save Copy of DT in buffer
-      buffer_index++;
-      buffer[buffer_index] = pdu;
+      send_pdu(pdu);
+      start_timing(s, pdu->x.dt.sequ);
+      s->requ_sequ = pdu->x.dt.sequ;
 
-      if (buffer_index == (n-1)) {
+      if (!free_slots(s)) {
         // buffer is full -> send BREAKind
-        state = BREAK;
-        temp_index = buffer_index;
+        s->state = BREAK;
+        count_stat(XDT_STAT_BREAKS, 1);
         sdu_break_ind.type = XBREAKind;
-        sdu_break_ind.x.break_ind.conn = conn;
+        sdu_break_ind.x.break_ind.conn = s->conn;
 
         // reset and set timer t2
-        reset_timer(&t2);
-        set_timer(&t2,TIMEOUT2);
+        reset_timer(&s->t2);
+        set_timer(&s->t2, s->rto);
 
         send_sdu(&sdu_break_ind);
-      } else {
-
-        // create and send XDATconf
-        sdu_conf.type = XDATconf;
-        sdu_conf.x.dat_conf.conn = sdu_recv->x.dat_requ.conn;
-        sdu_conf.x.dat_conf.sequ = sdu_recv->x.dat_requ.sequ;
-        send_sdu(&sdu_conf);
+      } else if (!pdu->x.dt.eom && worth_confirming(s)) {
+        confirm(s);
       }
 
-      // reset and set timer t3
-      reset_timer(&t3);
-      set_timer(&t3,TIMEOUT3);
-
-      // if last xdatrequ update last sequ
+      // reset and set timer t3, unless the producer has finished
+      reset_timer(&s->t3);
       if (sdu_recv->x.dat_requ.eom == 1) {
-        last_sequ = sdu_recv->x.dat_requ.sequ;
+        // if last xdatrequ update last sequ
+        s->last_sequ = sdu_recv->x.dat_requ.sequ;
+      } else {
+        set_timer(&s->t3,TIMEOUT3);
       }
 
-    } else if (msg.type == T2) {
-      temp_index = buffer_index;
-      state = GO_BACK_N;
+    } else if (msg->type == T2) {
+      if (used_slots(s)) {
+        back_off(s);
+      }
+      s->resend = s->base;
+      s->state = GO_BACK_N;
+      count_stat(XDT_STAT_GO_BACK_N, 1);
 
-    } else if (msg.type == T3) {
+    } else if (msg->type == T3) {
       sdu_abort_ind.type = XABORTind;
       send_sdu(&sdu_abort_ind);
 
-      running = 0;
-      state = IDLE;
+      s->running = 0;
+      s->state = IDLE;
     }
 }
 
 /** @brief implement sender GO_BACK_N state */
-static void sender_go_back_n(void) {
-  XDT_pdu pdu_go_back_n;
-
-  pdu_go_back_n = buffer[n-temp_index-1];
-
-  temp_index--;
-  send_pdu(&pdu_go_back_n);
+static void sender_go_back_n(XDT_sender *s) {
+  // oldest unacknowledged DT first, skip selectively acknowledged ones
+  while (s->resend != s->next && s->sacked[s->resend & s->mask]) {
+    s->resend++;
+  }
+  if (s->resend != s->next) {
+    retransmit(s, s->resend++);
+  }
 
   // last elemenent
-  if (temp_index == -1) {
+  if (s->resend == s->next) {
+    s->recovered = s->next;
+
     //reset and set t2
-    reset_timer(&t2);
-    set_timer(&t2,TIMEOUT2);
-    if (last_state == BREAK) {
-      state = BREAK;
+    reset_timer(&s->t2);
+    set_timer(&s->t2, s->rto);
+    if (s->last_state == BREAK) {
+      s->state = BREAK;
     } else {
-      state = CONNECTED;
+      s->state = CONNECTED;
     }
   }
 }
 
 /** @brief implement sender BREAK state */
-static void sender_break(void) {
-  XDT_message msg;
-
-  get_message(&msg);
-
+static void sender_break(XDT_sender *s, XDT_message *msg) {
   XDT_sdu sdu;
   XDT_pdu* pdu;
 
-  last_state = state;
+  s->last_state = s->state;
 
-  if (msg.type == ABO) {
-      pdu = &msg.pdu;
+  if (msg->type == ABO) {
+      pdu = &msg->pdu;
 
       // create and send XABORTind
       sdu.type = XABORTind;
       sdu.x.abort_ind.conn = pdu->x.abo.conn;
       send_sdu(&sdu);
-      running = 0;
-      state = IDLE;
+      s->running = 0;
+      s->state = IDLE;
 
-    } else if (msg.type == ACK) {
+    } else if (msg->type == ACK) {
 
-      pdu = &msg.pdu;
+      pdu = &msg->pdu;
 
-      // reset and set timers t2 and t3
-      reset_timer(&t2);
-      set_timer(&t2,TIMEOUT2);
+      // reset and set timers t2 and t3 on progress
+      if (acknowledge(s, pdu)) {
+        reset_timer(&s->t2);
+        set_timer(&s->t2, s->rto);
 
-      reset_timer(&t3);
-      set_timer(&t3,TIMEOUT3);
-
-      // check buffer
-      for (int i = 0; i < n; i++) {
-        if (buffer[i].x.dt.sequ == pdu->x.ack.sequ) {
-          // printf("                                       DT wurde bestaetigt, Index vorher: %d\n\n", buffer_index);
-
-          // if last ack form last element in buffer arrived -> send XDATconf to go on
-          if (pdu->x.ack.sequ == buffer[buffer_index].x.dt.sequ) {
-            sdu.type = XDATconf;
-            sdu.x.dat_conf.conn = pdu->x.ack.conn;
-            sdu.x.dat_conf.sequ = pdu->x.ack.sequ;
-            send_sdu(&sdu);
-
-            state = CONNECTED;
-          }
-
-          buffer[i] = null;
-          shift_buffer();
-          buffer_index--;
-
-          break;
+        reset_timer(&s->t3);
+        if (!s->last_sequ) {
+          set_timer(&s->t3,TIMEOUT3);
         }
       }
+      finish(s, pdu);
 
-    } else if (msg.type == T2) {
-      state = GO_BACK_N;
+      // if at least half of the buffer is free again -> send XDATconf to go on
+      if (s->running && free_slots(s) * 2 >= s->window) {
+        confirm(s);
+        s->state = CONNECTED;
+      }
+
+    } else if (msg->type == T2) {
+      if (used_slots(s)) {
+        back_off(s);
+      }
+      s->resend = s->base;
+      s->state = GO_BACK_N;
+      count_stat(XDT_STAT_GO_BACK_N, 1);
 
-    } else if (msg.type == T3) {
+    } else if (msg->type == T3) {
       sdu.type = XABORTind;
       send_sdu(&sdu);
 
-      running = 0;
-      state = IDLE;
+      s->running = 0;
+      s->state = IDLE;
     }
 }
 
-static void
-print_buffer(void) 
+/**
+ * @brief Initializes a sender instance context
+ *
+ * The timers are created for the instance currently served by the runtime environment,
+ * the round trip time estimate is taken over from its peer service if known.
+ *
+ * @param s points to the sender context
+ * @param config protocol parameters: window (1 to #SENDER_WINDOW_MAX), bounds of the
+ *        retransmission timeout (at most #SENDER_RTO_MAX) and biggest payload size
+ */
+void
+sender_init(XDT_sender *s, XDT_config const *config)
 {
-  printf("Bufferindex = %d\n",buffer_index);
-  for (int i = 0; i < n; i++) {
-    printf("Buffer Index %d : %u , %ld\n", i,buffer[i].x.dt.sequ,buffer[i].type);
+  unsigned size = 1;
+
+  s->state = IDLE;
+  s->last_state = -1;
+  s->running = 1;
+  s->conn = 0;
+  s->last_sequ = 0;
+  s->requ_sequ = 0;
+  s->granted = 0;
+  s->retransmissions = 0;
+  s->retransmitted = 0;
+
+  s->rto_min = config->rto_min / 1e3;
+  s->rto_max = config->rto_max / 1e3;
+  s->rto = bound_rto(s, TIMEOUT2);
+  s->srtt = -1;
+  s->rttvar = 0;
+  s->timing = 0;
+
+  // a connection to a known peer starts with its round trip time
+  get_peer_rtt(&s->srtt, &s->rttvar);
+  if (s->srtt >= 0) {
+    s->rto = bound_rto(s, s->srtt + 4 * s->rttvar);
   }
-}
 
-static void
-init_buffer(void)
-{
-  // initialize buffer
-  null.x.dt.sequ = 0;
-  for (int i = 0; i < n; i++) {
-    buffer[i] = null;
+  create_timer(&s->t1, T1);
+  create_timer(&s->t2, T2);
+  create_timer(&s->t3, T3);
+
+  // buffer entries are counted by the next power of two
+  while (size < config->window) {
+    size <<= 1;
+  }
+  if (!(s->sacked = calloc(size, sizeof *s->sacked)) || !(s->kept = calloc(size, sizeof *s->kept))) {
+    perror("allocating sender buffer failed");
+    exit(EXIT_FAILURE);
   }
+  s->mask = size - 1;
+  s->window = config->window;
+  s->base = s->next = s->resend = s->recovered = 0;
+  s->max_length = config->max_length;
+  s->entry_size = 0;
+  s->buffer = 0;
 }
 
 /** 
  * @brief State scheduler
  *
- * Calls the appropriate function associated with the current protocol state.
+ * Calls the appropriate function associated with the current protocol state
+ * to process the message @a msg. The GO_BACK_N state does not consume any message,
+ * so it is run until all buffered DTs are repeated. The repeated DTs are held
+ * back and sent in batches (see hold_pdus()).
+ *
+ * @param s points to the sender context
+ * @param msg message read by get_message() or delivered by the dispatcher
+ *
+ * @return not 0 while the sender is running, 0 when the data transfer has finished
  */
-static void
-run_sender(void)
+int
+sender_handle(XDT_sender *s, XDT_message *msg)
 {
-  do {
-    //printf("\nZustand Sender: %d\n",state);
-    switch (state) {
-    case (IDLE):
-      sender_idle();
-      break;
+  //printf("\nZustand Sender: %d\n",s->state);
+  if (msg->type == T1) {
+    count_stat(XDT_STAT_T1_EXPIRED, 1);
+  } else if (msg->type == T2) {
+    count_stat(XDT_STAT_T2_EXPIRED, 1);
+  } else if (msg->type == T3) {
+    count_stat(XDT_STAT_T3_EXPIRED, 1);
+  }
 
-    case (AWAIT_ACK):
-      sender_await_ack();
-      break;
+  switch (s->state) {
+  case (IDLE):
+    sender_idle(s, msg);
+    break;
 
-    case (CONNECTED):
-      sender_connected();
-      break;
+  case (AWAIT_ACK):
+    sender_await_ack(s, msg);
+    break;
 
-    case (GO_BACK_N):
-      sender_go_back_n();
-      break;
+  case (CONNECTED):
+    sender_connected(s, msg);
+    break;
 
-    case (BREAK):
-      sender_break();
-      break;
+  case (BREAK):
+    sender_break(s, msg);
+    break;
+  }
+
+  // the repeated DTs leave by as few system calls as possible
+  if (s->running && s->state == GO_BACK_N) {
+    hold_pdus();
+    while (s->running && s->state == GO_BACK_N) {
+      sender_go_back_n(s);
     }
-  } while (running);
+    flush_pdus();
+  }
 
-} /* run_sender */
+  return s->running;
+} /* sender_handle */
+
+/**
+ * @brief Releases the resources of a sender instance context
+ *
+ * @param s points to the sender context
+ */
+void
+sender_cleanup(XDT_sender *s)
+{
+  delete_timer(&s->t1);
+  delete_timer(&s->t2);
+  delete_timer(&s->t3);
+
+  free(s->buffer);
+  free(s->sacked);
+  free(s->kept);
+  s->buffer = 0;
+  s->sacked = 0;
+  s->kept = 0;
+}
 
 /** 
  * @brief Sender instance entry function
@@ -438,30 +692,34 @@ run_sender(void)
  * - get_message() to read SDU, PDU and timer messages from the queue
  * - send_sdu() to send an SDU message to the producer,
  * - send_pdu() to send a PDU message to the receiving peer,
- * - #XDT_COPY_DATA to copy the message payload,	 
+ * - keep_payload() and free_payload() to buffer a payload in the producer's
+ *   payload ring, #XDT_COPY_DATA to copy it else,
  * - create_timer() to create a timer associated with a message type,
  * - set_timer() to arm a timer (on expiration a timer associated message is
- *   put into the queue)
- * - reset_timer() to disarm a timer (all timer associated messages are removed
- *   from the queue)         
+ *   delivered by get_message()), re-arming only stores the new deadline
+ * - reset_timer() to disarm a timer (no timer message is delivered afterwards)
  * - delete_timer() to delete a timer.      
+ * - get_peer_rtt() and set_peer_rtt() to share the round trip time estimate
+ *   with other connections to the same peer service.
+ * - count_stat() and record_rtt() to update the connection's statistics.
+ *
+ * @param config protocol parameters (see sender_init())
  */
 void
-start_sender(void)
+start_sender(XDT_config const *config)
 {
-  create_timer(&t1, T1);
-  create_timer(&t2, T2);
-  create_timer(&t3, T3);
+  XDT_sender s;
+  XDT_message msg;
 
-  init_buffer();
+  sender_init(&s, config);
 
-  run_sender();
+  do {
+    get_message(&msg);
+  } while (sender_handle(&s, &msg));
 
-  delete_timer(&t1);
-  delete_timer(&t2);
-  delete_timer(&t3);
+  sender_cleanup(&s);
 } /* start_sender */
 
 /**
  * @}	
- */  
\ No newline at end of file
+ */  
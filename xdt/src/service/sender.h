@@ -12,7 +12,80 @@
  * @{
  */
 
-void start_sender(void);
+#include "service.h"
+
+
+/** @brief Default n from go_back_n: number of unacknowledged DT PDUs the sender buffers */
+#define SENDER_WINDOW 5
+
+/** @brief Biggest n from go_back_n */
+#define SENDER_WINDOW_MAX 65536
+
+/** @brief Default lower bound of the retransmission timeout (T2) in milliseconds */
+#define SENDER_RTO_MIN 50
+
+/** @brief Default and biggest upper bound of the retransmission timeout (T2) in milliseconds */
+#define SENDER_RTO_MAX 5000
+
+/** @brief Payload of a buffered DT kept in the producer's payload ring (see keep_payload()) */
+typedef struct
+{
+  unsigned offset; /**< ring offset of the payload */
+  unsigned length; /**< number of payload bytes, 0 if the payload is copied into the buffer entry */
+} XDT_sender_kept;
+
+/**
+ * @brief Sender instance context
+ *
+ * Holds the complete protocol state of one sending data transfer, so several
+ * senders may be served by the same process (see XDT_config.single_process).
+ */
+typedef struct
+{
+  int state; /**< current state */
+  int last_state; /**< last visited state */
+  int running; /**< sender running flag */
+
+  unsigned conn; /**< connection number of data transfer */
+  unsigned last_sequ; /**< sequence number of the DT carrying the end of message */
+  unsigned requ_sequ; /**< sequence number of the newest XDATrequ accepted */
+  unsigned granted; /**< sequence number up to which the producer may send XDATrequs (see XDT_xdat_conf) */
+
+  XDT_timer t1; /**< connection establishment timer */
+  XDT_timer t2; /**< retransmission timer */
+  XDT_timer t3; /**< producer inactivity timer */
+
+  unsigned window; /**< maximum number of DTs in @a buffer */
+  unsigned base; /**< sequence number of the oldest DT in @a buffer */
+  unsigned next; /**< sequence number of the next DT to put into @a buffer */
+  unsigned resend; /**< sequence number of the next DT to retransmit in GO_BACK_N state */
+  unsigned mask; /**< number of entries in @a buffer minus one (a power of two minus one) */
+  unsigned max_length; /**< biggest payload size offered to, after connection establishment negotiated with the receiving peer */
+  size_t entry_size; /**< size of an entry in @a buffer: a DT with up to @a max_length payload bytes */
+  char *buffer; /**< ring of sent but not yet acknowledged DTs indexed by the masked sequence number, allocated on connection establishment */
+  unsigned char *sacked; /**< flags of the DTs in @a buffer acknowledged selectively (not to retransmit) */
+  XDT_sender_kept *kept; /**< payloads of the DTs in @a buffer left in the producer's payload ring */
+  unsigned recovered; /**< sequence number up to which gaps reported by SACKs are retransmitted */
+
+  double rto; /**< current retransmission timeout (T2) in seconds */
+  double rto_min; /**< lower bound of @a rto in seconds */
+  double rto_max; /**< upper bound of @a rto in seconds */
+  double srtt; /**< smoothed round trip time in seconds, negative before the first sample */
+  double rttvar; /**< round trip time variation in seconds */
+  int timing; /**< if not 0, the round trip time of DT @a timed is measured */
+  unsigned timed; /**< sequence number of the DT measured */
+  double timed_at; /**< time DT @a timed was sent */
+
+  unsigned long retransmissions; /**< number of retransmitted DTs */
+  unsigned long retransmitted; /**< number of retransmitted payload bytes */
+} XDT_sender;
+
+
+void sender_init(XDT_sender * sender, XDT_config const *config);
+int sender_handle(XDT_sender * sender, XDT_message * msg);
+void sender_cleanup(XDT_sender * sender);
+
+void start_sender(XDT_config const *config);
 
 
 /**
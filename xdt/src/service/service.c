@@ -42,20 +42,33 @@
 
 #include "service.h"
 #include "queue.h"
+#include "conntable.h"
+#include "sender.h"
+#include "receiver.h"
+#include "wheel.h"
+#include "tunnel.h"
+#include "shard.h"
 
-#include <xdt/timer.h>
+#include <xdt/log.h>
+#include <xdt/payload.h>
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <signal.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
 
 #include <unistd.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 
 
@@ -79,29 +92,32 @@
  */
 #define QOR(f) if (errno!=EINTR) { perror(f); should_quit=1; } continue;
 
+/** @brief Like QOR(), but returns from serving a single message */
+#define QOR_RETURN(f) { if (errno!=EINTR) { perror(f); should_quit=1; } return XDT_SERVICE_NA; }
 
-/** @brief Number of maximum simultaneous connections to serve */
-#define MAX_CONNECTIONS 5
+/**
+ * @brief Type of the message waking an instance process to check its timers
+ *
+ * Put into the queue by the dispatcher when the instance's timerfd expires.
+ * No protocol timer uses this type (their types follow it).
+ */
+#define TIMER_WAKEUP pdu_msg_max_succ
 
-/** @brief Instance context data */
-typedef struct
-{
-  int role; /**< type of instance (sender, receiver or none) */
-  pid_t pid; /**< process id of this instance */
+/** @brief Number of epoll events processed per wait */
+#define MAX_EVENTS 64
 
-  unsigned real_conn; /**< data transfer connection number assigned by the receiver */
-  unsigned mapped_conn; /**< mapped local connection number (maybe different from @a real_conn in sender instance) */
+/** @brief Most messages held back per instance while its queue is full, further ones are dropped */
+#define BACKLOG_MAX 1024
 
-  XDT_address producer; /**< source address (only needed for sender instance) */
-  XDT_address consumer; /**< destination address (only needed for sender instance) */
+/** @brief Time until held back messages are written again (milliseconds) */
+#define BACKLOG_RETRY_MS 1
 
-  int user_sock; /**< unix domain socket for communication with associated user */
-  int peer_sock; /**< UDP socket for communication with associated peer */
-  struct sockaddr_in receiver;  /**< sending socket address of receiving peer (only needed for sender instance) */
-  socklen_t receiver_len; /**< size of the @a receiver address */
+/** @brief Number of messages written to or held back from a queue between two samples of its depth */
+#define DEPTH_SAMPLE 64
+
+/** @brief Most PDUs an instance takes from its peer socket in a row before it looks at its queue (see XDT_config.direct) */
+#define DIRECT_BURST 32
 
-  XDT_queue queue; /**< message queue beween dispatcher and the service instance */
-} XDT_instance;
 
 /** @brief Flag indicating the dispatcher should quit */
 static volatile sig_atomic_t should_quit = 0;
@@ -112,521 +128,2429 @@ static volatile sig_atomic_t instance_died = 0;
 /** @brief The error case to simulate by all instances */
 static XDT_error err_case = 0;
 
+/** @brief Flag indicating that all instances are served by the dispatcher process */
+static int single_process = 0;
+
 /** @brief UDP socket to receive PDU messages from peers */
 static int net_listen_sock = -1;
 
-/** @brief Unix domain socket to receive SDU messages from users */
+/** @brief Unix domain socket to receive SDU messages from users, bound to this shard's access point */
 static int local_listen_sock = -1;
 
-/** @brief Last assigned connection number */
+/** @brief Last assigned connection number, without the shard key (see #XDT_SHARD_CONN) */
 static unsigned int new_conn = 0;
 
+/** @brief Number of dispatcher shards sharing the listen address */
+static unsigned shards = 1;
+
+/** @brief Index of this dispatcher's shard */
+static unsigned shard = 0;
+
+/** @brief Process ids of the other shards (kept by the first shard), 0 if exited */
+static pid_t shard_pids[XDT_SHARDS_MAX];
+
+/** @brief Socket pair per shard, the shard receives from the first socket what the others pass on by the second one */
+static int shard_socks[XDT_SHARDS_MAX][2];
+
+/** @brief Statistics of messages passed on to other shards */
+static struct
+{
+  unsigned long pdus; /**< PDUs passed on */
+  unsigned long sdus; /**< SDUs passed on */
+  unsigned long dropped; /**< PDUs dropped, the other shard's socket was full */
+} shard_stats;
+
+/** @brief Number of maximum simultaneous connections to serve */
+static unsigned max_connections = 0;
+
+/** @brief Protocol parameters of the instances (window, timeouts, acknowledgement mode, payload size) */
+static XDT_config instance_config;
+
 /** @brief Context information for all running instances */
-static XDT_instance instances[MAX_CONNECTIONS];
+static XDT_conntable connections;
 
 /** @brief Points to the current serving instance */
 static XDT_instance *curinst = 0;
 
+/** @brief Tunnels to peer services (only used with XDT_config.tunnel) */
+static XDT_tunnels tunnels;
 
-/** 
- * @brief Sets up a new receiver instance
+/** @brief epoll(7) instance of the dispatcher */
+static int epoll_fd = -1;
+
+/** @brief Timers of all instances served by this process */
+static XDT_wheel wheel;
+
+/** @brief timerfd of the dispatcher's wheel (only used in single-process mode) */
+static int wheel_fd = -1;
+
+/** @brief Absolute expiration time the timerfd of this process is armed with, 0 if disarmed */
+static double wheel_armed = 0;
+
+/** @brief Number of PDUs the instance took from its peer socket since it looked at its queue (see wait_direct()) */
+static unsigned direct_burst = 0;
+
+/**
+ * @brief Message held back by the dispatcher while the instance's queue is full
  *
- * A random bound UDP socket is created and connected with
- * the sending peer.
- * An unbound unix domain socket is created and connected
- * with the consumer.
- * A message queue is created containing the PDU message @a du.
- * The connection number is assigned.
+ * Followed by the message (type and data).
+ */
+typedef struct xdt_backlog
+{
+  struct xdt_backlog *next; /**< next newer message, @e null terminates */
+  size_t size; /**< size of the message */
+} XDT_backlog;
+
+/** @brief Instances with held back messages, chained by XDT_instance.backlogged_next */
+static XDT_instance *backlogged = 0;
+
+/** @brief Queue statistics of all released instances */
+static XDT_queue_stats queue_stats;
+
+/**
+ * @brief Connection handed over to a pre-forked instance process
  *
- * @param du points to the initial DT PDU message
- * 
- * @return 0 on sucess, value < 0 on failure
+ * Sent by the dispatcher through the worker's control socket, a payload ring
+ * may be passed along. The instance process connects its own sockets.
  */
-static int
-setup_receiver_instance(XDT_pdu * du)
+typedef struct
 {
-  struct sockaddr_in peer_addr;
-  struct sockaddr_un user_addr;
-  int i;
+  XDT_role role; /**< role of the instance */
+  unsigned real_conn; /**< connection number assigned by the receiver */
+  unsigned mapped_conn; /**< mapped local connection number */
+  XDT_address producer; /**< source address (sender instance) */
+  XDT_address consumer; /**< destination address (sender instance) */
+  struct sockaddr_in peer; /**< listen address of the peer service */
+  struct sockaddr_un user; /**< user access point of the producer or consumer */
+  socklen_t user_len; /**< length of @a user */
+  struct sockaddr_in probe; /**< socket address the initial DT came from (see XDT_instance.probe) */
+  socklen_t probe_len; /**< length of @a probe, 0 if none */
+  XDT_stat_conn *stats; /**< statistics of the connection, in the segment mapped before the process was forked */
+} XDT_handover;
 
-  assert(du);
+/**
+ * @brief Pre-forked instance process (see XDT_config.pool)
+ *
+ * Queue and timerfd outlive the connections, the process serves one after another.
+ */
+typedef struct
+{
+  pid_t pid; /**< process id, 0 if to be forked (again), -1 if forking failed */
+  int ctl; /**< dispatcher's end of the control socket pair */
+  XDT_queue queue; /**< message queue of the served instance */
+  int timer_fd; /**< timerfd armed by the process and watched by the dispatcher */
+  int event_fd; /**< eventfd counting the messages written to @a queue (see XDT_config.direct), else -1 */
+  XDT_instance *inst; /**< instance served, @e null if idle */
+  XDT_handover handover; /**< connection to hand over by hand_over() */
+} XDT_worker;
 
-  /* create random bound udp socket and connect with sending peer */
-  if ((curinst->peer_sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
-    perror("socket");
-    return -5;
+/** @brief Pre-forked instance processes (dispatcher only) */
+static XDT_worker *workers = 0;
+
+/** @brief Number of @a workers */
+static unsigned pool_size = 0;
+
+/** @brief Number of running pre-forked instance processes */
+static unsigned pool_alive = 0;
+
+/** @brief Process's end of the control socket pair (pre-forked instance process only) */
+static int worker_ctl = -1;
+
+/** @brief Context of the connection served (pre-forked instance process only) */
+static XDT_instance worker_inst;
+
+/** @brief Timer statistics of this process */
+static struct
+{
+  unsigned long pdus; /**< PDUs served to instances */
+  unsigned long settime; /**< timerfd_settime(2) calls */
+  unsigned long wakeups; /**< timerfd expirations */
+  unsigned long postponed; /**< wheel entries fired before the timer's (postponed) deadline or after its reset */
+  unsigned long expired; /**< timer messages delivered */
+} timer_stats;
+
+
+/**
+ * @brief Datagrams transferred by one recvmmsg(2) or sendmmsg(2) call
+ *
+ * Holds up to #XDT_config.batch datagram buffers with their message headers.
+ */
+typedef struct
+{
+  unsigned count; /**< number of datagrams in the batch */
+  size_t size; /**< size of a datagram buffer */
+  char *buffers; /**< datagram buffers, @a size bytes each */
+  struct iovec *iov; /**< one vector per datagram buffer */
+  struct mmsghdr *msgs; /**< one message header per datagram buffer */
+  struct sockaddr_storage *addrs; /**< source address per received datagram */
+  char *control; /**< ancillary data buffer per received datagram, @e null if none */
+  size_t control_size; /**< size of an ancillary data buffer */
+} XDT_batch;
+
+/** @brief PDUs received from peers */
+static XDT_batch net_batch;
+
+/** @brief SDUs received from users, each buffer is a packed SDU message, a payload ring may be passed along */
+static XDT_batch local_batch;
+
+/**
+ * @brief Message passed on to the shard serving its connection
+ *
+ * Followed by the packed PDU or SDU message (see pack_message()).
+ */
+typedef struct
+{
+  struct sockaddr_in peer; /**< source address of a PDU, unused for SDUs */
+  socklen_t peer_len; /**< length of @a peer */
+} XDT_shard_message;
+
+/** @brief Messages passed on by other shards, a payload ring may be passed along */
+static XDT_batch shard_batch;
+
+/** @brief Encoded PDUs held back by hold_pdus() */
+static XDT_batch held;
+
+/** @brief Flag indicating that send_pdu() holds PDUs back */
+static int holding = 0;
+
+/** @brief Packed message written to or read from an instance queue, see create_buffers() */
+static char *message_buffer = 0;
+
+/** @brief Size of @a message_buffer */
+static size_t message_buffer_size = 0;
+
+/** @brief Encoded PDU sent by send_pdu() */
+static char *send_stream = 0;
+
+/** @brief Encoded PDU received by receive_direct() without a payload ring, the decoded DT's payload stays in there */
+static char *receive_stream = 0;
+
+/** @brief Size of @a send_stream, @a receive_stream and a datagram buffer of @a net_batch */
+static size_t stream_size = 0;
+
+
+/**
+ * @brief Allocates the buffers of a datagram batch
+ *
+ * @param b points to the batch
+ * @param size size of a datagram buffer
+ * @param control size of the ancillary data buffer per datagram, 0 for none
+ */
+static void
+create_batch(XDT_batch * b, size_t size, size_t control)
+{
+  unsigned i, n = instance_config.batch;
+
+  b->count = 0;
+  b->size = size;
+  b->control = 0;
+  b->control_size = control;
+  if (!(b->buffers = calloc(n, size)) || !(b->iov = calloc(n, sizeof *b->iov))
+      || !(b->msgs = calloc(n, sizeof *b->msgs)) || !(b->addrs = calloc(n, sizeof *b->addrs))
+      || (control && !(b->control = calloc(n, control)))) {
+    perror("allocating datagram batch failed");
+    exit(EXIT_FAILURE);
   }
-  ZERO(peer_addr);
-  peer_addr.sin_family = AF_INET;
-  peer_addr.sin_port = htons(du->x.dt.source_addr.port);
-  if ((i=inet_pton(AF_INET, du->x.dt.source_addr.host, &peer_addr.sin_addr)) < 1) {
-    fprintf(stderr, "inet_pton: %s\n", (i==-1)?strerror(errno):
-	    "address does not contain a character string representing a valid IPv4 address");
-    return -10;
+  for (i = 0; i < n; ++i) {
+    b->iov[i].iov_base = b->buffers + i * size;
+    b->iov[i].iov_len = size;
+    b->msgs[i].msg_hdr.msg_iov = &b->iov[i];
+    b->msgs[i].msg_hdr.msg_iovlen = 1;
   }
-  if (connect(curinst->peer_sock, (struct sockaddr *)&peer_addr, sizeof peer_addr) == -1) {
-    perror("connect");
-    return -15;
+}
+
+/**
+ * @brief Allocates the message and PDU stream buffers
+ *
+ * Their size follows from the biggest payload size, a received datagram
+ * may also be a tunnel datagram (see #XDT_TUNNEL_DATAGRAM).
+ *
+ * @param max_length biggest payload size of a message
+ */
+static void
+create_buffers(unsigned max_length)
+{
+  message_buffer_size = XDT_MESSAGE_SIZE(max_length);
+  stream_size = PDU_STREAM_SIZE(max_length) > XDT_TUNNEL_DATAGRAM ? PDU_STREAM_SIZE(max_length) : XDT_TUNNEL_DATAGRAM;
+  if (!(message_buffer = malloc(message_buffer_size)) || !(send_stream = malloc(stream_size))
+      || !(receive_stream = malloc(stream_size))) {
+    perror("allocating message buffers failed");
+    exit(EXIT_FAILURE);
   }
+}
 
-  /* create unbound local socket and connect with consumer */
-  if ((curinst->user_sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1) {
-    perror("socket");
-    return -20;
+/**
+ * @brief Receives as many datagrams as available (up to #XDT_config.batch) by one system call
+ *
+ * @param sock socket to receive from
+ * @param b points to the batch, @e count is set to the number of received datagrams
+ *
+ * @return number of received datagrams, -1 on failure
+ */
+static int
+receive_batch(int sock, XDT_batch * b)
+{
+  unsigned i;
+  int n;
+
+  for (i = 0; i < instance_config.batch; ++i) {
+    b->iov[i].iov_len = b->size;
+    b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+    b->msgs[i].msg_hdr.msg_namelen = sizeof b->addrs[i];
+    if (b->control) {
+      b->msgs[i].msg_hdr.msg_control = b->control + i * b->control_size;
+      b->msgs[i].msg_hdr.msg_controllen = b->control_size;
+    }
   }
-  ZERO(user_addr);
-  user_addr.sun_family = AF_LOCAL;
-  if (xdt_address_to_uap_name(&du->x.dt.dest_addr, user_addr.sun_path, sizeof user_addr.sun_path) < 0) {
-    fputs("xdt_address_to_uap_name() failed\n", stderr);
-    return -25;
+  b->count = 0;
+  if ((n = recvmmsg(sock, b->msgs, instance_config.batch, MSG_DONTWAIT | MSG_CMSG_CLOEXEC, 0)) > 0) {
+    b->count = n;
   }
-  if (connect(curinst->user_sock, (struct sockaddr *)&user_addr, SUN_LEN(&user_addr)) == -1) {
-    perror("connect");
-    return -30;
+
+  return n;
+}
+
+/**
+ * @brief Sends the held PDUs by as few system calls as possible
+ */
+static void
+send_held_pdus(void)
+{
+  unsigned i;
+
+  if (!held.count) {
+    return;
+  }
+  /* sendmmsg_err() removes dropped PDUs from the message headers */
+  for (i = 0; i < held.count; ++i) {
+    held.msgs[i].msg_hdr.msg_iov = &held.iov[i];
+    held.msgs[i].msg_hdr.msg_name = curinst->peer_to_len ? &curinst->peer_to : 0;
+    held.msgs[i].msg_hdr.msg_namelen = curinst->peer_to_len;
+  }
+  if (sendmmsg_err(curinst->peer_sock, held.msgs, held.count, err_case) == -1) {
+    perror("sendmmsg_err");
+  }
+  held.count = 0;
+}
+
+/**
+ * @brief Sends the PDUs aggregated for a tunnel by one datagram
+ *
+ * @param t points to the tunnel
+ */
+static void
+send_tunnel(XDT_tunnel * t)
+{
+  if (!t->pending) {
+    return;
   }
+  if (send_err(t->sock, t->datagram, t->pending, ERR_NO) == -1) {
+    perror("send_err");
+  }
+  t->datagrams++;
+  t->pending = 0;
+}
+
+/**
+ * @brief Sends the PDUs aggregated for all tunnels
+ *
+ * Called before the dispatcher waits, so the PDUs of all connections served
+ * since then leave together.
+ */
+static void
+flush_tunnels(void)
+{
+  XDT_tunnel *t;
 
-  /* create message queue */
-  if (xdt_queue_create(&curinst->queue) < 0) {
-    return -40;;
+  while ((t = xdt_tunnel_take_pending(&tunnels))) {
+    send_tunnel(t);
   }
+}
 
-  /* put pdu in queue */
-  if (xdt_queue_write(&curinst->queue, du, sizeof *du) < 0) {
-    return -50;
+/**
+ * @brief Prints the statistics of all tunnels
+ */
+static void
+print_tunnel_stats(void)
+{
+  char host[INET_ADDRSTRLEN];
+  XDT_tunnel *t;
+
+  for (t = tunnels.first; t; t = t->next) {
+    inet_ntop(AF_INET, &t->peer.sin_addr, host, sizeof host);
+    printf("(%d) tunnel to %s:%d: %lu connections, %lu PDUs aggregated into %lu datagrams", (int)getpid(), host,
+           ntohs(t->peer.sin_port), t->carried, t->aggregated, t->datagrams);
+    if (t->srtt >= 0) {
+      printf(", srtt %.3f ms", t->srtt * 1e3);
+    }
+    putchar('\n');
   }
+}
 
-  /* length of receiving peer socket address (not used in receiver) */
-  curinst->receiver_len = 0;
+/**
+ * @brief Returns the biggest payload size messages in an instance queue can carry
+ *
+ * @return payload size in bytes, at least #XDT_DATA_DEFAULT
+ */
+static unsigned
+max_queued_payload(void)
+{
+  size_t max = xdt_queue_msg_max(), header = offsetof(XDT_sdu, x.dat_requ.data);
 
-  /* set connection number */
-  curinst->real_conn = curinst->mapped_conn = ++new_conn;
+  if (header < offsetof(XDT_sdu, x.dat_ind.data)) {
+    header = offsetof(XDT_sdu, x.dat_ind.data);
+  }
+  if (header < offsetof(XDT_pdu, x.dt.data)) {
+    header = offsetof(XDT_pdu, x.dt.data);
+  }
 
-  return 0;
+  return max < header + XDT_DATA_DEFAULT ? XDT_DATA_DEFAULT : max - header > XDT_DATA_MAX ? XDT_DATA_MAX : max - header;
 }
 
 
-/** 
- * @brief Sets up a new sender instance
+/**
+ * @brief Connects the current instance with the peer service
  *
- * The address of the producer is stored.
- * A random bound UDP socket is created and connected with
- * the receiving peer.
- * An unbound unix domain socket is created and connected
- * with the producer.
- * A message queue is created containing the SDU message @a du.
- * The mapped connection number is assigned.
+ * With #XDT_config.tunnel the instance shares the tunnel to the peer service,
+ * else a random bound UDP socket is created and connected.
  *
- * @param du points to the initial XDATrequ SDU message
- * 
- * @return 0 on sucess, value < 0 on failure
+ * @param peer_addr listen address of the peer service
+ *
+ * @return 0 on success, value < 0 on failure
  */
 static int
-setup_sender_instance(XDT_sdu * du)
+connect_peer(struct sockaddr_in const *peer_addr)
 {
-  struct sockaddr_in peer_addr;
-  struct sockaddr_un user_addr;
-  int i;
-
-  assert(du);
-
-  /* store source address */
-  curinst->producer = du->x.dat_requ.source_addr;
-  curinst->consumer = du->x.dat_requ.dest_addr;
-
+  if (instance_config.tunnel) {
+    if (!(curinst->tunnel = xdt_tunnel_open(&tunnels, peer_addr))) {
+      perror("xdt_tunnel_open");
+      return -1;
+    }
+    curinst->tunnel->streams++;
+    curinst->tunnel->carried++;
+    curinst->peer_sock = curinst->tunnel->sock;
+    return 0;
+  }
 
-  /* create random bound udp socket and connect with receiving peer */
   if ((curinst->peer_sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
     perror("socket");
-    return -5;
-  }
-  peer_addr.sin_family = AF_INET;
-  peer_addr.sin_port = htons(du->x.dat_requ.dest_addr.port);
-  if ((i=inet_pton(AF_INET, du->x.dat_requ.dest_addr.host, &peer_addr.sin_addr))<1) {
-    fprintf(stderr, "inet_pton: %s\n", (i==-1)?strerror(errno):
-	    "address does not contain a character string representing a valid IPv4 address");
-    return -10;
+    return -2;
   }
-  if (connect(curinst->peer_sock, (struct sockaddr *)&peer_addr, sizeof peer_addr) == -1) {
+  if (connect(curinst->peer_sock, (struct sockaddr const *)peer_addr, sizeof *peer_addr) == -1) {
     perror("connect");
-    return -15;
+    return -3;
   }
 
-  /* create unbound local socket and connect with producer */
-  if ((curinst->user_sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1) {
-    perror("socket");
-    return -20;
-  }
-  ZERO(user_addr);
-  user_addr.sun_family = AF_LOCAL;
-  if (xdt_address_to_uap_name(&du->x.dat_requ.source_addr, user_addr.sun_path, sizeof user_addr.sun_path) < 0) {
-    fputs("xdt_address_to_uap_name() failed\n", stderr);
-    return -25;
-  }
-  if (connect(curinst->user_sock, (struct sockaddr *)&user_addr, SUN_LEN(&user_addr)) == -1) {
-    perror("connect");
-    return -40;
-  }
+  return 0;
+}
 
-  /* create message queue */
-  if (xdt_queue_create(&curinst->queue) < 0) {
-    return -50;;
-  }
 
-  /* put sdu in queue */
-  if (xdt_queue_write(&curinst->queue, du, sizeof *du) < 0) {
-    return -60;
+/**
+ * @brief Packs a message for an instance queue
+ *
+ * @param msg points to the message
+ * @param buffer where to pack the message into, at least #XDT_MESSAGE_SIZE bytes
+ *        for the payload size of @a msg
+ *
+ * @return size in bytes of the packed message
+ */
+static size_t
+pack_message(XDT_message const *msg, void *buffer)
+{
+  if (msg->type > sdu_msg_min_pred && msg->type < sdu_msg_max_succ) {
+    return xdt_sdu_pack(&msg->sdu, buffer);
   }
+  if (msg->type > pdu_msg_min_pred && msg->type < pdu_msg_max_succ) {
+    return pack_pdu(&msg->pdu, buffer);
+  }
+  memcpy(buffer, &msg->type, sizeof msg->type);
 
-  /* length of receiver socket address (to be assigned through 1st ACK) */
-  curinst->receiver_len = 0;
+  return sizeof msg->type;
+}
 
-  /* set local connection number */
-  curinst->mapped_conn = ++new_conn;
-  curinst->real_conn = 0;       /* to be assigned by receiver with 1st ACK */
+/**
+ * @brief Unpacks a message read from an instance queue or passed by another shard
+ *
+ * The payload is not copied, see xdt_sdu_unpack() and unpack_pdu().
+ *
+ * @param msg where to unpack the message into
+ * @param buffer the packed message
+ * @param size number of bytes in @a buffer
+ *
+ * @return 0 on success, -1 if @a size does not match the message
+ */
+static int
+unpack_message(XDT_message * msg, void *buffer, size_t size)
+{
+  if (size < sizeof msg->type) {
+    return -1;
+  }
+  memcpy(&msg->type, buffer, sizeof msg->type);
+  if (msg->type > sdu_msg_min_pred && msg->type < sdu_msg_max_succ) {
+    return xdt_sdu_unpack(&msg->sdu, buffer, size);
+  }
+  if (msg->type > pdu_msg_min_pred && msg->type < pdu_msg_max_succ) {
+    return unpack_pdu(&msg->pdu, buffer, size);
+  }
 
   return 0;
 }
 
-/** 
- * @brief Sets up a new instance
+
+/**
+ * @brief Writes a message to an instance's queue without blocking
  *
- * If not the maximum number of simultaneous connections is reached
- * #curinst will  point to the set up instance.
+ * Every #DEPTH_SAMPLE messages and when the queue is full, its depth is sampled.
+ * With #XDT_config.direct, the message is counted by the instance's eventfd.
  *
- * @param role the type of the instance to create
- * @param du initial SDU or PDU message
+ * @param inst points to the instance
+ * @param msg points to the message
+ * @param msg_size size of the message (type and data)
  *
- * @return 0 on success, value < 0 on failure
+ * @return 0 on success, value < 0 on error (see xdt_queue_try_write(), @e errno is EAGAIN if full)
  */
 static int
-setup_instance(XDT_role role, void *du)
+write_queue(XDT_instance * inst, void *msg, size_t msg_size)
 {
-  int i;
+  XDT_queue_stats *st = &inst->queue_stats;
+  int depth, err;
 
-  assert(du);
+  if (xdt_queue_try_write(&inst->queue, msg, msg_size) == 0) {
+    if (inst->event_fd != -1) {
+      uint64_t one = 1;
 
-  curinst = 0;
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (instances[i].role == XDT_SERVICE_NA) {
-      curinst = &instances[i];
-      break;
+      if (write(inst->event_fd, &one, sizeof one) == -1) {
+        perror("write");
+      }
+    }
+    if (++st->queued % DEPTH_SAMPLE) {
+      return 0;
     }
+    err = 0;
+  } else if ((err = errno) != EAGAIN || (st->deferred + st->dropped) % DEPTH_SAMPLE) {
+    return -1;
   }
 
-  if (!curinst) {
-    return -10;
+  if ((depth = xdt_queue_depth(&inst->queue)) > (int)st->depth_max) {
+    st->depth_max = depth;
+  }
+  if (depth >= 0) {
+    xdt_stats_sample(inst->stats, XDT_STAT_DEPTH, depth);
   }
+  errno = err;
 
-  if (role == XDT_SERVICE_RECEIVER) {
-    if (setup_receiver_instance(du) < 0) {
-      return -20;
+  return err ? -1 : 0;
+}
+
+
+/**
+ * @brief Connects the current instance with the peer service and the user
+ *
+ * A random bound UDP socket is created and connected with the peer, or the
+ * tunnel to the peer is used. With #XDT_config.direct, the UDP socket is left
+ * unconnected, see send_pdu(). An unbound unix domain socket is created and
+ * connected with the user. A pre-forked instance process connects sockets
+ * of its own, for it the endpoints are only stored (see hand_over()).
+ *
+ * @param peer endpoint of the peer service
+ * @param user endpoint of the producer or consumer
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+static int
+connect_instance(XDT_endpoint const *peer, XDT_endpoint const *user)
+{
+  XDT_handover *h;
+
+  if (curinst->worker) {
+    h = &workers[curinst->worker - 1].handover;
+    h->peer = peer->inet;
+    h->user = user->uap;
+    h->user_len = user->uap_len;
+    return 0;
+  }
+
+  if (instance_config.direct) {
+    /* connected with the peer's socket of the connection later */
+    if ((curinst->peer_sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
+      perror("socket");
+      return -5;
     }
-  } else {                      /* XDT_SERVICE_SENDER */
-    if (setup_sender_instance(du) < 0) {
-      return -30;
+    curinst->peer_to = peer->inet;
+    curinst->peer_to_len = sizeof curinst->peer_to;
+  } else if (connect_peer(&peer->inet) < 0) {
+    return -10;
+  }
+  if ((curinst->user_sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1) {
+    perror("socket");
+    return -20;
+  }
+  if (connect(curinst->user_sock, (struct sockaddr const *)&user->uap, user->uap_len) == -1) {
+    perror("connect");
+    return -30;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Puts the initial message into the queue of the current instance
+ *
+ * The message queue is created, or the one of the pre-forked instance
+ * process is used.
+ *
+ * @param du points to the initial message
+ * @param du_size size of the message (type and data)
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+static int
+open_instance_queue(void *du, size_t du_size)
+{
+  if (curinst->worker) {
+    curinst->queue = workers[curinst->worker - 1].queue;
+  } else {
+    if (xdt_queue_create(&curinst->queue) < 0) {
+      return -10;
+    }
+    if (instance_config.queue_size && xdt_queue_limit(&curinst->queue, instance_config.queue_size) < 0) {
+      perror("xdt_queue_limit");
+    }
+  }
+
+  if (write_queue(curinst, du, du_size) < 0) {
+    return -20;
+  }
+
+  return 0;
+}
+
+
+/** 
+ * @brief Sets up a new receiver instance
+ *
+ * The instance is connected with the sending peer and the consumer,
+ * see connect_instance().
+ * A message queue is created containing the PDU message @a du
+ * (not in single-process mode, the dispatcher passes it directly).
+ * With #XDT_config.shared_payload, a payload ring for the consumer is created
+ * (by a pre-forked instance process itself).
+ * The connection number is assigned.
+ *
+ * @param du points to the initial DT PDU message
+ * 
+ * @return 0 on sucess, value < 0 on failure
+ */
+static int
+setup_receiver_instance(XDT_pdu * du)
+{
+  XDT_endpoint peer, user;
+
+  assert(du);
+
+  /* connect with sending peer and consumer */
+  if (xdt_address_endpoint(&du->x.dt.source_addr, &peer) < 0) {
+    fputs("xdt_address_endpoint() failed: invalid source address\n", stderr);
+    return -10;
+  }
+  if (xdt_address_endpoint(&du->x.dt.dest_addr, &user) < 0) {
+    fputs("xdt_address_endpoint() failed: invalid destination address\n", stderr);
+    return -25;
+  }
+  if (connect_instance(&peer, &user) < 0) {
+    return -30;
+  }
+
+  /* the instance passes the ring with its first SDU */
+  if (instance_config.shared_payload && !curinst->worker && xdt_payload_create(&curinst->ring) < 0) {
+    perror("xdt_payload_create");
+    return -35;
+  }
+
+  /* create message queue, put pdu in queue */
+  if (!single_process && open_instance_queue(message_buffer, pack_pdu(du, message_buffer)) < 0) {
+    return -40;
+  }
+
+  /* length of receiving peer socket address (not used in receiver) */
+  curinst->receiver_len = 0;
+
+  /* set connection number, the sender service steers the ACKs by its shard key */
+  curinst->real_conn = curinst->mapped_conn
+    = XDT_SHARD_CONN(++new_conn, xdt_shard_key(&du->x.dt.source_addr, &du->x.dt.dest_addr));
+
+  return 0;
+}
+
+
+/** 
+ * @brief Sets up a new sender instance
+ *
+ * The address of the producer is stored.
+ * The instance is connected with the receiving peer and the producer,
+ * see connect_instance().
+ * A message queue is created containing the SDU message @a du
+ * (not in single-process mode, the dispatcher passes it directly).
+ * The mapped connection number is assigned.
+ *
+ * @param du points to the initial XDATrequ SDU message
+ * 
+ * @return 0 on sucess, value < 0 on failure
+ */
+static int
+setup_sender_instance(XDT_sdu * du)
+{
+  XDT_endpoint peer, user;
+
+  assert(du);
+
+  /* store source address */
+  curinst->producer = du->x.dat_requ.source_addr;
+  curinst->consumer = du->x.dat_requ.dest_addr;
+
+
+  /* connect with receiving peer and producer */
+  if (xdt_address_endpoint(&du->x.dat_requ.dest_addr, &peer) < 0) {
+    fputs("xdt_address_endpoint() failed: invalid destination address\n", stderr);
+    return -10;
+  }
+  if (xdt_address_endpoint(&du->x.dat_requ.source_addr, &user) < 0) {
+    fputs("xdt_address_endpoint() failed: invalid source address\n", stderr);
+    return -25;
+  }
+  if (connect_instance(&peer, &user) < 0) {
+    return -40;
+  }
+
+  /* create message queue, put sdu in queue */
+  if (!single_process && open_instance_queue(message_buffer, xdt_sdu_pack(du, message_buffer)) < 0) {
+    return -50;
+  }
+
+  /* length of receiver socket address (to be assigned through 1st ACK) */
+  curinst->receiver_len = 0;
+
+  /* set local connection number */
+  curinst->mapped_conn = XDT_SHARD_CONN(++new_conn, xdt_shard_key(&du->x.dat_requ.source_addr, &du->x.dat_requ.dest_addr));
+  curinst->real_conn = 0;       /* to be assigned by receiver with 1st ACK */
+
+  return 0;
+}
+
+/**
+ * @brief Drops the messages held back for an instance
+ *
+ * @param inst points to the instance
+ */
+static void
+drop_backlog(XDT_instance * inst)
+{
+  XDT_backlog *b;
+
+  while ((b = inst->backlog)) {
+    inst->backlog = b->next;
+    free(b);
+    inst->queue_stats.dropped++;
+    xdt_stats_count(inst->stats, XDT_STAT_DROPPED, 1);
+  }
+  inst->backlog_last = 0;
+  inst->backlog_len = 0;
+}
+
+/**
+ * @brief Adds the queue statistics of a finished instance to the totals
+ *
+ * They are printed at log level #XDT_LOG_MESSAGES, dropped messages are counted
+ * in the statistics segment anyway.
+ *
+ * @param inst points to the instance
+ */
+static void
+count_queue_stats(XDT_instance * inst)
+{
+  XDT_queue_stats *st = &inst->queue_stats;
+
+  if (xdt_logging(XDT_LOG_MESSAGES)) {
+    printf("(%d) connection %u queue: %lu queued, %lu deferred, %lu dropped, depth up to %u\n", (int)getpid(),
+           inst->mapped_conn, st->queued, st->deferred, st->dropped, st->depth_max);
+  }
+  queue_stats.queued += st->queued;
+  queue_stats.deferred += st->deferred;
+  queue_stats.dropped += st->dropped;
+  if (st->depth_max > queue_stats.depth_max) {
+    queue_stats.depth_max = st->depth_max;
+  }
+}
+
+/**
+ * @brief Releases context information for a finished instance
+ *
+ * @param inst points to the instance to cleanup
+ */
+static void
+free_instance(XDT_instance * inst)
+{
+  XDT_instance **p;
+
+  if (inst->backlog) {
+    drop_backlog(inst);
+    for (p = &backlogged; *p != inst; p = &(*p)->backlogged_next);
+    *p = inst->backlogged_next;
+  }
+  if (inst->worker) {
+    XDT_worker *w = &workers[inst->worker - 1];
+    uint64_t expirations;
+
+    /* queue and timerfd serve the next connection, stale messages and wake-ups are dropped */
+    if (inst->queue.id != -1) {
+      count_queue_stats(inst);
+      while (xdt_queue_depth(&inst->queue) > 0
+             && xdt_queue_read(&inst->queue, message_buffer, message_buffer_size, 0) > 0);
+    }
+    while (read(w->timer_fd, &expirations, sizeof expirations) > 0);
+    if (w->event_fd != -1) {
+      while (read(w->event_fd, &expirations, sizeof expirations) > 0);
+    }
+    w->inst = 0;
+  } else if (!single_process && inst->queue.id != -1) {
+    count_queue_stats(inst);
+    xdt_queue_delete(&inst->queue);
+  }
+  if (inst->user_sock != -1) {
+    close(inst->user_sock);
+  }
+  if (inst->tunnel) {
+    /* the tunnel stays open for the next connection */
+    inst->tunnel->streams--;
+  } else if (inst->peer_sock != -1) {
+    close(inst->peer_sock);
+  }
+  if (inst->timer_fd != -1) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, inst->timer_fd, 0);
+    close(inst->timer_fd);
+  }
+  if (inst->event_fd != -1 && !inst->worker) {
+    close(inst->event_fd);
+  }
+  xdt_payload_detach(&inst->ring);
+  xdt_stats_release(inst->stats);
+  inst->stats = 0;
+  xdt_conntable_free(&connections, inst);
+}
+
+/** 
+ * @brief Sets up a new instance
+ *
+ * If not the maximum number of simultaneous connections is reached
+ * #curinst will  point to the set up instance, which is allocated in
+ * and indexed by the connection table #connections.
+ *
+ * @param role the type of the instance to create
+ * @param du initial SDU or PDU message
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+static int
+setup_instance(XDT_role role, void *du)
+{
+  struct epoll_event ev;
+  int i;
+
+  assert(du);
+
+  curinst = 0;
+  if (max_connections && connections.used >= max_connections) {
+    return -10;
+  }
+  if (!(curinst = xdt_conntable_alloc(&connections))) {
+    return -15;
+  }
+
+  curinst->user_sock = curinst->peer_sock = curinst->timer_fd = curinst->event_fd = -1;
+  curinst->queue.id = -1;
+  curinst->tunnel = 0;
+  curinst->stats = 0;
+  xdt_payload_init(&curinst->ring);
+  for (i = 0; i < MAX_INSTANCE_TIMERS; ++i) {
+    memset(&curinst->timers[i], 0, sizeof curinst->timers[i]);
+    curinst->timers[i].inst = curinst;
+  }
+
+  /* an idle pre-forked instance process takes the connection */
+  for (i = 0; i < (int)pool_size && !(workers[i].pid > 0 && !workers[i].inst); ++i);
+  if (i < (int)pool_size) {
+    workers[i].inst = curinst;
+    curinst->worker = i + 1;
+    curinst->pid = workers[i].pid;
+    curinst->event_fd = workers[i].event_fd;
+
+  /* the instance process arms its timerfd, the dispatcher waits for it */
+  } else if (!single_process) {
+    ZERO(ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = curinst;
+    if ((curinst->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) == -1
+        || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, curinst->timer_fd, &ev) == -1) {
+      perror("timerfd");
+      free_instance(curinst);
+      return -17;
+    }
+    if (instance_config.direct && (curinst->event_fd = eventfd(0, EFD_NONBLOCK)) == -1) {
+      perror("eventfd");
+      free_instance(curinst);
+      return -18;
+    }
+  }
+
+  if (role == XDT_SERVICE_RECEIVER) {
+    if (setup_receiver_instance(du) < 0) {
+      free_instance(curinst);
+      return -20;
+    }
+  } else {                      /* XDT_SERVICE_SENDER */
+    if (setup_sender_instance(du) < 0) {
+      free_instance(curinst);
+      return -30;
+    }
+  }
+
+  /* set instance role */
+  curinst->role = role;
+
+  /* statistics of its own, the pid of a forked instance process follows */
+  curinst->stats = xdt_stats_claim(curinst->mapped_conn, role, curinst->worker ? curinst->pid : getpid());
+  xdt_stats_count(0, XDT_STAT_CONNECTIONS, 1);
+
+  /* index by connection number and addresses */
+  xdt_conntable_link(&connections, curinst);
+
+  return 0;
+}
+
+
+/**
+ * @brief Closes the dispatcher's copies of the sockets of a spawned instance
+ *
+ * Only the instance process communicates with the user and the peer,
+ * so the dispatcher unmaps the payload ring too.
+ *
+ * @param inst points to the instance
+ */
+static void
+release_instance_sockets(XDT_instance * inst)
+{
+  close(inst->user_sock);
+  close(inst->peer_sock);
+  inst->user_sock = inst->peer_sock = -1;
+  xdt_payload_detach(&inst->ring);
+}
+
+/**
+ * @brief Releases a pre-forked instance process which has exited
+ *
+ * The connection it served is released too. Unless the dispatcher quits,
+ * the process is forked again before the next wait.
+ *
+ * @param w points to the worker
+ */
+static void
+release_worker(XDT_worker * w)
+{
+  if (w->inst) {
+    free_instance(w->inst);
+  }
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->ctl, 0);
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->timer_fd, 0);
+  close(w->ctl);
+  close(w->timer_fd);
+  if (w->event_fd != -1) {
+    close(w->event_fd);
+  }
+  xdt_queue_delete(&w->queue);
+  w->pid = 0;
+  pool_alive--;
+}
+
+/**
+ * @brief Releases context information for a finished instance
+ *
+ * @param pid process id of the instance to cleanup
+ */
+static void
+free_instance_by_pid(pid_t pid)
+{
+  XDT_instance *inst;
+  unsigned i;
+
+  instance_died = 0;
+  for (i = 0; i < pool_size && workers[i].pid != pid; ++i);
+  if (i < pool_size) {
+    release_worker(&workers[i]);
+  } else if ((inst = xdt_conntable_by_pid(&connections, pid))) {
+    free_instance(inst);
+  }
+}
+
+/**
+ * @brief Reaps recently deceased instances 
+ *
+ * Called whenever one or more instances have finsihed.
+ * Reads the status of the finsihed processes and frees
+ * it's context information.
+ */
+static void
+reap_instances(void)
+{
+  pid_t pid;
+  unsigned i;
+
+  while ((pid = waitpid(-1, 0, WNOHANG)) > 0) {
+    for (i = 1; i < shards && shard_pids[i] != pid; ++i);
+    if (i < shards) {
+      fprintf(stderr, "warning: shard %u with pid=%d exited\n", i, (int)pid);
+      shard_pids[i] = 0;
+      continue;
+    }
+    printf("(%d) reaped instance with pid=%d\n", (int)getpid(), (int)pid);
+    free_instance_by_pid(pid);
+  }
+}
+
+
+/**
+ * @brief Prints the timer statistics of this process at log level #XDT_LOG_MESSAGES
+ */
+static void
+print_timer_stats(void)
+{
+  if (xdt_logging(XDT_LOG_MESSAGES)) {
+    printf("(%d) timers: %lu timerfd_settime calls and %lu wake-ups for %lu PDUs served, "
+           "%lu expired, %lu postponed\n", (int)getpid(), timer_stats.settime, timer_stats.wakeups,
+           timer_stats.pdus, timer_stats.expired, timer_stats.postponed);
+  }
+}
+
+
+/**
+ * @brief Detaches current spawned process
+ *
+ * An new process group is created to detach the instance 
+ * from the controlling terminal.
+ * The dispatcher has registered handlers for SIGINT, SIGTERM and SIGCHLD.
+ * The new spawned instance does not need to catch SIGINT and SIGCHLD.
+ * SIGTERM is ignored per default. Since the dispatcher informs all running instance
+ * about the end of message dispatching by sending them SIGTERM,
+ * the sender and/or receiver code may override this signal action, if necessary.
+ */
+static void
+detach_instance(void)
+{
+  struct sigaction sa;
+
+  /* create new process group */
+  setpgid(0, 0);
+
+  /* the instance process exits when its data transfer has finished */
+  memset(&timer_stats, 0, sizeof timer_stats);
+  atexit(print_timer_stats);
+
+  /* trace into a ring of its own */
+  if (xdt_trace_reopen() < 0) {
+    perror("xdt_trace_reopen");
+    exit(EXIT_FAILURE);
+  }
+
+  /* reset signal handlers, ignore SIGTERM */
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = 0;
+  sa.sa_handler = SIG_DFL;
+  if (sigaction(SIGINT, &sa, 0) == -1) {
+    perror("sigaction");
+    exit(EXIT_FAILURE);
+  }
+  if (sigaction(SIGCHLD, &sa, 0) == -1) {
+    perror("sigaction");
+    exit(EXIT_FAILURE);
+  }
+
+  sa.sa_handler = SIG_IGN;
+  if (sigaction(SIGTERM, &sa, 0) == -1) {
+    perror("sigaction");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+/**
+ * @brief Creates the sockets for the next connection of a pre-forked instance process
+ *
+ * They are connected by await_connection(), so a new connection costs no socket(2) call.
+ */
+static void
+open_worker_sockets(void)
+{
+  if ((curinst->peer_sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1
+      || (curinst->user_sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1) {
+    perror("socket");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief Forks a pre-forked instance process
+ *
+ * Its message queue, timerfd and control socket pair are created first and
+ * kept for all connections it serves. The dispatcher waits for the timerfd
+ * and the control socket by epoll(7). If forking fails, the worker is not
+ * tried again.
+ *
+ * @param w points to the worker
+ *
+ * @return #XDT_SERVICE_WORKER in the new process, #XDT_SERVICE_NA in the dispatcher
+ */
+static XDT_role
+spawn_worker(XDT_worker * w)
+{
+  struct epoll_event ev;
+  int sv[2];
+  pid_t pid;
+  unsigned i;
+
+  w->pid = -1;
+  w->inst = 0;
+  w->timer_fd = w->event_fd = -1;
+  w->queue.id = -1;
+  if (socketpair(PF_LOCAL, SOCK_SEQPACKET, 0, sv) == -1) {
+    perror("socketpair");
+    return XDT_SERVICE_NA;
+  }
+  fflush(stdout);
+  if (xdt_queue_create(&w->queue) < 0 || (w->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) == -1
+      || (instance_config.direct && (w->event_fd = eventfd(0, EFD_NONBLOCK)) == -1) || (pid = fork()) == -1) {
+    perror("pre-forking instance process failed");
+    if (w->queue.id != -1) {
+      xdt_queue_delete(&w->queue);
+    }
+    if (w->timer_fd != -1) {
+      close(w->timer_fd);
+    }
+    if (w->event_fd != -1) {
+      close(w->event_fd);
+    }
+    close(sv[0]);
+    close(sv[1]);
+    return XDT_SERVICE_NA;
+  }
+
+  if (pid == 0) {
+    /* the dispatcher's ends of the other workers must not keep their control sockets open */
+    for (i = 0; i < pool_size; ++i) {
+      if (workers[i].pid > 0) {
+        close(workers[i].ctl);
+      }
+    }
+    close(sv[0]);
+    worker_ctl = sv[1];
+
+    curinst = &worker_inst;
+    curinst->queue = w->queue;
+    curinst->timer_fd = w->timer_fd;
+    curinst->event_fd = w->event_fd;
+    xdt_payload_init(&curinst->ring);
+    detach_instance();
+    open_worker_sockets();
+    return XDT_SERVICE_WORKER;
+  }
+
+  close(sv[1]);
+  if (instance_config.queue_size && xdt_queue_limit(&w->queue, instance_config.queue_size) < 0) {
+    perror("xdt_queue_limit");
+  }
+  w->pid = pid;
+  w->ctl = sv[0];
+  ZERO(ev);
+  ev.events = EPOLLIN;
+  ev.data.ptr = &w->ctl;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, w->ctl, &ev) == -1) {
+    perror("epoll_ctl");
+    exit(EXIT_FAILURE);
+  }
+  ev.data.ptr = &w->timer_fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, w->timer_fd, &ev) == -1) {
+    perror("epoll_ctl");
+    exit(EXIT_FAILURE);
+  }
+  pool_alive++;
+  printf("(%d) pre-forked instance process with pid=%d\n", (int)getpid(), (int)pid);
+
+  return XDT_SERVICE_NA;
+}
+
+/**
+ * @brief Takes the message of a pre-forked instance process that its connection has finished
+ *
+ * The connection is released, so the process takes the next one.
+ *
+ * @param w points to the worker
+ */
+static void
+return_worker(XDT_worker * w)
+{
+  char done;
+  ssize_t n;
+
+  while ((n = recv(w->ctl, &done, sizeof done, MSG_DONTWAIT)) > 0) {
+    if (w->inst) {
+      if (xdt_logging(XDT_LOG_MESSAGES)) {
+        printf("(%d) instance with pid=%d finished mapped connection number %u\n", (int)getpid(), (int)w->pid,
+               w->inst->mapped_conn);
+      }
+      free_instance(w->inst);
+    }
+  }
+  if (n == 0) {
+    /* the process has exited, it is released when reaped */
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, w->ctl, 0);
+  }
+}
+
+
+/**
+ * @brief Signal handler for the dispatcher
+ *
+ * On SIGINT and SIGTERM, the exit flag #should_quit is set. 
+ * On SIGCHLD #instance_died is set.
+ *
+ * @param signo the raised signal number
+ */
+static void
+dispatcher_signal_handler(int signo)
+{
+  switch (signo) {
+  case SIGINT:
+  case SIGTERM:
+    should_quit = 1;
+    break;
+
+  case SIGCHLD:
+    instance_died = 1;
+    break;
+  }
+}
+
+
+/** @brief Sets up signal handlers for the dispatcher */
+static void
+setup_signals(void)
+{
+  struct sigaction sa;
+
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_NOCLDSTOP;
+#ifdef SA_INTERRUPT
+  /* do not restart system calls after those signals */
+  sa.sa_flags |= SA_INTERRUPT;
+#endif
+  sa.sa_handler = dispatcher_signal_handler;
+
+  if (sigaction(SIGINT, &sa, 0) == -1) {
+    perror("sigaction");
+    exit(EXIT_FAILURE);
+  }
+  if (sigaction(SIGTERM, &sa, 0) == -1) {
+    perror("sigaction");
+    exit(EXIT_FAILURE);
+  }
+  if (sigaction(SIGCHLD, &sa, 0) == -1) {
+    perror("sigaction");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+/**
+ * @brief Debug printing of timer messages
+ *
+ * Analogous to print_sdu() and print_pdu().
+ *
+ * @param msg points to the timer message
+ * @param info string to make the output unique
+ * @param stream output stream, @e stderr is used if @e null
+ */
+static void
+print_timer(XDT_message * msg, char *info, FILE * stream)
+{
+  if (!stream) {
+    stream = stderr;
+  }
+
+  fprintf(stream, "\nTIMER: >> %s <<\n", info ? info : "");
+  fprintf(stream, "type = (%ld)\n", msg->type);
+}
+
+
+/**
+ * @brief Debug printing of any message read from the queue or passed by the dispatcher
+ *
+ * @param msg points to the message
+ */
+static void
+print_message(XDT_message * msg)
+{
+  if (msg->type > sdu_msg_min_pred && msg->type < sdu_msg_max_succ) {
+    print_sdu(&(msg->sdu), "received", 0);
+
+  } else if (msg->type > pdu_msg_min_pred && msg->type < pdu_msg_max_succ) {
+    print_pdu(&(msg->pdu), "received", 0);
+
+  } else if (msg->type > pdu_msg_max_succ) {
+    print_timer(msg, "expired", 0);
+  }
+}
+
+
+/**
+ * @brief Records a trace event of a PDU
+ *
+ * Analogous to xdt_trace_sdu().
+ *
+ * @param event event kind, e.g. ::XDT_TRACE_SENT
+ * @param pdu points to a @e PDU message
+ */
+static void
+trace_pdu(unsigned event, XDT_pdu const *pdu)
+{
+  switch ((int)pdu->type) {
+  case DT:
+    xdt_trace_record(event, pdu->type, pdu->x.dt.conn, pdu->x.dt.sequ, pdu->x.dt.length, pdu->x.dt.eom);
+    break;
+  case ACK:
+    xdt_trace_record(event, pdu->type, pdu->x.ack.conn, pdu->x.ack.sequ, 0, pdu->x.ack.sack);
+    break;
+  case ABO:
+    xdt_trace_record(event, pdu->type, pdu->x.abo.conn, 0, 0, 0);
+    break;
+  default:
+    xdt_trace_record(event, pdu->type, 0, 0, 0, 0);
+  }
+}
+
+/**
+ * @brief Counts a PDU sent or received by the current instance in its statistics
+ *
+ * @param pdu points to a @e PDU message
+ * @param received not 0 if the PDU was received, 0 if sent
+ */
+static void
+count_pdu(XDT_pdu const *pdu, int received)
+{
+  switch ((int)pdu->type) {
+  case DT:
+    xdt_stats_count(curinst->stats, received ? XDT_STAT_DT_RECEIVED : XDT_STAT_DT_SENT, 1);
+    if (!received) {
+      xdt_stats_count(curinst->stats, XDT_STAT_BYTES_SENT, pdu->x.dt.length);
+    }
+    break;
+  case ACK:
+    xdt_stats_count(curinst->stats, received ? XDT_STAT_ACK_RECEIVED : XDT_STAT_ACK_SENT, 1);
+    break;
+  case ABO:
+    xdt_stats_count(curinst->stats, received ? XDT_STAT_ABO_RECEIVED : XDT_STAT_ABO_SENT, 1);
+    break;
+  }
+}
+
+
+/**
+ * @brief Points the payload of an XDATrequ into the producer's payload ring
+ *
+ * The protocol instances only see SDUs carrying their payload. The ring space
+ * is released by release_payload() after the SDU is served. An SDU with an
+ * invalid ring range gets type 0.
+ *
+ * @param msg points to the message
+ */
+static void
+take_payload(XDT_message * msg)
+{
+  XDT_xdat_requ *requ = &msg->sdu.x.dat_requ;
+  char const *data;
+
+  if (msg->type != XDATrequ || !requ->shared) {
+    return;
+  }
+
+  if (requ->length > XDT_DATA_MAX || !(data = xdt_payload_data(&curinst->ring, requ->offset, requ->length))) {
+    fputs("warning: XDATrequ payload not in a payload ring\n", stderr);
+    msg->type = 0;
+    return;
+  }
+  requ->data = (char *)(uintptr_t)data;
+  requ->shared = 0;
+  curinst->taken_offset = requ->offset;
+  curinst->taken_length = requ->length;
+}
+
+/**
+ * @brief Releases the ring space of the payload served by take_payload()
+ *
+ * @param inst points to the instance
+ */
+static void
+release_payload(XDT_instance * inst)
+{
+  /* releasing is cumulative, payload behind kept payload is released along with that */
+  if (inst->taken_length && !inst->kept && xdt_payload_attached(&inst->ring)) {
+    xdt_payload_release(&inst->ring, inst->taken_offset, inst->taken_length);
+  }
+  inst->taken_length = 0;
+}
+
+/**
+ * @brief Keeps the payload of the XDATrequ just read in the producer's payload ring
+ *
+ * The payload stays valid beyond the next get_message(), until free_payload()
+ * is called for it or for a payload kept later. So a sender instance buffers
+ * the DT without copying its payload.
+ *
+ * @param offset where to store the ring offset of the payload
+ *
+ * @return 1 if the payload is kept, 0 if it is not in a payload ring (copy it then)
+ */
+int
+keep_payload(unsigned *offset)
+{
+  if (!curinst->taken_length) {
+    return 0;
+  }
+  *offset = curinst->taken_offset;
+  curinst->kept_end = curinst->taken_offset + curinst->taken_length;
+  curinst->kept = 1;
+  curinst->taken_length = 0;
+
+  return 1;
+}
+
+/**
+ * @brief Frees a payload kept by keep_payload() and all payloads kept before
+ *
+ * @param offset ring offset of the payload
+ * @param length number of payload bytes
+ */
+void
+free_payload(unsigned offset, unsigned length)
+{
+  if (xdt_payload_attached(&curinst->ring)) {
+    xdt_payload_release(&curinst->ring, offset, length);
+  }
+  if (offset + length == curinst->kept_end) {
+    curinst->kept = 0;
+  }
+}
+
+/**
+ * @brief Reserves space in the consumer's payload ring to receive the next message into
+ *
+ * A receiver instance receives its messages right into the ring, so send_sdu()
+ * passes the payload of a DT on without copying it. The space is reserved once
+ * per get_message() and taken back by drop_landing() unless send_sdu() took
+ * the payload from there.
+ *
+ * @return where to receive up to a message or a PDU stream into, @e null if the
+ *         instance has no ring or it is full
+ */
+static char *
+landing_zone(void)
+{
+  size_t size = message_buffer_size > stream_size ? message_buffer_size : stream_size;
+  unsigned offset, skip;
+  char *zone;
+
+  if (curinst->landing || curinst->role != XDT_SERVICE_RECEIVER || !xdt_payload_attached(&curinst->ring)) {
+    return curinst->landing;
+  }
+  if (!(zone = xdt_payload_reserve(&curinst->ring, size + sizeof (long), &offset))) {
+    return 0;
+  }
+
+  /* messages are unpacked in place, so they start aligned */
+  skip = -(uintptr_t)zone & (sizeof (long) - 1);
+  curinst->landing = zone + skip;
+  curinst->landing_offset = offset + skip;
+  curinst->landing_size = size;
+
+  return curinst->landing;
+}
+
+/**
+ * @brief Takes back the ring space reserved by landing_zone()
+ */
+static void
+drop_landing(void)
+{
+  if (curinst->landing) {
+    xdt_payload_unreserve(&curinst->ring, curinst->landing_offset);
+    curinst->landing = 0;
+  }
+}
+
+
+/**
+ * @brief Traces and logs a message read from the queue or passed by the dispatcher
+ *
+ * At the default log level without tracing this costs two comparisons.
+ *
+ * @param msg points to the message
+ */
+static void
+log_message(XDT_message * msg)
+{
+  if (xdt_tracing()) {
+    if (msg->type > sdu_msg_min_pred && msg->type < sdu_msg_max_succ) {
+      xdt_trace_sdu(XDT_TRACE_RECEIVED, &msg->sdu);
+    } else if (msg->type > pdu_msg_min_pred && msg->type < pdu_msg_max_succ) {
+      trace_pdu(XDT_TRACE_RECEIVED, &msg->pdu);
+    } else if (msg->type > pdu_msg_max_succ) {
+      xdt_trace_record(XDT_TRACE_EXPIRED, msg->type, curinst->mapped_conn, 0, 0, 0);
+    }
+  }
+
+  if (xdt_logging(XDT_LOG_MESSAGES)) {
+    print_message(msg);
+  }
+}
+
+
+/*** TIMERS AND SINGLE-PROCESS MODE *************************************/
+
+
+/**
+ * @brief Reads the monotonic clock
+ *
+ * @return seconds since some unspecified starting point
+ */
+static double
+monotonic_time(void)
+{
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+    perror("clock_gettime");
+    exit(EXIT_FAILURE);
+  }
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * @brief Searches the current instance's timer slot of a timer
+ *
+ * @param timer points to an XDT timer, @e null to search for an unused slot
+ *
+ * @return pointer to the timer slot, else @e null
+ */
+static XDT_soft_timer *
+get_soft_timer(XDT_timer * timer)
+{
+  int i;
+
+  for (i = 0; i < MAX_INSTANCE_TIMERS; ++i) {
+    if (curinst->timers[i].timer == timer) {
+      return &curinst->timers[i];
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief Arms a timerfd with the next expiration of the timer wheel
+ *
+ * The timerfd is only set when it is disarmed or has to expire earlier.
+ * It is never disarmed or postponed, expiring too early only costs a wake-up.
+ *
+ * @param fd timerfd (see timerfd_create(2)) on the monotonic clock
+ */
+static void
+arm_wheel_fd(int fd)
+{
+  struct itimerspec spec;
+  double next = xdt_wheel_next(&wheel);
+
+  if (next == 0 || (wheel_armed > 0 && wheel_armed <= next)) {
+    return;
+  }
+
+  ZERO(spec);
+  spec.it_value.tv_sec = (time_t)next;
+  spec.it_value.tv_nsec = (long)((next - (time_t)next) * 1e9);
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, 0) == -1) {
+    perror("timerfd_settime");
+    exit(EXIT_FAILURE);
+  }
+  timer_stats.settime++;
+  wheel_armed = next;
+}
+
+/**
+ * @brief Takes the next expired timer off the timer wheel
+ *
+ * Wheel entries of reset timers are dropped, those of postponed timers
+ * are armed again with the current deadline.
+ *
+ * @return the expired timer, @e null if no timer has expired
+ */
+static XDT_soft_timer *
+next_expired(void)
+{
+  double now = monotonic_time();
+  XDT_soft_timer *t;
+
+  while ((t = (XDT_soft_timer *)xdt_wheel_expire(&wheel, now))) {
+    if (t->expires > 0 && t->expires <= now) {
+      t->expires = 0;
+      timer_stats.expired++;
+      return t;
+    }
+    timer_stats.postponed++;
+    if (t->expires > 0) {
+      t->armed = t->expires;
+      xdt_wheel_add(&wheel, &t->entry, t->armed);
+    }
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief Takes a PDU the peer sent to the socket of the current instance
+ *
+ * As long as the socket is not connected, only a PDU of the connection is
+ * taken: a DT with its connection number in a receiver instance, the initial
+ * ACK for its addresses in a sender instance. The socket is connected with its
+ * source then, so further PDUs go there directly and only its PDUs are received.
+ * A receiver instance receives into its consumer's payload ring (see landing_zone()).
+ *
+ * @param msg points to the message buffer
+ *
+ * @return 1 if a PDU was received, 0 if none
+ */
+static int
+receive_direct(XDT_message * msg)
+{
+  struct sockaddr_in from;
+  socklen_t from_len = sizeof from;
+  XDT_pdu *pdu = &msg->pdu;
+  char *stream = landing_zone();
+  ssize_t n;
+
+  if (!stream) {
+    stream = receive_stream;
+  }
+  if ((n = recvfrom(curinst->peer_sock, stream, stream_size, MSG_DONTWAIT | MSG_TRUNC, (struct sockaddr *)&from,
+                    &from_len)) <= 0 || (size_t)n > stream_size || deserialize_pdu(stream, n, pdu) <= 0) {
+    return 0;
+  }
+  if (!curinst->peer_to_len) {
+    return 1;
+  }
+
+  if (curinst->role == XDT_SERVICE_RECEIVER
+      ? pdu->type != DT || pdu->x.dt.conn != curinst->real_conn
+      : pdu->type != ACK || pdu->x.ack.sequ != 1 || !XDT_ADDRESS_EQUAL(pdu->x.ack.dest_addr, curinst->producer)
+        || !XDT_ADDRESS_EQUAL(pdu->x.ack.source_addr, curinst->consumer)) {
+    return 0;
+  }
+  if (connect(curinst->peer_sock, (struct sockaddr *)&from, from_len) == -1) {
+    perror("connect");
+    return 0;
+  }
+  curinst->peer_to_len = 0;
+  if (xdt_logging(XDT_LOG_MESSAGES)) {
+    printf("(%d) connection %u: peer socket %s:%d sends directly\n", (int)getpid(), curinst->mapped_conn,
+           inet_ntoa(from.sin_addr), ntohs(from.sin_port));
+  }
+
+  return 1;
+}
+
+/**
+ * @brief Waits for a PDU on the peer socket or a message in the queue of the current instance
+ *
+ * Only used with #XDT_config.direct: the dispatcher counts the messages it
+ * writes into the queue by the instance's eventfd, so the queue is only read
+ * when it holds a message. After #DIRECT_BURST PDUs from the peer socket,
+ * the eventfd is looked at again.
+ *
+ * @param msg points to the message buffer
+ *
+ * @return 0 if the queue holds a message, else 1: @a msg holds a PDU, a #TIMER_WAKEUP
+ *         if the timerfd has expired or type 0 if interrupted by a signal
+ */
+static int
+wait_direct(XDT_message * msg)
+{
+  struct pollfd fds[3];
+  uint64_t count;
+
+  for (;;) {
+    if (curinst->pending) {
+      curinst->pending--;
+      return 0;
+    }
+    if (direct_burst < DIRECT_BURST && receive_direct(msg)) {
+      direct_burst++;
+      return 1;
+    }
+    direct_burst = 0;
+
+    fds[0].fd = curinst->peer_sock;
+    fds[1].fd = curinst->event_fd;
+    fds[2].fd = curinst->timer_fd;
+    fds[0].events = fds[1].events = fds[2].events = POLLIN;
+    if (poll(fds, 3, -1) == -1) {
+      if (errno != EINTR) {
+        perror("poll");
+        exit(EXIT_FAILURE);
+      }
+      msg->type = 0;
+      return 1;
+    }
+    if ((fds[1].revents & POLLIN) && read(curinst->event_fd, &count, sizeof count) > 0) {
+      curinst->pending += count;
+    }
+    if ((fds[2].revents & POLLIN) && read(curinst->timer_fd, &count, sizeof count) > 0) {
+      msg->type = TIMER_WAKEUP;
+      return 1;
+    }
+  }
+}
+
+
+/**
+ * @brief Passes a message to the protocol instance
+ *
+ * The instance is released when it has finished its data transfer.
+ *
+ * @param inst points to the instance to serve
+ * @param msg points to the PDU, SDU or timer message
+ */
+static void
+serve_instance(XDT_instance * inst, XDT_message * msg)
+{
+  int running;
+
+  curinst = inst;
+
+  if (msg->type > pdu_msg_min_pred && msg->type < pdu_msg_max_succ) {
+    timer_stats.pdus++;
+    count_pdu(&msg->pdu, 1);
+  }
+  take_payload(msg);
+  log_message(msg);
+
+  if (inst->role == XDT_SERVICE_SENDER) {
+    if (!(running = sender_handle(&inst->proto.sender, msg))) {
+      sender_cleanup(&inst->proto.sender);
+    }
+  } else {                      /* XDT_SERVICE_RECEIVER */
+    if (!(running = receiver_handle(&inst->proto.receiver, msg))) {
+      receiver_cleanup(&inst->proto.receiver);
+    }
+  }
+  release_payload(inst);
+
+  if (!running) {
+    printf("(%d) finished %s instance with mapped connection number %u\n", (int)getpid(), inst->role == XDT_SERVICE_SENDER ? "sender" : "receiver", inst->mapped_conn);
+    free_instance(inst);
+  }
+}
+
+
+/**
+ * @brief Initializes the protocol state of a new instance and passes the initial message
+ *
+ * @param inst points to the instance set up by setup_instance()
+ * @param msg points to the initial DT PDU or XDATrequ SDU message
+ */
+static void
+start_instance(XDT_instance * inst, XDT_message * msg)
+{
+  curinst = inst;
+
+  if (inst->role == XDT_SERVICE_SENDER) {
+    sender_init(&inst->proto.sender, &instance_config);
+  } else {                      /* XDT_SERVICE_RECEIVER */
+    receiver_init(&inst->proto.receiver, inst->real_conn, &instance_config);
+  }
+
+  serve_instance(inst, msg);
+}
+
+
+/**
+ * @brief Puts a message into an instance's queue without blocking the dispatcher
+ *
+ * While the queue is full, messages are held back and written by
+ * flush_backlogs() in order, so a slow instance never stops the dispatcher.
+ * A window of DTs or ACKs may arrive at once and the queue need not hold it,
+ * so a droppable PDU is only dropped when a window of messages is held back
+ * already (the peer repeats it on timeout; both services are expected to use
+ * the same window). The producer keeps within its credit, at most
+ * #BACKLOG_MAX messages are held back per instance before dropping them too.
+ *
+ * @param inst points to the instance
+ * @param msg points to the message
+ * @param msg_size size of the message (type and data)
+ * @param droppable not 0 if the message may be dropped
+ *
+ * @return 0 if the message was queued, held back or dropped, value < 0 on error
+ */
+static int
+queue_message(XDT_instance * inst, void *msg, size_t msg_size, int droppable)
+{
+  XDT_backlog *b;
+
+  /* messages following held back ones are held back too */
+  if (!inst->backlog) {
+    if (write_queue(inst, msg, msg_size) == 0) {
+      return 0;
+    }
+    if (errno != EAGAIN) {
+      return -1;
     }
   }
 
-  /* set instance role */
-  curinst->role = role;
+  if ((droppable && inst->backlog_len >= instance_config.window) || inst->backlog_len >= BACKLOG_MAX) {
+    inst->queue_stats.dropped++;
+    xdt_stats_count(inst->stats, XDT_STAT_DROPPED, 1);
+    return 0;
+  }
+  if (!(b = malloc(sizeof *b + msg_size))) {
+    return -1;
+  }
+  b->next = 0;
+  b->size = msg_size;
+  memcpy(b + 1, msg, msg_size);
+
+  if (inst->backlog) {
+    inst->backlog_last->next = b;
+  } else {
+    inst->backlog = b;
+    inst->backlogged_next = backlogged;
+    backlogged = inst;
+  }
+  inst->backlog_last = b;
+  inst->backlog_len++;
+  inst->queue_stats.deferred++;
 
   return 0;
 }
 
-
 /**
- * @brief Searches for a receiver instance by it's connection number
- *
- * @param conn connection number
- *
- * @return pointer to the receiver instance with connection number @a conn, else @e null
+ * @brief Writes the held back messages of all instances as far as their queues take them
  */
-static XDT_instance *
-get_instance_by_real_conn(unsigned conn)
+static void
+flush_backlogs(void)
 {
-  int i;
+  XDT_instance **p = &backlogged, *inst;
+  XDT_backlog *b;
+
+  while ((inst = *p)) {
+    while ((b = inst->backlog) && write_queue(inst, b + 1, b->size) == 0) {
+      inst->backlog = b->next;
+      inst->backlog_len--;
+      free(b);
+    }
+    if (b && errno != EAGAIN) {
+      perror("xdt_queue_try_write");
+      drop_backlog(inst);
+    }
 
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (instances[i].role == XDT_SERVICE_RECEIVER && instances[i].real_conn == conn) {
-      return &instances[i];
+    if (inst->backlog) {
+      p = &inst->backlogged_next;
+    } else {
+      inst->backlog_last = 0;
+      *p = inst->backlogged_next;
     }
   }
-
-  return 0;
 }
 
-
 /**
- * @brief Searches for a sender instance by it's mapped connection number
+ * @brief Passes a message from the dispatcher to an instance
+ *
+ * The message is packed into the instance's queue (see queue_message()) or,
+ * in single-process mode, processed immediately.
  *
- * @param conn mapped connection number
+ * @param inst points to the instance
+ * @param msg points to the message
+ * @param droppable not 0 if the message may be dropped while the queue is full
  *
- * @return pointer to the sender instance with mapped connection number @a conn, else @e null
+ * @return 0 on success, value < 0 on error (see xdt_queue_try_write())
  */
-static XDT_instance *
-get_instance_by_mapped_conn(unsigned conn)
+static int
+deliver_message(XDT_instance * inst, XDT_message * msg, int droppable)
 {
-  int i;
-
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (instances[i].role == XDT_SERVICE_SENDER && instances[i].mapped_conn == conn) {
-      return &instances[i];
-    }
+  if (single_process) {
+    serve_instance(inst, msg);
+    return 0;
   }
 
-  return 0;
+  return queue_message(inst, message_buffer, pack_message(msg, message_buffer), droppable);
 }
 
 
 /**
- * @brief Searches for a sender instance by it's endpoint addresses
- *
- * @param src source address
- * @param dst destination address
- *
- * @return pointer to the sender instance with matching addresses, else @e null
+ * @brief Delivers timer messages of all expired timers in single-process mode
  */
-static XDT_instance *
-get_instance_by_xdt_addresses(XDT_address * src, XDT_address * dst)
+static void
+expire_timers(void)
 {
-  int i;
+  XDT_soft_timer *t;
 
-  assert(src && dst);
+  while ((t = next_expired())) {
+    XDT_message msg;
 
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (instances[i].role == XDT_SERVICE_SENDER && XDT_ADDRESS_EQUAL(*src, instances[i].producer) && XDT_ADDRESS_EQUAL(*dst, instances[i].consumer)) {
-      return &instances[i];
-    }
+    msg.type = t->timer->type;
+    serve_instance(t->inst, &msg);
   }
-
-  return 0;
 }
 
 
 /**
- * @brief Searches for a sender instance by it's connection number 
- *        and send address of it's receiving peer
+ * @brief Returns the shard serving the connection of a PDU
  *
- * @param conn connection number
- * @param addr socket address of the sending peer
- * @param addr_len sizo of the address @a addr
+ * Initial DTs and ACKs are assigned by the addresses they carry, all
+ * others by the shard key within their connection number.
+ *
+ * @param pdu points to the PDU message
  *
- * @return pointer to the sender instance, else @e null
+ * @return shard index
  */
-static XDT_instance *
-get_instance_by_socket_address(unsigned conn, struct sockaddr_in *addr, socklen_t addr_len)
+static unsigned
+pdu_shard(XDT_pdu const *pdu)
 {
-  int i;
-
-  assert(addr);
+  switch ((int)pdu->type) {
+  case DT:
+    if (pdu->x.dt.sequ == 1) {
+      return XDT_SHARD_OF_CONN(xdt_shard_key(&pdu->x.dt.source_addr, &pdu->x.dt.dest_addr), shards);
+    }
+    return XDT_SHARD_OF_CONN(pdu->x.dt.conn, shards);
 
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (instances[i].role == XDT_SERVICE_SENDER && instances[i].real_conn == conn && instances[i].receiver_len == addr_len && !memcmp(&instances[i].receiver, addr, addr_len)) {
-      return &instances[i];
+  case ACK:
+    if (pdu->x.ack.sequ == 1) {
+      return XDT_SHARD_OF_CONN(xdt_shard_key(&pdu->x.ack.dest_addr, &pdu->x.ack.source_addr), shards);
     }
-  }
+    return XDT_SHARD_OF_CONN(pdu->x.ack.conn, shards);
 
-  return 0;
-}
+  case ABO:
+    return XDT_SHARD_OF_CONN(pdu->x.abo.conn, shards);
 
+  default:
+    return shard;
+  }
+}
 
 /**
- * @brief Releases context information for a finished instance
+ * @brief Returns the shard serving the connection of an SDU
  *
- * @param inst points to the instance to cleanup
+ * @param sdu points to the SDU message
+ *
+ * @return shard index
  */
-static void
-free_instance(XDT_instance * inst)
+static unsigned
+sdu_shard(XDT_sdu const *sdu)
 {
-  if (inst->role != XDT_SERVICE_NA) {
-    xdt_queue_delete(&inst->queue);
-    inst->role = XDT_SERVICE_NA;
+  if (sdu->type != XDATrequ) {
+    return shard;
   }
+  if (sdu->x.dat_requ.sequ == 1) {
+    return XDT_SHARD_OF_CONN(xdt_shard_key(&sdu->x.dat_requ.source_addr, &sdu->x.dat_requ.dest_addr), shards);
+  }
+  return XDT_SHARD_OF_CONN(sdu->x.dat_requ.conn, shards);
 }
 
 /**
- * @brief Releases context information for a finished instance
+ * @brief Passes a message on to the shard serving its connection
  *
- * @param pid process id of the instance to cleanup
+ * SDUs are passed on blocking, the order of a producer's SDUs is kept. PDUs
+ * are dropped when the shard's socket is full, as the network would: all
+ * shards pass on PDUs, so they must not wait for each other.
+ *
+ * @param to index of the shard
+ * @param msg points to the PDU or SDU message, it is passed on packed
+ * @param peer source address of a PDU, @e null for an SDU
+ * @param peer_len length of @a peer
+ * @param ring_fd payload ring passed along with an initial XDATrequ, -1 if none
  */
 static void
-free_instance_by_pid(pid_t pid)
+pass_to_shard(unsigned to, XDT_message * msg, struct sockaddr_in const *peer, socklen_t peer_len, int ring_fd)
 {
-  int i;
+  static XDT_shard_message head;
+  union
+  {
+    char buf[XDT_PAYLOAD_CONTROL_SIZE];
+    struct cmsghdr align;
+  } control;
+  struct msghdr mh;
+  struct iovec iov[2];
+
+  if (peer) {
+    head.peer = *peer;
+    head.peer_len = peer_len;
+  }
+  iov[0].iov_base = &head;
+  iov[0].iov_len = sizeof head;
+  iov[1].iov_base = message_buffer;
+  iov[1].iov_len = pack_message(msg, message_buffer);
+  ZERO(mh);
+  mh.msg_iov = iov;
+  mh.msg_iovlen = 2;
+
+  if (ring_fd != -1) {
+    struct cmsghdr *cmsg;
+
+    ZERO(control);
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof control.buf;
+    cmsg = CMSG_FIRSTHDR(&mh);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof (int));
+    memcpy(CMSG_DATA(cmsg), &ring_fd, sizeof ring_fd);
+  }
 
-  instance_died = 0;
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (instances[i].role != XDT_SERVICE_NA && instances[i].pid == pid) {
-      free_instance(&instances[i]);
-      return;
+  if (sendmsg(shard_socks[to][1], &mh, peer ? MSG_DONTWAIT : 0) == -1) {
+    if (peer && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      shard_stats.dropped++;
+    } else {
+      perror("passing message on to shard failed");
     }
+    return;
+  }
+  if (peer) {
+    shard_stats.pdus++;
+  } else {
+    shard_stats.sdus++;
   }
 }
 
 /**
- * @brief Reaps recently deceased instances 
- *
- * Called whenever one or more instances have finsihed.
- * Reads the status of the finsihed processes and frees
- * it's context information.
+ * @brief Prints the statistics of this shard
  */
 static void
-reap_instances(void)
+print_shard_stats(void)
 {
-  pid_t pid;
-
-  while ((pid = waitpid(-1, 0, WNOHANG)) > 0) {
-    printf("(%d) reaped instance with pid=%d\n", (int)getpid(), (int)pid);
-    free_instance_by_pid(pid);
-  }
+  printf("(%d) shard %u of %u: passed on %lu PDUs and %lu SDUs, dropped %lu PDUs\n", (int)getpid(), shard, shards,
+         shard_stats.pdus, shard_stats.sdus, shard_stats.dropped);
 }
 
-
 /**
- * @brief Detaches current spawned process
+ * @brief Creates a UDP socket bound to the listen address
  *
- * An new process group is created to detach the instance 
- * from the controlling terminal.
- * The dispatcher has registered handlers for SIGINT, SIGTERM and SIGCHLD.
- * The new spawned instance does not need to catch SIGINT and SIGCHLD.
- * SIGTERM is ignored per default. Since the dispatcher informs all running instance
- * about the end of message dispatching by sending them SIGTERM,
- * the sender and/or receiver code may override this signal action, if necessary.
+ * With more than one shard, the sockets of all shards share the address by
+ * SO_REUSEPORT. A whole window of DTs with #XDT_config.max_length payload
+ * bytes must fit into the receive buffer, the kernel limits the size to
+ * net.core.rmem_max.
+ *
+ * @param net_addr listen address
+ * @param config window and payload size
+ *
+ * @return the socket
  */
-static void
-detach_instance(void)
+static int
+bind_net_listen_sock(struct sockaddr_in const *net_addr, XDT_config const *config)
 {
-  struct sigaction sa;
-
-  /* create new process group */
-  setpgid(0, 0);
+  int sock, on = 1, size = 0, want = 2 * config->window * (PDU_HEADER_STREAM_MAX + config->max_length);
+  socklen_t len = sizeof size;
 
-  /* reset signal handlers, ignore SIGTERM */
-  sigemptyset(&sa.sa_mask);
-  sa.sa_flags = 0;
-  sa.sa_handler = SIG_DFL;
-  if (sigaction(SIGINT, &sa, 0) == -1) {
-    perror("sigaction");
+  if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
+    perror("socket");
     exit(EXIT_FAILURE);
   }
-  if (sigaction(SIGCHLD, &sa, 0) == -1) {
-    perror("sigaction");
+  if (shards > 1 && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) == -1) {
+    perror("setsockopt SO_REUSEPORT");
     exit(EXIT_FAILURE);
   }
-
-  sa.sa_handler = SIG_IGN;
-  if (sigaction(SIGTERM, &sa, 0) == -1) {
-    perror("sigaction");
+  if (bind(sock, (struct sockaddr const *)net_addr, sizeof *net_addr) == -1) {
+    perror("bind");
+    fputs("Maybe another service is running using the same SAP\n", stderr);
     exit(EXIT_FAILURE);
   }
-}
 
+  if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0 && size < want
+      && setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &want, sizeof want) == -1) {
+    perror("warning: setsockopt SO_RCVBUF");
+  }
+
+  return sock;
+}
 
 /**
- * @brief Signal handler for the dispatcher
+ * @brief Starts the dispatcher shards
  *
- * On SIGINT and SIGTERM, the exit flag #should_quit is set. 
- * On SIGCHLD #instance_died is set.
+ * The listen sockets of all shards join the SO_REUSEPORT group in shard order,
+ * so the steering program's index is the shard, which is checked by probes
+ * (see xdt_shard_probe()). Then the statistics segment is created and the
+ * other shards are forked, each keeps its own listen socket and the receiving
+ * end of its socket pair. The first shard keeps the listen sockets of all.
  *
- * @param signo the raised signal number
+ * @param sap listen address, names the statistics segment
+ * @param net_addr listen address
+ * @param config window and payload size
  */
 static void
-dispatcher_signal_handler(int signo)
+start_shards(XDT_address const *sap, struct sockaddr_in const *net_addr, XDT_config const *config)
 {
-  switch (signo) {
-  case SIGINT:
-  case SIGTERM:
-    should_quit = 1;
-    break;
+  int socks[XDT_SHARDS_MAX];
+  unsigned i;
+  pid_t pid;
 
-  case SIGCHLD:
-    instance_died = 1;
-    break;
+  for (i = 0; i < shards; ++i) {
+    socks[i] = bind_net_listen_sock(net_addr, config);
   }
-}
 
+  /* the address is ours now, all processes forked from here on share the statistics */
+  if (xdt_stats_create(sap) < 0) {
+    perror("warning: creating the statistics segment failed");
+  }
+  if (shards == 1) {
+    net_listen_sock = socks[0];
+    return;
+  }
 
-/** @brief Sets up signal handlers for the dispatcher */
-static void
-setup_signals(void)
-{
-  struct sigaction sa;
+  if (xdt_shard_steer(socks[0], shards) < 0) {
+    perror("warning: steering PDUs to shards failed, the shards pass them on");
+  } else if (xdt_shard_probe(socks, shards, net_addr) < 0) {
+    fputs("warning: PDUs are not steered to their shards, the shards pass them on\n", stderr);
+    xdt_shard_unsteer(socks[0]);
+  }
+  for (i = 0; i < shards; ++i) {
+    if (socketpair(PF_LOCAL, SOCK_DGRAM, 0, shard_socks[i]) == -1) {
+      perror("socketpair");
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  sigemptyset(&sa.sa_mask);
-  sa.sa_flags = SA_NOCLDSTOP;
-#ifdef SA_INTERRUPT
-  /* do not restart system calls after those signals */
-  sa.sa_flags |= SA_INTERRUPT;
-#endif
-  sa.sa_handler = dispatcher_signal_handler;
+  /* do not print buffered output of the first shard twice */
+  fflush(stdout);
+  for (i = 1; i < shards && !shard; ++i) {
+    switch (pid = fork()) {
+    case -1:
+      perror("fork");
+      exit(EXIT_FAILURE);
+    case 0:
+      shard = i;
+      memset(shard_pids, 0, sizeof shard_pids);
+      break;
+    default:
+      shard_pids[i] = pid;
+    }
+  }
 
-  if (sigaction(SIGINT, &sa, 0) == -1) {
-    perror("sigaction");
-    exit(EXIT_FAILURE);
+  for (i = 0; i < shards; ++i) {
+    if (i != shard) {
+      /* the first shard keeps all listen sockets, so the group is not renumbered if a shard exits */
+      if (shard) {
+        close(socks[i]);
+      }
+      close(shard_socks[i][0]);
+    } else {
+      close(shard_socks[i][1]);
+    }
   }
-  if (sigaction(SIGTERM, &sa, 0) == -1) {
-    perror("sigaction");
-    exit(EXIT_FAILURE);
+  net_listen_sock = socks[shard];
+  printf("(%d) dispatcher shard %u of %u started\n", (int)getpid(), shard, shards);
+  fflush(stdout);
+}
+
+/**
+ * @brief Stops the other dispatcher shards
+ *
+ * Called by the first shard when dispatching has finished.
+ */
+static void
+stop_shards(void)
+{
+  unsigned i;
+
+  for (i = 1; i < shards; ++i) {
+    if (shard_pids[i]) {
+      kill(shard_pids[i], SIGTERM);
+    }
   }
-  if (sigaction(SIGCHLD, &sa, 0) == -1) {
-    perror("sigaction");
-    exit(EXIT_FAILURE);
+  for (i = 1; i < shards; ++i) {
+    while (shard_pids[i] && waitpid(shard_pids[i], 0, 0) == -1 && errno == EINTR);
+    shard_pids[i] = 0;
   }
 }
 
 
 /**
- * @brief Debug printing of timer messages
+ * @brief Hands the current instance over to its pre-forked instance process
  *
- * Analogous to print_sdu() and print_pdu().
+ * The connection is released if the process cannot take it.
  *
- * @param msg points to the timer message
- * @param info string to make the output unique
- * @param stream output stream, @e stderr is used if @e null
+ * @param ring_fd payload ring to pass along, -1 if none, closed in any case
  */
 static void
-print_timer(XDT_message * msg, char *info, FILE * stream)
+hand_over(int ring_fd)
 {
-  if (!stream) {
-    stream = stderr;
+  XDT_worker *w = &workers[curinst->worker - 1];
+  XDT_handover *h = &w->handover;
+  int rc;
+
+  h->role = curinst->role;
+  h->real_conn = curinst->real_conn;
+  h->mapped_conn = curinst->mapped_conn;
+  h->producer = curinst->producer;
+  h->consumer = curinst->consumer;
+  h->probe = curinst->probe;
+  h->probe_len = curinst->probe_len;
+  h->stats = curinst->stats;
+
+  if (ring_fd != -1) {
+    rc = xdt_payload_send_fd(w->ctl, h, sizeof *h, ring_fd);
+    close(ring_fd);
+  } else {
+    rc = send(w->ctl, h, sizeof *h, MSG_DONTWAIT);
+  }
+  if (rc == -1) {
+    perror("handing over connection failed");
+    free_instance(curinst);
+    return;
   }
 
-  fprintf(stream, "\nTIMER: >> %s <<\n", info ? info : "");
-  fprintf(stream, "type = (%ld)\n", msg->type);
+  if (xdt_logging(XDT_LOG_MESSAGES)) {
+    printf("(%d) handed %s instance over to pid=%d\n", (int)getpid(),
+           h->role == XDT_SERVICE_SENDER ? "sender" : "receiver", (int)w->pid);
+  }
 }
 
 
 /**
- * @brief Signal handler for real-time signals
+ * @brief Passes a PDU received from a peer to its instance
+ *
+ * An initial DT sets up a new receiver instance, an initial ACK completes
+ * the connection number and peer address of its sender instance. With more
+ * than one shard, a PDU of a connection served by another shard is passed on
+ * to it.
  *
- * Called on timer expiration.
- * A message with the timers type is put into the queue.
+ * @param msg points to the PDU message
+ * @param peer_addr source address of the PDU
+ * @param addr_len length of @a peer_addr
+ * @param c when returning as receiver, the assigned connection number 
+ *        is stored where @a c points to
  *
- * @param signo raised signal number 
- * @param info signal information
- * @param cruft not used
+ * @return the role to continue with in a new instance process, #XDT_SERVICE_NA in the dispatcher
  */
-static void
-timeout_handler(int signo, siginfo_t * info, void *cruft)
-{
-  int saved_errno = errno;
-  long type = info->si_value.sival_int;
-
-  /* avoid 'unused parameter' compiler warnings */
-  signo = signo;
-  cruft = 0;
-
-  /** 
-   * @bug The @e msgsnd(2) system call used in xdt_queue_write() 
-   *      is not declared as reentrant (async-signal-safe), 
-   *      so to behaviour is undefined.
-   */
-  if (xdt_queue_write(&curinst->queue, &type, sizeof type) < 0) {
-    fputs("writing queue failed\n", stderr);
-    exit(EXIT_FAILURE);
+static XDT_role
+dispatch_pdu(XDT_message * msg, struct sockaddr_in const *peer_addr, socklen_t addr_len, unsigned *c)
+{
+  unsigned owner;
+
+  if (shards > 1 && (owner = pdu_shard(&msg->pdu)) != shard) {
+    pass_to_shard(owner, msg, peer_addr, addr_len, -1);
+    return XDT_SERVICE_NA;
+  }
+
+  switch ((int)msg->pdu.type) {
+  case DT:
+    /* I'm receiver */
+    if (msg->pdu.x.dt.sequ == 1) {
+      /* initial DT */
+      if (setup_instance(XDT_SERVICE_RECEIVER, &msg->pdu) == 0) {
+        if (instance_config.direct) {
+          /* the initial ACK tells a sending instance with its own socket where to send */
+          memcpy(&curinst->probe, peer_addr, sizeof curinst->probe);
+          curinst->probe_len = addr_len;
+        }
+        if (single_process) {
+          start_instance(curinst, msg);
+          break;
+        }
+        if (curinst->worker) {
+          hand_over(-1);
+          break;
+        }
+        *c = curinst->real_conn;
+        switch (curinst->pid = fork()) {
+        case 0:
+          detach_instance();
+          return XDT_SERVICE_RECEIVER;
+        case -1:
+          QOR_RETURN("fork");
+        default:
+          /* parent */
+          printf("(%d) forked receiver instance with pid=%d\n", (int)getpid(), (int)curinst->pid);
+          if (curinst->stats) {
+            curinst->stats->pid = curinst->pid;
+          }
+          release_instance_sockets(curinst);
+          xdt_conntable_link(&connections, curinst);
+        }
+      } else {
+        fputs("warning: could not setup receiver instance\n", stderr);
+      }
+    } else {
+      /* not initial DT */
+      if (!(curinst = xdt_conntable_by_real_conn(&connections, msg->pdu.x.dt.conn))) {
+        fputs("warning: get_instance_by_real_conn: could not find instance for received DT\n", stderr);
+        break;
+      }
+      if (deliver_message(curinst, msg, 1) < 0) {
+        QOR_RETURN("xdt_queue_try_write");
+      }
+    }
+    break;
+
+  case ACK:
+    /* I'm sender */
+    if (msg->pdu.x.ack.sequ == 1) {
+      /* initial ACK */
+      if (!(curinst = xdt_conntable_by_xdt_addresses(&connections, &msg->pdu.x.ack.dest_addr, &msg->pdu.x.ack.source_addr))) {
+        fputs("warning: get_instance_by_xdt_addresses: could not find instance for received ACK\n", stderr);
+        break;
+      }
+      /* store connection number */
+      curinst->real_conn = msg->pdu.x.ack.conn;
+
+      /* store socket address of receiving peer */
+      memcpy(&curinst->receiver, peer_addr, addr_len);
+      curinst->receiver_len = addr_len;
+
+      /* index by connection number and socket address */
+      xdt_conntable_link(&connections, curinst);
+
+      /* deliver message, it carries the connection number */
+      if (deliver_message(curinst, msg, 0) < 0) {
+        QOR_RETURN("xdt_queue_try_write");
+      }
+    } else {
+      /*not initial ACK */
+      if (!(curinst = xdt_conntable_by_socket_address(&connections, msg->pdu.x.ack.conn, peer_addr, addr_len))) {
+        fputs("warning: get_instance_by_socket_address: could not find instance for received ACK\n", stderr);
+        break;
+      }
+      if (deliver_message(curinst, msg, 1) < 0) {
+        QOR_RETURN("xdt_queue_try_write");
+      }
+    }
+    break;
+
+  case ABO:
+    /* I'm sender */
+    if (!(curinst = xdt_conntable_by_socket_address(&connections, msg->pdu.x.abo.conn, peer_addr, addr_len))) {
+      fputs("warning: get_instance_by_socket_address: could not find instance for received ABO\n", stderr);
+      break;
+    }
+    if (deliver_message(curinst, msg, 0) < 0) {
+      QOR_RETURN("xdt_queue_try_write");
+    }
+    break;
+
+  default:
+    fputs("warning: unknown PDU type\n", stderr);
+  }
+
+  return XDT_SERVICE_NA;
+}
+
+/**
+ * @brief Passes an SDU received from a user to its instance
+ *
+ * An initial XDATrequ sets up a new sender instance, which takes the payload
+ * ring passed along. Further XDATrequs get the real connection number. With
+ * more than one shard, an SDU of a connection served by another shard is
+ * passed on to it.
+ *
+ * @param sdu_msg points to the SDU message
+ * @param ring_fd payload ring passed along with the SDU, -1 if none, closed if not taken
+ *
+ * @return the role to continue with in a new instance process, #XDT_SERVICE_NA in the dispatcher
+ */
+static XDT_role
+dispatch_sdu(XDT_message * sdu_msg, int ring_fd)
+{
+  unsigned owner;
+
+  if (shards > 1 && (owner = sdu_shard(&sdu_msg->sdu)) != shard) {
+    pass_to_shard(owner, sdu_msg, 0, 0, ring_fd);
+    if (ring_fd != -1) {
+      close(ring_fd);
+    }
+    return XDT_SERVICE_NA;
+  }
+
+  if (sdu_msg->sdu.type == XDATrequ) {
+    if (sdu_msg->sdu.x.dat_requ.sequ == 1) {
+      /* initial XDATrequ */
+      if (setup_instance(XDT_SERVICE_SENDER, &sdu_msg->sdu) == 0) {
+        if (curinst->worker) {
+          /* the pre-forked instance process maps the ring itself */
+          hand_over(ring_fd);
+          return XDT_SERVICE_NA;
+        }
+        if (ring_fd != -1) {
+          /* mapped before fork(2), so the instance process inherits the mapping */
+          if (xdt_payload_attach(&curinst->ring, ring_fd) < 0) {
+            fputs("warning: could not attach payload ring\n", stderr);
+          }
+          ring_fd = -1;
+        }
+        if (single_process) {
+          start_instance(curinst, sdu_msg);
+          return XDT_SERVICE_NA;
+        }
+        switch (curinst->pid = fork()) {
+        case 0:
+          detach_instance();
+          return XDT_SERVICE_SENDER;
+        case -1:
+          QOR_RETURN("fork");
+        default:
+          /* parent */
+          printf("(%d) forked sender instance with pid=%d\n", (int)getpid(), (int)curinst->pid);
+          if (curinst->stats) {
+            curinst->stats->pid = curinst->pid;
+          }
+          release_instance_sockets(curinst);
+          xdt_conntable_link(&connections, curinst);
+        }
+      } else {
+        fputs("warning: could not setup sender instance\n", stderr);
+      }
+    } else {
+      /* not initial XDATrequ */
+
+      /* get instance data */
+      if (!(curinst = xdt_conntable_by_mapped_conn(&connections, sdu_msg->sdu.x.dat_requ.conn))) {
+        fputs("warning: get_instance_by_mapped_conn: could not find instance for received XDATrequ\n", stderr);
+      } else {
+        /* set connection number to real connection number, unless the
+           initial ACK went straight to the instance's own socket so far */
+        if (curinst->real_conn) {
+          sdu_msg->sdu.x.dat_requ.conn = curinst->real_conn;
+        }
+
+        /* deliver message, its payload may still be in the ring */
+        if (deliver_message(curinst, sdu_msg, 0) < 0) {
+          QOR_RETURN("xdt_queue_try_write");
+        }
+      }
+    }
+  } else {
+    fputs("warning: unknown SDU type\n", stderr);
+  }
+
+  if (ring_fd != -1) {
+    close(ring_fd);
   }
 
-  errno = saved_errno;
+  return XDT_SERVICE_NA;
 }
 
 
@@ -647,51 +2571,114 @@ timeout_handler(int signo, siginfo_t * info, void *cruft)
  * Some signals are catched to graceful terminate the dispatcher and all still running 
  * instances (by sending them SIGTERM, which are ignored there per default).
  * The initial connection number is random generated and each instance gets assigned
- * a consecutive connection number (mapped or real).
+ * a consecutive connection number (mapped or real), its low bits replaced by the
+ * shard key of the producer and consumer address (see #XDT_SHARD_CONN).
+ *
+ * With more than one shard (see XDT_config.shards) the dispatcher forks the other
+ * shards first, see start_shards(). Every shard serves the connections with its
+ * key, a message of another shard's connection is passed on to it. Every shard
+ * receives SDUs from users at an access point of its own: the initial XDATrequ
+ * arrives at the first shard's, the XDATconfs tell the producer where to send
+ * the further ones (see xdt_address_to_shard_sap_name()).
+ *
+ * In single-process mode (see XDT_config.single_process) no instance is spawned. 
+ * The dispatcher keeps the protocol state of every connection in its instance context
+ * and passes each message directly to start_instance() or serve_instance().
+ * Timers are maintained by the dispatcher too, in a timer wheel whose next expiration
+ * arms the dispatcher's timerfd. In this mode the function only returns after the
+ * dispatching has finished.
+ *
+ * Otherwise every instance process keeps its timers in its own wheel and arms the
+ * timerfd created by setup_instance(), which the dispatcher waits for too and answers
+ * by a #TIMER_WAKEUP message (see get_message()).
+ *
+ * With a pool (see XDT_config.pool) the dispatcher forks that many instance
+ * processes in advance, each with its queue, timerfd and a control socket. A new
+ * connection is handed over to an idle one (see hand_over()), which connects its
+ * sockets, serves the connection and reports back when it has finished (see
+ * await_connection() and finish_connection()). Only while all of them are busy,
+ * an instance process is forked per connection as without a pool. The function
+ * returns #XDT_SERVICE_WORKER in a pre-forked instance process.
+ *
+ * With XDT_config.direct the peers of an established connection send their
+ * PDUs to the instance's socket instead of the listen address: see send_pdu()
+ * and receive_direct(). The dispatcher only passes SDUs, timer wake-ups and
+ * the PDUs of the handshake then.
  *
  * @param sap local listen address
  * @param c when returning as receiver, the assigned connection number 
  *        is stored where @a c points to
- * @param error_case the error case to simulate by all instances
+ * @param config the error case to simulate by all instances, the serving mode and the
+ *        protocol parameters, the payload size is lowered to what the queues can carry
  *
  * @return 
  */
 XDT_role
-dispatch(XDT_address const *sap, unsigned *c, XDT_error error_case)
+dispatch(XDT_address const *sap, unsigned *c, XDT_config *config)
 {
   struct sockaddr_in net_addr, peer_addr;
-  struct sockaddr_un local_addr, user_addr;
+  struct sockaddr_un local_addr;
+  struct epoll_event ev;
   socklen_t addr_len;
-  fd_set master_set;
-  XDT_pdu pdu;
-  XDT_sdu sdu;
-  char pdu_stream[PDU_STREAM_MAX];
+  XDT_message msg;
+  char *pdu_stream;
+  ssize_t bytes;
+  unsigned long net_calls = 0, net_pdus = 0, local_calls = 0, local_sdus = 0;
+  XDT_role role;
+  unsigned k;
   int i;
 
   printf("(%d) dispatching messages started...\n", (int)getpid());
 
-  if (!sap || !c) {
+  if (!sap || !c || !config) {
     fputs("parameter failure\n", stderr);
     exit(EXIT_FAILURE);
   }
 
-  err_case = error_case;
+  err_case = config->error_case;
+  single_process = config->single_process;
+  max_connections = config->max_connections;
 
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    instances[i].role = XDT_SERVICE_NA;
+  /* instance processes get messages with up to max_length payload bytes by queue */
+  if (!single_process && config->max_length > max_queued_payload()) {
+    config->max_length = max_queued_payload();
+    printf("(%d) payload size limited to %u bytes by the message queue\n", (int)getpid(), config->max_length);
+  }
+  if (config->tunnel) {
+    /* the tunnels' state is shared by all connections, so they are served here */
+    printf("(%d) tunnels: serving all connections in the dispatcher process\n", (int)getpid());
   }
+  instance_config = *config;
 
-  setup_signals();
+  /* pre-forked instance processes, forked by the dispatching loop */
+  if (!single_process && config->pool) {
+    if (!(workers = calloc(config->pool, sizeof *workers))) {
+      perror("calloc");
+      exit(EXIT_FAILURE);
+    }
+    pool_size = config->pool;
+  }
 
-  /* init starting connection number */
-  srand(time(0) ^ getpid());
-  new_conn = rand();
+  /* buffers are sized by the payload size, a peer with -T aggregates PDUs up to a tunnel datagram */
+  create_buffers(config->max_length);
+  create_batch(&net_batch, stream_size, 0);
+  create_batch(&local_batch, XDT_SDU_SIZE(config->max_length), XDT_PAYLOAD_CONTROL_SIZE);
+  create_batch(&held, PDU_STREAM_SIZE(config->max_length), 0);
+  xdt_tunnels_init(&tunnels);
 
-  /* create peer endpoint */
-  if ((net_listen_sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
-    perror("socket");
+  shards = config->shards;
+  if (shards > 1) {
+    create_batch(&shard_batch, sizeof (XDT_shard_message) + message_buffer_size, XDT_PAYLOAD_CONTROL_SIZE);
+  }
+
+  if (xdt_conntable_create(&connections) < 0) {
+    perror("xdt_conntable_create");
     exit(EXIT_FAILURE);
   }
+
+  setup_signals();
+
+  /* create peer endpoints, one per shard, and fork the other shards */
   ZERO(net_addr);
   net_addr.sin_family = AF_INET;
   net_addr.sin_port = htons(sap->port);
@@ -700,21 +2687,21 @@ dispatch(XDT_address const *sap, unsigned *c, XDT_error error_case)
 	    "address does not contain a character string representing a valid IPv4 address");
     exit(EXIT_FAILURE);
   }
-  if (bind(net_listen_sock, (struct sockaddr *)&net_addr, sizeof net_addr) == -1) {
-    perror("bind");
-    fputs("Maybe another service is running using the same SAP\n", stderr);
-    exit(EXIT_FAILURE);
-  }
+  start_shards(sap, &net_addr, config);
+
+  /* init starting connection number */
+  srand(time(0) ^ getpid());
+  new_conn = rand();
 
-  /* create user endpoint */
+  /* create user endpoint, one per shard: producers move on to the shard serving their connection */
+  ZERO(local_addr);
   if ((local_listen_sock = socket(PF_LOCAL, SOCK_DGRAM, 0)) == -1) {
     perror("socket");
     exit(EXIT_FAILURE);
   }
-  ZERO(local_addr);
   local_addr.sun_family = AF_LOCAL;
-  if (xdt_address_to_sap_name(sap, local_addr.sun_path, sizeof local_addr.sun_path) < 0) {
-    fputs("xdt_address_to_sap_name() failed\n", stderr);
+  if (xdt_address_to_shard_sap_name(sap, shard, local_addr.sun_path, sizeof local_addr.sun_path) < 0) {
+    fputs("xdt_address_to_shard_sap_name() failed\n", stderr);
     exit(EXIT_FAILURE);
   }
   /* fails, if path from previous run not deleted */
@@ -724,192 +2711,288 @@ dispatch(XDT_address const *sap, unsigned *c, XDT_error error_case)
     exit(EXIT_FAILURE);
   }
 
-  i = 1 + ((net_listen_sock > local_listen_sock) ? net_listen_sock : local_listen_sock);
-  FD_ZERO(&master_set);
-  FD_SET(net_listen_sock, &master_set);
-  FD_SET(local_listen_sock, &master_set);
+  /* wait for both endpoints and the timers by epoll(7), instance timerfds are added by setup_instance() */
+  xdt_wheel_init(&wheel, monotonic_time());
+  if ((epoll_fd = epoll_create(2)) == -1) {
+    perror("epoll_create");
+    exit(EXIT_FAILURE);
+  }
+  ZERO(ev);
+  ev.events = EPOLLIN;
+  ev.data.ptr = &net_listen_sock;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, net_listen_sock, &ev) == -1) {
+    perror("epoll_ctl");
+    exit(EXIT_FAILURE);
+  }
+  ev.data.ptr = &local_listen_sock;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, local_listen_sock, &ev) == -1) {
+    perror("epoll_ctl");
+    exit(EXIT_FAILURE);
+  }
+  ev.data.ptr = &shard_socks[shard][0];
+  if (shards > 1 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, shard_socks[shard][0], &ev) == -1) {
+    perror("epoll_ctl");
+    exit(EXIT_FAILURE);
+  }
+  if (single_process) {
+    ev.data.ptr = &wheel_fd;
+    if ((wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) == -1
+        || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wheel_fd, &ev) == -1) {
+      perror("timerfd");
+      exit(EXIT_FAILURE);
+    }
+  }
 
   while (!should_quit) {
-    fd_set sock_set = master_set;
+    struct epoll_event events[MAX_EVENTS];
+    int net_ready = 0, local_ready = 0, shard_ready = 0;
+    int ready;
 
     /* reap recently deceased instances */
     reap_instances();
 
-    /* wait for readable socket */
-    if (select(i, &sock_set, 0, 0, 0) == -1) {
-      QOR("select");
+    /* fork the pre-forked instance processes, again if one has exited */
+    for (k = 0; k < pool_size; ++k) {
+      if (!workers[k].pid && spawn_worker(&workers[k]) != XDT_SERVICE_NA) {
+        return XDT_SERVICE_WORKER;
+      }
+    }
+
+    if (single_process) {
+      arm_wheel_fd(wheel_fd);
     }
 
-    if (FD_ISSET(net_listen_sock, &sock_set)) {
+    /* the PDUs aggregated while serving the last messages leave now */
+    flush_tunnels();
+
+    /* held back messages go first, until they are written the wait is short */
+    flush_backlogs();
 
-      /* pdu from peer */
-      addr_len = sizeof peer_addr;
-      if (recvfrom(net_listen_sock, pdu_stream, sizeof pdu_stream, 0, (struct sockaddr *)&peer_addr, &addr_len) == -1) {
-        QOR("recvfrom");
+    /* wait for readable socket or timer expiration */
+    if ((ready = epoll_wait(epoll_fd, events, MAX_EVENTS, backlogged ? BACKLOG_RETRY_MS : -1)) == -1) {
+      QOR("epoll_wait");
+    }
+    for (i = 0; i < ready; ++i) {
+      void *ptr = events[i].data.ptr;
+      uint64_t expirations;
+
+      if (ptr == &net_listen_sock) {
+        net_ready = 1;
+      } else if (ptr == &local_listen_sock) {
+        local_ready = 1;
+      } else if (ptr == &shard_socks[shard][0]) {
+        shard_ready = 1;
+      } else if (ptr == &wheel_fd) {
+        if (read(wheel_fd, &expirations, sizeof expirations) > 0) {
+          wheel_armed = 0;
+          timer_stats.wakeups++;
+        }
+      } else if (ptr >= (void *)workers && ptr < (void *)(workers + pool_size)) {
+        /* control socket or timerfd of a pre-forked instance process */
+        XDT_worker *w = workers + ((char *)ptr - (char *)workers) / sizeof *workers;
+        long type = TIMER_WAKEUP;
+
+        if (ptr == &w->ctl) {
+          return_worker(w);
+        } else if (read(w->timer_fd, &expirations, sizeof expirations) > 0 && w->inst
+                   && queue_message(w->inst, &type, sizeof type, 0) < 0) {
+          perror("xdt_queue_try_write");
+        }
+      } else {
+        /* timerfd of an instance process expired, wake it up */
+        XDT_instance *inst = ptr;
+        long type = TIMER_WAKEUP;
+
+        if (read(inst->timer_fd, &expirations, sizeof expirations) > 0
+            && queue_message(inst, &type, sizeof type, 0) < 0) {
+          perror("xdt_queue_try_write");
+        }
       }
-      if (deserialize_pdu(pdu_stream, sizeof pdu_stream, &pdu) < 0) {
-        fputs("deserializing PDU failed\n", stderr);
-        break;
+    }
+
+    if (single_process) {
+      expire_timers();
+    }
+
+    if (net_ready) {
+
+      /* pdus from peers, as many as available */
+      if (receive_batch(net_listen_sock, &net_batch) == -1 && errno != EAGAIN) {
+        QOR("recvmmsg");
       }
+      net_calls++;
 
-      switch ((int)pdu.type) {
-      case DT:
-        /* I'm receiver */
-        if (pdu.x.dt.sequ == 1) {
-          /* initial DT */
-          if (setup_instance(XDT_SERVICE_RECEIVER, &pdu) == 0) {
-            *c = curinst->real_conn;
-            switch (curinst->pid = fork()) {
-            case 0:
-              detach_instance();
-              return XDT_SERVICE_RECEIVER;
-            case -1:
-              QOR("fork");
-              break;
-            default:
-              /* parent */
-              printf("(%d) forked receiver instance with pid=%d\n", (int)getpid(), (int)curinst->pid);
-            }
-          } else {
-            fputs("warning: could not setup receiver instance\n", stderr);
-          }
-        } else {
-          /* not initial DT */
-          if (!(curinst = get_instance_by_real_conn(pdu.x.dt.conn))) {
-            fputs("warning: get_instance_by_real_conn: could not find instance for received DT\n", stderr);
-            continue;
-          }
-          if (xdt_queue_write(&curinst->queue, &pdu, sizeof pdu) < 0) {
-            QOR("xdt_queue_write");
-          }
-        }
-        break;
+      for (k = 0; k < net_batch.count && !should_quit; ++k) {
+        ssize_t off;
+        int n;
 
-      case ACK:
-        /* I'm sender */
-        if (pdu.x.ack.sequ == 1) {
-          /* initial ACK */
-          if (!(curinst = get_instance_by_xdt_addresses(&pdu.x.ack.dest_addr, &pdu.x.ack.source_addr))) {
-            fputs("warning: get_instance_by_xdt_addresses: could not find instance for received ACK\n", stderr);
-            continue;
-          }
-          /* store connection number */
-          curinst->real_conn = pdu.x.ack.conn;
+        pdu_stream = net_batch.buffers + k * net_batch.size;
+        bytes = net_batch.msgs[k].msg_len;
+        addr_len = net_batch.msgs[k].msg_hdr.msg_namelen;
+        memcpy(&peer_addr, &net_batch.addrs[k], sizeof peer_addr);
 
-          /* store socket address of receiving peer */
-          memcpy(&curinst->receiver, &peer_addr, addr_len);
-          curinst->receiver_len = addr_len;
+        /* the payload exceeds the configured size */
+        if (net_batch.msgs[k].msg_hdr.msg_flags & MSG_TRUNC) {
+          fputs("warning: PDU too big, dropped\n", stderr);
+          continue;
+        }
 
-          /* deliver message */
-          if (xdt_queue_write(&curinst->queue, &pdu, sizeof pdu) < 0) {
-            QOR("xdt_queue_write");
-          }
-        } else {
-          /*not initial ACK */
-          if (!(curinst = get_instance_by_socket_address(pdu.x.ack.conn, &peer_addr, addr_len))) {
-            fputs("warning: get_instance_by_socket_address: could not find instance for received ACK\n", stderr);
+        /* a tunnel aggregates several PDUs into one datagram */
+        for (off = 0; off < bytes; off += n) {
+          /* decode the received bytes only, a truncated PDU fails */
+          if ((n = deserialize_pdu(pdu_stream + off, bytes - off, &msg.pdu)) <= 0) {
+            fputs("deserializing PDU failed\n", stderr);
+            should_quit = 1;
             break;
           }
-          if (xdt_queue_write(&curinst->queue, &pdu, sizeof pdu) < 0) {
-            QOR("xdt_queue_write");
+          net_pdus++;
+
+          if ((role = dispatch_pdu(&msg, &peer_addr, addr_len, c)) != XDT_SERVICE_NA) {
+            return role;
           }
         }
-        break;
+      }
+    }
 
-      case ABO:
-        /* I'm sender */
-        if (!(curinst = get_instance_by_socket_address(pdu.x.abo.conn, &peer_addr, addr_len))) {
-          fputs("warning: get_instance_by_socket_address: could not find instance for received ABO\n", stderr);
-          break;
+    if (local_ready) {
+      /* sdus from users, as many as available */
+      if (receive_batch(local_listen_sock, &local_batch) == -1 && errno != EAGAIN) {
+        QOR("recvmmsg");
+      }
+      local_calls++;
+      local_sdus += local_batch.count;
+
+      for (k = 0; k < local_batch.count; ++k) {
+        /* the producer passes its payload ring along with the initial XDATrequ */
+        int ring_fd = xdt_payload_received_fd(&local_batch.msgs[k].msg_hdr);
+
+        if ((local_batch.msgs[k].msg_hdr.msg_flags & MSG_TRUNC)
+            || unpack_message(&msg, local_batch.buffers + k * local_batch.size, local_batch.msgs[k].msg_len) < 0
+            || msg.type <= sdu_msg_min_pred || msg.type >= sdu_msg_max_succ) {
+          fputs("warning: invalid SDU, dropped\n", stderr);
+          if (ring_fd != -1) {
+            close(ring_fd);
+          }
+          continue;
         }
-        if (xdt_queue_write(&curinst->queue, &pdu, sizeof pdu) < 0) {
-          QOR("xdt_queue_write");
+        if ((role = dispatch_sdu(&msg, ring_fd)) != XDT_SERVICE_NA) {
+          return role;
         }
-        break;
-
-      default:
-        fputs("warning: unknown PDU type\n", stderr);
       }
     }
 
-    if (FD_ISSET(local_listen_sock, &sock_set)) {
-      /* sdu from user */
-      addr_len = sizeof user_addr;
-      if (recvfrom(local_listen_sock, &sdu, sizeof sdu, 0, (struct sockaddr *)&user_addr, &addr_len) == -1) {
-        QOR("recvfrom");
+    if (shard_ready) {
+      /* messages passed on by other shards */
+      if (receive_batch(shard_socks[shard][0], &shard_batch) == -1 && errno != EAGAIN) {
+        QOR("recvmmsg");
       }
 
-      if (sdu.type == XDATrequ) {
-        if (sdu.x.dat_requ.sequ == 1) {
-          /* initial XDATrequ */
-          if (setup_instance(XDT_SERVICE_SENDER, &sdu) == 0) {
-            switch (curinst->pid = fork()) {
-            case 0:
-              detach_instance();
-              return XDT_SERVICE_SENDER;
-            case -1:
-              QOR("fork");
-              break;
-            default:
-              /* parent */
-              printf("(%d) forked sender instance with pid=%d\n", (int)getpid(), (int)curinst->pid);
-            }
-          } else {
-            fputs("warning: could not setup sender instance\n", stderr);
-          }
-        } else {
-          /* not initial XDATrequ */
+      for (k = 0; k < shard_batch.count && !should_quit; ++k) {
+        XDT_shard_message *sm = (XDT_shard_message *)(shard_batch.buffers + k * shard_batch.size);
+        int ring_fd = xdt_payload_received_fd(&shard_batch.msgs[k].msg_hdr);
 
-          /* get instance data */
-          if (!(curinst = get_instance_by_mapped_conn(sdu.x.dat_requ.conn))) {
-            fputs("warning: get_instance_by_mapped_conn: could not find instance for received XDATrequ\n", stderr);
-            continue;
+        if (shard_batch.msgs[k].msg_len < sizeof *sm
+            || unpack_message(&msg, sm + 1, shard_batch.msgs[k].msg_len - sizeof *sm) < 0) {
+          fputs("warning: invalid message from shard, dropped\n", stderr);
+          if (ring_fd != -1) {
+            close(ring_fd);
           }
-
-          /* set connection number to real connection number */
-          sdu.x.dat_requ.conn = curinst->real_conn;
-
-          /* deliver message */
-          if (xdt_queue_write(&curinst->queue, &sdu, sizeof sdu) < 0) {
-            QOR("xdt_queue_write");
+          continue;
+        }
+        if (msg.type > pdu_msg_min_pred && msg.type < pdu_msg_max_succ) {
+          if (ring_fd != -1) {
+            close(ring_fd);
           }
+          role = dispatch_pdu(&msg, &sm->peer, sm->peer_len, c);
+        } else {
+          role = dispatch_sdu(&msg, ring_fd);
+        }
+        if (role != XDT_SERVICE_NA) {
+          return role;
         }
-      } else {
-        fputs("warning: unknown SDU type\n", stderr);
       }
     }
   }
 
   /* cleanup */
   printf("(%d) ...dispatching messages finished. Inform running instances...\n", (int)getpid());
+  printf("(%d) received %lu PDUs by %lu and %lu SDUs by %lu system calls\n", (int)getpid(),
+         net_pdus, net_calls, local_sdus, local_calls);
+  if (single_process) {
+    print_timer_stats();
+  }
+  print_tunnel_stats();
+  if (shards > 1) {
+    print_shard_stats();
+    if (!shard) {
+      stop_shards();
+    }
+  }
+
+  close(epoll_fd);
+  if (wheel_fd != -1) {
+    close(wheel_fd);
+  }
+
+  if (single_process) {
+    XDT_instance *inst = 0;
+
+    /* release still running instances */
+    while ((inst = xdt_conntable_next(&connections, inst))) {
+      curinst = inst;
+      if (inst->role == XDT_SERVICE_SENDER) {
+        sender_cleanup(&inst->proto.sender);
+      } else {
+        receiver_cleanup(&inst->proto.receiver);
+      }
+      free_instance(inst);
+    }
+
+  } else {
+    XDT_instance *inst = 0;
 
-  /* terminate still running instances */
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (instances[i].role != XDT_SERVICE_NA) {
-      printf("(%d) send SIGTERM to instance with pid=%d\n", (int)getpid(), (int)instances[i].pid);
-      kill(instances[i].pid, SIGTERM);
+    /* terminate still running instances */
+    while ((inst = xdt_conntable_next(&connections, inst))) {
+      if (!inst->worker) {
+        printf("(%d) send SIGTERM to instance with pid=%d\n", (int)getpid(), (int)inst->pid);
+        kill(inst->pid, SIGTERM);
+      }
+    }
+    for (k = 0; k < pool_size; ++k) {
+      if (workers[k].pid > 0) {
+        printf("(%d) send SIGTERM to pre-forked instance with pid=%d\n", (int)getpid(), (int)workers[k].pid);
+        kill(workers[k].pid, SIGTERM);
+      }
     }
   }
 
-WAIT:
-  for (i = 0; i < MAX_CONNECTIONS; ++i) {
-    if (instances[i].role != XDT_SERVICE_NA) {
-      pid_t pid;
+  while (connections.used || pool_alive) {
+    pid_t pid;
 
-      if ((pid = waitpid(-1, 0, 0)) == -1) {
-        if (errno != EINTR) {
-          perror("waitpid");
-          exit(EXIT_FAILURE);
-        }
-        goto WAIT;
+    if ((pid = waitpid(-1, 0, 0)) == -1) {
+      if (errno != EINTR) {
+        perror("waitpid");
+        exit(EXIT_FAILURE);
       }
-      printf("(%d) reaped instance with pid=%d\n", (int)getpid(), (int)pid);
-      free_instance_by_pid(pid);
-      goto WAIT;
+      continue;
     }
+    printf("(%d) reaped instance with pid=%d\n", (int)getpid(), (int)pid);
+    free_instance_by_pid(pid);
+  }
+
+  if (!single_process) {
+    printf("(%d) queues: %lu messages queued, %lu deferred, %lu dropped, depth up to %u\n", (int)getpid(),
+           queue_stats.queued, queue_stats.deferred, queue_stats.dropped, queue_stats.depth_max);
   }
 
+  xdt_conntable_delete(&connections);
+  xdt_tunnels_delete(&tunnels);
+  free(workers);
+
   remove(local_addr.sun_path);
+  if (!shard) {
+    xdt_stats_remove(sap);
+  }
 
   printf("(%d) ...done.\n", (int)getpid());
 
@@ -917,45 +3000,253 @@ WAIT:
 }
 
 
+/**
+ * @brief Waits for the next connection handed over to a pre-forked instance process
+ *
+ * The sockets are connected with the peer and the user, a payload ring passed
+ * along is mapped. Then start_sender() or start_receiver() serves the
+ * connection, followed by finish_connection().
+ *
+ * @param c when returning as receiver, the assigned connection number
+ *        is stored where @a c points to
+ *
+ * @return the role to serve the connection with, #XDT_SERVICE_NA if the dispatcher has quit
+ */
+XDT_role
+await_connection(unsigned *c)
+{
+  union
+  {
+    char buf[XDT_PAYLOAD_CONTROL_SIZE];
+    struct cmsghdr align;
+  } control;
+  struct msghdr mh;
+  struct iovec iov;
+  XDT_handover h;
+  ssize_t n;
+  int ring_fd, i;
+
+  ZERO(mh);
+  iov.iov_base = &h;
+  iov.iov_len = sizeof h;
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control.buf;
+  mh.msg_controllen = sizeof control.buf;
+  while ((n = recvmsg(worker_ctl, &mh, 0)) == -1 && errno == EINTR);
+  if (n != sizeof h) {
+    return XDT_SERVICE_NA;
+  }
+  ring_fd = xdt_payload_received_fd(&mh);
+
+  curinst->role = h.role;
+  curinst->real_conn = h.real_conn;
+  curinst->mapped_conn = h.mapped_conn;
+  curinst->producer = h.producer;
+  curinst->consumer = h.consumer;
+  for (i = 0; i < MAX_INSTANCE_TIMERS; ++i) {
+    memset(&curinst->timers[i], 0, sizeof curinst->timers[i]);
+    curinst->timers[i].inst = curinst;
+  }
+  xdt_wheel_init(&wheel, monotonic_time());
+
+  curinst->pending = 0;
+  curinst->probe = h.probe;
+  curinst->probe_len = h.probe_len;
+  curinst->stats = h.stats;
+  if (instance_config.direct) {
+    /* connected with the peer's socket of the connection later */
+    curinst->peer_to = h.peer;
+    curinst->peer_to_len = sizeof curinst->peer_to;
+  } else if (connect(curinst->peer_sock, (struct sockaddr const *)&h.peer, sizeof h.peer) == -1) {
+    perror("connect");
+    exit(EXIT_FAILURE);
+  }
+  if (connect(curinst->user_sock, (struct sockaddr const *)&h.user, h.user_len) == -1) {
+    perror("connect");
+    exit(EXIT_FAILURE);
+  }
+
+  if (ring_fd != -1) {
+    if (xdt_payload_attach(&curinst->ring, ring_fd) < 0) {
+      fputs("warning: could not attach payload ring\n", stderr);
+    }
+  } else if (h.role == XDT_SERVICE_RECEIVER && instance_config.shared_payload
+             && xdt_payload_create(&curinst->ring) < 0) {
+    perror("xdt_payload_create");
+    exit(EXIT_FAILURE);
+  }
+
+  *c = h.real_conn;
+
+  return h.role;
+}
+
+/**
+ * @brief Tells the dispatcher that the connection of a pre-forked instance process has finished
+ *
+ * The sockets and the payload ring are released and the timerfd is disarmed,
+ * new sockets are created for the next connection.
+ */
+void
+finish_connection(void)
+{
+  struct itimerspec spec;
+  char done = 1;
+
+  close(curinst->peer_sock);
+  close(curinst->user_sock);
+  xdt_payload_detach(&curinst->ring);
+  curinst->taken_length = 0;
+  curinst->kept = 0;
+  curinst->landing = 0;
+
+  ZERO(spec);
+  if (timerfd_settime(curinst->timer_fd, 0, &spec, 0) == -1) {
+    perror("timerfd_settime");
+    exit(EXIT_FAILURE);
+  }
+  wheel_armed = 0;
+
+  open_worker_sockets();
+  while (send(worker_ctl, &done, sizeof done, 0) == -1) {
+    if (errno != EINTR) {
+      perror("send");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+
 /**
  * @brief Sends a PDU to the peer
  *
+ * While PDUs are held back (see hold_pdus()), the PDU is only encoded and sent
+ * with the others by flush_pdus() or when #XDT_config.batch PDUs are held.
+ * PDUs other than DTs sent through a tunnel are aggregated with those of the
+ * other connections into one datagram, sent before the dispatcher waits again.
+ * With #XDT_config.direct, PDUs go to the peer service until the peer's socket
+ * of the connection is known (see receive_direct()). A receiver instance sends
+ * its initial ACK to the socket the initial DT came from as well.
+ *
  * @param pdu points to the PDU message
  */
 void
 send_pdu(XDT_pdu * pdu)
 {
-  char pdu_stream[PDU_STREAM_MAX];
+  int len;
+
+  if (xdt_tracing()) {
+    trace_pdu(XDT_TRACE_SENT, pdu);
+  }
+  if (xdt_logging(XDT_LOG_MESSAGES)) {
+    print_pdu(pdu, "to send", 0);
+  }
+  count_pdu(pdu, 0);
 
-  print_pdu(pdu, "to send", 0);
+  if (curinst->probe_len && curinst->peer_to_len && pdu->type == ACK && pdu->x.ack.sequ == 1) {
+    /* a sending instance with its own socket learns this one, other services drop it */
+    if ((len = serialize_pdu(pdu, send_stream, stream_size)) < 0) {
+      fputs("serializing PDU failed\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+    if (sendto_err(curinst->peer_sock, send_stream, len, err_case, (struct sockaddr *)&curinst->probe,
+                   curinst->probe_len) == -1) {
+      perror("sendto_err");
+    }
+  }
+
+  if (curinst->tunnel && pdu->type != DT) {
+    XDT_tunnel *t = curinst->tunnel;
+    char *stream;
+
+    if (!(stream = xdt_tunnel_reserve(&tunnels, t, PDU_HEADER_STREAM_MAX))) {
+      send_tunnel(t);
+      stream = xdt_tunnel_reserve(&tunnels, t, PDU_HEADER_STREAM_MAX);
+    }
+    if ((len = serialize_pdu(pdu, stream, PDU_HEADER_STREAM_MAX)) < 0) {
+      fputs("serializing PDU failed\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+    /* the error case is simulated per PDU, not per datagram */
+    if (dropped_err(stream, len, err_case) == 0) {
+      t->pending += len;
+      t->aggregated++;
+    }
+    return;
+  }
+
+  if (holding) {
+    if ((len = serialize_pdu(pdu, held.buffers + held.count * held.size, held.size)) < 0) {
+      fputs("serializing PDU failed\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+    held.iov[held.count++].iov_len = len;
+    if (held.count == instance_config.batch) {
+      send_held_pdus();
+    }
+    return;
+  }
 
-  if (serialize_pdu(pdu, pdu_stream, sizeof pdu_stream) < 0) {
+  if ((len = serialize_pdu(pdu, send_stream, stream_size)) < 0) {
     fputs("serializing PDU failed\n", stderr);
     exit(EXIT_FAILURE);
   }
-  if (send_err(curinst->peer_sock, pdu_stream, sizeof pdu_stream, err_case) == -1) {
-    perror("send_err");
+  if (sendto_err(curinst->peer_sock, send_stream, len, err_case, (struct sockaddr *)&curinst->peer_to,
+                 curinst->peer_to_len) == -1) {
+    perror("sendto_err");
   }
 }
 
+/**
+ * @brief Holds PDUs back to send them by as few system calls as possible
+ *
+ * Subsequent calls of send_pdu() only encode the PDUs, until flush_pdus() is called.
+ */
+void
+hold_pdus(void)
+{
+  holding = 1;
+}
+
+/**
+ * @brief Sends all PDUs held back since hold_pdus() and stops holding them back
+ */
+void
+flush_pdus(void)
+{
+  send_held_pdus();
+  holding = 0;
+}
+
 /**
  * @brief Sends an SDU to the user
  *
  * When called by a sender instance, the connection number is mapped before transmission.
+ * A receiver instance with a payload ring passes the payload of XDATinds by the ring:
+ * a DT received right into the ring (see landing_zone()) is passed as it is, other
+ * payload is copied into the ring, unless it is full. The ring is passed to the
+ * consumer along with the first SDU.
  *
  * @param sdu points to the SDU message 
  */
 void
 send_sdu(XDT_sdu * sdu)
 {
+  struct iovec iov[2];
+  int iovcnt;
+
   if (curinst->role == XDT_SERVICE_SENDER) {
 
-    print_sdu(sdu, "to send /before/ connection mapping", 0);
+    if (xdt_logging(XDT_LOG_MESSAGES)) {
+      print_sdu(sdu, "to send /before/ connection mapping", 0);
+    }
 
     /* map connection number */
     switch ((int)sdu->type) {
     case XDATconf:
       sdu->x.dat_conf.conn = curinst->mapped_conn;
+      sdu->x.dat_conf.shard = shard;
       break;
     case XBREAKind:
       sdu->x.break_ind.conn = curinst->mapped_conn;
@@ -968,21 +3259,83 @@ send_sdu(XDT_sdu * sdu)
       break;
     }
 
-    print_sdu(sdu, "to send /after/ connection mapping", 0);
+    if (xdt_logging(XDT_LOG_MESSAGES)) {
+      print_sdu(sdu, "to send /after/ connection mapping", 0);
+    }
 
-  } else {
+  } else if (xdt_logging(XDT_LOG_MESSAGES)) {
     print_sdu(sdu, "to send", 0);
   }
 
-  if (write(curinst->user_sock, sdu, sizeof *sdu) == -1) {
-    perror("warning: send_sdu: write");
+  if (xdt_tracing()) {
+    xdt_trace_sdu(XDT_TRACE_SENT, sdu);
+  }
+  if (sdu->type == XDATind) {
+    xdt_stats_count(curinst->stats, XDT_STAT_BYTES_DELIVERED, sdu->x.dat_ind.length);
+  }
+
+  if (xdt_payload_attached(&curinst->ring)) {
+    XDT_xdat_ind *ind = &sdu->x.dat_ind;
+    char *data;
+
+    if (sdu->type != XDATind) {
+      /* no payload */
+    } else if (curinst->landing && ind->data >= curinst->landing
+               && ind->data + ind->length <= curinst->landing + curinst->landing_size) {
+      /* received right into the ring, the space behind the payload is taken back */
+      ind->offset = curinst->landing_offset + (unsigned)(ind->data - curinst->landing);
+      xdt_payload_unreserve(&curinst->ring, ind->offset + ind->length);
+      curinst->landing = 0;
+      ind->shared = 1;
+    } else if ((data = xdt_payload_reserve(&curinst->ring, ind->length, &ind->offset))) {
+      /* any space received into is skipped now */
+      memcpy(data, ind->data, ind->length);
+      curinst->landing = 0;
+      ind->shared = 1;
+    }
+    if (curinst->ring.fd != -1) {
+      iovcnt = xdt_sdu_iov(sdu, iov);
+      if (xdt_payload_sendv_fd(curinst->user_sock, iov, iovcnt, curinst->ring.fd) != -1) {
+        /* the consumer has its own descriptor now */
+        close(curinst->ring.fd);
+        curinst->ring.fd = -1;
+        return;
+      }
+      /* the consumer gets no ring, send the payload within the SDU and go on without */
+      perror("warning: send_sdu: sendmsg");
+      if (sdu->type == XDATind) {
+        ind->shared = 0;
+      }
+      iovcnt = xdt_sdu_iov(sdu, iov);
+      if (writev(curinst->user_sock, iov, iovcnt) == -1) {
+        perror("warning: send_sdu: writev");
+      }
+      /* not before, the payload may be in the ring */
+      xdt_payload_detach(&curinst->ring);
+      curinst->landing = 0;
+      return;
+    }
+  }
+
+  /* the payload is gathered from where it is, e.g. the DT received */
+  iovcnt = xdt_sdu_iov(sdu, iov);
+  if (writev(curinst->user_sock, iov, iovcnt) == -1) {
+    perror("warning: send_sdu: writev");
   }
 }
 
 /**
  * @brief Get the next PDU, SDU or timer message 
  *
+ * Expired timers are delivered first. While waiting for a message from the queue,
+ * the instance's timerfd is armed with the next timer expiration, the dispatcher
+ * then wakes the instance by a #TIMER_WAKEUP message.
+ * With #XDT_config.direct, PDUs are taken from the instance's peer socket too,
+ * see wait_direct().
  * When the call is interrupted by a signal, the message type is set to 0.
+ * The payload of an XDATrequ or DT stays valid until the next call, see
+ * keep_payload() to keep it longer. A receiver instance receives into the
+ * consumer's payload ring, so send_sdu() passes the payload on without copying.
  *
  * @param msg points to the message buffer 
  *
@@ -994,27 +3347,54 @@ send_sdu(XDT_sdu * sdu)
 void
 get_message(XDT_message * msg)
 {
-  if (xdt_queue_read(&curinst->queue, msg, sizeof *msg, 0) < 0) {
-    if (errno != EINTR) {
-      perror("get_message: reading queue failed");
-      exit(EXIT_FAILURE);
+  XDT_soft_timer *t;
+  char *buffer;
+  ssize_t len;
+
+  /* the last message is served */
+  release_payload(curinst);
+  drop_landing();
+
+  do {
+    if ((t = next_expired())) {
+      msg->type = t->timer->type;
+      break;
     }
-    /* interrupted, clear type */
-    msg->type = 0;
-  }
 
-  if (msg->type > sdu_msg_min_pred && msg->type < sdu_msg_max_succ) {
-    print_sdu(&(msg->sdu), "received", 0);
+    arm_wheel_fd(curinst->timer_fd);
 
-  } else if (msg->type > pdu_msg_min_pred && msg->type < pdu_msg_max_succ) {
-    print_pdu(&(msg->pdu), "received", 0);
+    /* a receiver instance receives right into its consumer's payload ring */
+    if (!(buffer = landing_zone())) {
+      buffer = message_buffer;
+    }
 
-  } else if (msg->type > pdu_msg_max_succ) {
-    print_timer(msg, "expired", 0);
-  }
-}
+    if (curinst->event_fd != -1 && wait_direct(msg)) {
+      /* from the peer socket or the timerfd */
+    } else if ((len = xdt_queue_read(&curinst->queue, buffer, message_buffer_size, 0)) < 0) {
+      if (errno != EINTR) {
+        perror("get_message: reading queue failed");
+        exit(EXIT_FAILURE);
+      }
+      /* interrupted, clear type */
+      msg->type = 0;
+    } else if (unpack_message(msg, buffer, len) < 0) {
+      fputs("warning: get_message: invalid message dropped\n", stderr);
+      msg->type = 0;
+    }
 
+    if (msg->type == TIMER_WAKEUP) {
+      /* the timerfd has expired and is disarmed */
+      wheel_armed = 0;
+      timer_stats.wakeups++;
+    } else if (msg->type > pdu_msg_min_pred && msg->type < pdu_msg_max_succ) {
+      timer_stats.pdus++;
+      count_pdu(&msg->pdu, 1);
+    }
+  } while (msg->type == TIMER_WAKEUP);
 
+  take_payload(msg);
+  log_message(msg);
+}
 
 
 /**
@@ -1029,80 +3409,145 @@ get_message(XDT_message * msg)
 void
 create_timer(XDT_timer * timer, int type)
 {
+  XDT_soft_timer *t;
+
   if (type <= pdu_msg_max_succ) {
-    perror("creating timer failed (invalid type value)");
+    fputs("creating timer failed (invalid type value)\n", stderr);
     exit(EXIT_FAILURE);
   }
-  if (xdt_timer_create(timer, TIMER_SIGNAL_BASE, timeout_handler, type) < 0) {
-    perror("creating timer failed");
+  if (!(t = get_soft_timer(0))) {
+    fputs("creating timer failed (too many timers)\n", stderr);
     exit(EXIT_FAILURE);
   }
+  timer->type = type;
+  t->timer = timer;
 }
 
 
 /**
  * @brief Arms an instance specific timer
+ *
+ * Only the deadline is stored, the timer wheel is updated just if the timer
+ * has to expire earlier than its wheel entry. No system call is made.
  * 
  * @param timer points to an XDT timer
  * @param timeout number of seconds after the timer should expire
+ *        (zero or negative value will disarm the timer)
  */
 void
 set_timer(XDT_timer * timer, double timeout)
 {
-  if (xdt_timer_set(timer, timeout) < 0) {
+  XDT_soft_timer *t;
+
+  if (!(t = get_soft_timer(timer))) {
     fputs("setting timer failed\n", stderr);
     exit(EXIT_FAILURE);
   }
+  if (timeout <= 0.0) {
+    /* the wheel entry is dropped when it fires */
+    t->expires = 0;
+    return;
+  }
+  t->expires = monotonic_time() + timeout;
+  if (!xdt_wheel_armed(&t->entry) || t->expires < t->armed) {
+    t->armed = t->expires;
+    xdt_wheel_add(&wheel, &t->entry, t->armed);
+  }
 }
 
 /**
  * @brief Disarms an instance specific timer
  * 
- * Additionally, all timer messages associated with this timer still available 
- * in the message queue are removed.
+ * An expired timer is delivered from the timer wheel, not from the queue,
+ * so no timer message of a disarmed timer is left.
  * 
  * @param timer points to an XDT timer
  */
 void
 reset_timer(XDT_timer * timer)
 {
-  long type;
-  int i;
+  set_timer(timer, -1.0);
+}
 
-  if (xdt_timer_reset(timer) < 0) {
-    fputs("resetting timer failed\n", stderr);
-    exit(EXIT_FAILURE);
-  }
+/**
+ * @brief Deletes an instance specific timer
+ *
+ * @param timer points to an XDT timer
+ */
+void
+delete_timer(XDT_timer * timer)
+{
+  XDT_soft_timer *t = get_soft_timer(timer);
 
-  /* remove all timer messages of given type, continue on interrupt */
-  while ((i = xdt_queue_read(&curinst->queue, &type, sizeof type, timer->type)) > 0 || (i < 0 && errno == EINTR));
+  t->expires = 0;
+  xdt_wheel_remove(&wheel, &t->entry);
+  t->timer = 0;
+}
 
-  if (i < 0) {
-    perror("reset_timer: reading queue failed");
-    exit(EXIT_FAILURE);
+
+/**
+ * @brief Gets the round trip time estimate of the peer service
+ *
+ * Connections through the same tunnel share their estimate, so a new one
+ * starts with the round trip time measured by the previous ones. Without a
+ * tunnel or before its first sample the values are left unchanged.
+ *
+ * @param srtt where to store the smoothed round trip time in seconds
+ * @param rttvar where to store the round trip time variation in seconds
+ */
+void
+get_peer_rtt(double *srtt, double *rttvar)
+{
+  if (curinst->tunnel && curinst->tunnel->srtt >= 0) {
+    *srtt = curinst->tunnel->srtt;
+    *rttvar = curinst->tunnel->rttvar;
   }
 }
 
 /**
- * @brief Deletes an instance specific timer
+ * @brief Stores the round trip time estimate of the peer service
  *
- * Additionally, all timer messages associated with this timer still available 
- * in the message queue are removed.
+ * Called by a sender instance on every new sample (see get_peer_rtt()).
  *
- * @param timer points to an XDT timer
+ * @param srtt smoothed round trip time in seconds
+ * @param rttvar round trip time variation in seconds
  */
 void
-delete_timer(XDT_timer * timer)
+set_peer_rtt(double srtt, double rttvar)
 {
-  reset_timer(timer);
-
-  if (xdt_timer_delete(timer) < 0) {
-    fputs("deleting timer failed\n", stderr);
-    exit(EXIT_FAILURE);
+  if (curinst->tunnel) {
+    curinst->tunnel->srtt = srtt;
+    curinst->tunnel->rttvar = rttvar;
   }
 }
 
 
+/**
+ * @brief Adds to a counter of the current instance's statistics
+ *
+ * The counters are read by the @e xdtstat tool, see stats.h.
+ *
+ * @param counter counter, e.g. ::XDT_STAT_RETRANSMITTED
+ * @param amount value to add
+ */
+void
+count_stat(unsigned counter, unsigned long amount)
+{
+  xdt_stats_count(curinst->stats, counter, amount);
+}
+
+/**
+ * @brief Records a round trip time sample in the current instance's statistics
+ *
+ * @param rtt round trip time in seconds
+ */
+void
+record_rtt(double rtt)
+{
+  xdt_stats_sample(curinst->stats, XDT_STAT_RTT, (uint64_t)(rtt * 1e6));
+}
+
+
 /**
  * @}
  */
@@ -16,6 +16,7 @@
 #include "pdu.h"
 #include "queue.h"
 #include "errors.h"
+#include "stats.h"
 
 #include <xdt/address.h>
 #include <xdt/sdu.h>
@@ -27,51 +28,84 @@ typedef enum
 {
   XDT_SERVICE_NA, /**< not an instance  */
   XDT_SERVICE_SENDER, /**< sender instance */
-  XDT_SERVICE_RECEIVER /**< receiver instance */
+  XDT_SERVICE_RECEIVER, /**< receiver instance */
+  XDT_SERVICE_WORKER /**< pre-forked instance process, serves connections by await_connection() */
 } XDT_role;
 
-XDT_role dispatch(XDT_address const *sap, unsigned *c, XDT_error error_case);
+/** @brief Service configuration evaluated from the command line */
+typedef struct
+{
+  XDT_error error_case; /**< the error case to simulate by all instances */
+  int single_process; /**< if not 0, all instances are served by the dispatcher process itself instead of forked processes */
+  unsigned max_connections; /**< number of maximum simultaneous connections to serve, 0 for no limit */
+  unsigned window; /**< number of DTs a sender instance sends without acknowledgement */
+  unsigned ack_every; /**< number of DTs a receiver instance acknowledges by one ACK (at most) */
+  unsigned rto_min; /**< lower bound of a sender instance's retransmission timeout in milliseconds */
+  unsigned rto_max; /**< upper bound of a sender instance's retransmission timeout in milliseconds */
+  int selective; /**< if not 0, receiver instances buffer out-of-order DTs (selective repeat) instead of dropping them (go-back-N) */
+  unsigned max_length; /**< biggest payload size instances agree to (#XDT_DATA_DEFAULT up to #XDT_DATA_MAX) */
+  unsigned batch; /**< number of datagrams the dispatcher receives and an instance sends by one system call (at most) */
+  unsigned shared_payload; /**< not 0 if receiver instances pass the payload to the consumer by a payload ring, receiving DTs right into it */
+  unsigned tunnel; /**< not 0 if all connections with a peer service share one tunnel (single-process mode only) */
+  unsigned shards; /**< number of dispatcher processes sharing the listen address, a power of two up to #XDT_SHARDS_MAX */
+  unsigned queue_size; /**< bytes the message queue of an instance holds, 0 for the system's limit */
+  unsigned pool; /**< number of instance processes forked in advance, each serving one connection after another, 0 to fork per connection */
+  unsigned direct; /**< not 0 if instances take the PDUs of established connections from their own socket instead of the dispatcher */
+} XDT_config;
+
+/** @brief Default number of maximum simultaneous connections to serve */
+#define XDT_MAX_CONNECTIONS 65536
+
+/** @brief Default number of datagrams received or sent by one system call */
+#define XDT_BATCH 16
+
+/** @brief Maximum number of datagrams received or sent by one system call */
+#define XDT_BATCH_MAX 64
+
+XDT_role dispatch(XDT_address const *sap, unsigned *c, XDT_config * config);
+XDT_role await_connection(unsigned *c);
+void finish_connection(void);
 
 
 /** @brief Message structure to use, when reading from an XDT queue
  * 
- * The message structure offers (by means of the outer union) two different
+ * The message structure offers (by means of the union) two different
  * views on the message content:
- * - a generic view, consisting of type header and contained data used to check
+ * - a generic view, consisting of the type header only, used to check
  *   message type and to read out timer event IDs from 'type' and
- * - a type specific view which offers (by means of the inner union) access to
- *   the type specific content, which is either a PDU or a SDU.
+ * - a type specific view which offers access to the type specific content,
+ *   which is either a PDU or a SDU.
  * 
  * It is mandatory to check the header 'type' before accessing the type
- * specific fields 'sdu' and 'pdu'.
+ * specific fields 'sdu' and 'pdu'. The payload of a contained XDATrequ, XDATind
+ * or DT is kept outside, get_message() leaves it valid until its next call.
  */
-typedef struct
+typedef union
 {
-  union
-  {
-    struct
-	{
-      long type; /**< type of contained message (SDU, PDU or timer event) */
-      char data[(sizeof (XDT_sdu) > sizeof (XDT_pdu)
-                ? sizeof (XDT_sdu) : sizeof (XDT_pdu)) - sizeof (long)];
-      /**< generic view on message content: byte buffer storing message data (without already contained type header: see field 'type' above) */
-    };
-    
-    union
-	{
-      XDT_sdu sdu; /**< type specific view on message (incl. type header) if a SDU is contained */
-      XDT_pdu pdu; /**< type specific view on message (incl. type header) if a PDU is contained */
-    };
-  };
+  long type; /**< type of contained message (SDU, PDU or timer event) */
+  XDT_sdu sdu; /**< type specific view on message (incl. type header) if a SDU is contained */
+  XDT_pdu pdu; /**< type specific view on message (incl. type header) if a PDU is contained */
 } XDT_message;
 
+/** @brief Biggest size of a packed message (SDU or PDU) with up to @a max_length payload bytes, as queued for an instance */
+#define XDT_MESSAGE_SIZE(max_length) \
+  (XDT_SDU_SIZE(max_length) > PDU_SIZE(max_length) ? XDT_SDU_SIZE(max_length) : PDU_SIZE(max_length))
+
 void send_pdu(XDT_pdu * pdu);
+void hold_pdus(void);
+void flush_pdus(void);
 void send_sdu(XDT_sdu * sdu);
 void get_message(XDT_message * msg);
+int keep_payload(unsigned *offset);
+void free_payload(unsigned offset, unsigned length);
 void create_timer(XDT_timer * timer, int type);
 void set_timer(XDT_timer * timer, double timeout);
 void reset_timer(XDT_timer * timer);
 void delete_timer(XDT_timer * timer);
+void get_peer_rtt(double *srtt, double *rttvar);
+void set_peer_rtt(double srtt, double rttvar);
+void count_stat(unsigned counter, unsigned long amount);
+void record_rtt(double rtt);
 
 
 /**
@@ -0,0 +1,261 @@
+/**
+ * @file shard.c
+ * @ingroup service
+ * @brief Dispatcher shards sharing the listen address
+ *
+ * With more than one shard, every dispatcher process binds a UDP socket of its
+ * own to the listen address by SO_REUSEPORT. A classic BPF program attached to
+ * the socket group steers each datagram to the shard serving its connection:
+ * the low #XDT_SHARD_BITS bits of every connection number are a key derived
+ * from the producer and consumer address (xdt_shard_key()), the shard index
+ * is this key modulo the (power of two) number of shards. Both services
+ * compute the same key, so DTs, ACKs and ABOs of a connection reach the same
+ * shard, whatever number of shards either service runs.
+ *
+ * The initial DT carries no connection number and the program does not parse
+ * addresses. It returns an out of range index for such datagrams, so the
+ * kernel picks a shard by the source address, which passes the PDU on to the
+ * owning shard if necessary.
+ *
+ * The program returns an index into the group, the kernel numbers the sockets
+ * in the order they joined it and renumbers them when one leaves. So the
+ * sockets join in shard order, none leaves while the service runs, and
+ * xdt_shard_probe() checks the numbering before the shards start.
+ */
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+#include "shard.h"
+#include "pdu.h"
+
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifdef HAVE_LINUX_FILTER_H
+# include <linux/filter.h>
+#endif
+
+
+/**
+ * @brief FNV-1a hash of a byte sequence
+ *
+ * @param p points to the bytes
+ * @param len number of bytes
+ * @param h hash value to combine the bytes with
+ *
+ * @return hash value
+ */
+static unsigned
+hash_bytes(void const *p, size_t len, unsigned h)
+{
+  unsigned char const *b = p;
+
+  while (len--) {
+    h = (h ^ *b++) * 16777619u;
+  }
+  return h;
+}
+
+/**
+ * @brief Hash value of an XDT address
+ *
+ * Only the used bytes of the host string count, the codecs differ in the padding.
+ */
+static unsigned
+hash_address(XDT_address const *addr, unsigned h)
+{
+  h = hash_bytes(addr->host, strnlen(addr->host, sizeof addr->host), h);
+  h = hash_bytes(&addr->port, sizeof addr->port, h);
+  return hash_bytes(&addr->slot, sizeof addr->slot, h);
+}
+
+/**
+ * @brief Returns the shard key of a connection
+ *
+ * Sender and receiver service compute it from the producer and consumer
+ * address of the initial XDATrequ and DT, and assign connection numbers
+ * carrying it (see #XDT_SHARD_CONN).
+ *
+ * @param source producer address
+ * @param dest consumer address
+ *
+ * @return key in the range [0, #XDT_SHARDS_MAX)
+ */
+unsigned
+xdt_shard_key(XDT_address const *source, XDT_address const *dest)
+{
+  unsigned h = hash_address(dest, hash_address(source, 2166136261u));
+
+  return (h ^ h >> 16) & (XDT_SHARDS_MAX - 1);
+}
+
+/**
+ * @brief Attaches the steering program to a group of SO_REUSEPORT sockets
+ *
+ * The sockets must have joined the group in shard order and must not leave it,
+ * the program returns the index of the socket to receive a datagram.
+ *
+ * @param sock any socket of the group
+ * @param shards number of sockets in the group, a power of two
+ *
+ * @return 0 on success, value < 0 on error (@e errno is set, ENOSYS if not supported)
+ */
+int
+xdt_shard_steer(int sock, unsigned shards)
+{
+#if defined(HAVE_LINUX_FILTER_H) && defined(SO_ATTACH_REUSEPORT_CBPF)
+  /* offsets of code, sequ and conn in the encoded PDUs, see pdu.c and pdu_raw.c */
+# ifdef XDT_RAW_CODEC
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),             /* A = code */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ABO, 4, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 2),             /* A = sequ */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 5, 0),      /* the initial ACK's addresses vary in length */
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 6),             /* A = conn of DT, ACK */
+    BPF_STMT(BPF_JMP | BPF_JA, 1),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 2),             /* A = conn of ABO */
+    BPF_STMT(BPF_ALU | BPF_AND | BPF_K, shards - 1),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_RET | BPF_K, XDT_SHARDS_MAX)          /* let the kernel choose */
+  };
+# else
+  struct sock_filter code[] = {
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),             /* A = code */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ABO, 8, 0),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 4),             /* A = sequ */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, 4),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),             /* initial PDU, A = code */
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ACK, 0, 7),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 60),            /* A = conn of the initial ACK, behind both addresses */
+    BPF_STMT(BPF_JMP | BPF_JA, 3),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8),             /* A = conn of DT, ACK */
+    BPF_STMT(BPF_JMP | BPF_JA, 1),
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 4),             /* A = conn of ABO */
+    BPF_STMT(BPF_ALU | BPF_AND | BPF_K, shards - 1),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_RET | BPF_K, XDT_SHARDS_MAX)          /* initial DT, let the kernel choose */
+  };
+# endif
+  struct sock_fprog prog;
+
+  prog.len = sizeof code / sizeof *code;
+  prog.filter = code;
+
+  return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) == -1 ? -1 : 0;
+#else
+  sock = sock;
+  shards = shards;
+  errno = ENOSYS;
+  return -2;
+#endif
+}
+
+/**
+ * @brief Detaches the steering program from a group of SO_REUSEPORT sockets
+ *
+ * The kernel picks the socket by the source address then.
+ *
+ * @param sock any socket of the group
+ *
+ * @return 0 on success, value < 0 on error (@e errno is set, ENOSYS if not supported)
+ */
+int
+xdt_shard_unsteer(int sock)
+{
+#ifdef SO_DETACH_REUSEPORT_BPF
+  int none = 0;
+
+  return setsockopt(sock, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF, &none, sizeof none) == -1 ? -1 : 0;
+#else
+  sock = sock;
+  errno = ENOSYS;
+  return -2;
+#endif
+}
+
+/**
+ * @brief Checks that the steering program's socket indexes are the shards
+ *
+ * For every shard i an ABO with connection number i is sent to the group,
+ * it must arrive at the socket of shard i. The probes are taken from the
+ * sockets again, other datagrams received meanwhile are dropped (the peers
+ * repeat them).
+ *
+ * @param socks sockets of the group in shard order, steered by xdt_shard_steer()
+ * @param shards number of sockets in the group
+ * @param addr address the group is bound to
+ *
+ * @return 0 if every probe arrived at its shard, value < 0 else
+ */
+int
+xdt_shard_probe(int const *socks, unsigned shards, struct sockaddr_in const *addr)
+{
+  struct sockaddr_in to = *addr, self, from;
+  char stream[PDU_HEADER_STREAM_MAX];
+  struct pollfd pfd;
+  socklen_t len = sizeof self;
+  XDT_pdu pdu;
+  int sock, rc = 0, found, n;
+  unsigned i;
+
+  if (to.sin_addr.s_addr == htonl(INADDR_ANY)) {
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  }
+  if ((sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
+    return -1;
+  }
+  if (connect(sock, (struct sockaddr *)&to, sizeof to) == -1 || getsockname(sock, (struct sockaddr *)&self, &len) == -1) {
+    close(sock);
+    return -1;
+  }
+
+  memset(&pdu, 0, sizeof pdu);
+  pdu.type = ABO;
+  pdu.x.abo.code = ABO;
+  for (i = 0; i < shards; ++i) {
+    pdu.x.abo.conn = i;
+    if ((n = serialize_pdu(&pdu, stream, sizeof stream)) < 0 || send(sock, stream, n, 0) == -1) {
+      close(sock);
+      return -2;
+    }
+  }
+  close(sock);
+
+  for (i = 0; i < shards; ++i) {
+    pfd.fd = socks[i];
+    pfd.events = POLLIN;
+    found = 0;
+    /* the probes are local, they arrive at once */
+    while (poll(&pfd, 1, found ? 0 : 100) > 0) {
+      len = sizeof from;
+      if ((n = recvfrom(socks[i], stream, sizeof stream, MSG_DONTWAIT, (struct sockaddr *)&from, &len)) < 0) {
+        break;
+      }
+      if (from.sin_port == self.sin_port && from.sin_addr.s_addr == self.sin_addr.s_addr
+          && deserialize_pdu(stream, n, &pdu) > 0 && pdu.type == ABO) {
+        if (pdu.x.abo.conn == i) {
+          found = 1;
+        } else {
+          rc = -3;
+        }
+      }
+    }
+    if (!found) {
+      rc = -3;
+    }
+  }
+
+  return rc;
+}
+
+
+/**
+ * @}
+ */
@@ -0,0 +1,54 @@
+/**
+ * @file shard.h
+ * @ingroup service
+ * @brief Dispatcher shards sharing the listen address
+ */
+
+#ifndef SHARD_H
+#define SHARD_H
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+
+#include <xdt/address.h>
+
+#include <netinet/in.h>
+
+
+/** @brief Number of low connection number bits carrying the shard key */
+#define XDT_SHARD_BITS 6
+
+/** @brief Maximum number of dispatcher shards, shard counts are powers of two up to this */
+#define XDT_SHARDS_MAX (1u << XDT_SHARD_BITS)
+
+/**
+ * @brief Shard serving the connection with connection number @a conn
+ *
+ * @param conn connection number (mapped or real)
+ * @param shards number of shards, a power of two
+ */
+#define XDT_SHARD_OF_CONN(conn, shards) ((conn) & ((shards) - 1))
+
+/**
+ * @brief Connection number with a shard key
+ *
+ * @param counter consecutive number of the allocating service
+ * @param key shard key, see xdt_shard_key()
+ */
+#define XDT_SHARD_CONN(counter, key) ((counter) << XDT_SHARD_BITS | (key))
+
+
+unsigned xdt_shard_key(XDT_address const *source, XDT_address const *dest);
+int xdt_shard_steer(int sock, unsigned shards);
+int xdt_shard_unsteer(int sock);
+int xdt_shard_probe(int const *socks, unsigned shards, struct sockaddr_in const *addr);
+
+
+/**
+ * @}
+ */
+
+#endif /* SHARD_H */
@@ -0,0 +1,285 @@
+/**
+ * @file stats.c
+ * @ingroup service
+ * @brief Protocol statistics in a shared memory segment
+ *
+ * The dispatcher creates a POSIX shared memory segment named after its listen
+ * address before it forks shards or instances, so every process of the
+ * service maps it at the same address. Each connection gets a slot of its own,
+ * updated mostly by the one process serving it, so the atomic adds hardly
+ * ever contend. When the connection is released, its slot is added to the
+ * service's statistics and freed again. The @e xdtstat tool maps the segment
+ * read-only and never blocks a writer.
+ */
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+
+/** @brief Statistics segment of this service, @e null if none */
+XDT_stats *xdt_stats = 0;
+
+
+/**
+ * @brief Current CLOCK_MONOTONIC time in nanoseconds
+ */
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Adds all counters and histograms of a block to another one
+ *
+ * @param to block to add to, updated by atomic adds
+ * @param from block to add
+ */
+static void
+add_block(XDT_stat_block * to, XDT_stat_block const *from)
+{
+  unsigned i, j;
+
+  for (i = 0; i < XDT_STAT_COUNTERS; ++i) {
+    if (from->counter[i]) {
+      __atomic_fetch_add(&to->counter[i], from->counter[i], __ATOMIC_RELAXED);
+    }
+  }
+  for (i = 0; i < XDT_STAT_HISTOGRAMS; ++i) {
+    for (j = 0; j < XDT_STAT_BUCKETS; ++j) {
+      if (from->histogram[i][j]) {
+        __atomic_fetch_add(&to->histogram[i][j], from->histogram[i][j], __ATOMIC_RELAXED);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Returns the name of the statistics segment of a service
+ *
+ * @param sap listen address of the service
+ * @param buf memory area where to store the name
+ * @param buf_size size of the buffer @a buf is pointing to
+ *
+ * @return 0 on success, value < 0 if @a buf is too small
+ */
+int
+xdt_stats_name(XDT_address const *sap, char *buf, size_t buf_size)
+{
+  int len = snprintf(buf, buf_size, "/xdt-stats-%s:%d", sap->host, sap->port);
+
+  return len < 0 || (size_t)len >= buf_size ? -1 : 0;
+}
+
+/**
+ * @brief Creates and maps the statistics segment of a service
+ *
+ * A segment left by a previous run of the service is replaced.
+ * Called before forking, so all processes of the service share the mapping.
+ *
+ * @param sap listen address of the service
+ *
+ * @return 0 on success, value < 0 on error (@e errno is set)
+ */
+int
+xdt_stats_create(XDT_address const *sap)
+{
+  char name[64];
+  void *mem;
+  int fd;
+
+  if (xdt_stats_name(sap, name, sizeof name) < 0) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  shm_unlink(name);
+  if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1) {
+    return -2;
+  }
+  if (ftruncate(fd, sizeof (XDT_stats)) == -1) {
+    close(fd);
+    shm_unlink(name);
+    return -3;
+  }
+  mem = mmap(0, sizeof (XDT_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    shm_unlink(name);
+    return -4;
+  }
+
+  xdt_stats = mem;
+  xdt_stats->conns = XDT_STAT_CONNS;
+  xdt_stats->pid = (int32_t)getpid();
+  xdt_stats->started = now_ns();
+  __atomic_store_n(&xdt_stats->magic, XDT_STAT_MAGIC, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/**
+ * @brief Removes the statistics segment of a service
+ *
+ * The mapping stays valid until the process exits, readers keep theirs.
+ *
+ * @param sap listen address of the service
+ */
+void
+xdt_stats_remove(XDT_address const *sap)
+{
+  char name[64];
+
+  if (xdt_stats && xdt_stats_name(sap, name, sizeof name) == 0) {
+    shm_unlink(name);
+  }
+}
+
+/**
+ * @brief Claims a free connection slot
+ *
+ * @param conn mapped connection number
+ * @param role role of the instance
+ * @param pid process serving the connection
+ *
+ * @return the slot, @e null if there is no segment or no free slot
+ *         (the connection counts into the service's statistics only)
+ */
+XDT_stat_conn *
+xdt_stats_claim(unsigned conn, unsigned role, pid_t pid)
+{
+  unsigned i;
+
+  if (!xdt_stats) {
+    return 0;
+  }
+  for (i = 0; i < XDT_STAT_CONNS; ++i) {
+    XDT_stat_conn *c = &xdt_stats->conn[i];
+    int32_t none = 0;
+
+    if (!__atomic_load_n(&c->pid, __ATOMIC_RELAXED)
+        && __atomic_compare_exchange_n(&c->pid, &none, (int32_t)pid, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      c->conn = conn;
+      c->role = role;
+      c->started = now_ns();
+      return c;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Adds the statistics of a released connection to the service's and frees its slot
+ *
+ * @param conn the slot, @e null if none
+ */
+void
+xdt_stats_release(XDT_stat_conn * conn)
+{
+  if (!conn) {
+    return;
+  }
+
+  __atomic_fetch_add(&xdt_stats->retiring, 1, __ATOMIC_ACQ_REL);
+  add_block(&xdt_stats->retired, &conn->block);
+  memset(&conn->block, 0, sizeof conn->block);
+  __atomic_store_n(&conn->pid, 0, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&xdt_stats->retired_count, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Adds to a counter
+ *
+ * @param conn the connection's slot, @e null to count into the service's statistics only
+ * @param counter counter, e.g. ::XDT_STAT_DT_SENT
+ * @param amount value to add
+ */
+void
+xdt_stats_count(XDT_stat_conn * conn, unsigned counter, uint64_t amount)
+{
+  if (xdt_stats) {
+    __atomic_fetch_add(&(conn ? &conn->block : &xdt_stats->retired)->counter[counter], amount, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * @brief Counts a value in a histogram
+ *
+ * @param conn the connection's slot, @e null to count into the service's statistics only
+ * @param histogram histogram, e.g. ::XDT_STAT_RTT
+ * @param value value to count
+ */
+void
+xdt_stats_sample(XDT_stat_conn * conn, unsigned histogram, uint64_t value)
+{
+  unsigned bucket = 0;
+
+  if (!xdt_stats) {
+    return;
+  }
+  while (value && bucket < XDT_STAT_BUCKETS - 1) {
+    value >>= 1;
+    bucket++;
+  }
+  __atomic_fetch_add(&(conn ? &conn->block : &xdt_stats->retired)->histogram[histogram][bucket], 1,
+                     __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Sums up the statistics of a service
+ *
+ * Adds the running connections to the released ones. While a connection
+ * is being released, the sum is taken again.
+ *
+ * @param stats mapped statistics segment
+ * @param sum where to store the sum
+ */
+void
+xdt_stats_sum(XDT_stats const *stats, XDT_stat_block * sum)
+{
+  uint64_t begun, finished;
+  unsigned i;
+
+  for (;;) {
+    finished = __atomic_load_n(&stats->retired_count, __ATOMIC_ACQUIRE);
+    begun = __atomic_load_n(&stats->retiring, __ATOMIC_ACQUIRE);
+    if (begun != finished) {
+      sched_yield();
+      continue;
+    }
+
+    memset(sum, 0, sizeof *sum);
+    add_block(sum, &stats->retired);
+    for (i = 0; i < XDT_STAT_CONNS; ++i) {
+      if (__atomic_load_n(&stats->conn[i].pid, __ATOMIC_ACQUIRE)) {
+        add_block(sum, &stats->conn[i].block);
+      }
+    }
+
+    if (__atomic_load_n(&stats->retiring, __ATOMIC_ACQUIRE) == begun) {
+      return;
+    }
+  }
+}
+
+
+/**
+ * @}
+ */
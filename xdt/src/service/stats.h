@@ -0,0 +1,127 @@
+/**
+ * @file stats.h
+ * @ingroup service
+ * @brief Protocol statistics in a shared memory segment
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+
+#include <xdt/address.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+
+/** @brief Counters of a connection and of the whole service */
+enum
+{
+  XDT_STAT_CONNECTIONS, /**< connections set up (service only) */
+  XDT_STAT_DT_SENT, /**< DTs sent, repetitions included */
+  XDT_STAT_DT_RECEIVED, /**< DTs received */
+  XDT_STAT_ACK_SENT, /**< ACKs sent */
+  XDT_STAT_ACK_RECEIVED, /**< ACKs received */
+  XDT_STAT_ABO_SENT, /**< ABOs sent */
+  XDT_STAT_ABO_RECEIVED, /**< ABOs received */
+  XDT_STAT_RETRANSMITTED, /**< DTs retransmitted by go-back-N or selective repeat */
+  XDT_STAT_GO_BACK_N, /**< go-back-N rounds */
+  XDT_STAT_T1_EXPIRED, /**< connection establishment timer (T1) expirations */
+  XDT_STAT_T2_EXPIRED, /**< retransmission timer (T2) expirations */
+  XDT_STAT_T3_EXPIRED, /**< producer inactivity timer (T3) expirations */
+  XDT_STAT_TI_EXPIRED, /**< receiver inactivity timer expirations */
+  XDT_STAT_BREAKS, /**< sender BREAK state entries */
+  XDT_STAT_DROPPED, /**< messages for the instance dropped while its queue was full */
+  XDT_STAT_BYTES_SENT, /**< payload bytes sent in DTs, repetitions included */
+  XDT_STAT_BYTES_DELIVERED, /**< payload bytes delivered to the consumer */
+  XDT_STAT_COUNTERS /**< number of counters */
+};
+
+/** @brief Histograms of a connection and of the whole service */
+enum
+{
+  XDT_STAT_RTT, /**< round trip time samples in microseconds */
+  XDT_STAT_DEPTH, /**< queue depth samples in messages */
+  XDT_STAT_HISTOGRAMS /**< number of histograms */
+};
+
+/** @brief Number of buckets of a histogram, bucket @e i > 0 counts values from 2^(i-1) up to 2^i - 1 */
+#define XDT_STAT_BUCKETS 32
+
+/** @brief Number of connections with statistics of their own, further ones count into the service's only */
+#define XDT_STAT_CONNS 1024
+
+/** @brief Magic number of a statistics segment */
+#define XDT_STAT_MAGIC 0x58445453
+
+/** @brief Counters and histograms */
+typedef struct
+{
+  uint64_t counter[XDT_STAT_COUNTERS]; /**< counters, indexed by e.g. ::XDT_STAT_DT_SENT */
+  uint64_t histogram[XDT_STAT_HISTOGRAMS][XDT_STAT_BUCKETS]; /**< histograms, indexed by e.g. ::XDT_STAT_RTT */
+} XDT_stat_block;
+
+/**
+ * @brief Statistics of a connection
+ *
+ * Claimed by the dispatcher when it sets up the instance, updated by the
+ * process serving it, added to the service's statistics when it is released.
+ */
+typedef struct
+{
+  int32_t pid; /**< process serving the connection, 0 if the slot is free */
+  uint32_t conn; /**< mapped connection number */
+  uint32_t role; /**< ::XDT_SERVICE_SENDER or ::XDT_SERVICE_RECEIVER */
+  uint32_t reserved; /**< zero */
+  uint64_t started; /**< CLOCK_MONOTONIC time of the setup in nanoseconds */
+  XDT_stat_block block; /**< counters and histograms */
+} XDT_stat_conn;
+
+/**
+ * @brief Statistics segment of a service
+ *
+ * Named after the listen address (see xdt_stats_name()), created by the
+ * dispatcher and removed when it exits. All processes of the service update
+ * it by atomic adds without locks. A connection's statistics move into
+ * @a retired when it is released: @a retiring counts the moves begun,
+ * @a retired_count those finished, so a reader repeats summing up while a
+ * move is in progress.
+ */
+typedef struct
+{
+  uint32_t magic; /**< #XDT_STAT_MAGIC */
+  uint32_t conns; /**< number of connection slots */
+  int32_t pid; /**< process id of the (first) dispatcher */
+  uint32_t reserved; /**< zero */
+  uint64_t started; /**< CLOCK_MONOTONIC time the service started in nanoseconds */
+  uint64_t retiring; /**< moves into @a retired begun */
+  uint64_t retired_count; /**< moves into @a retired finished */
+  XDT_stat_block retired; /**< statistics of the released connections and of those without a slot */
+  XDT_stat_conn conn[XDT_STAT_CONNS]; /**< connection slots */
+} XDT_stats;
+
+
+extern XDT_stats *xdt_stats;
+
+int xdt_stats_name(XDT_address const *sap, char *buf, size_t buf_size);
+int xdt_stats_create(XDT_address const *sap);
+void xdt_stats_remove(XDT_address const *sap);
+XDT_stat_conn *xdt_stats_claim(unsigned conn, unsigned role, pid_t pid);
+void xdt_stats_release(XDT_stat_conn * conn);
+void xdt_stats_count(XDT_stat_conn * conn, unsigned counter, uint64_t amount);
+void xdt_stats_sample(XDT_stat_conn * conn, unsigned histogram, uint64_t value);
+void xdt_stats_sum(XDT_stats const *stats, XDT_stat_block * sum);
+
+
+/**
+ * @}
+ */
+
+#endif /* STATS_H */
@@ -0,0 +1,155 @@
+/**
+ * @file tunnel.c
+ * @ingroup service
+ * @brief Long-lived tunnels between two services
+ *
+ * Without tunnels every connection opens a UDP socket of its own and starts
+ * with the initial retransmission timeout. With many short transfers between
+ * the same two services, a tunnel per peer service is opened once instead:
+ * its connected socket carries the PDUs of all connections, multiplexed by
+ * their connection numbers, and its round trip time estimate is handed from
+ * one connection to the next. PDUs queued for the same tunnel while the
+ * dispatcher serves a batch of messages leave together in one datagram
+ * (see xdt_tunnel_reserve()), the receiving dispatcher decodes PDU after PDU.
+ */
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+#include "tunnel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+
+/**
+ * @brief Initializes an empty tunnel table
+ *
+ * @param tunnels points to the table
+ */
+void
+xdt_tunnels_init(XDT_tunnels * tunnels)
+{
+  tunnels->first = 0;
+  tunnels->pending = 0;
+  tunnels->count = 0;
+}
+
+/**
+ * @brief Closes all tunnels of a table
+ *
+ * Pending PDUs are dropped.
+ *
+ * @param tunnels points to the table
+ */
+void
+xdt_tunnels_delete(XDT_tunnels * tunnels)
+{
+  XDT_tunnel *t;
+
+  while ((t = tunnels->first)) {
+    tunnels->first = t->next;
+    close(t->sock);
+    free(t);
+  }
+  xdt_tunnels_init(tunnels);
+}
+
+/**
+ * @brief Returns the tunnel to a peer service, opening it on first use
+ *
+ * @param tunnels points to the table
+ * @param peer listen address of the peer service
+ *
+ * @return the tunnel, @e null on error (@e errno is set)
+ */
+XDT_tunnel *
+xdt_tunnel_open(XDT_tunnels * tunnels, struct sockaddr_in const *peer)
+{
+  XDT_tunnel *t;
+
+  for (t = tunnels->first; t; t = t->next) {
+    if (t->peer.sin_addr.s_addr == peer->sin_addr.s_addr && t->peer.sin_port == peer->sin_port) {
+      return t;
+    }
+  }
+
+  if (!(t = calloc(1, sizeof *t))) {
+    return 0;
+  }
+  t->peer = *peer;
+  t->srtt = -1;
+  if ((t->sock = socket(PF_INET, SOCK_DGRAM, 0)) == -1) {
+    free(t);
+    return 0;
+  }
+  if (connect(t->sock, (struct sockaddr const *)&t->peer, sizeof t->peer) == -1) {
+    close(t->sock);
+    free(t);
+    return 0;
+  }
+
+  t->next = tunnels->first;
+  tunnels->first = t;
+  tunnels->count++;
+
+  return t;
+}
+
+/**
+ * @brief Reserves space for an encoded PDU in the pending datagram of a tunnel
+ *
+ * The tunnel is queued for xdt_tunnel_take_pending(). The caller adds the
+ * number of bytes actually encoded to XDT_tunnel.pending.
+ *
+ * @param tunnels points to the table
+ * @param tunnel points to the tunnel
+ * @param len number of bytes to reserve
+ *
+ * @return where to encode the PDU, @e null if the datagram has to be sent first
+ */
+char *
+xdt_tunnel_reserve(XDT_tunnels * tunnels, XDT_tunnel * tunnel, size_t len)
+{
+  if (XDT_TUNNEL_DATAGRAM - tunnel->pending < len) {
+    return 0;
+  }
+  if (!tunnel->queued) {
+    tunnel->queued = 1;
+    tunnel->next_pending = tunnels->pending;
+    tunnels->pending = tunnel;
+  }
+
+  return tunnel->datagram + tunnel->pending;
+}
+
+/**
+ * @brief Takes the next tunnel with pending PDUs off the queue
+ *
+ * @param tunnels points to the table
+ *
+ * @return the tunnel, @e null if no tunnel is queued
+ */
+XDT_tunnel *
+xdt_tunnel_take_pending(XDT_tunnels * tunnels)
+{
+  XDT_tunnel *t;
+
+  if ((t = tunnels->pending)) {
+    tunnels->pending = t->next_pending;
+    t->next_pending = 0;
+    t->queued = 0;
+  }
+
+  return t;
+}
+
+
+/**
+ * @}
+ */
@@ -0,0 +1,73 @@
+/**
+ * @file tunnel.h
+ * @ingroup service
+ * @brief Long-lived tunnels between two services
+ */
+
+#ifndef TUNNEL_H
+#define TUNNEL_H
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+
+/** @brief Biggest datagram of aggregated PDUs, fits into an Ethernet frame */
+#define XDT_TUNNEL_DATAGRAM 1400
+
+/**
+ * @brief Tunnel to a peer service
+ *
+ * All connections between the two services share the tunnel's socket and
+ * round trip time estimate, the connection number tells their PDUs apart.
+ * Small PDUs of all connections are aggregated into one datagram.
+ */
+typedef struct xdt_tunnel
+{
+  struct sockaddr_in peer; /**< listen address of the peer service */
+  int sock; /**< UDP socket connected with the peer service */
+  unsigned streams; /**< number of connections using the tunnel */
+  unsigned long carried; /**< number of connections carried so far */
+  double srtt; /**< smoothed round trip time to the peer service in seconds, negative before the first sample */
+  double rttvar; /**< round trip time variation in seconds */
+  unsigned long aggregated; /**< number of PDUs sent aggregated */
+  unsigned long datagrams; /**< number of datagrams of aggregated PDUs sent */
+  size_t pending; /**< number of bytes in @a datagram */
+  int queued; /**< not 0 if linked into the list of tunnels with pending PDUs */
+  struct xdt_tunnel *next; /**< next tunnel of the table */
+  struct xdt_tunnel *next_pending; /**< next tunnel with pending PDUs */
+  char datagram[XDT_TUNNEL_DATAGRAM]; /**< encoded PDUs to send by one datagram */
+} XDT_tunnel;
+
+/**
+ * @brief Tunnel table
+ *
+ * Tunnels are opened on first use and kept until the table is deleted.
+ * A service talks to few other services, so they are kept in a list.
+ */
+typedef struct
+{
+  XDT_tunnel *first; /**< list of all tunnels */
+  XDT_tunnel *pending; /**< list of the tunnels with pending PDUs */
+  unsigned count; /**< number of tunnels */
+} XDT_tunnels;
+
+
+void xdt_tunnels_init(XDT_tunnels * tunnels);
+void xdt_tunnels_delete(XDT_tunnels * tunnels);
+XDT_tunnel *xdt_tunnel_open(XDT_tunnels * tunnels, struct sockaddr_in const *peer);
+char *xdt_tunnel_reserve(XDT_tunnels * tunnels, XDT_tunnel * tunnel, size_t len);
+XDT_tunnel *xdt_tunnel_take_pending(XDT_tunnels * tunnels);
+
+
+/**
+ * @}
+ */
+
+#endif /* TUNNEL_H */
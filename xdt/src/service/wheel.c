@@ -0,0 +1,353 @@
+/**
+ * @file wheel.c
+ * @ingroup service
+ * @brief Hierarchical timer wheel
+ *
+ * The protocol instances arm, re-arm and disarm their timers on nearly every
+ * message, which only links and unlinks list elements here. The caller waits
+ * for xdt_wheel_next() by a single kernel timer and collects the expired
+ * timers by xdt_wheel_expire().
+ */
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+#include "wheel.h"
+
+
+/** @brief Mask to get the slot of a tick or block */
+#define SLOT_MASK (XDT_WHEEL_SLOTS - 1)
+
+/** @brief Number of bits to shift a tick to get its block */
+#define BLOCK_SHIFT 8
+
+/** @brief Index of the first level 1 slot */
+#define LEVEL1 XDT_WHEEL_SLOTS
+
+/** @brief Index of the overflow list */
+#define OVERFLOW (2 * XDT_WHEEL_SLOTS)
+
+#if (1 << BLOCK_SHIFT) != XDT_WHEEL_SLOTS
+# error "BLOCK_SHIFT does not match XDT_WHEEL_SLOTS"
+#endif
+
+
+/**
+ * @brief Converts a time into the number of passed ticks
+ *
+ * @param wheel points to the wheel
+ * @param t time in seconds
+ *
+ * @return ticks passed from tick 0 until @a t, 0 if @a t is before
+ */
+static unsigned long
+ticks(XDT_wheel const *wheel, double t)
+{
+  double d = (t - wheel->origin) / XDT_WHEEL_TICK;
+
+  return d > 0 ? (unsigned long)d : 0;
+}
+
+/**
+ * @brief Converts a tick into a time
+ *
+ * @param wheel points to the wheel
+ * @param tick tick number
+ *
+ * @return time in seconds
+ */
+static double
+tick_time(XDT_wheel const *wheel, unsigned long tick)
+{
+  return wheel->origin + tick * XDT_WHEEL_TICK;
+}
+
+/**
+ * @brief Searches the first non-empty slot of a level
+ *
+ * @param wheel points to the wheel
+ * @param level index of the first slot of the level
+ * @param from slot of the level to start with
+ *
+ * @return slot of the level, -1 if all slots from @a from on are empty
+ */
+static int
+first_used(XDT_wheel const *wheel, unsigned level, unsigned from)
+{
+  unsigned i = (level + from) / XDT_WHEEL_WORD_BITS;
+  unsigned long bits = wheel->used[i] & (~0UL << (level + from) % XDT_WHEEL_WORD_BITS);
+
+  for (;;) {
+    if (bits) {
+      return i * XDT_WHEEL_WORD_BITS + __builtin_ctzl(bits) - level;
+    }
+    if (++i == (level + XDT_WHEEL_SLOTS) / XDT_WHEEL_WORD_BITS) {
+      return -1;
+    }
+    bits = wheel->used[i];
+  }
+}
+
+/**
+ * @brief Links a timer into the slot its tick belongs to
+ *
+ * @param wheel points to the wheel
+ * @param timer points to the timer, not linked
+ */
+static void
+place(XDT_wheel * wheel, XDT_wheel_timer * timer)
+{
+  unsigned long block = timer->tick >> BLOCK_SHIFT, distance = block - (wheel->current >> BLOCK_SHIFT);
+  XDT_wheel_timer *head;
+
+  if (!distance) {
+    timer->slot = timer->tick & SLOT_MASK;
+  } else if (distance < XDT_WHEEL_SLOTS) {
+    timer->slot = LEVEL1 + (block & SLOT_MASK);
+  } else {
+    timer->slot = OVERFLOW;
+  }
+
+  head = &wheel->slots[timer->slot];
+  timer->prev = head;
+  timer->next = head->next;
+  head->next->prev = timer;
+  head->next = timer;
+  if (timer->slot != OVERFLOW) {
+    wheel->used[timer->slot / XDT_WHEEL_WORD_BITS] |= 1UL << timer->slot % XDT_WHEEL_WORD_BITS;
+  }
+}
+
+/**
+ * @brief Unlinks a timer from its slot
+ *
+ * @param wheel points to the wheel
+ * @param timer points to the linked timer
+ */
+static void
+unlink_timer(XDT_wheel * wheel, XDT_wheel_timer * timer)
+{
+  XDT_wheel_timer *head = &wheel->slots[timer->slot];
+
+  timer->prev->next = timer->next;
+  timer->next->prev = timer->prev;
+  timer->prev = timer->next = 0;
+  if (head->next == head && timer->slot != OVERFLOW) {
+    wheel->used[timer->slot / XDT_WHEEL_WORD_BITS] &= ~(1UL << timer->slot % XDT_WHEEL_WORD_BITS);
+  }
+}
+
+/**
+ * @brief Moves the timers of a level 1 slot down to level 0
+ *
+ * @param wheel points to the wheel
+ * @param slot index of the level 1 slot of the current block
+ */
+static void
+cascade(XDT_wheel * wheel, unsigned slot)
+{
+  XDT_wheel_timer *head = &wheel->slots[slot], *t;
+
+  while ((t = head->next) != head) {
+    unlink_timer(wheel, t);
+    place(wheel, t);
+  }
+}
+
+/**
+ * @brief Enters the next block of ticks
+ *
+ * The timers of the block are moved down to level 0, once per revolution
+ * the overflow list is sorted in.
+ *
+ * @param wheel points to the wheel
+ */
+static void
+next_block(XDT_wheel * wheel)
+{
+  unsigned long block = (wheel->current >> BLOCK_SHIFT) + 1;
+
+  wheel->current = block << BLOCK_SHIFT;
+  if (!(block & SLOT_MASK)) {
+    XDT_wheel_timer *head = &wheel->slots[OVERFLOW], list;
+
+    /* take the list off, so timers remaining in overflow are not visited again */
+    if (head->next != head) {
+      list.next = head->next;
+      list.prev = head->prev;
+      list.next->prev = list.prev->next = &list;
+      head->next = head->prev = head;
+      while (list.next != &list) {
+        XDT_wheel_timer *t = list.next;
+
+        list.next = t->next;
+        t->next->prev = &list;
+        place(wheel, t);
+      }
+    }
+  }
+  cascade(wheel, LEVEL1 + (block & SLOT_MASK));
+}
+
+/**
+ * @brief Initializes an empty timer wheel
+ *
+ * @param wheel points to the wheel
+ * @param now current time in seconds, becomes tick 0
+ */
+void
+xdt_wheel_init(XDT_wheel * wheel, double now)
+{
+  unsigned i;
+
+  for (i = 0; i < sizeof wheel->slots / sizeof *wheel->slots; ++i) {
+    wheel->slots[i].prev = wheel->slots[i].next = &wheel->slots[i];
+  }
+  for (i = 0; i < sizeof wheel->used / sizeof *wheel->used; ++i) {
+    wheel->used[i] = 0;
+  }
+  wheel->current = 0;
+  wheel->origin = now;
+  wheel->count = 0;
+}
+
+/**
+ * @brief Arms a timer, an armed timer is re-armed
+ *
+ * The timer never expires before @a expires, but up to one tick later.
+ *
+ * @param wheel points to the wheel
+ * @param timer points to the timer, initially zeroed (not armed)
+ * @param expires absolute expiration time in seconds
+ */
+void
+xdt_wheel_add(XDT_wheel * wheel, XDT_wheel_timer * timer, double expires)
+{
+  unsigned long tick = ticks(wheel, expires);
+
+  /* round up, so the timer does not expire early */
+  if (tick_time(wheel, tick) < expires) {
+    tick++;
+  }
+  if (tick < wheel->current) {
+    tick = wheel->current;
+  }
+
+  xdt_wheel_remove(wheel, timer);
+  timer->tick = tick;
+  place(wheel, timer);
+  wheel->count++;
+}
+
+/**
+ * @brief Disarms a timer, nothing happens if it is not armed
+ *
+ * @param wheel points to the wheel
+ * @param timer points to the timer
+ */
+void
+xdt_wheel_remove(XDT_wheel * wheel, XDT_wheel_timer * timer)
+{
+  if (xdt_wheel_armed(timer)) {
+    unlink_timer(wheel, timer);
+    wheel->count--;
+  }
+}
+
+/**
+ * @brief Takes the next expired timer off the wheel
+ *
+ * Call it repeatedly until it returns @e null to collect all timers
+ * expired until @a now.
+ *
+ * @param wheel points to the wheel
+ * @param now current time in seconds
+ *
+ * @return the expired timer, now disarmed, @e null if no timer has expired
+ */
+XDT_wheel_timer *
+xdt_wheel_expire(XDT_wheel * wheel, double now)
+{
+  unsigned long target = ticks(wheel, now);
+
+  while (wheel->current <= target) {
+    unsigned long end;
+    int slot;
+
+    if (!wheel->count) {
+      wheel->current = target + 1;
+      break;
+    }
+
+    /* level 0 slots hold timers of one tick each */
+    if ((slot = first_used(wheel, 0, wheel->current & SLOT_MASK)) >= 0) {
+      unsigned long tick = (wheel->current & ~(unsigned long)SLOT_MASK) | slot;
+
+      if (tick <= target) {
+        XDT_wheel_timer *t = wheel->slots[slot].next;
+
+        wheel->current = tick;
+        xdt_wheel_remove(wheel, t);
+        return t;
+      }
+    }
+
+    end = (wheel->current | SLOT_MASK) + 1;
+    if (target + 1 < end) {
+      wheel->current = target + 1;
+      break;
+    }
+    next_block(wheel);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Computes when the wheel has to be checked for expired timers next
+ *
+ * The result is exact if a timer expires in the current block of ticks,
+ * else it is the start of the block of the next timer to expire, or the start
+ * of the next revolution when the overflow list is sorted in.
+ *
+ * @param wheel points to the wheel
+ *
+ * @return absolute time in seconds, 0 if no timer is armed
+ */
+double
+xdt_wheel_next(XDT_wheel * wheel)
+{
+  unsigned long block = wheel->current >> BLOCK_SHIFT, revolution;
+  int slot;
+
+  if (!wheel->count) {
+    return 0;
+  }
+
+  if ((slot = first_used(wheel, 0, wheel->current & SLOT_MASK)) >= 0) {
+    return tick_time(wheel, block << BLOCK_SHIFT | slot);
+  }
+
+  /* overflow timers are sorted in at the next revolution */
+  revolution = (block | SLOT_MASK) + 1;
+
+  /* level 1 slots of the following blocks, wrapping around */
+  if ((slot = first_used(wheel, LEVEL1, (block + 1) & SLOT_MASK)) < 0) {
+    slot = first_used(wheel, LEVEL1, 0);
+  }
+  if (slot >= 0) {
+    block += (slot - block) & SLOT_MASK;
+  }
+  if (slot < 0 || (block > revolution && wheel->slots[OVERFLOW].next != &wheel->slots[OVERFLOW])) {
+    block = revolution;
+  }
+
+  return tick_time(wheel, block << BLOCK_SHIFT);
+}
+
+
+/**
+ * @}
+ */
@@ -0,0 +1,76 @@
+/**
+ * @file wheel.h
+ * @ingroup service
+ * @brief Hierarchical timer wheel
+ */
+
+#ifndef WHEEL_H
+#define WHEEL_H
+
+/**
+ * @addtogroup service
+ * @{
+ */
+
+
+/** @brief Number of slots per wheel level (power of two) */
+#define XDT_WHEEL_SLOTS 256
+
+/** @brief Resolution of the wheel in seconds */
+#define XDT_WHEEL_TICK 0.001
+
+/** @brief Number of bits per word of the slot bitmaps */
+#define XDT_WHEEL_WORD_BITS (8 * sizeof (unsigned long))
+
+
+/**
+ * @brief Timer linked into a wheel slot
+ *
+ * Embed it into the timer's context, see xdt_wheel_add().
+ */
+typedef struct xdt_wheel_timer
+{
+  struct xdt_wheel_timer *prev; /**< predecessor in the slot list, @e null if not armed */
+  struct xdt_wheel_timer *next; /**< successor in the slot list, @e null if not armed */
+  unsigned long tick; /**< expiration tick */
+  unsigned slot; /**< index of the slot list the timer is linked into */
+} XDT_wheel_timer;
+
+/**
+ * @brief Timer wheel
+ *
+ * The ticks are grouped into blocks of #XDT_WHEEL_SLOTS ticks. Timers expiring
+ * in the current block are linked into the slot of their tick (level 0), timers
+ * of the following blocks into the slot of their block (level 1), all later ones
+ * into an overflow list. When a block is entered, its level 1 slot is moved down
+ * to level 0, the overflow list is sorted in once per wheel revolution.
+ * Bitmaps of the non-empty slots make finding the next expiration cheap.
+ */
+typedef struct
+{
+  XDT_wheel_timer slots[2 * XDT_WHEEL_SLOTS + 1]; /**< list heads of level 0, level 1 and the overflow list */
+  unsigned long used[2 * XDT_WHEEL_SLOTS / XDT_WHEEL_WORD_BITS]; /**< bitmap of the non-empty slots of both levels */
+  unsigned long current; /**< first tick not completely expired yet */
+  double origin; /**< time of tick 0 in seconds */
+  unsigned count; /**< number of armed timers */
+} XDT_wheel;
+
+
+void xdt_wheel_init(XDT_wheel * wheel, double now);
+void xdt_wheel_add(XDT_wheel * wheel, XDT_wheel_timer * timer, double expires);
+void xdt_wheel_remove(XDT_wheel * wheel, XDT_wheel_timer * timer);
+XDT_wheel_timer *xdt_wheel_expire(XDT_wheel * wheel, double now);
+double xdt_wheel_next(XDT_wheel * wheel);
+
+/**
+ * @brief Checks whether a timer is armed
+ * @param timer points to a wheel timer
+ */
+#define xdt_wheel_armed(timer) ((timer)->next != 0)
+
+
+/**
+ * @}
+ */
+
+#endif /* WHEEL_H */
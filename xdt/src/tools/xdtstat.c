@@ -0,0 +1,245 @@
+/* xdtstat.c
+ *
+ * Live protocol statistics of a running service.
+ *
+ * The service keeps counters and histograms per connection and in total in
+ * a shared memory segment named after its listen address (see
+ * service/stats.h). The tool maps it read-only and prints the totals once,
+ * or with -i every <interval> seconds the rates since the last line, <count>
+ * times or until interrupted. With -C the running connections follow each
+ * line. Reading takes no lock, the service is never slowed down.
+ *
+ * usage: ./xdtstat [-i <interval>] [-c <count>] [-C] <listen address>
+ */
+
+#include <service/service.h>
+#include <service/stats.h>
+#include <xdt/address.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+
+static double interval = 0;
+static int count = 0;
+static int list_conns = 0;
+
+static XDT_stats const *stats;
+
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* maps the statistics segment of the service at the given listen address */
+static void
+attach(XDT_address const *sap)
+{
+  char name[64];
+  void *mem;
+  int fd;
+
+  if (xdt_stats_name(sap, name, sizeof name) < 0) {
+    fputs("error in <listen address>\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  if ((fd = shm_open(name, O_RDONLY, 0)) == -1) {
+    fprintf(stderr, "%s: %s (is the service running?)\n", name, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  mem = mmap(0, sizeof (XDT_stats), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  stats = mem;
+  if (__atomic_load_n(&stats->magic, __ATOMIC_ACQUIRE) != XDT_STAT_MAGIC || stats->conns != XDT_STAT_CONNS) {
+    fprintf(stderr, "%s: not a statistics segment of this version\n", name);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* upper bound of the histogram bucket holding the given fraction of all samples */
+static uint64_t
+percentile(uint64_t const *histogram, double fraction)
+{
+  uint64_t samples = 0, seen = 0;
+  unsigned i;
+
+  for (i = 0; i < XDT_STAT_BUCKETS; ++i) {
+    samples += histogram[i];
+  }
+  if (!samples) {
+    return 0;
+  }
+  for (i = 0; i < XDT_STAT_BUCKETS - 1; ++i) {
+    if ((seen += histogram[i]) >= fraction * samples) {
+      break;
+    }
+  }
+  return i ? ((uint64_t)1 << i) - 1 : 0;
+}
+
+static void
+print_header(void)
+{
+  printf("%8s %6s %6s %9s %9s %9s %9s %8s %7s %6s %6s %6s %6s %6s %7s %9s %8s %8s %6s\n",
+         "time/s", "conns", "active", "DT out", "DT in", "ACK out", "ACK in", "retrans", "gbn",
+         "T1", "T2", "T3", "TI", "break", "dropped", "MB in", "rtt p50", "rtt p99", "depth");
+}
+
+/* prints the difference of two sums, divided by the seconds between them (1 for totals) */
+static void
+print_line(double t, XDT_stat_block const *now, XDT_stat_block const *last, double seconds, unsigned active)
+{
+  uint64_t d[XDT_STAT_COUNTERS], rtt[XDT_STAT_BUCKETS], depth[XDT_STAT_BUCKETS];
+  unsigned i;
+
+  for (i = 0; i < XDT_STAT_COUNTERS; ++i) {
+    d[i] = now->counter[i] - last->counter[i];
+  }
+  for (i = 0; i < XDT_STAT_BUCKETS; ++i) {
+    rtt[i] = now->histogram[XDT_STAT_RTT][i] - last->histogram[XDT_STAT_RTT][i];
+    depth[i] = now->histogram[XDT_STAT_DEPTH][i] - last->histogram[XDT_STAT_DEPTH][i];
+  }
+
+  printf("%8.1f %6llu %6u %9.0f %9.0f %9.0f %9.0f %8.0f %7.0f %6llu %6llu %6llu %6llu %6llu %7llu %9.2f %8llu %8llu %6llu\n",
+         t, (unsigned long long)d[XDT_STAT_CONNECTIONS], active,
+         d[XDT_STAT_DT_SENT] / seconds, d[XDT_STAT_DT_RECEIVED] / seconds,
+         d[XDT_STAT_ACK_SENT] / seconds, d[XDT_STAT_ACK_RECEIVED] / seconds,
+         d[XDT_STAT_RETRANSMITTED] / seconds, d[XDT_STAT_GO_BACK_N] / seconds,
+         (unsigned long long)d[XDT_STAT_T1_EXPIRED], (unsigned long long)d[XDT_STAT_T2_EXPIRED],
+         (unsigned long long)d[XDT_STAT_T3_EXPIRED], (unsigned long long)d[XDT_STAT_TI_EXPIRED],
+         (unsigned long long)d[XDT_STAT_BREAKS], (unsigned long long)d[XDT_STAT_DROPPED],
+         d[XDT_STAT_BYTES_DELIVERED] / seconds / 1e6,
+         (unsigned long long)percentile(rtt, .5), (unsigned long long)percentile(rtt, .99),
+         (unsigned long long)percentile(depth, .99));
+}
+
+/* prints the running connections, returns their number */
+static unsigned
+print_conns(int print)
+{
+  uint64_t now = now_ns();
+  unsigned i, active = 0;
+
+  if (print) {
+    printf("  %7s %-8s %10s %9s %9s %9s %9s %9s %8s %12s %8s\n", "pid", "role", "conn", "age", "DT out", "DT in",
+           "ACK out", "ACK in", "retrans", "bytes in", "rtt p50");
+  }
+  for (i = 0; i < XDT_STAT_CONNS; ++i) {
+    XDT_stat_conn const *c = &stats->conn[i];
+    XDT_stat_block b;
+    int32_t pid;
+
+    if (!(pid = __atomic_load_n(&c->pid, __ATOMIC_ACQUIRE))) {
+      continue;
+    }
+    active++;
+    if (!print) {
+      continue;
+    }
+    memcpy(&b, &c->block, sizeof b);
+    printf("  %7d %-8s %10u %8.1fs %9llu %9llu %9llu %9llu %8llu %12llu %8llu\n", (int)pid,
+           c->role == XDT_SERVICE_SENDER ? "sender" : "receiver", c->conn, (now - c->started) / 1e9,
+           (unsigned long long)b.counter[XDT_STAT_DT_SENT], (unsigned long long)b.counter[XDT_STAT_DT_RECEIVED],
+           (unsigned long long)b.counter[XDT_STAT_ACK_SENT], (unsigned long long)b.counter[XDT_STAT_ACK_RECEIVED],
+           (unsigned long long)b.counter[XDT_STAT_RETRANSMITTED],
+           (unsigned long long)b.counter[XDT_STAT_BYTES_DELIVERED],
+           (unsigned long long)percentile(b.histogram[XDT_STAT_RTT], .5));
+  }
+
+  return active;
+}
+
+static void
+print_usage(char const *cmd)
+{
+  fprintf(stderr, "usage: %s [-i <interval>] [-c <count>] [-C] <listen address>\n", cmd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  static XDT_stat_block zero;
+  XDT_stat_block last, now;
+  XDT_address sap;
+  uint64_t start, then, t;
+  unsigned active;
+  int opt, n;
+
+  while ((opt = getopt(argc, argv, "i:c:C")) != -1) {
+    switch (opt) {
+    case 'i':
+      interval = atof(optarg);
+      break;
+    case 'c':
+      count = atoi(optarg);
+      break;
+    case 'C':
+      list_conns = 1;
+      break;
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind + 1 != argc || interval < 0 || count < 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (xdt_address_parse(argv[optind], &sap) < 0) {
+    fputs("error in <listen address>\n", stderr);
+    return EXIT_FAILURE;
+  }
+  attach(&sap);
+
+  /* a single line of totals since the service started */
+  xdt_stats_sum(stats, &last);
+  then = now_ns();
+  if (!interval) {
+    print_header();
+    active = print_conns(0);
+    print_line((then - stats->started) / 1e9, &last, &zero, 1, active);
+    if (list_conns) {
+      print_conns(1);
+    }
+    return EXIT_SUCCESS;
+  }
+
+  start = then;
+  print_header();
+  for (n = 0; !count || n < count; ++n) {
+    usleep((useconds_t)(interval * 1e6));
+    if (kill(stats->pid, 0) == -1 && errno == ESRCH) {
+      fputs("the service has exited\n", stderr);
+      return EXIT_FAILURE;
+    }
+    xdt_stats_sum(stats, &now);
+    t = now_ns();
+    active = print_conns(0);
+    print_line((t - start) / 1e9, &now, &last, (t - then) / 1e9, active);
+    if (list_conns) {
+      print_conns(1);
+    }
+    fflush(stdout);
+    last = now;
+    then = t;
+  }
+
+  return EXIT_SUCCESS;
+}
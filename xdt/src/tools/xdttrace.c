@@ -0,0 +1,144 @@
+/* xdttrace.c
+ *
+ * Decoder of binary message trace files.
+ *
+ * The service and the user record their messages into trace files when
+ * configured by --enable-trace and started with -t <trace file>, one file
+ * <trace file>.<pid> per process (see xdt/log.h). The events of all given
+ * files are merged by time and printed one per line, the time relative to
+ * the first event. Files may be decoded while still being written.
+ *
+ * usage: ./xdttrace <trace file>.<pid> ...
+ */
+
+#include <service/pdu.h>
+#include <xdt/log.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+typedef struct
+{
+  XDT_trace_event e;
+  int pid;
+} event;
+
+
+static event *events;
+
+static size_t count, capacity;
+
+
+static char const *
+type_name(int type, char *buf, size_t size)
+{
+  static char const *const names[] = {
+    [XDATrequ] = "XDATrequ", [XDATind] = "XDATind", [XDATconf] = "XDATconf",
+    [XBREAKind] = "XBREAKind", [XABORTind] = "XABORTind", [XDISind] = "XDISind",
+    [DT] = "DT", [ACK] = "ACK", [ABO] = "ABO"
+  };
+
+  if (type > sdu_msg_min_pred && type < pdu_msg_max_succ && type != sdu_msg_max_succ) {
+    return names[type];
+  }
+  snprintf(buf, size, type > pdu_msg_max_succ ? "timer %d" : "type %d", type);
+  return buf;
+}
+
+/* appends the events of one trace file, oldest first */
+static void
+load(char const *path)
+{
+  XDT_trace_header const *ring;
+  XDT_trace_event const *ev;
+  struct stat st;
+  void *map;
+  uint64_t head, first, n;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  if ((size_t)st.st_size < sizeof *ring
+      || (map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    fprintf(stderr, "%s: not a trace file\n", path);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  ring = map;
+  if (ring->magic != XDT_TRACE_MAGIC || !ring->size || (ring->size & (ring->size - 1))
+      || (size_t)st.st_size < sizeof *ring + ring->size * sizeof *ev) {
+    fprintf(stderr, "%s: not a trace file\n", path);
+    exit(EXIT_FAILURE);
+  }
+
+  ev = (XDT_trace_event const *)(ring + 1);
+  head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  first = head > ring->size ? head - ring->size : 0;
+  if (head > ring->size) {
+    fprintf(stderr, "%s: %llu oldest events overwritten\n", path, (unsigned long long)first);
+  }
+
+  for (n = first; n < head; ++n) {
+    if (count == capacity) {
+      capacity = capacity ? 2 * capacity : 4096;
+      if (!(events = realloc(events, capacity * sizeof *events))) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    events[count].e = ev[n & (ring->size - 1)];
+    events[count].pid = ring->pid;
+    count++;
+  }
+
+  munmap(map, st.st_size);
+}
+
+static int
+by_time(void const *a, void const *b)
+{
+  uint64_t ta = ((event const *)a)->e.time, tb = ((event const *)b)->e.time;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static char const *const kinds[] = { "?", "sent", "received", "expired" };
+  char buf[32];
+  size_t i;
+  int f;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <trace file>.<pid> ...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  for (f = 1; f < argc; ++f) {
+    load(argv[f]);
+  }
+  qsort(events, count, sizeof *events, by_time);
+
+  printf("%14s %7s %-8s %-9s %10s %10s %6s %10s\n", "time/us", "pid", "event", "type", "conn", "sequ", "length", "extra");
+  for (i = 0; i < count; ++i) {
+    XDT_trace_event const *e = &events[i].e;
+
+    printf("%14.3f %7d %-8s %-9s %10u %10u %6u %#10x\n", (e->time - events[0].e.time) / 1e3, events[i].pid,
+           kinds[e->event <= XDT_TRACE_EXPIRED ? e->event : 0], type_name(e->type, buf, sizeof buf),
+           e->conn, e->sequ, e->length, e->extra);
+  }
+
+  free(events);
+
+  return EXIT_SUCCESS;
+}
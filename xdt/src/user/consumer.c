@@ -66,7 +66,7 @@ consumer_connect(void)
   if (sdu.type == XDATind) {
     if (sdu.x.dat_ind.sequ == sequ) {
       conn = sdu.x.dat_ind.conn;
-      write_data(sdu.x.dat_ind.data, sdu.x.dat_ind.length);
+      write_data(sdu_data(&sdu), sdu.x.dat_ind.length);
       ++sequ;
 
       state = DATA_TRANSFER;
@@ -85,7 +85,7 @@ consumer_data_transfer(void)
 
   if (sdu.type == XDATind) {
     if (sdu.x.dat_ind.conn == conn && sdu.x.dat_ind.sequ == sequ) {
-      write_data(sdu.x.dat_ind.data, sdu.x.dat_ind.length);
+      write_data(sdu_data(&sdu), sdu.x.dat_ind.length);
       ++sequ;
     }
   } else if (sdu.type == XABORTind) {
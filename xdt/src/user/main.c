@@ -34,9 +34,15 @@
  * and responding properly.
  * To receive SDU messages get_sdu() is called. It blocks until a message from the
  * XDT layer is available. To deliver SDU messages to the XDT layer deliver_sdu()
- * is used. The payload data to send is fetched by successive calls of read_data() 
- * and the received payload data is stord by write_data(). The data is read from
- * standard input (stdin) and written to standard output (stdout). All other output 
+ * is used, XDATrequ SDUs are delivered by deliver_sdu_data() with their payload
+ * gathered from where it is. The payload data to send is fetched by successive calls
+ * of slice_data() and the received payload data is stord by write_data(). The data is
+ * read from standard input (stdin), or with @e -f from a file mapped into memory by
+ * open_data(), and written to standard output (stdout). With @e -m the producer
+ * passes the payload by a shared memory ring (see share_payload()), reading stdin
+ * right into it, and the XDT layer keeps it there until acknowledged; a consumer
+ * reads payload from such a ring whenever the XDT layer passes one, so
+ * sdu_data() locates the payload of a received SDU. All other output 
  * like debug and error messages are directed to standard error (stderr).
  *
  *
@@ -50,11 +56,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <ctype.h>
+
+#include <unistd.h>
 
 #include "user.h"
 #include "producer.h"
 #include "consumer.h"
 
+#include <xdt/log.h>
+
 
 /**
  * @brief Prints program usage information
@@ -65,7 +76,7 @@
 static void
 print_usage(FILE * f, char const *cmd)
 {
-  fprintf(f, "usage: %s <local address> [<remote address>]\n\n" "<local address>, <remote address> = host:port[.slot]\n\n" "  host = hostname or IPv4 address in standard dot notation\n" "  port = IP port number in range [%d, %d]\n" "  slot = XDT user slot in range [%u, %u] (default is %u)\n", cmd, XDT_PORT_MIN, XDT_PORT_MAX, XDT_SLOT_MIN, XDT_SLOT_MAX, XDT_SLOT_MIN);
+  fprintf(f, "usage: %s [-p <payload>] [-f <file>] [-m] [-l <log level>] [-t <trace file>] <local address> [<remote address>]\n\n" "<payload> = biggest payload size of a message in bytes (producer only), within %u and %u (default is %u)\n" "<file> = file to send instead of stdin (producer only), regular files are mapped into memory\n" "-m = pass the payload to the XDT layer by a shared memory ring (producer only)\n" "<log level> = %d (quiet), %d (dump SDUs) or %d (dump SDUs and payload), at most %d compiled in (default is %d)\n" "<trace file> = record binary SDU trace events to <trace file>.<pid>, decode them by xdttrace\n" "<local address>, <remote address> = host:port[.slot]\n\n" "  host = hostname or IPv4 address in standard dot notation\n" "  port = IP port number in range [%d, %d]\n" "  slot = XDT user slot in range [%u, %u] (default is %u)\n", cmd, XDT_DATA_DEFAULT, XDT_DATA_MAX, XDT_DATA_DEFAULT, XDT_LOG_QUIET, XDT_LOG_MESSAGES, XDT_LOG_PAYLOAD, XDT_LOG_MAX, XDT_LOG_QUIET, XDT_PORT_MIN, XDT_PORT_MAX, XDT_SLOT_MIN, XDT_SLOT_MAX, XDT_SLOT_MIN);
 }
 
 
@@ -85,17 +96,70 @@ main(int argc, char *argv[])
 {
   XDT_address local;
   XDT_address peer;
-  int producer = argc > 2;
-  int i;
+  char const *cmd = argv[0];
+  unsigned long max_length = XDT_DATA_DEFAULT;
+  char const *file = 0;
+  int shared = 0;
+  char *end;
+  int producer;
+  int i, opt;
+
+  while ((opt = getopt(argc, argv, "p:f:ml:t:")) != -1) {
+    switch (opt) {
+    case 'p':
+      max_length = isdigit((int)optarg[0]) ? strtoul(optarg, &end, 10) : 0;
+      if (!isdigit((int)optarg[0]) || *end || max_length < XDT_DATA_DEFAULT || max_length > XDT_DATA_MAX) {
+        fputs("error in <payload>\n", stderr);
+        print_usage(stderr, cmd);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'f':
+      file = optarg;
+      break;
+
+    case 'm':
+      shared = 1;
+      break;
+
+    case 'l':
+      if (!isdigit((int)optarg[0]) || optarg[1] || optarg[0] - '0' > XDT_LOG_MAX) {
+        fputs("error in <log level>\n", stderr);
+        print_usage(stderr, cmd);
+        return EXIT_FAILURE;
+      }
+      xdt_log_level = optarg[0] - '0';
+      break;
+
+    case 't':
+      if (xdt_trace_open(optarg) < 0) {
+        if (!xdt_tracing()) {
+          fputs("error in <trace file>: tracing not compiled in (configure --enable-trace)\n", stderr);
+        } else {
+          perror("error in <trace file>");
+        }
+        return EXIT_FAILURE;
+      }
+      break;
+
+    default:
+      print_usage(stderr, cmd);
+      return EXIT_FAILURE;
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
+  producer = argc > 2;
 
   if (argc < 2 || argc > 3) {
-    print_usage(stderr, argv[0]);
+    print_usage(stderr, cmd);
     return EXIT_FAILURE;
   }
 
   if ((i = xdt_address_parse(argv[1], &local)) < 0) {
     fputs("error in <local address>\n", stderr);
-    print_usage(stderr, argv[0]);
+    print_usage(stderr, cmd);
     return EXIT_FAILURE;
   }
 
@@ -104,11 +168,17 @@ main(int argc, char *argv[])
   if (producer) {
     if (xdt_address_parse(argv[2], &peer) < 0) {
       fputs("error in <remote address>\n", stderr);
-      print_usage(stderr, argv[0]);
+      print_usage(stderr, cmd);
       return EXIT_FAILURE;
     }
 
-    start_producer(&local, &peer);
+    if (file) {
+      open_data(file);
+    }
+    if (shared) {
+      share_payload();
+    }
+    start_producer(&local, &peer, max_length);
   } else {
     start_consumer();
   }
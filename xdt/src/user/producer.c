@@ -13,6 +13,10 @@
 #include "producer.h"
 
 #include <assert.h>
+#include <stdio.h>
+
+#include <unistd.h>
+#include <sys/resource.h>
 
 
 enum
@@ -35,9 +39,21 @@ static unsigned conn = 0;
 /** @brief sequence number of last message sent */
 static unsigned sequ = 1;
 
+/** @brief sequence number up to which we may send messages without waiting for a confirmation */
+static unsigned limit = 1;
+
+/** @brief biggest payload size wanted, offered to the XDT layer by the first message */
+static unsigned max_length = XDT_DATA_DEFAULT;
+
+/** @brief payload size of a message, as agreed by the XDT layer */
+static unsigned chunk = XDT_DATA_DEFAULT;
+
 /** @brief flag indicating if we have sent the last message */
 static unsigned eom = 0;
 
+/** @brief number of payload bytes delivered */
+static unsigned long long delivered = 0;
+
 /** @brief Local address */
 static XDT_address *source_addr = 0;
 
@@ -64,24 +80,53 @@ producer_idle(void)
 }
 
 
+/**
+ * @brief Updates the send window
+ *
+ * XDATconf confirms all messages up to it's sequence number and opens
+ * the window for further messages (see XDT_xdat_conf). It also tells
+ * the payload size agreed for the connection.
+ *
+ * @param conf points to the received XDATconf
+ */
+static void
+update_limit(XDT_xdat_conf const *conf)
+{
+  unsigned new_limit = conf->sequ + (conf->window ? conf->window : 1);
+
+  if (conf->max_length >= XDT_DATA_DEFAULT && conf->max_length <= max_length) {
+    chunk = conf->max_length;
+  }
+
+  if (new_limit > limit) {
+    limit = new_limit;
+  }
+}
+
+
 /** @brief Implements the producer's CONNECT state */
 static void
 producer_connect(void)
 {
   XDT_sdu sdu;
+  char const *data;
 
   sdu.type = XDATrequ;
   sdu.x.dat_requ.sequ = 1;
   sdu.x.dat_requ.source_addr = *source_addr;
   sdu.x.dat_requ.dest_addr = *dest_addr;
   sdu.x.dat_requ.eom = 0;
-  sdu.x.dat_requ.length = read_data(sdu.x.dat_requ.data);
-  deliver_sdu(&sdu);
+  sdu.x.dat_requ.max_length = max_length;
+  /* the payload size is not agreed yet */
+  sdu.x.dat_requ.length = slice_data(&data, XDT_DATA_DEFAULT);
+  deliver_sdu_data(&sdu, data);
+  delivered += sdu.x.dat_requ.length;
 
   get_sdu(&sdu);
   if (sdu.type == XDATconf) {
     if (sdu.x.dat_conf.sequ == 1) {
       conn = sdu.x.dat_conf.conn;
+      update_limit(&sdu.x.dat_conf);
       state = DATA_TRANSFER;
     }
   } else if (sdu.type == XABORTind) {
@@ -99,9 +144,14 @@ producer_break(void)
   get_sdu(&sdu);
 
   if (sdu.type == XDATconf) {
-    if (sdu.x.dat_conf.conn == conn && sdu.x.dat_conf.sequ == sequ) {
+    if (sdu.x.dat_conf.conn == conn) {
+      update_limit(&sdu.x.dat_conf);
       state = DATA_TRANSFER;
     }
+  } else if (sdu.type == XDISind) {
+    if (sdu.x.dis_ind.conn == conn) {
+      state = IDLE;
+    }
   } else if (sdu.type == XABORTind) {
     if (sdu.x.abort_ind.conn == conn) {
       state = IDLE;
@@ -110,20 +160,27 @@ producer_break(void)
 }
 
 
-/** @brief Implements the producer's DATA_TRANSFER state */
+/**
+ * @brief Implements the producer's DATA_TRANSFER state
+ *
+ * Sends messages as long as the window allows, then waits for the next
+ * confirmation (or any other indication).
+ */
 static void
 producer_data_transfer(void)
 {
   XDT_sdu sdu;
+  char const *data;
 
-  if (!eom) {
+  while (!eom && sequ < limit) {
     sdu.type = XDATrequ;
     sdu.x.dat_requ.sequ = ++sequ;
     sdu.x.dat_requ.conn = conn;
-    sdu.x.dat_requ.length = read_data(sdu.x.dat_requ.data);
-    eom = sdu.x.dat_requ.eom = sdu.x.dat_requ.length < XDT_DATA_MAX;
+    sdu.x.dat_requ.length = slice_data(&data, chunk);
+    eom = sdu.x.dat_requ.eom = sdu.x.dat_requ.length < chunk;
 
-    deliver_sdu(&sdu);
+    deliver_sdu_data(&sdu, data);
+    delivered += sdu.x.dat_requ.length;
   }
 
   for (;;) {
@@ -131,7 +188,8 @@ producer_data_transfer(void)
 
     switch ((int)sdu.type) {
     case XDATconf:
-      if (sdu.x.dat_conf.conn == conn && sdu.x.dat_conf.sequ == sequ) {
+      if (sdu.x.dat_conf.conn == conn) {
+        update_limit(&sdu.x.dat_conf);
         return;
       }
       break;
@@ -188,6 +246,29 @@ run_producer(void)
 }
 
 
+/**
+ * @brief Prints the CPU time used by the producer per GB of payload
+ */
+static void
+print_cpu_usage(void)
+{
+  struct rusage ru;
+  double cpu;
+
+  if (getrusage(RUSAGE_SELF, &ru) == -1) {
+    perror("getrusage");
+    return;
+  }
+  cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+  fprintf(stderr, "(%d) producer: %llu bytes delivered, %.3f s CPU", (int)getpid(), delivered, cpu);
+  if (delivered) {
+    fprintf(stderr, " (%.3f s per GB)", cpu / delivered * 1e9);
+  }
+  fputc('\n', stderr);
+}
+
+
 /** 
  * @brief Producer entry function
  *
@@ -196,21 +277,28 @@ run_producer(void)
  *
  * The only functions needed here are
  * - get_sdu() to read SDU messages from the XDT layer,
- * - deliver_sdu() to deliver an SDU message to the XDT layer and
- * - read_data() to read the data to deliver.
+ * - deliver_sdu_data() to deliver an XDATrequ SDU to the XDT layer and
+ * - slice_data() to get the data to deliver, from @e stdin or a file (see open_data()).
+ *
+ * Finally the CPU time used per GB of payload is printed.
  *
  * @param src source address
  * @param dst destination address
+ * @param max_length_wanted biggest payload size of a message wanted (#XDT_DATA_DEFAULT to #XDT_DATA_MAX)
  */
 void
-start_producer(XDT_address * src, XDT_address * dst)
+start_producer(XDT_address * src, XDT_address * dst, unsigned max_length_wanted)
 {
   assert(src && dst);
+  assert(max_length_wanted >= XDT_DATA_DEFAULT && max_length_wanted <= XDT_DATA_MAX);
 
   source_addr = src;
   dest_addr = dst;
+  max_length = max_length_wanted;
 
   run_producer();
+
+  print_cpu_usage();
 }
 
 
@@ -16,7 +16,7 @@
 #include <xdt/address.h>
 
 
-void start_producer(XDT_address * src, XDT_address * dst);
+void start_producer(XDT_address * src, XDT_address * dst, unsigned max_length);
 
 
 /**
@@ -15,14 +15,24 @@
 
 #include "user.h"
 
+#include <xdt/log.h>
+#include <xdt/payload.h>
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
 #include <signal.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifndef SUN_LEN
 #define SUN_LEN(sun) sizeof(*(sun))
@@ -39,6 +49,12 @@
 /** @brief Unix domain socket for delivering SDU messages to the XDT layer */
 static int send_sock = -1;
 
+/** @brief Local address of a producer, names the access points of the XDT layer */
+static XDT_address send_sap;
+
+/** @brief Dispatcher shard whose access point #send_sock is connected to */
+static unsigned send_shard = 0;
+
 /** @brief Unix domain socket for receiving SDU messages from the XDT layer */
 static int recv_sock = -1;
 
@@ -48,6 +64,33 @@ static struct sockaddr_un recv_addr;
 /** @brief Flag indicating, if the path stored in #recv_addr can be removed */
 static volatile sig_atomic_t remove_sun_path = 0;
 
+/** @brief Payload file mapped by open_data(), @e null if reading @e stdin */
+static char const *data_map = 0;
+
+/** @brief Size of #data_map in bytes */
+static size_t data_size = 0;
+
+/** @brief Offset of the next payload byte in #data_map */
+static size_t data_pos = 0;
+
+/** @brief Buffer for payload read from @e stdin by slice_data() */
+static char data_buffer[XDT_DATA_MAX];
+
+/** @brief Payload ring shared with the XDT layer: written by a producer, read by a consumer */
+static XDT_payload_ring ring = { 0, 0, 0, 0, 0, -1 };
+
+/** @brief Received XDATind whose payload is still in #ring, released by the next get_sdu() */
+static XDT_xdat_ind held_ind;
+
+/** @brief Space in #ring slice_data() read @e stdin into, @e null if none or delivered */
+static char *sliced = 0;
+
+/** @brief Ring offset of #sliced */
+static unsigned sliced_offset;
+
+/** @brief Number of bytes read into #sliced */
+static unsigned sliced_length;
+
 
 /**
  * @brief Exit handler
@@ -146,6 +189,7 @@ setup_user(XDT_address * local, int producer)
       perror("setup_user: connect");
       exit(EXIT_FAILURE);
     }
+    send_sap = *local;
   }
 
   /* create bound socket for receiving */
@@ -167,32 +211,113 @@ setup_user(XDT_address * local, int producer)
   remove_sun_path = 1;
 }
 
+/**
+ * @brief Sends further SDUs to the access point of a dispatcher shard
+ *
+ * A service with several shards serves a connection by one of them, told by
+ * its XDATconfs. SDUs sent to its access point need not be passed on by the
+ * first shard. If it cannot be reached, SDUs go where they went before.
+ *
+ * @param shard index of the shard
+ */
+static void
+follow_shard(unsigned shard)
+{
+  struct sockaddr_un addr;
+
+  if (send_sock == -1 || shard == send_shard) {
+    return;
+  }
+  ZERO(addr);
+  addr.sun_family = AF_LOCAL;
+  if (xdt_address_to_shard_sap_name(&send_sap, shard, addr.sun_path, sizeof addr.sun_path) < 0
+      || connect(send_sock, (struct sockaddr *)&addr, SUN_LEN(&addr)) == -1) {
+    perror("warning: get_sdu: connecting to the shard failed");
+    return;
+  }
+  send_shard = shard;
+}
+
 /**
  * @brief Receives an SDU message from the XDT layer
  *
+ * The XDT layer may pass a payload ring along with an SDU, the payload of
+ * following XDATinds may then be in the ring (see sdu_data()). A producer
+ * sends further SDUs to the shard named by an XDATconf (see follow_shard()). It is released
+ * by the next call. The SDU is received packed into a static buffer,
+ * the payload stays there until the next call too.
+ *
  * @param sdu points to the SDU message to be filled
  */
 void
 get_sdu(XDT_sdu * sdu)
 {
+  static union
+  {
+    char buf[XDT_SDU_SIZE(XDT_DATA_MAX)];
+    long align;
+  } packed;
+  union
+  {
+    char buf[XDT_PAYLOAD_CONTROL_SIZE];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
   ssize_t bytes;
+  int fd;
 
   if (!sdu) {
     fputs("get_sdu: null pointer as SDU argument\n", stderr);
     exit(EXIT_FAILURE);
   }
 
-  if ((bytes = read(recv_sock, sdu, sizeof *sdu)) == -1) {
-    perror("get_sdu: read");
+  if (held_ind.shared) {
+    xdt_payload_release(&ring, held_ind.offset, held_ind.length);
+    held_ind.shared = 0;
+  }
+
+  memset(&msg, 0, sizeof msg);
+  iov.iov_base = packed.buf;
+  iov.iov_len = sizeof packed.buf;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  if ((bytes = recvmsg(recv_sock, &msg, MSG_CMSG_CLOEXEC)) == -1) {
+    perror("get_sdu: recvmsg");
     exit(EXIT_FAILURE);
   }
 
-  if ((size_t) bytes < sizeof *sdu) {
-    /* message to small */
+  if ((fd = xdt_payload_received_fd(&msg)) != -1) {
+    /* a new connection comes with a new ring */
+    xdt_payload_detach(&ring);
+    if (xdt_payload_attach(&ring, fd) < 0) {
+      fputs("get_sdu: could not attach payload ring\n", stderr);
+    }
+  }
+
+  if (xdt_sdu_unpack(sdu, packed.buf, bytes) < 0) {
+    /* message size does not match */
     sdu->type = 0;
+  } else if (sdu->type == XDATconf) {
+    follow_shard(sdu->x.dat_conf.shard);
+  } else if (sdu->type == XDATind && sdu->x.dat_ind.shared) {
+    if (sdu->x.dat_ind.length > XDT_DATA_MAX
+        || !xdt_payload_data(&ring, sdu->x.dat_ind.offset, sdu->x.dat_ind.length)) {
+      /* payload not in the ring */
+      sdu->type = 0;
+    } else {
+      held_ind = sdu->x.dat_ind;
+    }
   }
 
-  print_sdu(sdu, "received", stderr);
+  if (xdt_tracing()) {
+    xdt_trace_sdu(XDT_TRACE_RECEIVED, sdu);
+  }
+  if (xdt_logging(XDT_LOG_MESSAGES)) {
+    print_sdu(sdu, "received", stderr);
+  }
 }
 
 /**
@@ -203,43 +328,260 @@ get_sdu(XDT_sdu * sdu)
 void
 deliver_sdu(XDT_sdu * sdu)
 {
+  struct iovec iov[2];
   ssize_t bytes;
+  size_t size;
 
   if (!sdu) {
     fputs("send_sdu: null pointer as SDU argument\n", stderr);
     exit(EXIT_FAILURE);
   }
 
-  print_sdu(sdu, "to send", stderr);
+  if (xdt_tracing()) {
+    xdt_trace_sdu(XDT_TRACE_SENT, sdu);
+  }
+  if (xdt_logging(XDT_LOG_MESSAGES)) {
+    print_sdu(sdu, "to send", stderr);
+  }
 
-  if ((bytes = write(send_sock, sdu, sizeof *sdu)) == -1) {
-    perror("send_sdu: write");
+  /* the payload is sent up to the last used byte only */
+  size = xdt_sdu_size(sdu);
+  if ((bytes = writev(send_sock, iov, xdt_sdu_iov(sdu, iov))) == -1) {
+    perror("send_sdu: writev");
     exit(EXIT_FAILURE);
   }
 
-  if ((size_t) bytes < sizeof *sdu) {
+  if ((size_t) bytes < size) {
     fputs("send_sdu: could not send entire SDU\n", stderr);
     exit(EXIT_FAILURE);
   }
 }
 
+/**
+ * @brief Returns the payload of a received XDATind
+ *
+ * @param sdu points to an XDATind SDU received by get_sdu()
+ *
+ * @return the payload, in the payload ring or in the SDU, valid until the next get_sdu()
+ */
+char const *
+sdu_data(XDT_sdu const *sdu)
+{
+  if (sdu->x.dat_ind.shared) {
+    return xdt_payload_data(&ring, sdu->x.dat_ind.offset, sdu->x.dat_ind.length);
+  }
+
+  return sdu->x.dat_ind.data;
+}
+
+/**
+ * @brief Passes the payload of XDATrequ SDUs by a shared memory ring
+ *
+ * The ring is passed to the XDT layer along with the first XDATrequ.
+ * Only used in producer instances.
+ */
+void
+share_payload(void)
+{
+  if (xdt_payload_create(&ring) < 0) {
+    perror("share_payload: xdt_payload_create");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief Delivers an XDATrequ SDU with payload stored elsewhere
+ *
+ * The SDU is gathered from its header and @a data by writev(2), so the payload
+ * is copied only once, from @a data into the socket. With a payload ring (see
+ * share_payload()) the payload is copied into the ring instead and only the
+ * header is sent, unless the ring is full. Payload slice_data() has read into
+ * the ring is not copied at all. The payload of @a sdu is set to @a data.
+ *
+ * @param sdu points to the XDATrequ SDU, @e length set
+ * @param data points to the payload, e.g. returned by slice_data()
+ */
+void
+deliver_sdu_data(XDT_sdu * sdu, char const *data)
+{
+  struct iovec iov[2];
+  ssize_t bytes;
+  size_t size;
+  int iovcnt;
+
+  if (!sdu || sdu->type != XDATrequ || sdu->x.dat_requ.length > XDT_DATA_MAX) {
+    fputs("send_sdu: invalid XDATrequ SDU argument\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+
+  sdu->x.dat_requ.data = (char *)(uintptr_t)data;
+  sdu->x.dat_requ.shared = 0;
+  if (xdt_payload_attached(&ring)) {
+    char *slot;
+
+    if (sliced && data == sliced && sdu->x.dat_requ.length <= sliced_length) {
+      /* read right into the ring */
+      sdu->x.dat_requ.offset = sliced_offset;
+      sdu->x.dat_requ.shared = 1;
+    } else if ((slot = xdt_payload_reserve(&ring, sdu->x.dat_requ.length, &sdu->x.dat_requ.offset))) {
+      memcpy(slot, data, sdu->x.dat_requ.length);
+      sdu->x.dat_requ.shared = 1;
+    }
+    /* space read into but not delivered is skipped now */
+    sliced = 0;
+  }
+
+  if (xdt_tracing()) {
+    xdt_trace_sdu(XDT_TRACE_SENT, sdu);
+  }
+  if (xdt_logging(XDT_LOG_MESSAGES)) {
+    print_sdu(sdu, "to send", stderr);
+  }
+
+  iovcnt = xdt_sdu_iov(sdu, iov);
+  size = xdt_sdu_size(sdu);
+
+  if (ring.fd != -1) {
+    /* pass the ring once along with the whole SDU, the XDT layer keeps it for the connection */
+    bytes = xdt_payload_sendv_fd(send_sock, iov, iovcnt, ring.fd);
+    close(ring.fd);
+    ring.fd = -1;
+  } else {
+    bytes = writev(send_sock, iov, iovcnt);
+  }
+  if (bytes == -1) {
+    perror("send_sdu: writev");
+    exit(EXIT_FAILURE);
+  }
+
+  if ((size_t) bytes < size) {
+    fputs("send_sdu: could not send entire SDU\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief Takes the payload from a file instead of @e stdin
+ *
+ * A regular file is mapped into memory, slice_data() then returns pieces of
+ * the mapping without copying. Any other file (e.g. a pipe) replaces @e stdin.
+ * Only used in producer instances.
+ *
+ * @param path path of the file
+ */
+void
+open_data(char const *path)
+{
+  struct stat st;
+  void *map;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+    perror("open_data");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!S_ISREG(st.st_mode)) {
+    if (dup2(fd, STDIN_FILENO) == -1) {
+      perror("open_data: dup2");
+      exit(EXIT_FAILURE);
+    }
+    close(fd);
+    return;
+  }
+
+  data_size = st.st_size;
+  data_pos = 0;
+  if (!data_size) {
+    /* nothing to map, but not stdin either */
+    data_map = data_buffer;
+  } else {
+    if ((map = mmap(0, data_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+      perror("open_data: mmap");
+      exit(EXIT_FAILURE);
+    }
+    madvise(map, data_size, MADV_SEQUENTIAL);
+    data_map = map;
+  }
+  close(fd);
+}
+
+/**
+ * @brief Returns the next piece of payload data
+ *
+ * If a file is mapped by open_data(), @a data points into the mapping,
+ * else the data is read from @e stdin by read_data() into a buffer,
+ * valid until the next call. With a payload ring (see share_payload())
+ * the buffer is reserved in the ring, so deliver_sdu_data() does not copy it.
+ * Only used in producer instances.
+ *
+ * @param data where to store the pointer to the payload
+ * @param size number of bytes wanted (at most #XDT_DATA_MAX)
+ *
+ * @return Number of bytes at @a data. If end of input is reached,
+ *         a value < @a size is returned.
+ */
+unsigned
+slice_data(char const **data, unsigned size)
+{
+  size_t left = data_size - data_pos;
+
+  if (!data_map) {
+    char *slot;
+
+    /* the last piece was not delivered, take its space back */
+    if (sliced) {
+      xdt_payload_unreserve(&ring, sliced_offset);
+      sliced = 0;
+    }
+    if (xdt_payload_attached(&ring) && size <= XDT_DATA_MAX
+        && (slot = xdt_payload_reserve(&ring, size, &sliced_offset))) {
+      sliced_length = read_data(slot, size);
+      xdt_payload_unreserve(&ring, sliced_offset + sliced_length);
+      *data = sliced = slot;
+      return sliced_length;
+    }
+
+    *data = data_buffer;
+    return read_data(data_buffer, size);
+  }
+
+  if (size > XDT_DATA_MAX) {
+    fputs("slice_data: invalid size parameter\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  if (size > left) {
+    size = left;
+  }
+  *data = data_map + data_pos;
+  data_pos += size;
+
+  return size;
+}
+
 /**
  * @brief Reads payload data from @e stdin
  *
  * Only used in producer instances.
  *
  * @param buffer buffer to store the read piece of payload
+ * @param size number of bytes to read (at most #XDT_DATA_MAX)
  *
  * @return Number of bytes stored in @a buffer. If end of input is reached,
- *         a value < #XDT_DATA_MAX is returned.
+ *         a value < @a size is returned.
  */
 unsigned
-read_data(char buffer[XDT_DATA_MAX])
+read_data(char buffer[XDT_DATA_MAX], unsigned size)
 {
   size_t bytes_read;
-  size_t bytes_available = XDT_DATA_MAX;
+  size_t bytes_available = size;
   char *buf = buffer;
 
+  if (size > XDT_DATA_MAX) {
+    fputs("read_data: could not read SDU data (invalid size parameter)\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+
   do {
     if ((bytes_read = fread(buf, 1, bytes_available, stdin)) == 0) {
       if (ferror(stdin)) {
@@ -264,12 +606,12 @@ read_data(char buffer[XDT_DATA_MAX])
  * @param length number of bytes to write
  */
 void
-write_data(char buffer[XDT_DATA_MAX], unsigned length)
+write_data(char const *buffer, unsigned length)
 {
 
   size_t bytes_written;
   size_t bytes_available = length;
-  char *buf = buffer;
+  char const *buf = buffer;
 
   if (length > XDT_DATA_MAX) {
     fputs("write_data: could not write SDU data (invalid length parameter)\n", stderr);
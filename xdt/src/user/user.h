@@ -21,8 +21,13 @@ void setup_user(XDT_address * local, int producer);
 
 void get_sdu(XDT_sdu * sdu);
 void deliver_sdu(XDT_sdu * sdu);
-unsigned read_data(char buffer[XDT_DATA_MAX]);
-void write_data(char buffer[XDT_DATA_MAX], unsigned length);
+void deliver_sdu_data(XDT_sdu * sdu, char const *data);
+char const *sdu_data(XDT_sdu const *sdu);
+void share_payload(void);
+void open_data(char const *path);
+unsigned slice_data(char const **data, unsigned size);
+unsigned read_data(char buffer[XDT_DATA_MAX], unsigned size);
+void write_data(char const *buffer, unsigned length);
 
 
 /**
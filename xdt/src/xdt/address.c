@@ -13,15 +13,14 @@
 
 #include <stdlib.h>
 #include <limits.h>
-#include <stdio.h>
 #include <string.h>
-#include <assert.h>
+#include <stddef.h>
+#include <time.h>
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
-#include <regex.h>
 
 /**
  * @brief Unix Domain Socket path prefix
@@ -32,6 +31,257 @@
  */
 #define XDT_SAP_NAME_PREFIX "/tmp/xdt-"
 
+/** @brief Number of hostnames kept by the resolver cache */
+#define RESOLVE_CACHE_SIZE 16
+
+/** @brief Size of a hostname buffer, longer hostnames are resolved but not cached */
+#define RESOLVE_NAME_MAX 64
+
+/** @brief Number of endpoints kept by xdt_address_endpoint() (power of two) */
+#define ENDPOINT_CACHE_SIZE 256
+
+
+/** @brief Resolved hostname */
+typedef struct
+{
+  char name[RESOLVE_NAME_MAX]; /**< hostname, empty if the entry is unused */
+  struct in_addr in; /**< its IPv4 address */
+  time_t expires; /**< monotonic time in seconds the entry is valid until */
+} XDT_resolved;
+
+/** @brief Cached socket addresses of an XDT address */
+typedef struct
+{
+  XDT_address addr; /**< the XDT address, host padded with zero bytes */
+  int used; /**< not 0 if the entry holds an endpoint */
+  XDT_endpoint ep; /**< its socket addresses */
+} XDT_cached_endpoint;
+
+
+/** @brief Resolver cache, guarded by #resolve_lock */
+static XDT_resolved resolved[RESOLVE_CACHE_SIZE];
+
+/** @brief Spin lock of the resolver cache */
+static char resolve_lock;
+
+/** @brief Endpoint cache indexed by a hash of the XDT address, guarded by #endpoint_lock */
+static XDT_cached_endpoint endpoints[ENDPOINT_CACHE_SIZE];
+
+/** @brief Spin lock of the endpoint cache */
+static char endpoint_lock;
+
+
+/**
+ * @brief Takes a spin lock
+ *
+ * The caches are held for a few memory accesses only, resolving
+ * and formatting happen outside.
+ *
+ * @param lock points to the lock
+ */
+static void
+lock(char *lock)
+{
+  while (__atomic_test_and_set(lock, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * @brief Releases a spin lock
+ *
+ * @param lock points to the lock
+ */
+static void
+unlock(char *lock)
+{
+  __atomic_clear(lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Appends a decimal number to a string
+ *
+ * @param p where to write the digits
+ * @param v the number
+ *
+ * @return behind the last digit written
+ */
+static char *
+put_decimal(char *p, unsigned long v)
+{
+  char digits[3 * sizeof v];
+  int n = 0;
+
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  while (n) {
+    *p++ = digits[--n];
+  }
+
+  return p;
+}
+
+/**
+ * @brief Builds the name of an access point
+ *
+ * @param addr points to the XDT address
+ * @param with_slot not 0 for a user, 0 for a service access point
+ * @param shard dispatcher shard of a service access point, appended if not 0
+ * @param buf memory area where to store the name
+ * @param buf_size size of the buffer @a buf is pointing to
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+static int
+format_name(XDT_address const *addr, int with_slot, unsigned shard, char *buf, size_t buf_size)
+{
+  char name[sizeof XDT_SAP_NAME_PREFIX + INET_ADDRSTRLEN + 2 * 3 * sizeof (unsigned long)];
+  char *p = name;
+  size_t host_len;
+
+  if (!addr || addr->port < XDT_PORT_MIN || addr->port > XDT_PORT_MAX || !buf) {
+    return -10;
+  }
+  host_len = strnlen(addr->host, sizeof addr->host);
+
+  memcpy(p, XDT_SAP_NAME_PREFIX, sizeof XDT_SAP_NAME_PREFIX - 1);
+  p += sizeof XDT_SAP_NAME_PREFIX - 1;
+  memcpy(p, addr->host, host_len);
+  p += host_len;
+  *p++ = ':';
+  p = put_decimal(p, addr->port);
+  if (with_slot) {
+    *p++ = '.';
+    p = put_decimal(p, addr->slot);
+  } else if (shard) {
+    *p++ = '#';
+    p = put_decimal(p, shard);
+  }
+  *p++ = 0;
+
+  if ((size_t)(p - name) > buf_size) {
+    /* buffer to small */
+    return -40;
+  }
+  memcpy(buf, name, p - name);
+
+  return 0;
+}
+
+/**
+ * @brief Reads a decimal number
+ *
+ * Numbers too big for an unsigned long are read as ULONG_MAX.
+ *
+ * @param p points to the first digit, set behind the last one
+ * @param value where to store the number
+ *
+ * @return 0 on success, value < 0 if there is no digit
+ */
+static int
+parse_decimal(char const **p, unsigned long *value)
+{
+  char const *s = *p;
+  unsigned long v = 0;
+
+  if (*s < '0' || *s > '9') {
+    return -1;
+  }
+  for (; *s >= '0' && *s <= '9'; ++s) {
+    v = v > (ULONG_MAX - 9) / 10 ? ULONG_MAX : v * 10 + (*s - '0');
+  }
+  *p = s;
+  *value = v;
+
+  return 0;
+}
+
+/**
+ * @brief Returns the monotonic time in seconds
+ */
+static time_t
+monotonic_seconds(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec;
+}
+
+/**
+ * @brief Resolves a hostname or IPv4 address
+ *
+ * Addresses in standard dot notation are converted directly. Hostnames are
+ * looked up in the resolver cache first, else by getaddrinfo(3), and kept for
+ * #XDT_RESOLVE_TTL seconds.
+ *
+ * @param host the hostname, not necessarily terminated
+ * @param len its length
+ * @param in where to store the IPv4 address
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+static int
+resolve(char const *host, size_t len, struct in_addr *in)
+{
+  char name[NI_MAXHOST];
+  struct addrinfo hints, *res;
+  XDT_resolved *r, *victim;
+  time_t now;
+
+  if (len >= sizeof name) {
+    return -1;
+  }
+  memcpy(name, host, len);
+  name[len] = 0;
+
+  if (inet_pton(AF_INET, name, in) == 1) {
+    return 0;
+  }
+
+  now = monotonic_seconds();
+  if (len < RESOLVE_NAME_MAX) {
+    lock(&resolve_lock);
+    for (r = resolved; r < resolved + RESOLVE_CACHE_SIZE; ++r) {
+      if (r->expires > now && !strcmp(r->name, name)) {
+        *in = r->in;
+        unlock(&resolve_lock);
+        return 0;
+      }
+    }
+    unlock(&resolve_lock);
+  }
+
+  memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(name, 0, &hints, &res) || !res) {
+    return -2;
+  }
+  *in = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+  freeaddrinfo(res);
+
+  if (len < RESOLVE_NAME_MAX) {
+    /* replace the entry of the same name or the one expiring first */
+    lock(&resolve_lock);
+    for (victim = r = resolved; r < resolved + RESOLVE_CACHE_SIZE; ++r) {
+      if (!strcmp(r->name, name)) {
+        victim = r;
+        break;
+      }
+      if (r->expires < victim->expires) {
+        victim = r;
+      }
+    }
+    memcpy(victim->name, name, len + 1);
+    victim->in = *in;
+    victim->expires = now + XDT_RESOLVE_TTL;
+    unlock(&resolve_lock);
+  }
+
+  return 0;
+}
+
 
 /**
  * @brief Translates between an XDT address and an User Access Point name
@@ -53,24 +303,8 @@
 int
 xdt_address_to_uap_name(XDT_address const *addr, char *buf, size_t buf_size)
 {
-  int len;
-
-  if (!addr || (addr->port < XDT_PORT_MIN) || addr->port > XDT_PORT_MAX || !buf) {
-    return -10;
-  }
-
   /* e.g. "/tmp/xdt-141.43.3.123:58312.5" */
-  if ((len = snprintf(buf, buf_size, "%s%s:%d.%u", XDT_SAP_NAME_PREFIX, addr->host, addr->port, addr->slot)) < 0) {
-    /* output error */
-    return -1;
-  }
-
-  if (len >= (int)buf_size) {
-    /* buffer to small */
-    return -40;
-  }
-
-  return 0;
+  return format_name(addr, 1, 0, buf, buf_size);
 }
 
 
@@ -94,24 +328,30 @@ xdt_address_to_uap_name(XDT_address const *addr, char *buf, size_t buf_size)
 int
 xdt_address_to_sap_name(XDT_address const *addr, char *buf, size_t buf_size)
 {
-  int len;
-
-  if (!addr || addr->port < XDT_PORT_MIN || addr->port > XDT_PORT_MAX || !buf) {
-    return -10;
-  }
-
   /* e.g. "/tmp/xdt-141.43.3.123:58312" */
-  if ((len = snprintf(buf, buf_size, "%s%s:%d", XDT_SAP_NAME_PREFIX, addr->host, addr->port)) < 0) {
-    /* output error */
-    return -1;
-  }
-
-  if (len >= (int)buf_size) {
-    /* buffer to small */
-    return -40;
-  }
+  return format_name(addr, 0, 0, buf, buf_size);
+}
 
-  return 0;
+/**
+ * @brief Translates between an XDT address and the Service Access Point name of a shard
+ *
+ * A service running several dispatcher shards listens for messages from the
+ * user layer at one access point per shard. The first shard's is the Service
+ * Access Point (see xdt_address_to_sap_name()), a producer moves on to the
+ * shard serving its connection (see XDT_xdat_conf).
+ *
+ * @param addr points to an user or service address
+ * @param shard index of the shard
+ * @param buf memory area where to store the Service Access Point name
+ * @param buf_size size of the buffer @a buf is pointing to
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+int
+xdt_address_to_shard_sap_name(XDT_address const *addr, unsigned shard, char *buf, size_t buf_size)
+{
+  /* e.g. "/tmp/xdt-141.43.3.123:58312#3" */
+  return format_name(addr, 0, shard, buf, buf_size);
 }
 
 /**
@@ -126,6 +366,10 @@ xdt_address_to_sap_name(XDT_address const *addr, char *buf, size_t buf_size)
  *   slot        ::= < XDT user slot number in range [XDT_SLOT_MIN, XDT_SLOT_MAX] >
  * @endverbatim
  *
+ * The parser neither allocates memory nor uses regular expressions, hostnames
+ * are resolved by a cache (see #XDT_RESOLVE_TTL), so it may be called by
+ * several threads at once.
+ *
  * @param buf string representing the XDT address
  * @param addr points to an XDT address
  * 
@@ -134,93 +378,136 @@ xdt_address_to_sap_name(XDT_address const *addr, char *buf, size_t buf_size)
 int
 xdt_address_parse(char const *buf, XDT_address * addr)
 {
-  /* host:port[.slot]
-   *
-   *   host = hostname or IPv4 address in standard dot notation
-   *   port = IP port number [XDT_PORT_MIN, XDT_PORT_MAX]
-   *   slot = XDT user slot number in range [XDT_SLOT_MIN, XDT_SLOT_MAX] (optional)
-   *
-   * matching regex: ([^:]{1,})(:)([0-9]{1,})($|\.([0-9]{1,})$)
-   */
-
-#define XDT_REGEX "([^:]{1,})(:)([0-9]{1,})($|\\.([0-9]{1,})$)"
-#define XDT_MATCH_MAX 6         /* no more are relevant and possible */
-#define XDT_MATCH_HOST 1
-#define XDT_MATCH_PORT 3
-#define XDT_MATCH_SLOT 5
-
-  regex_t preg;
-  regmatch_t match[XDT_MATCH_MAX];
-  int err = 0;
-  char *atom;
-  struct hostent *h;
-  long l;
-  unsigned long ul;
+  char const *colon, *host, *p;
+  unsigned long port, ul;
+  struct in_addr in;
 
   if (!buf || !addr) {
     return -1;
   }
 
-  if (regcomp(&preg, XDT_REGEX, REG_EXTENDED)) {
-    return -10;
+  /* port and slot are digits, so the host ends at the last colon and
+   * starts behind the colon before, if any */
+  if (!(colon = strrchr(buf, ':'))) {
+    return -20;
+  }
+  for (host = colon; host > buf && host[-1] != ':'; --host);
+  if (host == colon) {
+    return -20;
   }
 
-  if (regexec(&preg, buf, XDT_MATCH_MAX, match, 0)) {
+  p = colon + 1;
+  if (parse_decimal(&p, &port) < 0) {
+    return -20;
+  }
+  if (*p == '.') {
+    ++p;
+    if (parse_decimal(&p, &ul) < 0) {
+      return -20;
+    }
+  } else {
+    /* slot (optional, default is XDT_PORT_MIN) */
+    ul = XDT_PORT_MIN;
+  }
+  if (*p) {
     return -20;
   }
 
-  if (!(atom = malloc(strlen(buf) + 1))) {
-    return -30;
+  /* port */
+  if (port < XDT_PORT_MIN || port > XDT_PORT_MAX) {
+    return -60;
+  }
+
+  /* slot */
+  if (ul == ULONG_MAX) {
+    return -70;
+  }
+  /* this next statement looks complicated but surpresses the 
+   * 'comparison of unsigned expression < 0 is always false'
+   * warning in the special case XDT_SLOT_MIN is zero */
+  if (ul > XDT_SLOT_MAX || (XDT_SLOT_MIN > 0 && (ul < 1 || ul + 1 < XDT_SLOT_MIN + 1))) {
+    return -80;
   }
 
   /* host */
-  memcpy(atom, buf + match[XDT_MATCH_HOST].rm_so, match[XDT_MATCH_HOST].rm_eo - match[XDT_MATCH_HOST].rm_so);
-  atom[match[XDT_MATCH_HOST].rm_eo - match[XDT_MATCH_HOST].rm_so] = 0;
-  if (!(h = gethostbyname(atom)) || h->h_addrtype != AF_INET) {
-    err = -40;
-    goto FREE_ATOM;
+  if (resolve(host, colon - host, &in) < 0) {
+    return -40;
   }
-  if (!inet_ntop(AF_INET, h->h_addr_list[0], addr->host, sizeof addr->host)) {
-    err = -50;
-    goto FREE_ATOM;
+  if (!inet_ntop(AF_INET, &in, addr->host, sizeof addr->host)) {
+    return -50;
   }
+  addr->port = port;
+  addr->slot = ul;
 
-  /* port */
-  memcpy(atom, buf + match[XDT_MATCH_PORT].rm_so, match[XDT_MATCH_PORT].rm_eo - match[XDT_MATCH_PORT].rm_so);
-  atom[match[XDT_MATCH_PORT].rm_eo - match[XDT_MATCH_PORT].rm_so] = 0;
-  l = strtol(atom, 0, 10);
-  if (l == LONG_MIN || l == LONG_MAX || l < XDT_PORT_MIN || l > XDT_PORT_MAX) {
-    err = -60;
-    goto FREE_ATOM;
-  }
-  addr->port = l;
-
-  /* slot (optional, default is XDT_PORT_MIN) */
-  if (match[XDT_MATCH_SLOT].rm_so != -1) {
-    memcpy(atom, buf + match[XDT_MATCH_SLOT].rm_so, match[XDT_MATCH_SLOT].rm_eo - match[XDT_MATCH_SLOT].rm_so);
-    atom[match[XDT_MATCH_SLOT].rm_eo - match[XDT_MATCH_SLOT].rm_so] = 0;
-    ul = strtol(atom, 0, 10);
-    if (ul == ULONG_MAX) {
-      err = -70;
-      goto FREE_ATOM;
-    }
-    /* this next statement looks complicated but surpresses the 
-     * 'comparison of unsigned expression < 0 is always false'
-     * warning in the special case XDT_SLOT_MIN is zero */
-    if (ul > XDT_SLOT_MAX || (XDT_SLOT_MIN > 0 && (ul < 1 || ul + 1 < XDT_SLOT_MIN + 1))) {
-      err = -80;
-      goto FREE_ATOM;
-    }
-    addr->slot = ul;
-  } else {
-    addr->slot = XDT_PORT_MIN;
+  return 0;
+}
+
+
+/**
+ * @brief Returns the socket addresses of an XDT address
+ *
+ * Services need the UDP address of a peer and the unix address of a user
+ * access point for every new instance. The addresses are kept in a cache
+ * indexed by the XDT address, so repeated connections between the same
+ * addresses neither format names nor convert the host. May be called by
+ * several threads at once.
+ *
+ * @param addr points to an XDT address, its host in standard dot notation
+ * @param ep where to store the socket addresses
+ *
+ * @return 0 on success, value < 0 on failure
+ */
+int
+xdt_address_endpoint(XDT_address const *addr, XDT_endpoint * ep)
+{
+  XDT_cached_endpoint *e;
+  unsigned char const *b;
+  unsigned h = 2166136261u;
+  size_t len;
+
+  if (!addr || !ep || (len = strnlen(addr->host, sizeof addr->host)) == sizeof addr->host) {
+    return -1;
+  }
+
+  /* FNV-1a over host, port and slot */
+  for (b = (unsigned char const *)addr->host; b < (unsigned char const *)addr->host + len; ++b) {
+    h = (h ^ *b) * 16777619u;
   }
+  h = (h ^ addr->port) * 16777619u;
+  h = (h ^ addr->slot) * 16777619u;
+  e = &endpoints[(h ^ h >> 16) & (ENDPOINT_CACHE_SIZE - 1)];
 
-FREE_ATOM:
-  free(atom);
-  regfree(&preg);
+  lock(&endpoint_lock);
+  if (e->used && e->addr.port == addr->port && e->addr.slot == addr->slot
+      && !memcmp(e->addr.host, addr->host, len + 1)) {
+    *ep = e->ep;
+    unlock(&endpoint_lock);
+    return 0;
+  }
+  unlock(&endpoint_lock);
 
-  return err;
+  memset(ep, 0, sizeof *ep);
+  ep->inet.sin_family = AF_INET;
+  ep->inet.sin_port = htons(addr->port);
+  if (inet_pton(AF_INET, addr->host, &ep->inet.sin_addr) != 1) {
+    return -10;
+  }
+  ep->uap.sun_family = AF_LOCAL;
+  if (xdt_address_to_uap_name(addr, ep->uap.sun_path, sizeof ep->uap.sun_path) < 0) {
+    return -20;
+  }
+  ep->uap_len = offsetof(struct sockaddr_un, sun_path) + strlen(ep->uap.sun_path);
+
+  lock(&endpoint_lock);
+  memset(&e->addr, 0, sizeof e->addr);
+  memcpy(e->addr.host, addr->host, len);
+  e->addr.port = addr->port;
+  e->addr.slot = addr->slot;
+  e->ep = *ep;
+  e->used = 1;
+  unlock(&endpoint_lock);
+
+  return 0;
 }
 
 
@@ -14,6 +14,8 @@
 
 #include <limits.h>
 
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 
 
@@ -76,9 +78,28 @@ typedef struct
 #define XDT_ADDRESS_EQUAL(left, right) !memcmp(&(left), &(right), sizeof(XDT_address))
 
 
+/** @brief Seconds a resolved hostname is cached by xdt_address_parse() */
+#define XDT_RESOLVE_TTL 60
+
+/**
+ * @brief Socket addresses of an XDT address
+ *
+ * Computed once per address and cached by xdt_address_endpoint(), so setting
+ * up a connection needs no string formatting.
+ */
+typedef struct
+{
+  struct sockaddr_in inet;      /**< host and port, the listen address of the service */
+  struct sockaddr_un uap;       /**< user access point, see xdt_address_to_uap_name() */
+  socklen_t uap_len;            /**< used length of @a uap */
+} XDT_endpoint;
+
+
 int xdt_address_to_uap_name(XDT_address const *addr, char *buf, size_t buf_size);
 int xdt_address_to_sap_name(XDT_address const *addr, char *buf, size_t buf_size);
+int xdt_address_to_shard_sap_name(XDT_address const *addr, unsigned shard, char *buf, size_t buf_size);
 int xdt_address_parse(char const *buf, XDT_address * addr);
+int xdt_address_endpoint(XDT_address const *addr, XDT_endpoint * ep);
 
 
 /**
@@ -0,0 +1,204 @@
+/**
+ * @file log.c
+ * @ingroup xdt
+ * @brief Log levels and binary message trace
+ *
+ * Message dumps by print_sdu() and print_pdu() are printed only if the runtime
+ * log level xdt_log_level asks for them, so the default level formats nothing.
+ *
+ * Configured by --enable-trace, a process may record every message into a ring
+ * of fixed-size binary events instead. The ring lives in a file mapped into
+ * memory, one file per process, so recording is a plain store without locks
+ * or system calls, and the events survive a crash. The @e xdttrace tool
+ * decodes the files.
+ */
+
+/**
+ * @addtogroup xdt
+ * @{
+ */
+
+#include "log.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+
+/** @brief Runtime log level, see xdt_logging() */
+int xdt_log_level = XDT_LOG_QUIET;
+
+/** @brief Trace ring of this process, @e null if not tracing */
+XDT_trace_header *xdt_trace_ring = 0;
+
+/** @brief Trace file name prefix given to xdt_trace_open() */
+static char trace_prefix[256];
+
+
+/**
+ * @brief Maps a new trace file for the calling process
+ *
+ * @return 0 on success, value < 0 on error (@e errno is set)
+ */
+static int
+map_trace_file(void)
+{
+  char path[sizeof trace_prefix + 16];
+  size_t size = sizeof (XDT_trace_header) + XDT_TRACE_EVENTS * sizeof (XDT_trace_event);
+  void *mem;
+  int fd;
+
+  snprintf(path, sizeof path, "%s.%d", trace_prefix, (int)getpid());
+  if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+    return -1;
+  }
+  if (ftruncate(fd, (off_t)size) == -1) {
+    close(fd);
+    return -2;
+  }
+  mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    return -3;
+  }
+
+  xdt_trace_ring = mem;
+  xdt_trace_ring->magic = XDT_TRACE_MAGIC;
+  xdt_trace_ring->size = XDT_TRACE_EVENTS;
+  xdt_trace_ring->pid = (int32_t)getpid();
+
+  return 0;
+}
+
+/**
+ * @brief Starts tracing the messages of this process
+ *
+ * The events are written to the file @a prefix.<pid>.
+ *
+ * @param prefix file name prefix
+ *
+ * @return 0 on success, value < 0 on error (@e errno is set, ENOSYS if tracing is not compiled in)
+ */
+int
+xdt_trace_open(char const *prefix)
+{
+#ifdef XDT_TRACE
+  if (strlen(prefix) >= sizeof trace_prefix) {
+    errno = ENAMETOOLONG;
+    return -4;
+  }
+  strcpy(trace_prefix, prefix);
+
+  return map_trace_file();
+#else
+  prefix = prefix;
+  errno = ENOSYS;
+  return -5;
+#endif
+}
+
+/**
+ * @brief Continues tracing in a file of its own after fork(2)
+ *
+ * Every process needs its own ring, so a child calls this before
+ * recording any event. Nothing happens if the parent does not trace.
+ *
+ * @return 0 on success, value < 0 on error (@e errno is set)
+ */
+int
+xdt_trace_reopen(void)
+{
+  if (!xdt_trace_ring) {
+    return 0;
+  }
+  munmap(xdt_trace_ring, sizeof (XDT_trace_header) + XDT_TRACE_EVENTS * sizeof (XDT_trace_event));
+  xdt_trace_ring = 0;
+
+  return map_trace_file();
+}
+
+/**
+ * @brief Records a trace event
+ *
+ * Called only if xdt_tracing() is true. The calling process is the only
+ * writer of its ring, the oldest events are overwritten.
+ *
+ * @param event event kind, e.g. ::XDT_TRACE_SENT
+ * @param type message type
+ * @param conn connection number
+ * @param sequ sequence number
+ * @param length payload length
+ * @param extra type specific value, see XDT_trace_event
+ */
+void
+xdt_trace_record(unsigned event, long type, unsigned conn, unsigned sequ, unsigned length, unsigned extra)
+{
+  XDT_trace_header *ring = xdt_trace_ring;
+  XDT_trace_event *e;
+  struct timespec ts;
+  uint64_t head;
+
+  if (!ring) {
+    return;
+  }
+
+  head = ring->head;
+  e = (XDT_trace_event *)(ring + 1) + (head & (XDT_TRACE_EVENTS - 1));
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  e->time = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+  e->type = (int32_t)type;
+  e->conn = conn;
+  e->sequ = sequ;
+  e->length = length;
+  e->extra = extra;
+  e->event = (uint16_t)event;
+  e->reserved = 0;
+
+  /* publish the event after it is complete */
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Records a trace event of an SDU
+ *
+ * @param event event kind, e.g. ::XDT_TRACE_SENT
+ * @param sdu points to an @e SDU message
+ */
+void
+xdt_trace_sdu(unsigned event, XDT_sdu const *sdu)
+{
+  switch ((int)sdu->type) {
+  case XDATrequ:
+    xdt_trace_record(event, sdu->type, sdu->x.dat_requ.conn, sdu->x.dat_requ.sequ, sdu->x.dat_requ.length,
+                     sdu->x.dat_requ.eom);
+    break;
+  case XDATind:
+    xdt_trace_record(event, sdu->type, sdu->x.dat_ind.conn, sdu->x.dat_ind.sequ, sdu->x.dat_ind.length,
+                     sdu->x.dat_ind.eom);
+    break;
+  case XDATconf:
+    xdt_trace_record(event, sdu->type, sdu->x.dat_conf.conn, sdu->x.dat_conf.sequ, 0, sdu->x.dat_conf.window);
+    break;
+  case XBREAKind:
+    xdt_trace_record(event, sdu->type, sdu->x.break_ind.conn, 0, 0, 0);
+    break;
+  case XABORTind:
+    xdt_trace_record(event, sdu->type, sdu->x.abort_ind.conn, 0, 0, 0);
+    break;
+  case XDISind:
+    xdt_trace_record(event, sdu->type, sdu->x.dis_ind.conn, 0, 0, 0);
+    break;
+  default:
+    xdt_trace_record(event, sdu->type, 0, 0, 0, 0);
+  }
+}
+
+
+/**
+ * @}
+ */
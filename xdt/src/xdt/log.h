@@ -0,0 +1,124 @@
+/**
+ * @file log.h
+ * @ingroup xdt
+ * @brief Log levels and binary message trace
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+/**
+ * @addtogroup xdt
+ * @{
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "sdu.h"
+
+#include <stdint.h>
+
+
+/** @brief Log level: no message dumps (default) */
+#define XDT_LOG_QUIET 0
+
+/** @brief Log level: dump every message sent, received or expired, without payload */
+#define XDT_LOG_MESSAGES 1
+
+/** @brief Log level: dump every message including its payload */
+#define XDT_LOG_PAYLOAD 2
+
+#ifndef XDT_LOG_MAX
+/** @brief Highest log level compiled in, chosen at configure time by --with-log-level */
+# define XDT_LOG_MAX XDT_LOG_PAYLOAD
+#endif
+
+/**
+ * @brief Checks whether messages of a log level are to be printed
+ *
+ * Levels above #XDT_LOG_MAX are folded away by the compiler, all others cost
+ * one comparison with the runtime level.
+ *
+ * @param level log level, e.g. #XDT_LOG_MESSAGES
+ */
+#define xdt_logging(level) ((level) <= XDT_LOG_MAX && (level) <= xdt_log_level)
+
+extern int xdt_log_level;
+
+
+/** @brief Trace event kinds */
+enum
+{
+  XDT_TRACE_SENT = 1, /**< message sent to the peer or the user */
+  XDT_TRACE_RECEIVED, /**< message received from the peer or the user */
+  XDT_TRACE_EXPIRED /**< timer message expired */
+};
+
+/**
+ * @brief Binary trace event
+ *
+ * Fixed-size record written to the trace ring on every message,
+ * decoded by the @e xdttrace tool.
+ */
+typedef struct
+{
+  uint64_t time; /**< CLOCK_MONOTONIC time in nanoseconds */
+  int32_t type; /**< message type, SDU, PDU or timer message type */
+  uint32_t conn; /**< connection number, 0 if unknown */
+  uint32_t sequ; /**< sequence number, 0 if none */
+  uint32_t length; /**< payload length, 0 if none */
+  uint32_t extra; /**< eom of DTs and data SDUs, SACK bits of ACKs, window of XDATconf */
+  uint16_t event; /**< event kind, e.g. ::XDT_TRACE_SENT */
+  uint16_t reserved; /**< zero */
+} XDT_trace_event;
+
+/** @brief Magic number of a trace file */
+#define XDT_TRACE_MAGIC 0x58445454
+
+/** @brief Number of events of a trace ring (power of two) */
+#define XDT_TRACE_EVENTS 65536
+
+/**
+ * @brief Trace file header
+ *
+ * A trace file consists of this header and the ring of #XDT_TRACE_EVENTS events.
+ * Event @e n is stored at index @e n modulo the ring size, @e head is the number
+ * of events written so far. It is updated after the event, so a reader sees
+ * complete events only (unless overwritten meanwhile).
+ */
+typedef struct
+{
+  uint32_t magic; /**< #XDT_TRACE_MAGIC */
+  uint32_t size; /**< number of events of the ring */
+  int32_t pid; /**< id of the tracing process */
+  uint32_t reserved; /**< zero */
+  uint64_t head; /**< number of events written */
+} XDT_trace_header;
+
+#ifdef XDT_TRACE
+/**
+ * @brief Checks whether tracing is enabled at runtime
+ *
+ * Without --enable-trace it is constantly false and the tracing code is left out.
+ */
+# define xdt_tracing() (xdt_trace_ring != 0)
+#else
+# define xdt_tracing() 0
+#endif
+
+extern XDT_trace_header *xdt_trace_ring;
+
+int xdt_trace_open(char const *prefix);
+int xdt_trace_reopen(void);
+void xdt_trace_record(unsigned event, long type, unsigned conn, unsigned sequ, unsigned length, unsigned extra);
+void xdt_trace_sdu(unsigned event, XDT_sdu const *sdu);
+
+
+/**
+ * @}
+ */
+
+#endif /* LOG_H */
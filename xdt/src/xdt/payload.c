@@ -0,0 +1,363 @@
+/**
+ * @file payload.c
+ * @ingroup xdt
+ * @brief Shared memory payload ring between user and XDT layer
+ *
+ * Instead of copying the payload of XDATrequ and XDATind SDUs through a unix
+ * domain socket, the side writing payload may put it into a ring in a memfd(2)
+ * mapping and send only the SDU header with the ring offset. The memfd is
+ * passed once by SCM_RIGHTS with the first such SDU, the reading side maps it
+ * and releases the payload when done. The writer never blocks: if the ring is
+ * full, it sends the payload within the SDU as before.
+ *
+ * The payload of an SDU is stored contiguously, the rest of the ring is
+ * skipped when it is too short. Offsets and counters are unsigned 32 bit
+ * values, wrapping around.
+ *
+ * The memfd is sealed against shrinking and growing, and the reading side
+ * only maps sealed ones: the writer cannot truncate it under the reader's
+ * mapping. The sizes of the ring and of the mapping are kept locally, the
+ * shared header is not trusted beyond the check on attaching.
+ */
+
+/**
+ * @addtogroup xdt
+ * @{
+ */
+
+#include "payload.h"
+
+#include <string.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+
+/** @brief Offset of the payload bytes in the mapping, the shared counters have a cache line of their own */
+#define PAYLOAD_HEADER 64
+
+
+/**
+ * @brief Initializes a payload ring as not attached
+ *
+ * @param ring points to the ring
+ */
+void
+xdt_payload_init(XDT_payload_ring * ring)
+{
+  ring->shm = 0;
+  ring->data = 0;
+  ring->mapped = 0;
+  ring->size = 0;
+  ring->tail = 0;
+  ring->fd = -1;
+}
+
+/**
+ * @brief Maps a ring by its memfd
+ *
+ * @param ring points to the ring
+ * @param size size of the memfd
+ *
+ * @return 0 on success, value < 0 on error (@e errno is set)
+ */
+static int
+map_ring(XDT_payload_ring * ring, size_t size)
+{
+  void *mem;
+
+  if ((mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0)) == MAP_FAILED) {
+    return -1;
+  }
+  ring->shm = mem;
+  ring->data = (char *)mem + PAYLOAD_HEADER;
+  ring->mapped = size;
+  ring->tail = 0;
+
+  return 0;
+}
+
+/**
+ * @brief Creates a new ring to write payload into
+ *
+ * @param ring points to the ring, not attached
+ *
+ * @return 0 on success, value < 0 on error (@e errno is set)
+ */
+int
+xdt_payload_create(XDT_payload_ring * ring)
+{
+#if defined HAVE_MEMFD_CREATE && defined F_ADD_SEALS
+  size_t size = PAYLOAD_HEADER + XDT_PAYLOAD_RING_SIZE;
+
+  if ((ring->fd = memfd_create("xdt-payload", MFD_CLOEXEC | MFD_ALLOW_SEALING)) == -1) {
+    return -1;
+  }
+  if (ftruncate(ring->fd, (off_t)size) == -1 || fcntl(ring->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) == -1
+      || map_ring(ring, size) < 0) {
+    xdt_payload_detach(ring);
+    return -2;
+  }
+  ring->size = ring->shm->size = XDT_PAYLOAD_RING_SIZE;
+  ring->shm->head = 0;
+
+  return 0;
+#else
+  ring = ring;
+  errno = ENOSYS;
+  return -3;
+#endif
+}
+
+/**
+ * @brief Attaches a ring passed by the writing side to read payload from
+ *
+ * The descriptor is owned by the ring afterwards, even on failure. Only a
+ * memfd sealed against shrinking and growing is mapped.
+ *
+ * @param ring points to the ring, not attached
+ * @param fd memfd received by xdt_payload_received_fd()
+ *
+ * @return 0 on success, value < 0 on error
+ */
+int
+xdt_payload_attach(XDT_payload_ring * ring, int fd)
+{
+#ifdef F_GET_SEALS
+  int seals = fcntl(fd, F_GET_SEALS);
+  int sealed = seals != -1 && (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) == (F_SEAL_SHRINK | F_SEAL_GROW);
+#else
+  int sealed = 0;
+#endif
+  struct stat st;
+  uint32_t size;
+
+  ring->fd = fd;
+  if (!sealed || fstat(fd, &st) == -1 || st.st_size <= PAYLOAD_HEADER || map_ring(ring, st.st_size) < 0) {
+    xdt_payload_detach(ring);
+    return -1;
+  }
+
+  /* do not trust the writer beyond the mapping, nor later changes of the header */
+  size = __atomic_load_n(&ring->shm->size, __ATOMIC_RELAXED);
+  if (!size || (size & (size - 1)) || size > st.st_size - PAYLOAD_HEADER) {
+    xdt_payload_detach(ring);
+    return -2;
+  }
+  ring->size = size;
+
+  /* the mapping stays valid without the descriptor */
+  close(ring->fd);
+  ring->fd = -1;
+
+  return 0;
+}
+
+/**
+ * @brief Unmaps a ring and closes its descriptor
+ *
+ * @param ring points to the ring
+ */
+void
+xdt_payload_detach(XDT_payload_ring * ring)
+{
+  if (ring->shm) {
+    munmap(ring->shm, ring->mapped);
+  }
+  if (ring->fd != -1) {
+    close(ring->fd);
+  }
+  xdt_payload_init(ring);
+}
+
+/**
+ * @brief Reserves space for the payload of an SDU
+ *
+ * Writer side. The space is taken at once, the reader releases it after
+ * reading the SDU's payload.
+ *
+ * @param ring points to the ring
+ * @param length number of bytes to write
+ * @param offset where to store the ring offset of the payload
+ *
+ * @return where to write the payload, @e null if the ring is full
+ */
+char *
+xdt_payload_reserve(XDT_payload_ring * ring, unsigned length, unsigned *offset)
+{
+  uint32_t size = ring->size, pos = ring->tail;
+  uint32_t head = __atomic_load_n(&ring->shm->head, __ATOMIC_ACQUIRE);
+
+  /* skip the rest of the ring if it is too short */
+  if ((pos & (size - 1)) + length > size) {
+    pos += size - (pos & (size - 1));
+  }
+  if (length > size || pos + length - head > size) {
+    return 0;
+  }
+
+  ring->tail = pos + length;
+  *offset = pos;
+
+  return ring->data + (pos & (size - 1));
+}
+
+/**
+ * @brief Takes back the last reservation, or the part of it behind @a offset
+ *
+ * Writer side, for payload that is sent within the SDU after all, or that
+ * turns out shorter than reserved.
+ *
+ * @param ring points to the ring
+ * @param offset ring offset returned by the last xdt_payload_reserve(), or within that reservation
+ */
+void
+xdt_payload_unreserve(XDT_payload_ring * ring, unsigned offset)
+{
+  ring->tail = offset;
+}
+
+/**
+ * @brief Locates the payload of an SDU
+ *
+ * Reader side.
+ *
+ * @param ring points to the ring
+ * @param offset ring offset of the payload
+ * @param length number of payload bytes
+ *
+ * @return the payload, @e null if no ring is attached or the range is invalid
+ */
+char const *
+xdt_payload_data(XDT_payload_ring const *ring, unsigned offset, unsigned length)
+{
+  uint32_t size = ring->size;
+
+  if (!ring->shm) {
+    return 0;
+  }
+  if ((offset & (size - 1)) + length > size) {
+    return 0;
+  }
+
+  return ring->data + (offset & (size - 1));
+}
+
+/**
+ * @brief Releases the payload of an SDU and all payload written before
+ *
+ * Reader side.
+ *
+ * @param ring points to the ring
+ * @param offset ring offset of the payload
+ * @param length number of payload bytes
+ */
+void
+xdt_payload_release(XDT_payload_ring * ring, unsigned offset, unsigned length)
+{
+  __atomic_store_n(&ring->shm->head, (uint32_t)(offset + length), __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Sends a datagram gathered from several buffers passing a descriptor along
+ *
+ * @param sock connected socket
+ * @param iov buffers to send as one datagram
+ * @param iovcnt number of buffers
+ * @param fd descriptor to pass by SCM_RIGHTS
+ *
+ * @return number of bytes sent, -1 on error (@e errno is set)
+ */
+ssize_t
+xdt_payload_sendv_fd(int sock, struct iovec const *iov, int iovcnt, int fd)
+{
+  union
+  {
+    char buf[CMSG_SPACE(sizeof (int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+
+  memset(&msg, 0, sizeof msg);
+  memset(&control, 0, sizeof control);
+  msg.msg_iov = (struct iovec *)(uintptr_t)iov;
+  msg.msg_iovlen = iovcnt;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof control.buf;
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof (int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+
+  return sendmsg(sock, &msg, 0);
+}
+
+/**
+ * @brief Sends a datagram passing a descriptor along
+ *
+ * @param sock connected socket
+ * @param buf data to send
+ * @param len number of bytes
+ * @param fd descriptor to pass by SCM_RIGHTS
+ *
+ * @return number of bytes sent, -1 on error (@e errno is set)
+ */
+int
+xdt_payload_send_fd(int sock, void const *buf, size_t len, int fd)
+{
+  struct iovec iov;
+
+  iov.iov_base = (void *)(uintptr_t)buf;
+  iov.iov_len = len;
+
+  return (int)xdt_payload_sendv_fd(sock, &iov, 1, fd);
+}
+
+/**
+ * @brief Takes a descriptor passed along with a received datagram
+ *
+ * Any further descriptors are closed.
+ *
+ * @param msg message header filled by recvmsg(2) or recvmmsg(2)
+ *
+ * @return the descriptor, -1 if none was passed
+ */
+int
+xdt_payload_received_fd(struct msghdr *msg)
+{
+  struct cmsghdr *cmsg;
+  int fd = -1;
+
+  if (!msg->msg_control || msg->msg_controllen < sizeof (struct cmsghdr)) {
+    return -1;
+  }
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      unsigned i, n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof (int);
+
+      for (i = 0; i < n; ++i) {
+        int passed;
+
+        memcpy(&passed, CMSG_DATA(cmsg) + i * sizeof (int), sizeof passed);
+        if (fd == -1) {
+          fd = passed;
+        } else {
+          close(passed);
+        }
+      }
+    }
+  }
+
+  return fd;
+}
+
+
+/**
+ * @}
+ */
@@ -0,0 +1,80 @@
+/**
+ * @file payload.h
+ * @ingroup xdt
+ * @brief Shared memory payload ring between user and XDT layer
+ */
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+/**
+ * @addtogroup xdt
+ * @{
+ */
+
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdint.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+/** @brief Number of payload bytes of a ring (power of two) */
+#define XDT_PAYLOAD_RING_SIZE (4 * 1024 * 1024)
+
+/** @brief Size of the ancillary data buffer to receive a ring descriptor by recvmsg(2) */
+#define XDT_PAYLOAD_CONTROL_SIZE CMSG_SPACE(sizeof (int))
+
+/** @brief Shared part of a payload ring, followed by the payload bytes */
+typedef struct
+{
+  uint32_t size; /**< number of payload bytes (power of two) */
+  uint32_t head; /**< number of bytes released (written by the reader only) */
+} XDT_payload_shared;
+
+/**
+ * @brief Payload ring
+ *
+ * Single-writer/single-reader ring in a memfd(2) mapping, shared by passing
+ * the descriptor over a unix domain socket (use as an opaque type).
+ */
+typedef struct
+{
+  XDT_payload_shared *shm; /**< mapping, @e null if no ring is attached */
+  char *data; /**< payload bytes of the mapping */
+  size_t mapped; /**< size of the mapping */
+  uint32_t size; /**< number of payload bytes, taken from @a shm once (the other side may change it) */
+  uint32_t tail; /**< number of bytes written (writer only) */
+  int fd; /**< memfd to pass to the other side, -1 if closed */
+} XDT_payload_ring;
+
+
+/**
+ * @brief Checks whether a ring is attached
+ * @param ring points to a payload ring
+ */
+#define xdt_payload_attached(ring) ((ring)->shm != 0)
+
+void xdt_payload_init(XDT_payload_ring * ring);
+int xdt_payload_create(XDT_payload_ring * ring);
+int xdt_payload_attach(XDT_payload_ring * ring, int fd);
+void xdt_payload_detach(XDT_payload_ring * ring);
+char *xdt_payload_reserve(XDT_payload_ring * ring, unsigned length, unsigned *offset);
+void xdt_payload_unreserve(XDT_payload_ring * ring, unsigned offset);
+char const *xdt_payload_data(XDT_payload_ring const *ring, unsigned offset, unsigned length);
+void xdt_payload_release(XDT_payload_ring * ring, unsigned offset, unsigned length);
+
+ssize_t xdt_payload_sendv_fd(int sock, struct iovec const *iov, int iovcnt, int fd);
+int xdt_payload_send_fd(int sock, void const *buf, size_t len, int fd);
+int xdt_payload_received_fd(struct msghdr * msg);
+
+
+/**
+ * @}
+ */
+
+#endif /* PAYLOAD_H */
@@ -26,8 +26,21 @@
  * are defined. Both layers exchange ::XDT_sdu SDU messages, 
  * which consist of a SDU type member, e.g. ::XDATrequ, and a union ::XDT_sdu_x 
  * containing the specific SDU, e.g. XDT_xdat_requ.
+ * They are exchanged packed, with the payload behind the other members
+ * (see xdt_sdu_pack(), xdt_sdu_unpack() and xdt_sdu_iov()).
  * Also, a function print_sdu() to uniformly print SDU messages is available.
  *
+ *
+ * In payload.h, payload.c a payload ring in shared memory is implemented. User and
+ * XDT layer may pass the payload of XDATrequ and XDATind SDUs through it, instead of
+ * copying it through the unix domain socket along with the SDU.
+ *
+ *
+ * In log.h, log.c the log levels are defined. Message dumps are printed only if
+ * xdt_logging() is true for their level, the default level #XDT_LOG_QUIET prints none.
+ * Configured by --enable-trace, xdt_trace_open() starts recording every message
+ * as a fixed-size binary event into a per-process ring, decoded by @e xdttrace.
+ *
  * 
  * In address.h, address.c the address type used in SDUs are defined.
  * An XDT_address consist of an IPv4 host address in standard dot notation,
@@ -46,34 +59,32 @@
 
 
 #include "sdu.h"
+#include "log.h"
 
 #include <ctype.h>
+#include <stdint.h>
 
 #include <sys/types.h>
 #include <unistd.h>
 
 
-/** @brief Wether to print the SDU payload or not */
-#define PRINT_SDU_PAYLOAD 0
-
-
 /**
  * @brief Prints (or not) the SDU payload
  * 
  * When detecting any non-printable characters, the rest of the output
- * is leaved out (indicated by a special tag). Output in general depends 
- * if #PRINT_SDU_PAYLOAD is set.
+ * is leaved out (indicated by a special tag). The payload is printed
+ * only at log level #XDT_LOG_PAYLOAD.
  *
- * @param data SDU data array
+ * @param data SDU payload
  * @param length used bytes in @a data
  * @param stream output stream, @e stderr is used if @e null
  */
 static void
-print_sdu_payload(char data[XDT_DATA_MAX], unsigned length, FILE * stream)
+print_sdu_payload(char const *data, unsigned length, FILE * stream)
 {
   unsigned i;
 
-  if (PRINT_SDU_PAYLOAD) {
+  if (xdt_logging(XDT_LOG_PAYLOAD)) {
 
     fputs("data = '", stderr);
     for (i = 0; (i < length) && (i < XDT_DATA_MAX); ++i) {
@@ -92,6 +103,176 @@ print_sdu_payload(char data[XDT_DATA_MAX], unsigned length, FILE * stream)
 }
 
 
+/**
+ * @brief Returns the size of an SDU message
+ *
+ * SDUs carrying payload end with the last used payload byte,
+ * so only this number of bytes has to be transferred. SDUs with
+ * their payload in a payload ring end before the payload.
+ *
+ * @param sdu points to an @e SDU message
+ *
+ * @return size in bytes (type and specific SDU)
+ */
+size_t
+xdt_sdu_size(XDT_sdu const *sdu)
+{
+  switch ((int)sdu->type) {
+  case XDATrequ:
+    return offsetof(XDT_sdu, x.dat_requ.data) + (sdu->x.dat_requ.shared ? 0 : sdu->x.dat_requ.length);
+  case XDATind:
+    return offsetof(XDT_sdu, x.dat_ind.data) + (sdu->x.dat_ind.shared ? 0 : sdu->x.dat_ind.length);
+  case XDATconf:
+    return offsetof(XDT_sdu, x) + sizeof (XDT_xdat_conf);
+  case XBREAKind:
+    return offsetof(XDT_sdu, x) + sizeof (XDT_xbreak_ind);
+  case XABORTind:
+    return offsetof(XDT_sdu, x) + sizeof (XDT_xabort_ind);
+  case XDISind:
+    return offsetof(XDT_sdu, x) + sizeof (XDT_xdis_ind);
+  default:
+    return sizeof (long);
+  }
+}
+
+
+/**
+ * @brief Returns the size of an SDU message without its payload
+ *
+ * @param sdu points to an @e SDU message, only its type is evaluated
+ *
+ * @return size in bytes of the members before the @e data pointer, for SDUs without payload of the whole SDU
+ */
+static size_t
+sdu_header_size(XDT_sdu const *sdu)
+{
+  switch ((int)sdu->type) {
+  case XDATrequ:
+    return offsetof(XDT_sdu, x.dat_requ.data);
+  case XDATind:
+    return offsetof(XDT_sdu, x.dat_ind.data);
+  default:
+    return xdt_sdu_size(sdu);
+  }
+}
+
+/**
+ * @brief Returns the payload of an SDU message to be transferred
+ *
+ * @param sdu points to an @e SDU message
+ * @param length where to store the number of payload bytes, 0 if none
+ *
+ * @return the payload, 0 if none or in a payload ring
+ */
+static char *
+sdu_payload(XDT_sdu const *sdu, unsigned *length)
+{
+  *length = 0;
+  if (sdu->type == XDATrequ && !sdu->x.dat_requ.shared) {
+    *length = sdu->x.dat_requ.length;
+    return sdu->x.dat_requ.data;
+  }
+  if (sdu->type == XDATind && !sdu->x.dat_ind.shared) {
+    *length = sdu->x.dat_ind.length;
+    return sdu->x.dat_ind.data;
+  }
+  return 0;
+}
+
+/**
+ * @brief Describes a packed SDU message for gathering output (writev(2), sendmsg(2))
+ *
+ * The first vector holds the members before the @e data pointer,
+ * the second one the used payload bytes, if there are any.
+ *
+ * @param sdu points to an @e SDU message
+ * @param iov the vectors to be set
+ *
+ * @return number of used vectors in @a iov, 1 or 2
+ */
+int
+xdt_sdu_iov(XDT_sdu const *sdu, struct iovec iov[2])
+{
+  unsigned length;
+  char *data = sdu_payload(sdu, &length);
+
+  iov[0].iov_base = (void *)(uintptr_t)sdu;
+  iov[0].iov_len = sdu_header_size(sdu);
+  if (!length) {
+    return 1;
+  }
+  iov[1].iov_base = data;
+  iov[1].iov_len = length;
+
+  return 2;
+}
+
+/**
+ * @brief Packs an SDU message into a buffer
+ *
+ * The used payload bytes take the place of the @e data pointer.
+ *
+ * @param sdu points to an @e SDU message
+ * @param buffer where to pack the SDU into, at least xdt_sdu_size() bytes
+ *
+ * @return size in bytes of the packed SDU
+ */
+size_t
+xdt_sdu_pack(XDT_sdu const *sdu, void *buffer)
+{
+  struct iovec iov[2];
+  int n = xdt_sdu_iov(sdu, iov);
+
+  memcpy(buffer, iov[0].iov_base, iov[0].iov_len);
+  if (n > 1) {
+    memcpy((char *)buffer + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+  }
+
+  return xdt_sdu_size(sdu);
+}
+
+/**
+ * @brief Unpacks a received SDU message
+ *
+ * The payload is not copied, @e data points into @a buffer instead
+ * (or is 0 if the payload is in a payload ring), so @a buffer has to be kept
+ * as long as the SDU is used.
+ *
+ * @param sdu where to unpack the SDU into, must not overlap @a buffer
+ * @param buffer the packed SDU message
+ * @param size number of bytes in @a buffer
+ *
+ * @return 0 on success, -1 if @a size does not match the SDU
+ */
+int
+xdt_sdu_unpack(XDT_sdu * sdu, void *buffer, size_t size)
+{
+  size_t header;
+  unsigned length;
+
+  if (size < sizeof (long)) {
+    return -1;
+  }
+  memcpy(&sdu->type, buffer, sizeof (long));
+  header = sdu_header_size(sdu);
+  if (size < header) {
+    return -1;
+  }
+  memcpy(sdu, buffer, header);
+
+  if (sdu->type == XDATrequ) {
+    sdu->x.dat_requ.data = sdu->x.dat_requ.shared ? 0 : (char *)buffer + header;
+  } else if (sdu->type == XDATind) {
+    sdu->x.dat_ind.data = sdu->x.dat_ind.shared ? 0 : (char *)buffer + header;
+  } else {
+    return 0;
+  }
+  sdu_payload(sdu, &length);
+
+  return length <= XDT_DATA_MAX && size == header + length ? 0 : -1;
+}
+
+
 /**
  * @brief Prints the content of an SDU
  *
@@ -119,7 +300,14 @@ print_sdu(XDT_sdu * sdu, char *info, FILE * stream)
     }
     fprintf(stream, "sequ = %u\n", sdu->x.dat_requ.sequ);
     fprintf(stream, "eom = %u\n", sdu->x.dat_requ.eom);
-    print_sdu_payload(sdu->x.dat_requ.data, sdu->x.dat_requ.length, stream);
+    if (sdu->x.dat_requ.sequ == 1) {
+      fprintf(stream, "max_length = %u\n", sdu->x.dat_requ.max_length);
+    }
+    if (sdu->x.dat_requ.shared) {
+      fprintf(stream, "offset = %u\n", sdu->x.dat_requ.offset);
+    } else {
+      print_sdu_payload(sdu->x.dat_requ.data, sdu->x.dat_requ.length, stream);
+    }
     fprintf(stream, "length = %u\n", sdu->x.dat_requ.length);
     break;
   case XDATind:
@@ -127,13 +315,20 @@ print_sdu(XDT_sdu * sdu, char *info, FILE * stream)
     fprintf(stream, "conn = %u\n", sdu->x.dat_ind.conn);
     fprintf(stream, "sequ = %u\n", sdu->x.dat_ind.sequ);
     fprintf(stream, "eom = %u\n", sdu->x.dat_ind.eom);
-    print_sdu_payload(sdu->x.dat_ind.data, sdu->x.dat_ind.length, stream);
+    if (sdu->x.dat_ind.shared) {
+      fprintf(stream, "offset = %u\n", sdu->x.dat_ind.offset);
+    } else {
+      print_sdu_payload(sdu->x.dat_ind.data, sdu->x.dat_ind.length, stream);
+    }
     fprintf(stream, "length = %u\n", sdu->x.dat_ind.length);
     break;
   case XDATconf:
     fprintf(stream, "type = XDATconf\n");
     fprintf(stream, "conn = %u\n", sdu->x.dat_conf.conn);
     fprintf(stream, "sequ = %u\n", sdu->x.dat_conf.sequ);
+    fprintf(stream, "window = %u\n", sdu->x.dat_conf.window);
+    fprintf(stream, "max_length = %u\n", sdu->x.dat_conf.max_length);
+    fprintf(stream, "shard = %u\n", sdu->x.dat_conf.shard);
     break;
   case XBREAKind:
     fprintf(stream, "type = XBREAKind\n");
@@ -51,19 +51,29 @@
 #include "address.h"
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 
+#include <sys/uio.h>
 
-/** @brief Maximum size in bytes of SDU payload */
-#define XDT_DATA_MAX 255
+
+/** @brief Size in bytes of SDU payload, if no bigger size is negotiated for a connection */
+#define XDT_DATA_DEFAULT 255
+
+/**
+ * @brief Maximum size in bytes of SDU payload
+ *
+ * The biggest payload size a connection may negotiate, so a DT PDU still fits into one UDP datagram.
+ */
+#define XDT_DATA_MAX 65000
 
 /**
  * @brief Copy SDU payload
  * 
- * @param src payload array @e data of source SDU
- * @param dst payload array @e data of destination SDU
- * @param len used bytes in source payload array @a src 
+ * @param src payload @e data of source SDU
+ * @param dst payload @e data of destination SDU
+ * @param len used bytes in source payload @a src 
  */
 #define XDT_COPY_DATA(src, dst, len) assert(len<=XDT_DATA_MAX), memcpy(dst, src, len);
 
@@ -94,8 +104,11 @@ typedef struct
   XDT_address source_addr; /**< source address, mandatory if first message, else ignored */
   XDT_address dest_addr; /**< destination address, mandatory if first message, else ignored */
   unsigned eom; /**< end of message indicator */
-  char data[XDT_DATA_MAX]; /**< payload (uninterpreted byte sequence) */
-  unsigned length; /**< number of used bytes in payload XDT_xdat_requ.data */
+  unsigned max_length; /**< biggest payload size the producer wants to send, only evaluated if first message */
+  unsigned length; /**< number of used bytes in payload XDT_xdat_requ.data, at most #XDT_DATA_DEFAULT if first message */
+  unsigned shared; /**< not 0 if the payload is in the payload ring at @a offset instead of XDT_xdat_requ.data (see payload.h) */
+  unsigned offset; /**< ring offset of the payload, only if @a shared */
+  char *data; /**< payload (uninterpreted byte sequence), only the used bytes are transferred behind the other members (see xdt_sdu_pack()) */
 } XDT_xdat_requ;
 
 /** @brief XDATind SDU */
@@ -104,15 +117,29 @@ typedef struct
   unsigned conn; /**< connection number */
   unsigned sequ; /**< sequence number */
   unsigned eom; /**< end of message indicator */
-  char data[XDT_DATA_MAX]; /**< payload (uninterpreted byte sequence) */
   unsigned length; /**< number of used bytes in payload XDT_xdat_ind.data */
+  unsigned shared; /**< not 0 if the payload is in the payload ring at @a offset instead of XDT_xdat_ind.data (see payload.h) */
+  unsigned offset; /**< ring offset of the payload, only if @a shared */
+  char *data; /**< payload (uninterpreted byte sequence), only the used bytes are transferred behind the other members (see xdt_sdu_pack()) */
 } XDT_xdat_ind;
 
-/** @brief XDATconf SDU */
+/**
+ * @brief XDATconf SDU
+ *
+ * Confirms all XDATrequ SDUs up to sequence number @a sequ (cumulative confirmation)
+ * and allows the producer to send further XDATrequ SDUs up to sequence number
+ * @a sequ + @a window without waiting for another confirmation.
+ * The payload of these XDATrequ SDUs may be up to @a max_length bytes,
+ * the size negotiated with the receiving peer. They may be sent to the access
+ * point of dispatcher shard @a shard, which serves the connection.
+ */
 typedef struct
 {
   unsigned conn; /**< connection number */
-  unsigned sequ; /**< sequence number */
+  unsigned sequ; /**< sequence number of the newest confirmed XDATrequ */
+  unsigned window; /**< number of XDATrequ SDUs the producer may send beyond @a sequ (0 is treated as 1) */
+  unsigned max_length; /**< biggest payload size of the connection (#XDT_DATA_DEFAULT up to #XDT_DATA_MAX) */
+  unsigned shard; /**< dispatcher shard serving the connection, see xdt_address_to_shard_sap_name() */
 } XDT_xdat_conf;
 
 /** @brief XBREAKind SDU */
@@ -145,15 +172,27 @@ typedef union
   XDT_xdis_ind dis_ind; /**< XDISind SDU */
 } XDT_sdu_x;
 
-/** @brief Compound SDU message */
+/**
+ * @brief Compound SDU message
+ *
+ * SDU messages are variable in length: they are transferred packed, the
+ * used payload bytes take the place of the @e data pointer
+ * (see xdt_sdu_size(), xdt_sdu_pack() and xdt_sdu_unpack()).
+ */
 typedef struct
 {
   long type; /**< message type, e.g. ::XDATrequ */
   XDT_sdu_x x; /**< specific SDU */
 } XDT_sdu;
 
+/** @brief Biggest size of a packed SDU message with up to @a max_length payload bytes */
+#define XDT_SDU_SIZE(max_length) (offsetof(XDT_sdu, x.dat_requ.data) + (max_length))
 
 
+size_t xdt_sdu_size(XDT_sdu const *sdu);
+int xdt_sdu_iov(XDT_sdu const *sdu, struct iovec iov[2]);
+size_t xdt_sdu_pack(XDT_sdu const *sdu, void *buffer);
+int xdt_sdu_unpack(XDT_sdu * sdu, void *buffer, size_t size);
 void print_sdu(XDT_sdu * sdu, char *info, FILE * stream);
 
 